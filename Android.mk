@@ -24,12 +24,71 @@ LOCAL_MODULE_PATH := $(TARGET_OUT_VENDOR_SHARED_LIBRARIES)
         src/hardware.c \
         src/userial_vendor.c \
         src/upio.c \
-        src/conf.c
+        src/conf.c \
+        src/vnd_loop.c \
+        src/sco_codec.c \
+        src/sco_jitter.c
     LOCAL_SHARED_LIBRARIES := libcutils
     LOCAL_MODULE_OWNER := broadcom
     include $(LOCAL_PATH)/vnd_buildcfg.mk
 
 include $(BUILD_SHARED_LIBRARY)
+
+# SCO path latency harness, on the host against a pty and a scripted
+# controller stand-in
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := bt_sco_latency
+LOCAL_MODULE_TAGS := optional
+
+    LOCAL_C_INCLUDES := \
+        $(BDROID_DIR)/hci/include \
+        $(LOCAL_PATH)/include
+    LOCAL_SRC_FILES := \
+        tools/sco_latency.c \
+        tools/vnd_props_host.c \
+        src/bt_vendor_brcm.c \
+        src/hardware.c \
+        src/userial_vendor.c \
+        src/upio.c \
+        src/conf.c \
+        src/vnd_loop.c \
+        src/sco_codec.c \
+        src/sco_jitter.c
+    LOCAL_STATIC_LIBRARIES := libcutils liblog
+    LOCAL_LDLIBS := -lpthread -lrt -lm
+    include $(LOCAL_PATH)/vnd_buildcfg.mk
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# upio gpiochip backend check, on the host against a fake chip or gpio-sim.
+# open(), ioctl() and close() are wrapped to observe and emulate the chip.
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := bt_upio_gpiochip
+LOCAL_MODULE_TAGS := optional
+
+    LOCAL_C_INCLUDES := \
+        $(BDROID_DIR)/hci/include \
+        $(LOCAL_PATH)/include
+    LOCAL_SRC_FILES := \
+        tools/upio_gpiochip.c \
+        tools/vnd_props_host.c \
+        src/bt_vendor_brcm.c \
+        src/hardware.c \
+        src/userial_vendor.c \
+        src/upio.c \
+        src/conf.c \
+        src/vnd_loop.c \
+        src/sco_codec.c \
+        src/sco_jitter.c
+    LOCAL_CFLAGS := -DUPIO_GPIO_CHARDEV=TRUE
+    LOCAL_STATIC_LIBRARIES := libcutils liblog
+    LOCAL_LDFLAGS := -Wl,--wrap=open -Wl,--wrap=ioctl -Wl,--wrap=close
+    LOCAL_LDLIBS := -lpthread -lrt -lm
+    include $(LOCAL_PATH)/vnd_buildcfg.mk
+
+include $(BUILD_HOST_EXECUTABLE)
 endif
 # end of BCM configuration
 
@@ -49,11 +49,25 @@
 #define VENDOR_LIB_RUNTIME_TUNING_ENABLED   FALSE
 #endif
 
+/* Watch the conf file and apply changes to the entries which are safe while
+   Bluetooth is on (see vnd_conf_keys.h) without a restart, e.g. for tuning
+   voice and power parameters in the lab */
+#ifndef VENDOR_LIB_CONF_LIVE_RELOAD
+#define VENDOR_LIB_CONF_LIVE_RELOAD         VENDOR_LIB_RUNTIME_TUNING_ENABLED
+#endif
+
 /* Run-time configuration file */
 #ifndef VENDOR_LIB_CONF_FILE
 #define VENDOR_LIB_CONF_FILE "/etc/bluetooth/bt_vendor.conf"
 #endif
 
+/* Binary snapshot of the resolved run-time configuration (conf file and
+   ro.bt.vnd.* properties), replayed without parsing while the conf file is
+   unchanged and the device was not rebooted. An empty name disables it. */
+#ifndef VENDOR_LIB_CONF_CACHE
+#define VENDOR_LIB_CONF_CACHE "/data/misc/bluedroid/bt_vendor.cache"
+#endif
+
 /* Device port name where Bluetooth controller attached */
 #ifndef BLUETOOTH_UART_DEVICE_PORT
 #define BLUETOOTH_UART_DEVICE_PORT      "/dev/ttyO1"    /* maguro */
@@ -180,6 +194,26 @@
 #define LPM_ENABLE_UART_TXD_TRI_STATE   0
 #endif
 
+/* LPM_SLEEP_GUARD_TIME / LPM_WAKEUP_GUARD_TIME
+
+    Sleep and wakeup guard times in 12.5ms units
+*/
+#ifndef LPM_SLEEP_GUARD_TIME
+#define LPM_SLEEP_GUARD_TIME            0
+#endif
+
+#ifndef LPM_WAKEUP_GUARD_TIME
+#define LPM_WAKEUP_GUARD_TIME           0
+#endif
+
+/* LPM_TXD_CONFIG
+
+    When set to 1, UART TXD is kept high in sleep state
+*/
+#ifndef LPM_TXD_CONFIG
+#define LPM_TXD_CONFIG                  0
+#endif
+
 /* LPM_PULSED_HOST_WAKE
 */
 #ifndef LPM_PULSED_HOST_WAKE
@@ -194,6 +228,19 @@
 #define LPM_IDLE_TIMEOUT_MULTIPLE       10
 #endif
 
+/* LPM_ADAPTIVE_POLICY
+
+    Default of LpmAdaptivePolicy in bt_vendor.conf. When set, the host idle
+    timeout and the LPM idle thresholds follow the traffic pattern seen
+    through BT_WAKE requests (idle, bursty or periodic). The stack is given
+    the shortest idle timeout and BT_WAKE is held for the remainder of the
+    per-class timeout. The requests are counted on the transmit path and
+    classified in the vendor event loop.
+*/
+#ifndef LPM_ADAPTIVE_POLICY
+#define LPM_ADAPTIVE_POLICY             FALSE
+#endif
+
 /* BT_WAKE_VIA_USERIAL_IOCTL
 
     Use userial ioctl function to control BT_WAKE signal
@@ -210,6 +257,16 @@
 #define BT_WAKE_VIA_PROC       FALSE
 #endif
 
+/* UPIO_GPIO_CHARDEV
+
+    Build support for GPIO lines on /dev/gpiochipN (linux/gpio.h, kernel
+    4.8 and later) for the HOST_WAKE monitor and the gpiochip BT_WAKE
+    backend
+*/
+#ifndef UPIO_GPIO_CHARDEV
+#define UPIO_GPIO_CHARDEV               FALSE
+#endif
+
 /* SCO_CFG_INCLUDED
 
     Do SCO configuration by default. If the firmware patch had been embedded
@@ -243,6 +300,10 @@
     1 : 16K
     2 : 4K
 */
+#define SCO_I2SPCM_IF_SAMPLE_RATE_8K    0
+#define SCO_I2SPCM_IF_SAMPLE_RATE_16K   1
+#define SCO_I2SPCM_IF_SAMPLE_RATE_4K    2
+
 #ifndef SCO_I2SPCM_IF_SAMPLE_RATE
 #define SCO_I2SPCM_IF_SAMPLE_RATE       0
 #endif
@@ -268,6 +329,17 @@
 #define SCO_I2SPCM_IF_CLOCK_RATE_WBS    ((SCO_I2SPCM_IF_CLOCK_RATE < 4) ? (SCO_I2SPCM_IF_CLOCK_RATE + 1) : (4))
 #endif
 
+/* SCO_I2SPCM_IF_RESAMPLE - Keep the I2S port at 16K with the wideband clock
+   for both codecs, the audio HAL converting CVSD audio to and from 8K with
+   the sco_codec resampler. Codec switches then leave the I2S port alone.
+
+    0 : Disable
+    1 : Enable
+*/
+#ifndef SCO_I2SPCM_IF_RESAMPLE
+#define SCO_I2SPCM_IF_RESAMPLE          0
+#endif
+
 #endif // SCO_USE_I2S_INTERFACE
 
 
@@ -364,6 +436,17 @@
 #define PCM_DATA_FMT_JUSTIFY_MODE       0
 #endif
 
+/* WARM_RESTART_TIMEOUT_MS
+
+    Warm restart: after BT off, the controller is kept powered, patched and
+    at the target baud rate, with the UART left open, so that the next BT on
+    only needs HCI_RESET and the BD_ADDR. Real power off follows after this
+    many ms without a BT on. 0 disables warm restart.
+*/
+#ifndef WARM_RESTART_TIMEOUT_MS
+#define WARM_RESTART_TIMEOUT_MS         0
+#endif
+
 /* HW_END_WITH_HCI_RESET
 
     Sample code implementation of sending a HCI_RESET command during the epilog
@@ -378,6 +461,28 @@
 #define MSBC_ENABLE_PARAM_SIZE          3
 #define MSBC_DISABLE_PARAM_SIZE         1
 
+/* Value types of the bt_vendor.conf entries, see vnd_conf_keys.h */
+#define CONF_TYPE_STR                   0   /* string, as written */
+#define CONF_TYPE_U8                    1   /* unsigned integer, 8 bits */
+#define CONF_TYPE_U32                   2   /* unsigned integer, 32 bits */
+#define CONF_TYPE_MS                    3   /* duration in ms, "ms" optional */
+#define CONF_TYPE_BOOL                  4   /* 0/1, false/true */
+
+/******************************************************************************
+**  Type definitions
+******************************************************************************/
+
+/* Value of a bt_vendor.conf entry, parsed and range checked once by conf.c */
+typedef struct
+{
+    const char *p_str;                  /* value as written */
+    uint32_t num;                       /* parsed value of non STR types */
+} conf_value_t;
+
+/* Action function of a bt_vendor.conf entry */
+typedef int (conf_action_t)(const char *p_conf_name,
+                            const conf_value_t *p_conf_value, int param);
+
 /******************************************************************************
 **  Extern variables and functions
 ******************************************************************************/
@@ -0,0 +1,259 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2009-2012 Broadcom Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+/******************************************************************************
+ *
+ *  Filename:      sco_codec.h
+ *
+ *  Description:   Contains definitions of the host side SCO voice codecs,
+ *                 used by the audio HAL when SCO is routed over HCI
+ *                 (SCO_PCM_ROUTING 1) and the controller carries the air
+ *                 coded data transparently
+ *
+ ******************************************************************************/
+
+#ifndef SCO_CODEC_H
+#define SCO_CODEC_H
+
+#include <stdint.h>
+
+/******************************************************************************
+**  Constants & Macros
+******************************************************************************/
+
+/* Codecs */
+#define SCO_CODEC_CVSD          0       /* CVSD 64 kbps, 8 kHz PCM */
+#define SCO_CODEC_MSBC          1       /* mSBC (HFP WBS), 16 kHz PCM */
+
+/* Both codecs code 7.5 ms of voice into one 60 byte SCO frame */
+#define SCO_CODEC_FRAME_BYTES   60
+#define SCO_CODEC_CVSD_SAMPLES  60
+#define SCO_CODEC_MSBC_SAMPLES  120
+#define SCO_CODEC_MAX_SAMPLES   SCO_CODEC_MSBC_SAMPLES
+
+/* Kernel instruction sets, in increasing order of preference */
+#define SCO_CODEC_ISA_SCALAR    0
+#define SCO_CODEC_ISA_SSE2      1
+#define SCO_CODEC_ISA_SSSE3     2
+#define SCO_CODEC_ISA_BEST      0xFF
+
+/* Sample rate converter directions, e.g. for CVSD over a 16 kHz I2S port */
+#define SCO_RESAMPLE_8K_TO_16K  0
+#define SCO_RESAMPLE_16K_TO_8K  1
+
+/* Packet status flag of received SCO data (Erroneous Data Reporting) */
+#define SCO_CODEC_PKT_OK        0       /* Correctly received */
+#define SCO_CODEC_PKT_INVALID   1       /* Possibly invalid */
+#define SCO_CODEC_PKT_LOST      2       /* No data received */
+#define SCO_CODEC_PKT_PARTIAL   3       /* Partially lost */
+
+/******************************************************************************
+**  Type definitions
+******************************************************************************/
+
+/* Opaque codec instance, one per direction pair of a SCO link */
+typedef struct sco_codec sco_codec_t;
+
+/* Opaque sample rate converter instance, one per stream */
+typedef struct sco_resampler sco_resampler_t;
+
+/* Receive statistics, since open or reset */
+typedef struct
+{
+    uint32_t frames;                    /* Frames received */
+    uint32_t lost;                      /* Flagged lost or partially lost */
+    uint32_t errors;                    /* Flagged invalid or undecodable */
+    uint32_t concealed;                 /* Frames replaced by concealment */
+    uint32_t plc_ns_avg;                /* CPU time per concealed frame */
+    uint32_t plc_ns_max;
+} sco_codec_stats_t;
+
+/******************************************************************************
+**  Functions
+******************************************************************************/
+
+/*******************************************************************************
+**
+** Function        sco_codec_open
+**
+** Description     Allocate a codec instance
+**
+** Returns         Codec instance, NULL if the codec is unknown or out of
+**                 memory
+**
+*******************************************************************************/
+sco_codec_t *sco_codec_open(uint8_t codec);
+
+/*******************************************************************************
+**
+** Function        sco_codec_close
+**
+** Description     Release a codec instance
+**
+** Returns         None
+**
+*******************************************************************************/
+void sco_codec_close(sco_codec_t *p_codec);
+
+/*******************************************************************************
+**
+** Function        sco_codec_reset
+**
+** Description     Reset the encoder and decoder states, e.g. when the SCO
+**                 link is set up again
+**
+** Returns         None
+**
+*******************************************************************************/
+void sco_codec_reset(sco_codec_t *p_codec);
+
+/*******************************************************************************
+**
+** Function        sco_codec_frame_samples
+**
+** Description     Get the number of PCM samples coded in a frame
+**
+** Returns         Samples per frame, 0 if the codec is unknown
+**
+*******************************************************************************/
+uint16_t sco_codec_frame_samples(uint8_t codec);
+
+/*******************************************************************************
+**
+** Function        sco_codec_encode
+**
+** Description     Encode one frame of PCM samples into SCO_CODEC_FRAME_BYTES
+**                 bytes
+**
+** Returns         Number of bytes written, <0 on error
+**
+*******************************************************************************/
+int sco_codec_encode(sco_codec_t *p_codec, const int16_t *p_pcm,
+                     uint8_t *p_frame);
+
+/*******************************************************************************
+**
+** Function        sco_codec_decode
+**
+** Description     Decode one SCO_CODEC_FRAME_BYTES bytes frame into PCM
+**                 samples
+**
+** Returns         Number of samples written, <0 if the frame is corrupted
+**
+*******************************************************************************/
+int sco_codec_decode(sco_codec_t *p_codec, const uint8_t *p_frame,
+                     int16_t *p_pcm);
+
+/*******************************************************************************
+**
+** Function        sco_codec_receive
+**
+** Description     Decode one received frame, or conceal it when its packet
+**                 status flag reports an error or it does not decode.
+**                 p_frame may be NULL when nothing was received.
+**
+** Returns         Number of samples written
+**
+*******************************************************************************/
+int sco_codec_receive(sco_codec_t *p_codec, const uint8_t *p_frame,
+                      uint8_t pkt_status, int16_t *p_pcm);
+
+/*******************************************************************************
+**
+** Function        sco_codec_get_stats
+**
+** Description     Get the receive statistics of a codec instance
+**
+** Returns         None
+**
+*******************************************************************************/
+void sco_codec_get_stats(const sco_codec_t *p_codec, sco_codec_stats_t *p_stats);
+
+/*******************************************************************************
+**
+** Function        sco_resampler_open
+**
+** Description     Allocate an 8 <-> 16 kHz sample rate converter
+**                 (SCO_RESAMPLE_*)
+**
+** Returns         Converter instance, NULL on error
+**
+*******************************************************************************/
+sco_resampler_t *sco_resampler_open(uint8_t dir);
+
+/*******************************************************************************
+**
+** Function        sco_resampler_close
+**
+** Description     Release a sample rate converter
+**
+** Returns         None
+**
+*******************************************************************************/
+void sco_resampler_close(sco_resampler_t *p_rs);
+
+/*******************************************************************************
+**
+** Function        sco_resampler_reset
+**
+** Description     Clear the filter history, e.g. when a new stream starts
+**
+** Returns         None
+**
+*******************************************************************************/
+void sco_resampler_reset(sco_resampler_t *p_rs);
+
+/*******************************************************************************
+**
+** Function        sco_resampler_process
+**
+** Description     Convert n input samples, n even when downsampling. p_out
+**                 holds 2 x n samples upsampling, n / 2 downsampling.
+**
+** Returns         Number of samples written
+**
+*******************************************************************************/
+uint16_t sco_resampler_process(sco_resampler_t *p_rs, const int16_t *p_in,
+                               uint16_t n, int16_t *p_out);
+
+/*******************************************************************************
+**
+** Function        sco_codec_set_isa
+**
+** Description     Select the kernels of all codec instances. The request is
+**                 lowered to what the CPU supports, SCO_CODEC_ISA_BEST
+**                 selects the fastest one.
+**
+** Returns         SCO_CODEC_ISA_* in use
+**
+*******************************************************************************/
+uint8_t sco_codec_set_isa(uint8_t isa);
+
+/*******************************************************************************
+**
+** Function        sco_codec_benchmark
+**
+** Description     Encode and decode frames of a synthetic voice signal on
+**                 the calling thread, with the kernels in use
+**
+** Returns         Encoded plus decoded frames per second, 0 on error
+**
+*******************************************************************************/
+uint32_t sco_codec_benchmark(uint8_t codec, uint32_t frames);
+
+#endif /* SCO_CODEC_H */
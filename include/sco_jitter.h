@@ -0,0 +1,139 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2009-2012 Broadcom Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+/******************************************************************************
+ *
+ *  Filename:      sco_jitter.h
+ *
+ *  Description:   Contains definitions of the adaptive jitter buffer of
+ *                 host routed SCO audio, between the HCI SCO packets read
+ *                 from the UART and the audio HAL playout clock
+ *
+ ******************************************************************************/
+
+#ifndef SCO_JITTER_H
+#define SCO_JITTER_H
+
+#include <stdint.h>
+
+/******************************************************************************
+**  Constants & Macros
+******************************************************************************/
+
+/* Frames held at most, 120 ms */
+#define SCO_JB_MAX_FRAMES       16
+
+/* Histograms of 2 ms bins, the last one counts everything above */
+#define SCO_JB_HIST_BINS        32
+#define SCO_JB_HIST_BIN_US      2000
+
+/******************************************************************************
+**  Type definitions
+******************************************************************************/
+
+/* Opaque jitter buffer instance, one per received SCO link */
+typedef struct sco_jb sco_jb_t;
+
+/* Statistics, since open or reset */
+typedef struct
+{
+    uint32_t packets;                   /* SCO packets received */
+    uint32_t frames;                    /* Frames played */
+    uint32_t underruns;                 /* Played before their data arrived */
+    uint32_t drops;                     /* Dropped to shrink the delay */
+    uint32_t overflows;                 /* Dropped on a full buffer */
+    uint16_t target_ms;                 /* Current playout delay target */
+    uint32_t jitter_hist[SCO_JB_HIST_BINS]; /* Frame arrival lateness */
+    uint32_t delay_hist[SCO_JB_HIST_BINS];  /* Frame arrival to playout */
+} sco_jb_stats_t;
+
+/******************************************************************************
+**  Functions
+******************************************************************************/
+
+/*******************************************************************************
+**
+** Function        sco_jb_open
+**
+** Description     Allocate a jitter buffer decoding codec (SCO_CODEC_*)
+**
+** Returns         Jitter buffer instance, NULL on error
+**
+*******************************************************************************/
+sco_jb_t *sco_jb_open(uint8_t codec);
+
+/*******************************************************************************
+**
+** Function        sco_jb_close
+**
+** Description     Release a jitter buffer, logging its statistics
+**
+** Returns         None
+**
+*******************************************************************************/
+void sco_jb_close(sco_jb_t *p_jb);
+
+/*******************************************************************************
+**
+** Function        sco_jb_reset
+**
+** Description     Flush the buffer and restart its timing model, e.g. when
+**                 the SCO link is set up again
+**
+** Returns         None
+**
+*******************************************************************************/
+void sco_jb_reset(sco_jb_t *p_jb);
+
+/*******************************************************************************
+**
+** Function        sco_jb_put
+**
+** Description     Queue one HCI SCO data packet (handle, length and payload,
+**                 without the H4 packet type). To be called as soon as the
+**                 packet is read from the UART, it is timestamped on entry.
+**
+** Returns         None
+**
+*******************************************************************************/
+void sco_jb_put(sco_jb_t *p_jb, const uint8_t *p_pkt, uint16_t len);
+
+/*******************************************************************************
+**
+** Function        sco_jb_get
+**
+** Description     Play out the next frame, on the audio clock. Missing data
+**                 is concealed.
+**
+** Returns         Number of samples written
+**
+*******************************************************************************/
+int sco_jb_get(sco_jb_t *p_jb, int16_t *p_pcm);
+
+/*******************************************************************************
+**
+** Function        sco_jb_get_stats
+**
+** Description     Get the statistics and histograms of a jitter buffer
+**
+** Returns         None
+**
+*******************************************************************************/
+void sco_jb_get_stats(sco_jb_t *p_jb, sco_jb_stats_t *p_stats);
+
+#endif /* SCO_JITTER_H */
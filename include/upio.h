@@ -49,6 +49,38 @@ enum {
     UPIO_ASSERT
 };
 
+/******************************************************************************
+**  Type definitions
+******************************************************************************/
+
+/* Kernel write statistics of the bluesleep proc interface */
+typedef struct
+{
+    uint32_t writes;            /* total writes into proc nodes */
+    uint32_t writes_per_sec;    /* write rate since the previous query */
+} upio_proc_stats_t;
+
+/* BT_WAKE transition counters of the deassert hysteresis layer */
+typedef struct
+{
+    uint32_t asserts;               /* assertions driven to the line */
+    uint32_t deasserts;             /* deassertions driven to the line */
+    uint32_t deassert_requests;     /* deassertions requested by the stack */
+    uint32_t deasserts_cancelled;   /* delayed deassertions dropped */
+    uint32_t delay_ms;              /* current deassert window */
+} upio_wake_stats_t;
+
+/* HOST_WAKE monitor statistics */
+typedef struct
+{
+    uint32_t wakes;                 /* HOST_WAKE assertions seen */
+    uint32_t first_bytes;           /* assertions followed by UART data */
+    uint32_t latency_last_us;       /* wake-to-first-byte latency */
+    uint32_t latency_min_us;
+    uint32_t latency_avg_us;
+    uint32_t latency_max_us;
+} upio_host_wake_stats_t;
+
 /******************************************************************************
 **  Extern variables and functions
 ******************************************************************************/
@@ -92,6 +124,19 @@ void upio_cleanup(void);
 *******************************************************************************/
 int upio_set_bluetooth_power(int on);
 
+/*******************************************************************************
+**
+** Function        upio_get_power_epoch
+**
+** Description     Tell whether the controller may have lost power: the
+**                 returned count changes on every power off, and on every
+**                 block of the Bluetooth switch by anybody else.
+**
+** Returns         Power epoch, to be compared with an earlier one
+**
+*******************************************************************************/
+uint32_t upio_get_power_epoch(void);
+
 /*******************************************************************************
 **
 ** Function        upio_set
@@ -103,5 +148,76 @@ int upio_set_bluetooth_power(int on);
 *******************************************************************************/
 void upio_set(uint8_t pio, uint8_t action, uint8_t polarity);
 
+/*******************************************************************************
+**
+** Function        upio_get_proc_stats
+**
+** Description     Report the number of writes issued into the bluesleep proc
+**                 nodes, in total and per second since LPM was enabled or
+**                 the previous call
+**
+** Returns         None
+**
+*******************************************************************************/
+void upio_get_proc_stats(upio_proc_stats_t *p_stats);
+
+/*******************************************************************************
+**
+** Function        upio_get_wake_stats
+**
+** Description     Report BT_WAKE transition counters of the hysteresis layer
+**
+** Returns         None
+**
+*******************************************************************************/
+void upio_get_wake_stats(upio_wake_stats_t *p_stats);
+
+/*******************************************************************************
+**
+** Function        upio_set_wake_hold
+**
+** Description     Keep BT_WAKE asserted for at least hold_ms after the stack
+**                 requests a deassert. 0 removes the floor.
+**
+** Returns         None
+**
+*******************************************************************************/
+void upio_set_wake_hold(uint32_t hold_ms);
+
+/*******************************************************************************
+**
+** Function        upio_host_wake_start
+**
+** Description     Start monitoring HOST_WAKE if a node has been configured.
+**                 Called when LPM is enabled.
+**
+** Returns         None
+**
+*******************************************************************************/
+void upio_host_wake_start(uint8_t polarity);
+
+/*******************************************************************************
+**
+** Function        upio_host_wake_stop
+**
+** Description     Stop monitoring HOST_WAKE and release pre-wake requests.
+**                 Called when LPM is disabled.
+**
+** Returns         None
+**
+*******************************************************************************/
+void upio_host_wake_stop(void);
+
+/*******************************************************************************
+**
+** Function        upio_get_host_wake_stats
+**
+** Description     Report HOST_WAKE wakes and wake-to-first-byte latency
+**
+** Returns         None
+**
+*******************************************************************************/
+void upio_get_host_wake_stats(upio_host_wake_stats_t *p_stats);
+
 #endif /* UPIO_H */
 
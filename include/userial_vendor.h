@@ -72,6 +72,23 @@
 #define USERIAL_DATABITS_8      (1<<9)
 
 
+/* Default upper bound of the wait for the controller to come out of reset,
+ * UartReadyTimeoutMs in bt_vendor.conf, 0 to not wait */
+#ifndef USERIAL_READY_TIMEOUT_MS
+#define USERIAL_READY_TIMEOUT_MS    200
+#endif
+
+/* Records the USERIAL baud rate of the port while the controller keeps it,
+ * so that it can be found again after the host process restarts */
+#ifndef USERIAL_BAUD_PROPERTY
+#define USERIAL_BAUD_PROPERTY       "bluetooth.vnd.uart_baud"
+#endif
+
+/* Wait for the Command Complete of a probing HCI_RESET */
+#ifndef USERIAL_BAUD_PROBE_TIMEOUT_MS
+#define USERIAL_BAUD_PROBE_TIMEOUT_MS   100
+#endif
+
 #if (BT_WAKE_VIA_USERIAL_IOCTL==TRUE)
 /* These are the ioctl values used for bt_wake ioctl via UART driver. you may
  * need to redefine them on you platform!
@@ -108,6 +125,10 @@ typedef enum {
     USERIAL_OP_NOP,
 } userial_vendor_ioctl_op_t;
 
+/* Controller ready callback, with the power on to ready time in ms, or -1
+ * when unknown or on timeout */
+typedef void (*userial_ready_cback_t)(int ready_ms);
+
 /******************************************************************************
 **  Extern variables and functions
 ******************************************************************************/
@@ -160,6 +181,29 @@ void userial_vendor_close(void);
 *******************************************************************************/
 void userial_vendor_set_baud(uint8_t userial_baud);
 
+/*******************************************************************************
+**
+** Function        userial_vendor_get_baud
+**
+** Description     Get the USERIAL baud rate the port is running at
+**
+** Returns         USERIAL baud rate
+**
+*******************************************************************************/
+uint8_t userial_vendor_get_baud(void);
+
+/*******************************************************************************
+**
+** Function        userial_vendor_forget_baud
+**
+** Description     Forget the baud rate recorded for the controller, after it
+**                 has been powered off
+**
+** Returns         None
+**
+*******************************************************************************/
+void userial_vendor_forget_baud(void);
+
 /*******************************************************************************
 **
 ** Function        userial_vendor_ioctl
@@ -171,5 +215,53 @@ void userial_vendor_set_baud(uint8_t userial_baud);
 *******************************************************************************/
 void userial_vendor_ioctl(userial_vendor_ioctl_op_t op, void *p_data);
 
+/*******************************************************************************
+**
+** Function        userial_vendor_power_on
+**
+** Description     Note that the controller has just been powered on
+**
+** Returns         None
+**
+*******************************************************************************/
+void userial_vendor_power_on(void);
+
+/*******************************************************************************
+**
+** Function        userial_vendor_wait_ready
+**
+** Description     Wait for CTS or a first byte from the controller, up to
+**                 the configured timeout. p_cback is called once, right away
+**                 when there is nothing to wait for, otherwise from the
+**                 vendor event loop thread. Not called if the port is closed
+**                 meanwhile.
+**
+** Returns         None
+**
+*******************************************************************************/
+void userial_vendor_wait_ready(userial_ready_cback_t p_cback);
+
+/*******************************************************************************
+**
+** Function        userial_vendor_get_fd
+**
+** Description     Get the fd of the opened serial port
+**
+** Returns         device fd, -1 if the port is closed
+**
+*******************************************************************************/
+int userial_vendor_get_fd(void);
+
+/*******************************************************************************
+**
+** Function        userial_vendor_get_port
+**
+** Description     Get the configured serial port device name
+**
+** Returns         port name
+**
+*******************************************************************************/
+const char *userial_vendor_get_port(void);
+
 #endif /* USERIAL_VENDOR_H */
 
@@ -0,0 +1,131 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2009-2012 Broadcom Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+/******************************************************************************
+ *
+ *  Filename:      vnd_conf_keys.h
+ *
+ *  Description:   Schema of the bt_vendor.conf entries (and of their
+ *                 ro.bt.vnd.* system property overrides)
+ *
+ *                 Each entry is
+ *
+ *                   CONF_KEY(name, type, min, max, action, param, live)
+ *
+ *                 where type is one of STR, U8, U32, MS or BOOL (see
+ *                 CONF_TYPE_* in bt_vendor_brcm.h), min and max bound the
+ *                 numeric types, and action is the conf_action_t called
+ *                 with the parsed value and param. live is TRUE when a
+ *                 change can be applied on a conf file reload, without a
+ *                 Bluetooth restart: the action must then be safe to call
+ *                 while Bluetooth is on.
+ *
+ *                 Each name can also be set as the ro.bt.vnd.<name> system
+ *                 property, which must fit PROPERTY_KEY_MAX. An entry whose
+ *                 name is too long for that is declared as
+ *
+ *                   CONF_KEY_PROP(name, prop, type, min, max, action, param,
+ *                                 live)
+ *
+ *                 with a shorter property name, ro.bt.vnd.<prop>. conf.c
+ *                 checks the lengths at build time.
+ *
+ *                 conf.c includes this file with its own CONF_KEY and
+ *                 CONF_KEY_PROP to build the dispatch table, which is searched
+ *                 by bisection: the entries MUST be kept in strcmp() order of
+ *                 their names.
+ *                 No include guard on purpose.
+ *
+ ******************************************************************************/
+
+/* BT_WAKE deassert window, param 1 is the upper bound of the adaptive one */
+CONF_KEY_PROP(BT_WAKE_DEASSERT_DELAY_MAX_MS, BT_WAKE_DEASSERT_MAX, \
+              MS, 0, 1000, upio_set_wake_hysteresis, 1, TRUE)
+CONF_KEY_PROP(BT_WAKE_DEASSERT_DELAY_MS, BT_WAKE_DEASSERT_MS, \
+              MS, 0, 1000, upio_set_wake_hysteresis, 0, TRUE)
+CONF_KEY(BtWakeBackend, STR, 0, 0, upio_set_bt_wake_backend, 0, FALSE)
+CONF_KEY(BtWakeGpio, STR, 0, 0, upio_set_bt_wake_backend, 1, FALSE)
+CONF_KEY(FwPatchFileName, STR, 0, 0, hw_set_patch_file_name, 0, FALSE)
+CONF_KEY(FwPatchFilePath, STR, 0, 0, hw_set_patch_file_path, 0, FALSE)
+#if (VENDOR_LIB_RUNTIME_TUNING_ENABLED == TRUE)
+CONF_KEY_PROP(FwPatchSettlementDelay, FwPatchSettleDelay, MS, 0, INT32_MAX, \
+              hw_set_patch_settlement_delay, 0, FALSE)
+#endif
+CONF_KEY(HostWakeNode, STR, 0, 0, upio_set_host_wake_node, 0, FALSE)
+
+/* LPM parameters, param is the offset in bt_lpm_param_t, past it for
+ * LPM_IDLE_TIMEOUT_MULTIPLE */
+CONF_KEY_PROP(LPM_ALLOW_HOST_SLEEP_DURING_SCO, LPM_HOST_SLEEP_SCO, \
+              U8, 0, 1, hw_lpm_set_param, 5, TRUE)
+CONF_KEY(LPM_BT_WAKE_POLARITY, U8, 0, 1, hw_lpm_set_param, 3, TRUE)
+CONF_KEY_PROP(LPM_COMBINE_SLEEP_MODE_AND_LPM, LPM_COMBINE_SLEEP, \
+              U8, 0, 1, hw_lpm_set_param, 6, TRUE)
+CONF_KEY_PROP(LPM_ENABLE_UART_TXD_TRI_STATE, LPM_TXD_TRI_STATE, \
+              U8, 0, 1, hw_lpm_set_param, 7, TRUE)
+CONF_KEY(LPM_HC_IDLE_THRESHOLD, U8, 1, 255, hw_lpm_set_param, 2, TRUE)
+CONF_KEY_PROP(LPM_HOST_WAKE_POLARITY, LPM_HOST_WAKE_POL, \
+              U8, 0, 1, hw_lpm_set_param, 4, TRUE)
+CONF_KEY(LPM_IDLE_THRESHOLD, U8, 1, 255, hw_lpm_set_param, 1, TRUE)
+CONF_KEY_PROP(LPM_IDLE_TIMEOUT_MULTIPLE, LPM_IDLE_TIMEOUT_MULT, \
+              U8, 1, 255, hw_lpm_set_param, 12, TRUE)
+CONF_KEY(LPM_PULSED_HOST_WAKE, U8, 0, 1, hw_lpm_set_param, 11, TRUE)
+CONF_KEY(LPM_SLEEP_GUARD_TIME, U8, 0, 255, hw_lpm_set_param, 8, TRUE)
+CONF_KEY(LPM_SLEEP_MODE, U8, 0, 9, hw_lpm_set_param, 0, TRUE)
+CONF_KEY(LPM_TXD_CONFIG, U8, 0, 1, hw_lpm_set_param, 10, TRUE)
+CONF_KEY(LPM_WAKEUP_GUARD_TIME, U8, 0, 255, hw_lpm_set_param, 9, TRUE)
+CONF_KEY(LpmAdaptivePolicy, BOOL, 0, 1, hw_lpm_set_adaptive_policy, 0, TRUE)
+
+/* PCM/I2S parameters, param is the index in the parameter array */
+#if (!defined(SCO_USE_I2S_INTERFACE) || (SCO_USE_I2S_INTERFACE == FALSE))
+CONF_KEY_PROP(PCM_DATA_FMT_FILL_BITS, PCM_FMT_FILL_BITS, \
+              U8, 0, 255, hw_pcm_fmt_set_param, 1, TRUE)
+CONF_KEY_PROP(PCM_DATA_FMT_FILL_METHOD, PCM_FMT_FILL_METHOD, \
+              U8, 0, 3, hw_pcm_fmt_set_param, 2, TRUE)
+CONF_KEY_PROP(PCM_DATA_FMT_FILL_NUM, PCM_FMT_FILL_NUM, \
+              U8, 0, 255, hw_pcm_fmt_set_param, 3, TRUE)
+CONF_KEY_PROP(PCM_DATA_FMT_JUSTIFY_MODE, PCM_FMT_JUSTIFY_MODE, \
+              U8, 0, 1, hw_pcm_fmt_set_param, 4, TRUE)
+CONF_KEY_PROP(PCM_DATA_FMT_SHIFT_MODE, PCM_FMT_SHIFT_MODE, \
+              U8, 0, 1, hw_pcm_fmt_set_param, 0, TRUE)
+#endif
+CONF_KEY(RfkillSysfsRoot, STR, 0, 0, upio_set_rfkill_root, 0, FALSE)
+#if (SCO_USE_I2S_INTERFACE == TRUE)
+CONF_KEY_PROP(SCO_I2SPCM_IF_CLOCK_RATE, SCO_I2S_CLOCK_RATE, \
+              U8, 0, 4, hw_i2s_set_param, 3, TRUE)
+CONF_KEY_PROP(SCO_I2SPCM_IF_MODE, SCO_I2S_MODE, \
+              U8, 0, 1, hw_i2s_set_param, 0, TRUE)
+CONF_KEY_PROP(SCO_I2SPCM_IF_RESAMPLE, SCO_I2S_RESAMPLE, \
+              BOOL, 0, 1, hw_i2s_set_resample, 0, TRUE)
+CONF_KEY_PROP(SCO_I2SPCM_IF_ROLE, SCO_I2S_ROLE, \
+              U8, 0, 1, hw_i2s_set_param, 1, TRUE)
+CONF_KEY_PROP(SCO_I2SPCM_IF_SAMPLE_RATE, SCO_I2S_SAMPLE_RATE, \
+              U8, 0, 2, hw_i2s_set_param, 2, TRUE)
+#endif
+CONF_KEY(SCO_JB_MAX_DELAY_MS, MS, 0, 1000, sco_jb_set_param, 1, TRUE)
+CONF_KEY(SCO_JB_UNDERRUN_PPM, U32, 0, 1000000, sco_jb_set_param, 0, TRUE)
+#if (!defined(SCO_USE_I2S_INTERFACE) || (SCO_USE_I2S_INTERFACE == FALSE))
+CONF_KEY(SCO_PCM_IF_CLOCK_MODE, U8, 0, 1, hw_pcm_set_param, 4, TRUE)
+CONF_KEY(SCO_PCM_IF_CLOCK_RATE, U8, 0, 4, hw_pcm_set_param, 1, TRUE)
+CONF_KEY(SCO_PCM_IF_FRAME_TYPE, U8, 0, 1, hw_pcm_set_param, 2, TRUE)
+CONF_KEY(SCO_PCM_IF_SYNC_MODE, U8, 0, 1, hw_pcm_set_param, 3, TRUE)
+CONF_KEY(SCO_PCM_ROUTING, U8, 0, 3, hw_pcm_set_param, 0, TRUE)
+#endif
+
+CONF_KEY(UartPort, STR, 0, 0, userial_set_port, 0, FALSE)
+CONF_KEY(UartReadyTimeoutMs, MS, 0, 5000, userial_set_ready_timeout, 0, TRUE)
+CONF_KEY(WarmRestartTimeoutMs, MS, 0, UINT32_MAX, vnd_set_warm_restart, 0, TRUE)
@@ -0,0 +1,213 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2009-2012 Broadcom Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+/******************************************************************************
+ *
+ *  Filename:      vnd_loop.h
+ *
+ *  Description:   Contains definitions of the vendor library event loop,
+ *                 a single thread hosting timers, fd watches and deferred
+ *                 work
+ *
+ ******************************************************************************/
+
+#ifndef VND_LOOP_H
+#define VND_LOOP_H
+
+#include <stdint.h>
+
+/******************************************************************************
+**  Constants & Macros
+******************************************************************************/
+
+/* Maximum number of timers which can be allocated at the same time */
+#ifndef VND_LOOP_MAX_TIMERS
+#define VND_LOOP_MAX_TIMERS     8
+#endif
+
+/* Maximum number of fds which can be watched at the same time */
+#ifndef VND_LOOP_MAX_FDS
+#define VND_LOOP_MAX_FDS        4
+#endif
+
+/* Maximum number of pending deferred work items */
+#ifndef VND_LOOP_MAX_WORK
+#define VND_LOOP_MAX_WORK       16
+#endif
+
+/* Nice value of the loop thread, 0 keeps the inherited priority. The loop
+   runs the BT_WAKE hysteresis and btwrite timers, the LPM policy windows,
+   HOST_WAKE monitoring, the conf file reload, the UART ready wait and the
+   warm restart power off: none of it is audio work. */
+#ifndef VND_LOOP_THREAD_PRIORITY
+#define VND_LOOP_THREAD_PRIORITY    (-2)    /* ANDROID_PRIORITY_FOREGROUND */
+#endif
+
+/* CPU affinity mask of the loop thread, 0 leaves the thread unpinned */
+#ifndef VND_LOOP_CPU_AFFINITY
+#define VND_LOOP_CPU_AFFINITY       0
+#endif
+
+/******************************************************************************
+**  Type definitions
+******************************************************************************/
+
+/* Callback of timers and deferred work, runs in the loop thread */
+typedef void (*vnd_loop_cback_t)(void *p_data);
+
+/* Callback of fd watches, runs in the loop thread */
+typedef void (*vnd_loop_fd_cback_t)(int fd, uint32_t events, void *p_data);
+
+/* Opaque timer handle */
+typedef struct vnd_loop_timer vnd_loop_timer_t;
+
+/******************************************************************************
+**  Functions
+******************************************************************************/
+
+/*******************************************************************************
+**
+** Function        vnd_loop_init
+**
+** Description     Create the event loop and start its thread
+**
+** Returns         0  : SUCCESS
+**                 <0 : ERROR
+**
+*******************************************************************************/
+int vnd_loop_init(void);
+
+/*******************************************************************************
+**
+** Function        vnd_loop_cleanup
+**
+** Description     Stop the loop thread and release all timers and watches
+**
+** Returns         None
+**
+*******************************************************************************/
+void vnd_loop_cleanup(void);
+
+/*******************************************************************************
+**
+** Function        vnd_loop_timer_new
+**
+** Description     Allocate a timer whose callback runs in the loop thread
+**
+** Returns         Timer handle, NULL if out of resources
+**
+*******************************************************************************/
+vnd_loop_timer_t *vnd_loop_timer_new(vnd_loop_cback_t p_cback, void *p_data);
+
+/*******************************************************************************
+**
+** Function        vnd_loop_timer_start
+**
+** Description     (Re)arm a timer to expire in timeout_ms, and then every
+**                 period_ms if period_ms is not 0
+**
+** Returns         None
+**
+*******************************************************************************/
+void vnd_loop_timer_start(vnd_loop_timer_t *p_timer, uint32_t timeout_ms,
+                          uint32_t period_ms);
+
+/*******************************************************************************
+**
+** Function        vnd_loop_timer_stop
+**
+** Description     Disarm a timer. An expiry which has not been dispatched yet
+**                 is dropped.
+**
+** Returns         None
+**
+*******************************************************************************/
+void vnd_loop_timer_stop(vnd_loop_timer_t *p_timer);
+
+/*******************************************************************************
+**
+** Function        vnd_loop_timer_free
+**
+** Description     Disarm and release a timer
+**
+** Returns         None
+**
+*******************************************************************************/
+void vnd_loop_timer_free(vnd_loop_timer_t *p_timer);
+
+/*******************************************************************************
+**
+** Function        vnd_loop_post
+**
+** Description     Queue a work item to be run in the loop thread
+**
+** Returns         0  : SUCCESS
+**                 <0 : ERROR (loop not running or queue full)
+**
+*******************************************************************************/
+int vnd_loop_post(vnd_loop_cback_t p_cback, void *p_data);
+
+/*******************************************************************************
+**
+** Function        vnd_loop_add_fd
+**
+** Description     Watch fd for the given epoll events
+**
+** Returns         0  : SUCCESS
+**                 <0 : ERROR
+**
+*******************************************************************************/
+int vnd_loop_add_fd(int fd, uint32_t events, vnd_loop_fd_cback_t p_cback,
+                    void *p_data);
+
+/*******************************************************************************
+**
+** Function        vnd_loop_mod_fd
+**
+** Description     Change the epoll events watched on fd
+**
+** Returns         0  : SUCCESS
+**                 <0 : ERROR
+**
+*******************************************************************************/
+int vnd_loop_mod_fd(int fd, uint32_t events);
+
+/*******************************************************************************
+**
+** Function        vnd_loop_remove_fd
+**
+** Description     Stop watching fd
+**
+** Returns         None
+**
+*******************************************************************************/
+void vnd_loop_remove_fd(int fd);
+
+/*******************************************************************************
+**
+** Function        vnd_loop_in_thread
+**
+** Description     Check whether the caller runs in the loop thread
+**
+** Returns         TRUE/FALSE
+**
+*******************************************************************************/
+uint8_t vnd_loop_in_thread(void);
+
+#endif /* VND_LOOP_H */
+
@@ -27,10 +27,14 @@
 #define LOG_TAG "bt_vendor"
 
 #include <utils/Log.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
 #include <cutils/properties.h>
 #include "bt_vendor_brcm.h"
 #include "upio.h"
 #include "userial_vendor.h"
+#include "vnd_loop.h"
 
 #ifndef BTVND_DBG
 #define BTVND_DBG FALSE
@@ -47,6 +51,8 @@
 ******************************************************************************/
 
 void hw_config_start(void);
+void hw_config_warm_start(void);
+uint8_t hw_config_is_complete(void);
 void hw_config_cleanup(void);
 uint8_t hw_lpm_enable(uint8_t turn_on);
 uint32_t hw_lpm_get_idle_timeout(void);
@@ -56,6 +62,12 @@ void hw_sco_config(void);
 #endif
 void vnd_load_prop();
 void vnd_load_conf(const char *p_path);
+int vnd_conf_cache_load(const char *p_path);
+void vnd_conf_cache_save(const char *p_path);
+#if (VENDOR_LIB_CONF_LIVE_RELOAD == TRUE)
+void vnd_conf_watch_start(const char *p_path);
+void vnd_conf_watch_stop(void);
+#endif
 #if (HW_END_WITH_HCI_RESET == TRUE)
 void hw_epilog_process(void);
 #endif
@@ -71,6 +83,17 @@ uint8_t vnd_local_bd_addr[6]={0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
 **  Local type definitions
 ******************************************************************************/
 
+/* Warm restart control block */
+typedef struct
+{
+    pthread_mutex_t mutex;
+    uint32_t timeout_ms;            /* 0 = warm restart disabled */
+    uint8_t held;                   /* powered and port open after BT off */
+    uint8_t resumed;                /* this session started warm */
+    uint32_t power_epoch;           /* upio power epoch when held */
+    vnd_loop_timer_t *p_timer;      /* inactivity timeout */
+} vnd_warm_cb_t;
+
 /******************************************************************************
 **  Static Variables
 ******************************************************************************/
@@ -81,10 +104,161 @@ static const tUSERIAL_CFG userial_init_cfg =
     USERIAL_BAUD_115200
 };
 
+static vnd_warm_cb_t warm_cb =
+{
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .timeout_ms = WARM_RESTART_TIMEOUT_MS,
+};
+
 /******************************************************************************
 **  Functions
 ******************************************************************************/
 
+/*****************************************************************************
+**   Warm Restart Functions
+*****************************************************************************/
+
+/*
+ * With warm restart enabled, BT off leaves the controller powered and the
+ * UART open once it has been fully configured. The vendor event loop is kept
+ * running across cleanup/init to host the inactivity timer, on expiry of
+ * which the port is closed and power is cut as a normal BT off would do.
+ * The idle loop is then left to the next init/cleanup cycle.
+ */
+
+/*******************************************************************************
+**
+** Function        warm_restart_timeout
+**
+** Description     Fall back to a real power off after the inactivity timeout.
+**                 Runs in the vendor event loop thread.
+**
+** Returns         None
+**
+*******************************************************************************/
+static void warm_restart_timeout(void *p_data)
+{
+    pthread_mutex_lock(&warm_cb.mutex);
+
+    /* a stale expiry may still run after warm_restart_resume */
+    if (warm_cb.held)
+    {
+        ALOGI("warm restart: idle for %u ms, powering off", warm_cb.timeout_ms);
+
+        warm_cb.held = FALSE;
+        userial_vendor_close();
+        upio_set_bluetooth_power(UPIO_BT_POWER_OFF);
+    }
+
+    pthread_mutex_unlock(&warm_cb.mutex);
+}
+
+/*******************************************************************************
+**
+** Function        warm_restart_eligible
+**
+** Description     Tell if BT off may keep the controller up, with
+**                 warm_cb.mutex held
+**
+** Returns         TRUE/FALSE
+**
+*******************************************************************************/
+static uint8_t warm_restart_eligible(void)
+{
+    return ((warm_cb.timeout_ms != 0) && hw_config_is_complete()) ? \
+            TRUE : FALSE;
+}
+
+/*******************************************************************************
+**
+** Function        warm_restart_hold
+**
+** Description     Keep the controller powered on BT off and arm the inactivity
+**                 timeout
+**
+** Returns         TRUE if power is kept, FALSE if it must be cut
+**
+*******************************************************************************/
+static uint8_t warm_restart_hold(void)
+{
+    uint8_t held = FALSE;
+
+    pthread_mutex_lock(&warm_cb.mutex);
+
+    if (warm_restart_eligible() && (vnd_loop_init() == 0))
+    {
+        if (warm_cb.p_timer == NULL)
+            warm_cb.p_timer = vnd_loop_timer_new(warm_restart_timeout, NULL);
+
+        if (warm_cb.p_timer != NULL)
+        {
+            vnd_loop_timer_start(warm_cb.p_timer, warm_cb.timeout_ms, 0);
+            warm_cb.power_epoch = upio_get_power_epoch();
+            warm_cb.held = held = TRUE;
+            ALOGI("warm restart: controller kept up for %u ms", \
+                  warm_cb.timeout_ms);
+        }
+    }
+
+    pthread_mutex_unlock(&warm_cb.mutex);
+
+    return held;
+}
+
+/*******************************************************************************
+**
+** Function        warm_restart_resume
+**
+** Description     Take back a controller kept up by warm_restart_hold,
+**                 unless its power was cut meanwhile, e.g. by an rfkill
+**                 block from outside of the stack
+**
+** Returns         TRUE if the controller is still up, FALSE otherwise
+**
+*******************************************************************************/
+static uint8_t warm_restart_resume(void)
+{
+    pthread_mutex_lock(&warm_cb.mutex);
+
+    warm_cb.resumed = warm_cb.held;
+    if (warm_cb.held)
+    {
+        vnd_loop_timer_stop(warm_cb.p_timer);
+        warm_cb.held = FALSE;
+
+        if (upio_get_power_epoch() != warm_cb.power_epoch)
+        {
+            ALOGW("warm restart: controller lost power, cold start");
+            warm_cb.resumed = FALSE;
+        }
+    }
+
+    pthread_mutex_unlock(&warm_cb.mutex);
+
+    return warm_cb.resumed;
+}
+
+/*******************************************************************************
+**
+** Function        vnd_set_warm_restart
+**
+** Description     Configure the warm restart inactivity timeout in ms,
+**                 0 disables warm restart
+**
+** Returns         0 : Success
+**                 Otherwise : Fail
+**
+*******************************************************************************/
+int vnd_set_warm_restart(const char *p_conf_name,
+                         const conf_value_t *p_conf_value, int param)
+{
+    pthread_mutex_lock(&warm_cb.mutex);
+    warm_cb.timeout_ms = p_conf_value->num;
+    pthread_mutex_unlock(&warm_cb.mutex);
+
+    return 0;
+}
+
 /*****************************************************************************
 **
 **   BLUETOOTH VENDOR INTERFACE LIBRARY FUNCTIONS
@@ -115,15 +289,30 @@ static int init(const bt_vendor_callbacks_t* p_cb, unsigned char *local_bdaddr)
     ALOGW("*****************************************************************");
 #endif
 
+    if (vnd_loop_init() < 0)
+    {
+        ALOGE("init failed to start vendor event loop!");
+        return -1;
+    }
+
     userial_vendor_init();
     upio_init();
 
-    /* Load first the configuration through properties */
-    vnd_load_prop();
-
-    /* Then the file configuration can overwrite them */
     property_get("ro.bt.conf_file", lib_conf_file, VENDOR_LIB_CONF_FILE);
-    vnd_load_conf(lib_conf_file);
+
+    /* Unless nothing changed since the previous start, load first the
+     * configuration through properties, then the file configuration can
+     * overwrite them */
+    if (vnd_conf_cache_load(lib_conf_file) != 0)
+    {
+        vnd_load_prop();
+        vnd_load_conf(lib_conf_file);
+        vnd_conf_cache_save(lib_conf_file);
+    }
+
+#if (VENDOR_LIB_CONF_LIVE_RELOAD == TRUE)
+    vnd_conf_watch_start(lib_conf_file);
+#endif
 
     /* store reference to user callbacks */
     bt_vendor_cbacks = (bt_vendor_callbacks_t *) p_cb;
@@ -147,16 +336,34 @@ static int op(bt_vendor_opcode_t opcode, void *param)
                 BTVNDDBG("op: BT_VND_OP_POWER_CTRL");
                 int *state = (int *) param;
                 if (*state == BT_VND_PWR_OFF)
-                    upio_set_bluetooth_power(UPIO_BT_POWER_OFF);
+                {
+                    if (warm_restart_hold() == FALSE)
+                        upio_set_bluetooth_power(UPIO_BT_POWER_OFF);
+                }
                 else if (*state == BT_VND_PWR_ON)
-                    upio_set_bluetooth_power(UPIO_BT_POWER_ON);
+                {
+                    if (warm_restart_resume() == TRUE)
+                        ALOGI("warm restart: controller still up");
+                    else
+                    {
+                        /* a port kept for a warm restart that did not
+                         * happen is at the wrong baud rate by now */
+                        userial_vendor_close();
+
+                        if (upio_set_bluetooth_power(UPIO_BT_POWER_ON) == 0)
+                            userial_vendor_power_on();
+                    }
+                }
             }
             break;
 
         case BT_VND_OP_FW_CFG:
             {
                 BTVNDDBG("op: BT_VND_OP_FW_CFG");
-                hw_config_start();
+                if (warm_cb.resumed)
+                    hw_config_warm_start();
+                else
+                    hw_config_start();
             }
             break;
 
@@ -191,7 +398,14 @@ static int op(bt_vendor_opcode_t opcode, void *param)
         case BT_VND_OP_USERIAL_CLOSE:
             {
                 BTVNDDBG("op: BT_VND_OP_USERIAL_CLOSE");
-                userial_vendor_close();
+                uint8_t keep;
+                /* keep the port, termios and baud rate for a warm restart */
+                pthread_mutex_lock(&warm_cb.mutex);
+                keep = (warm_cb.held || warm_restart_eligible()) ? TRUE : FALSE;
+                pthread_mutex_unlock(&warm_cb.mutex);
+
+                if (keep == FALSE)
+                    userial_vendor_close();
             }
             break;
 
@@ -252,11 +466,26 @@ static int op(bt_vendor_opcode_t opcode, void *param)
 /** Closes the interface */
 static void cleanup( void )
 {
+    uint8_t stop_loop;
+
     BTVNDDBG("cleanup");
 
+#if (VENDOR_LIB_CONF_LIVE_RELOAD == TRUE)
+    vnd_conf_watch_stop();
+#endif
     upio_cleanup();
     hw_config_cleanup();
 
+    /* keep the loop for the inactivity timer of a warm restart */
+    pthread_mutex_lock(&warm_cb.mutex);
+    if ((stop_loop = !warm_cb.held) == TRUE)
+        warm_cb.p_timer = NULL;
+    pthread_mutex_unlock(&warm_cb.mutex);
+
+    /* outside the lock, a pending expiry needs it to let the loop exit */
+    if (stop_loop)
+        vnd_loop_cleanup();
+
     bt_vendor_cbacks = NULL;
 }
 
@@ -28,25 +28,36 @@
 #define LOG_TAG "bt_vnd_conf"
 
 #include <utils/Log.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <cutils/properties.h>
 #include "bt_vendor_brcm.h"
+#include "vnd_loop.h"
 
 /******************************************************************************
 **  Externs
 ******************************************************************************/
-int userial_set_port(char *p_conf_name, char *p_conf_value, int param);
-int hw_set_patch_file_path(char *p_conf_name, char *p_conf_value, int param);
-int hw_set_patch_file_name(char *p_conf_name, char *p_conf_value, int param);
-#if (VENDOR_LIB_RUNTIME_TUNING_ENABLED == TRUE)
-int hw_set_patch_settlement_delay(char *p_conf_name, char *p_conf_value, int param);
-#endif
-#if (!defined(SCO_USE_I2S_INTERFACE) || (SCO_USE_I2S_INTERFACE == FALSE))
-int hw_pcm_set_param(char *p_conf_name, char *p_conf_value, int param);
-int hw_pcm_fmt_set_param(char *p_conf_name, char *p_conf_value, int param);
-#else
-int hw_i2s_set_param(char *p_conf_name, char *p_conf_value, int param);
-#endif
+
+/* Action functions of all entries, see vnd_conf_keys.h */
+#define CONF_KEY(name, type, min, max, action, param, live) \
+    conf_action_t action;
+#define CONF_KEY_PROP(name, prop, type, min, max, action, param, live) \
+    conf_action_t action;
+#include "vnd_conf_keys.h"
+#undef CONF_KEY
+#undef CONF_KEY_PROP
+
 /******************************************************************************
 **  Local type definitions
 ******************************************************************************/
@@ -55,49 +66,563 @@ int hw_i2s_set_param(char *p_conf_name, char *p_conf_value, int param);
 #define CONF_DELIMITERS " =\n\r\t"
 #define CONF_VALUES_DELIMITERS "=\n\r\t"
 #define CONF_MAX_LINE_LEN 255
-
-typedef int (conf_action_t)(char *p_conf_name, char *p_conf_value, int param);
+#define CONF_PROP_PREFIX "ro.bt.vnd."
 
 typedef struct {
     const char *conf_entry;
+    const char *prop_name;              /* ro.bt.vnd.<prop_name> */
     conf_action_t *p_action;
     int param;
+    uint8_t type;
+    uint8_t live;                       /* can change with Bluetooth on */
+    uint32_t min;
+    uint32_t max;
 } conf_entry_t;
 
+/* Cache of the resolved configuration, see VENDOR_LIB_CONF_CACHE */
+#define CONF_CACHE_MAGIC        0x43565442  /* "BTVC" */
+#define CONF_CACHE_VERSION      1
+#define CONF_CACHE_MAX_RECORDS  128
+#define CONF_CACHE_POOL_LEN     4096
+#define CONF_BOOT_ID_PATH       "/proc/sys/kernel/random/boot_id"
+
+/* What the cached configuration was resolved from */
+typedef struct {
+    char boot_id[40];                   /* ro properties are per boot */
+    char conf_path[PROPERTY_VALUE_MAX];
+    int64_t conf_mtime;
+    int64_t conf_size;                  /* -1 if there was no conf file */
+    uint64_t conf_ino;
+} conf_cache_key_t;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;                     /* records following the header */
+    uint32_t table_sig;                 /* conf_table the indexes refer to */
+    uint32_t pool_len;                  /* value strings following records */
+    uint32_t checksum;                  /* of the records and strings */
+    conf_cache_key_t key;
+} conf_cache_hdr_t;
+
+/* One successful action, in the order it was taken */
+typedef struct {
+    uint16_t index;                     /* in conf_table */
+    uint16_t str_off;                   /* of the value in the string pool */
+    uint32_t num;
+} conf_cache_rec_t;
+
+typedef struct {
+    uint8_t recording;
+    uint8_t overflow;
+    uint16_t count;
+    uint32_t pool_len;
+    conf_cache_rec_t rec[CONF_CACHE_MAX_RECORDS];
+    char pool[CONF_CACHE_POOL_LEN];
+} conf_cache_cb_t;
+
+#if (VENDOR_LIB_CONF_LIVE_RELOAD == TRUE)
+/* Delay from the last change of the conf file to its reload, so that an
+ * editor is done writing it */
+#define CONF_RELOAD_DELAY_MS    200
+
+typedef struct {
+    int fd;                             /* inotify, -1 if not watching */
+    vnd_loop_timer_t *p_timer;          /* reload delay */
+    char path[PROPERTY_VALUE_MAX];
+    const char *p_name;                 /* file name part of path */
+} conf_watch_cb_t;
+#endif
+
 /******************************************************************************
 **  Static variables
 ******************************************************************************/
 
 /*
- * Current supported entries and corresponding action functions
+ * Current supported entries and corresponding action functions, generated
+ * from vnd_conf_keys.h in name order
  */
 static const conf_entry_t conf_table[] = {
-    {"UartPort", userial_set_port, 0},
-    {"FwPatchFilePath", hw_set_patch_file_path, 0},
-    {"FwPatchFileName", hw_set_patch_file_name, 0},
-#if (VENDOR_LIB_RUNTIME_TUNING_ENABLED == TRUE)
-    {"FwPatchSettlementDelay", hw_set_patch_settlement_delay, 0},
+#define CONF_KEY(name, type, min, max, action, param, live) \
+    {#name, #name, action, param, CONF_TYPE_##type, live, min, max},
+#define CONF_KEY_PROP(name, prop, type, min, max, action, param, live) \
+    {#name, #prop, action, param, CONF_TYPE_##type, live, min, max},
+#include "vnd_conf_keys.h"
+#undef CONF_KEY
+#undef CONF_KEY_PROP
+};
+
+/* Every property name must fit PROPERTY_KEY_MAX, the terminator included,
+ * or property_set() rejects it: give a long name a CONF_KEY_PROP */
+#define CONF_KEY(name, type, min, max, action, param, live) \
+    typedef char conf_prop_fits_##name[ \
+        (sizeof(CONF_PROP_PREFIX #name) <= PROPERTY_KEY_MAX) ? 1 : -1];
+#define CONF_KEY_PROP(name, prop, type, min, max, action, param, live) \
+    typedef char conf_prop_fits_##name[ \
+        (sizeof(CONF_PROP_PREFIX #prop) <= PROPERTY_KEY_MAX) ? 1 : -1];
+#include "vnd_conf_keys.h"
+#undef CONF_KEY
+#undef CONF_KEY_PROP
+
+#define CONF_TABLE_SIZE (sizeof(conf_table) / sizeof(conf_table[0]))
+
+static pthread_once_t conf_table_once = PTHREAD_ONCE_INIT;
+static uint8_t conf_table_sorted;
+static uint32_t conf_table_sig;
+
+static conf_cache_cb_t conf_cache_cb;
+
+/* Hash of the value each entry was last set to, 0 if never set */
+static uint32_t conf_value_sig[CONF_TABLE_SIZE];
+
+#if (VENDOR_LIB_CONF_LIVE_RELOAD == TRUE)
+static conf_watch_cb_t conf_watch_cb = { .fd = -1 };
 #endif
-#if (!defined(SCO_USE_I2S_INTERFACE) || (SCO_USE_I2S_INTERFACE == FALSE))
-    {"SCO_PCM_ROUTING", hw_pcm_set_param, 0},
-    {"SCO_PCM_IF_CLOCK_RATE", hw_pcm_set_param, 0},
-    {"SCO_PCM_IF_FRAME_TYPE", hw_pcm_set_param, 0},
-    {"SCO_PCM_IF_SYNC_MODE", hw_pcm_set_param, 1},
-    {"SCO_PCM_IF_CLOCK_MODE", hw_pcm_set_param, 1},
-
-    {"PCM_DATA_FMT_SHIFT_MODE", hw_pcm_fmt_set_param, 0},
-    {"PCM_DATA_FMT_FILL_BITS", hw_pcm_fmt_set_param, 0},
-    {"PCM_DATA_FMT_FILL_METHOD", hw_pcm_fmt_set_param, 0},
-    {"PCM_DATA_FMT_FILL_NUM", hw_pcm_fmt_set_param, 3},
-    {"PCM_DATA_FMT_JUSTIFY_MODE", hw_pcm_fmt_set_param, 0},
-#else
-    {"SCO_I2SPCM_IF_MODE", hw_i2s_set_param, 1},
-    {"SCO_I2SPCM_IF_ROLE", hw_i2s_set_param, 1},
-    {"SCO_I2SPCM_IF_SAMPLE_RATE", hw_i2s_set_param, 0},
-    {"SCO_I2SPCM_IF_CLOCK_RATE", hw_i2s_set_param, 1},
+
+/*****************************************************************************
+**   Helper Functions
+*****************************************************************************/
+
+/*******************************************************************************
+**
+** Function        conf_hash
+**
+** Description     FNV-1a hash of len bytes, continued from h
+**
+** Returns         Hash
+**
+*******************************************************************************/
+static uint32_t conf_hash(uint32_t h, const void *p_data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *) p_data;
+
+    while (len--)
+        h = (h ^ *p++) * 16777619;
+
+    return h;
+}
+
+/*******************************************************************************
+**
+** Function        conf_value_hash
+**
+** Description     Hash of a value as written, never 0
+**
+** Returns         Hash
+**
+*******************************************************************************/
+static uint32_t conf_value_hash(const char *p_str)
+{
+    return conf_hash(2166136261U, p_str, strlen(p_str)) | 1;
+}
+
+/*******************************************************************************
+**
+** Function        conf_table_check
+**
+** Description     Verify once that conf_table is in name order, as bisection
+**                 relies on it. A misplaced entry in vnd_conf_keys.h is
+**                 reported and lookups fall back to a linear search.
+**                 Also fingerprint the table for the cache.
+**
+** Returns         None
+**
+*******************************************************************************/
+static void conf_table_check(void)
+{
+    unsigned i;
+
+    conf_table_sorted = TRUE;
+    conf_table_sig = 2166136261U;
+
+    for (i = 0; i < CONF_TABLE_SIZE; i++)
+    {
+        conf_table_sig = conf_hash(conf_table_sig, conf_table[i].conf_entry, \
+                                   strlen(conf_table[i].conf_entry) + 1);
+        conf_table_sig = conf_hash(conf_table_sig, &conf_table[i].type, 1);
+
+        if (i == 0)
+            continue;
+
+        if (strcmp(conf_table[i-1].conf_entry, conf_table[i].conf_entry) >= 0)
+        {
+            ALOGE("conf_table: %s out of order in vnd_conf_keys.h", \
+                  conf_table[i].conf_entry);
+            conf_table_sorted = FALSE;
+        }
+    }
+}
+
+/*******************************************************************************
+**
+** Function        conf_entry_cmp
+**
+** Description     bsearch() comparator of a name with a conf_table entry
+**
+** Returns         <0, 0 or >0 as strcmp()
+**
+*******************************************************************************/
+static int conf_entry_cmp(const void *p_name, const void *p_entry)
+{
+    return strcmp((const char *) p_name, \
+                  ((const conf_entry_t *) p_entry)->conf_entry);
+}
+
+/*******************************************************************************
+**
+** Function        conf_lookup
+**
+** Description     Find the conf_table entry of a name
+**
+** Returns         Entry, NULL if the name is not supported
+**
+*******************************************************************************/
+static const conf_entry_t *conf_lookup(const char *p_name)
+{
+    unsigned i;
+
+    pthread_once(&conf_table_once, conf_table_check);
+
+    if (conf_table_sorted == TRUE)
+        return bsearch(p_name, conf_table, CONF_TABLE_SIZE, \
+                       sizeof(conf_entry_t), conf_entry_cmp);
+
+    for (i = 0; i < CONF_TABLE_SIZE; i++)
+    {
+        if (strcmp(conf_table[i].conf_entry, p_name) == 0)
+            return &conf_table[i];
+    }
+
+    return NULL;
+}
+
+/*******************************************************************************
+**
+** Function        conf_lookup_prop
+**
+** Description     Find the conf_table entry of a ro.bt.vnd.* property name,
+**                 which is the entry name or its shorter property name
+**
+** Returns         Entry, NULL if the name is not supported
+**
+*******************************************************************************/
+static const conf_entry_t *conf_lookup_prop(const char *p_name)
+{
+    const conf_entry_t *p_entry;
+    unsigned i;
+
+    if ((p_entry = conf_lookup(p_name)) != NULL)
+        return p_entry;
+
+    for (i = 0; i < CONF_TABLE_SIZE; i++)
+    {
+        if (strcmp(conf_table[i].prop_name, p_name) == 0)
+            return &conf_table[i];
+    }
+
+    return NULL;
+}
+
+/*******************************************************************************
+**
+** Function        conf_parse
+**
+** Description     Parse a value as the type of its entry and check it
+**                 against the range of the entry
+**
+** Returns         0 : Success
+**                 Otherwise : Fail
+**
+*******************************************************************************/
+static int conf_parse(const conf_entry_t *p_entry, const char *p_str, \
+                      conf_value_t *p_value)
+{
+    char *p_end;
+    unsigned long num;
+
+    p_value->p_str = p_str;
+    p_value->num = 0;
+
+    switch (p_entry->type)
+    {
+        case CONF_TYPE_STR:
+            return 0;
+
+        case CONF_TYPE_BOOL:
+            if ((strcmp(p_str, "1") == 0) || (strcasecmp(p_str, "true") == 0))
+                p_value->num = TRUE;
+            else if ((strcmp(p_str, "0") != 0) && \
+                     (strcasecmp(p_str, "false") != 0))
+                break;
+            return 0;
+
+        default:
+            /* strtoul would take a sign */
+            if ((*p_str < '0') || (*p_str > '9'))
+                break;
+
+            errno = 0;
+            num = strtoul(p_str, &p_end, 0);
+
+            if ((p_entry->type == CONF_TYPE_MS) && (strcmp(p_end, "ms") == 0))
+                p_end += 2;
+
+            if ((errno != 0) || (*p_end != '\0') || \
+                (num < p_entry->min) || (num > p_entry->max))
+                break;
+
+            p_value->num = (uint32_t) num;
+            return 0;
+    }
+
+    ALOGE("invalid value \"%s\" for %s", p_str, p_entry->conf_entry);
+    return -EINVAL;
+}
+
+/*******************************************************************************
+**
+** Function        conf_cache_record
+**
+** Description     Append an action taken to the cache being built
+**
+** Returns         None
+**
+*******************************************************************************/
+static void conf_cache_record(const conf_entry_t *p_entry, \
+                              const conf_value_t *p_value)
+{
+    conf_cache_cb_t *p_cb = &conf_cache_cb;
+    size_t len = strlen(p_value->p_str) + 1;
+    conf_cache_rec_t *p_rec;
+
+    if ((p_cb->count == CONF_CACHE_MAX_RECORDS) || \
+        (p_cb->pool_len + len > CONF_CACHE_POOL_LEN))
+    {
+        p_cb->overflow = TRUE;
+        return;
+    }
+
+    p_rec = &p_cb->rec[p_cb->count++];
+    p_rec->index = (uint16_t) (p_entry - conf_table);
+    p_rec->str_off = (uint16_t) p_cb->pool_len;
+    p_rec->num = p_value->num;
+    memcpy(p_cb->pool + p_cb->pool_len, p_value->p_str, len);
+    p_cb->pool_len += len;
+}
+
+/*******************************************************************************
+**
+** Function        conf_cache_key
+**
+** Description     Describe the sources the configuration is resolved from:
+**                 the boot, as ro.bt.vnd.* properties cannot change within
+**                 one, and the conf file
+**
+** Returns         0 : Success
+**                 Otherwise : no boot id, the cache cannot be used
+**
+*******************************************************************************/
+static int conf_cache_key(const char *p_path, conf_cache_key_t *p_key)
+{
+    struct stat st;
+    ssize_t len;
+    int fd;
+
+    memset(p_key, 0, sizeof(*p_key));
+
+    if ((fd = open(CONF_BOOT_ID_PATH, O_RDONLY)) < 0)
+        return -1;
+
+    len = read(fd, p_key->boot_id, sizeof(p_key->boot_id) - 1);
+    close(fd);
+
+    if (len <= 0)
+        return -1;
+
+    snprintf(p_key->conf_path, sizeof(p_key->conf_path), "%s", p_path);
+
+    if (stat(p_path, &st) == 0)
+    {
+        p_key->conf_mtime = (int64_t) st.st_mtime;
+        p_key->conf_size = (int64_t) st.st_size;
+        p_key->conf_ino = (uint64_t) st.st_ino;
+    }
+    else
+    {
+        p_key->conf_size = -1;
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+**
+** Function        conf_apply
+**
+** Description     Parse the value of an entry and call its action function
+**
+** Returns         0 : Success
+**                 Otherwise : Fail
+**
+*******************************************************************************/
+static int conf_apply(const conf_entry_t *p_entry, const char *p_str)
+{
+    conf_value_t value;
+    int ret;
+
+    if (conf_parse(p_entry, p_str, &value) != 0)
+        return -EINVAL;
+
+    ret = p_entry->p_action(p_entry->conf_entry, &value, p_entry->param);
+
+    if (ret == 0)
+        conf_value_sig[p_entry - conf_table] = conf_value_hash(p_str);
+
+    if ((ret == 0) && (conf_cache_cb.recording == TRUE))
+        conf_cache_record(p_entry, &value);
+
+    return ret;
+}
+
+/*******************************************************************************
+**
+** Function        conf_reload_entry
+**
+** Description     Apply an entry of a reloaded conf file if its value
+**                 changed and it can change with Bluetooth on. Otherwise
+**                 the change is left to the next Bluetooth start.
+**
+** Returns         None
+**
+*******************************************************************************/
+static void conf_reload_entry(const conf_entry_t *p_entry, const char *p_str)
+{
+    uint32_t sig = conf_value_hash(p_str);
+    uint32_t *p_sig = &conf_value_sig[p_entry - conf_table];
+
+    if (*p_sig == sig)
+        return;
+
+    if (p_entry->live == FALSE)
+    {
+        ALOGW("%s changed to %s, rejected: takes a Bluetooth restart", \
+              p_entry->conf_entry, p_str);
+        /* reported once per value */
+        *p_sig = sig;
+        return;
+    }
+
+    if (conf_apply(p_entry, p_str) == 0)
+        ALOGI("%s reloaded as %s", p_entry->conf_entry, p_str);
+}
+
+/*******************************************************************************
+**
+** Function        conf_load_file
+**
+** Description     Read conf entry from p_path file one by one and apply
+**                 them, or only the ones changed if reloading
+**
+** Returns         0 : Success
+**                 Otherwise : file not found
+**
+*******************************************************************************/
+static int conf_load_file(const char *p_path, uint8_t reload)
+{
+    FILE    *p_file;
+    char    *p_name;
+    char    *p_value;
+    char    *p_save;
+    const conf_entry_t *p_entry;
+    char    line[CONF_MAX_LINE_LEN+1]; /* add 1 for \0 char */
+
+    if ((p_file = fopen(p_path, "r")) == NULL)
+        return -1;
+
+    /* read line by line */
+    while (fgets(line, CONF_MAX_LINE_LEN+1, p_file) != NULL)
+    {
+        if (line[0] == CONF_COMMENT)
+            continue;
+
+        p_name = strtok_r(line, CONF_DELIMITERS, &p_save);
+
+        if (NULL == p_name)
+        {
+            continue;
+        }
+
+        p_value = strtok_r(NULL, CONF_DELIMITERS, &p_save);
+
+        if (NULL == p_value)
+        {
+            ALOGW("vnd_load_conf: missing value for name: %s", p_name);
+            continue;
+        }
+
+        if ((p_entry = conf_lookup(p_name)) == NULL)
+            continue;
+
+        if (reload == TRUE)
+            conf_reload_entry(p_entry, p_value);
+        else
+            conf_apply(p_entry, p_value);
+    }
+
+    fclose(p_file);
+    return 0;
+}
+
+#if (VENDOR_LIB_CONF_LIVE_RELOAD == TRUE)
+/*******************************************************************************
+**
+** Function        conf_watch_reload
+**
+** Description     Reload timer callback, in the vendor loop thread
+**
+** Returns         None
+**
+*******************************************************************************/
+static void conf_watch_reload(void *p_data)
+{
+    ALOGI("%s changed, reloading", conf_watch_cb.path);
+
+    if (conf_load_file(conf_watch_cb.path, TRUE) != 0)
+        ALOGW("cannot reload %s", conf_watch_cb.path);
+}
+
+/*******************************************************************************
+**
+** Function        conf_watch_event
+**
+** Description     inotify events of the conf file directory, in the vendor
+**                 loop thread. A write or a rename over the conf file
+**                 (re)arms the reload timer.
+**
+** Returns         None
+**
+*******************************************************************************/
+static void conf_watch_event(int fd, uint32_t events, void *p_data)
+{
+    char buf[sizeof(struct inotify_event) + NAME_MAX + 1] \
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *p_ev;
+    ssize_t len, off;
+
+    while ((len = read(fd, buf, sizeof(buf))) > 0)
+    {
+        for (off = 0; off < len; off += sizeof(*p_ev) + p_ev->len)
+        {
+            p_ev = (const struct inotify_event *) (buf + off);
+
+            if ((p_ev->len > 0) && \
+                (strcmp(p_ev->name, conf_watch_cb.p_name) == 0))
+                vnd_loop_timer_start(conf_watch_cb.p_timer, \
+                                     CONF_RELOAD_DELAY_MS, 0);
+        }
+    }
+}
 #endif
-    {(const char *) NULL, NULL, 0}
-};
 
 /*****************************************************************************
 **   CONF INTERFACE FUNCTIONS
@@ -115,12 +640,6 @@ static const conf_entry_t conf_table[] = {
 *******************************************************************************/
 void vnd_load_conf(const char *p_path)
 {
-    FILE    *p_file;
-    char    *p_name;
-    char    *p_value;
-    conf_entry_t    *p_entry;
-    char    line[CONF_MAX_LINE_LEN+1]; /* add 1 for \0 char */
-
     ALOGI("Attempt to load conf from %s", p_path);
 
 #if (!defined(SCO_USE_I2S_INTERFACE) || (SCO_USE_I2S_INTERFACE == FALSE))
@@ -129,81 +648,306 @@ void vnd_load_conf(const char *p_path)
     ALOGI("I2S define");
 #endif
 
-    if ((p_file = fopen(p_path, "r")) != NULL)
+    if (conf_load_file(p_path, FALSE) != 0)
     {
-        /* read line by line */
-        while (fgets(line, CONF_MAX_LINE_LEN+1, p_file) != NULL)
-        {
-            if (line[0] == CONF_COMMENT)
-                continue;
+        ALOGI( "vnd_load_conf file >%s< not found", p_path);
+    }
+}
+
+/*******************************************************************************
+**
+** Function        vnd_load_prop_cback
+**
+** Description     property_list callback, applying the ro.bt.vnd.* ones
+**
+** Returns         None
+**
+*******************************************************************************/
+static void vnd_load_prop_cback(const char *p_key, const char *p_value, \
+                                void *p_cookie)
+{
+    const conf_entry_t *p_entry;
+
+    if ((strncmp(p_key, CONF_PROP_PREFIX, sizeof(CONF_PROP_PREFIX) - 1) != 0) \
+        || (p_value[0] == '\0'))
+        return;
+
+    if ((p_entry = conf_lookup_prop(p_key + sizeof(CONF_PROP_PREFIX) - 1)) \
+        == NULL)
+    {
+        ALOGW("vnd_load_prop: unsupported property %s", p_key);
+        return;
+    }
+
+    if (conf_apply(p_entry, p_value) == 0)
+        ALOGI("%s set to %s through property", p_entry->conf_entry, p_value);
+}
+
+/*******************************************************************************
+**
+** Function        vnd_load_prop
+**
+** Description     Read conf entry from android system properties and call
+**                 the corresponding config function. The properties are
+**                 enumerated once, so only the ones set cost a lookup.
+**
+** Returns         None
+**
+*******************************************************************************/
+void vnd_load_prop()
+{
+    property_list(vnd_load_prop_cback, NULL);
+}
 
-            p_name = strtok(line, CONF_DELIMITERS);
+/*******************************************************************************
+**
+** Function        vnd_conf_cache_load
+**
+** Description     Apply the cached configuration resolved from the
+**                 properties and p_path, if neither changed since it was
+**                 saved. Otherwise start recording the actions taken by
+**                 vnd_load_prop and vnd_load_conf for vnd_conf_cache_save.
+**
+** Returns         0 : configuration applied from the cache
+**                 Otherwise : to be loaded and saved
+**
+*******************************************************************************/
+int vnd_conf_cache_load(const char *p_path)
+{
+    conf_cache_key_t key;
+    const conf_cache_hdr_t *p_hdr;
+    const conf_cache_rec_t *p_rec;
+    const char *p_pool;
+    conf_value_t value;
+    struct stat st;
+    void *p_map;
+    size_t size;
+    uint16_t i;
+    int fd;
+    int ret = -1;
 
-            if (NULL == p_name)
-            {
-                continue;
-            }
+    memset(&conf_cache_cb, 0, sizeof(conf_cache_cb));
+    conf_cache_cb.recording = TRUE;
 
-            p_value = strtok(NULL, CONF_DELIMITERS);
+    pthread_once(&conf_table_once, conf_table_check);
 
-            if (NULL == p_value)
-            {
-                ALOGW("vnd_load_conf: missing value for name: %s", p_name);
-                continue;
-            }
+    if ((VENDOR_LIB_CONF_CACHE[0] == '\0') || (conf_cache_key(p_path, &key) != 0))
+        return -1;
 
-            p_entry = (conf_entry_t *)conf_table;
+    if ((fd = open(VENDOR_LIB_CONF_CACHE, O_RDONLY)) < 0)
+        return -1;
 
-            while (p_entry->conf_entry != NULL)
-            {
-                if (strcmp(p_entry->conf_entry, (const char *)p_name) == 0)
-                {
-                    p_entry->p_action(p_name, p_value, p_entry->param);
-                    break;
-                }
+    if ((fstat(fd, &st) != 0) || (st.st_size < (off_t) sizeof(*p_hdr)))
+    {
+        close(fd);
+        return -1;
+    }
 
-                p_entry++;
-            }
-        }
+    size = (size_t) st.st_size;
+    p_map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (p_map == MAP_FAILED)
+        return -1;
+
+    p_hdr = (const conf_cache_hdr_t *) p_map;
+    p_rec = (const conf_cache_rec_t *) (p_hdr + 1);
+    p_pool = (const char *) (p_rec + p_hdr->count);
+
+    if ((p_hdr->magic != CONF_CACHE_MAGIC) || \
+        (p_hdr->version != CONF_CACHE_VERSION) || \
+        (p_hdr->table_sig != conf_table_sig) || \
+        (memcmp(&p_hdr->key, &key, sizeof(key)) != 0))
+        goto done;
+
+    if ((size != sizeof(*p_hdr) + p_hdr->count * sizeof(*p_rec) + \
+                 p_hdr->pool_len) || \
+        ((p_hdr->pool_len > 0) && (p_pool[p_hdr->pool_len - 1] != '\0')) || \
+        (conf_hash(2166136261U, p_rec, size - sizeof(*p_hdr)) != \
+         p_hdr->checksum))
+    {
+        ALOGW("vnd_conf_cache_load: %s corrupted", VENDOR_LIB_CONF_CACHE);
+        goto done;
+    }
 
-        fclose(p_file);
+    for (i = 0; i < p_hdr->count; i++)
+    {
+        if ((p_rec[i].index >= CONF_TABLE_SIZE) || \
+            (p_rec[i].str_off >= p_hdr->pool_len))
+            goto done;
     }
-    else
+
+    for (i = 0; i < p_hdr->count; i++)
     {
-        ALOGI( "vnd_load_conf file >%s< not found", p_path);
+        const conf_entry_t *p_entry = &conf_table[p_rec[i].index];
+
+        value.p_str = p_pool + p_rec[i].str_off;
+        value.num = p_rec[i].num;
+        p_entry->p_action(p_entry->conf_entry, &value, p_entry->param);
+        conf_value_sig[p_rec[i].index] = conf_value_hash(value.p_str);
     }
+
+    ALOGI("conf loaded from %s, %u entries", VENDOR_LIB_CONF_CACHE, \
+          p_hdr->count);
+    conf_cache_cb.recording = FALSE;
+    ret = 0;
+
+done:
+    munmap(p_map, size);
+    return ret;
 }
 
 /*******************************************************************************
 **
-** Function        vnd_load_prop
+** Function        vnd_conf_cache_save
 **
-** Description     Read conf entry from android system properties and call
-**                 the corresponding config function
+** Description     Save the actions recorded since vnd_conf_cache_load as
+**                 the cached configuration of p_path
 **
 ** Returns         None
 **
 *******************************************************************************/
-void vnd_load_prop()
+void vnd_conf_cache_save(const char *p_path)
 {
-    char     prop_key[PROPERTY_KEY_MAX];
-    char     prop_value[PROPERTY_VALUE_MAX];
-    conf_entry_t    *p_entry;
+    conf_cache_cb_t *p_cb = &conf_cache_cb;
+    char tmp_path[sizeof(VENDOR_LIB_CONF_CACHE) + 4];
+    conf_cache_hdr_t hdr;
+    size_t rec_len;
+    uint8_t ok;
+    int fd;
+
+    if (p_cb->recording == FALSE)
+        return;
 
-    p_entry = (conf_entry_t *)conf_table;
+    p_cb->recording = FALSE;
 
-    while (p_entry->conf_entry != NULL)
+    if (p_cb->overflow == TRUE)
     {
-        const char *prefix = "ro.bt.vnd.";
-        strcpy(prop_key, prefix);
-        strncat(prop_key, p_entry->conf_entry, PROPERTY_KEY_MAX - 1 - strlen(prefix));
-        //check that property value is not empty
-        if (property_get(prop_key, prop_value, NULL) > 0) {
-            p_entry->p_action((char *)p_entry->conf_entry, prop_value,
-                                                           p_entry->param);
-            ALOGI("%s set to %s through property", p_entry->conf_entry,
-                                                   prop_value);
-        }
-        p_entry++;
+        ALOGW("vnd_conf_cache_save: too many entries to cache");
+        return;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+
+    if ((VENDOR_LIB_CONF_CACHE[0] == '\0') || \
+        (conf_cache_key(p_path, &hdr.key) != 0))
+        return;
+
+    rec_len = p_cb->count * sizeof(conf_cache_rec_t);
+    hdr.magic = CONF_CACHE_MAGIC;
+    hdr.version = CONF_CACHE_VERSION;
+    hdr.count = p_cb->count;
+    hdr.table_sig = conf_table_sig;
+    hdr.pool_len = p_cb->pool_len;
+    hdr.checksum = conf_hash(conf_hash(2166136261U, p_cb->rec, rec_len), \
+                             p_cb->pool, p_cb->pool_len);
+
+    /* Written aside then renamed, a reader never sees a partial cache */
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", VENDOR_LIB_CONF_CACHE);
+
+    if ((fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0)
+    {
+        ALOGW("vnd_conf_cache_save: cannot create %s (%s)", tmp_path, \
+              strerror(errno));
+        return;
+    }
+
+    ok = ((write(fd, &hdr, sizeof(hdr)) == (ssize_t) sizeof(hdr)) && \
+          (write(fd, p_cb->rec, rec_len) == (ssize_t) rec_len) && \
+          (write(fd, p_cb->pool, p_cb->pool_len) == (ssize_t) p_cb->pool_len));
+    close(fd);
+
+    if ((ok == FALSE) || (rename(tmp_path, VENDOR_LIB_CONF_CACHE) != 0))
+    {
+        ALOGW("vnd_conf_cache_save: cannot write %s", VENDOR_LIB_CONF_CACHE);
+        unlink(tmp_path);
+    }
+}
+
+#if (VENDOR_LIB_CONF_LIVE_RELOAD == TRUE)
+/*******************************************************************************
+**
+** Function        vnd_conf_watch_stop
+**
+** Description     Stop watching the conf file
+**
+** Returns         None
+**
+*******************************************************************************/
+void vnd_conf_watch_stop(void)
+{
+    conf_watch_cb_t *p_cb = &conf_watch_cb;
+
+    if (p_cb->fd < 0)
+        return;
+
+    vnd_loop_remove_fd(p_cb->fd);
+
+    if (p_cb->p_timer != NULL)
+    {
+        vnd_loop_timer_free(p_cb->p_timer);
+        p_cb->p_timer = NULL;
+    }
+
+    close(p_cb->fd);
+    p_cb->fd = -1;
+}
+
+/*******************************************************************************
+**
+** Function        vnd_conf_watch_start
+**
+** Description     Watch p_path for changes, serviced by the vendor loop.
+**                 The directory is watched as editors often replace files.
+**
+** Returns         None
+**
+*******************************************************************************/
+void vnd_conf_watch_start(const char *p_path)
+{
+    conf_watch_cb_t *p_cb = &conf_watch_cb;
+    char dir[PROPERTY_VALUE_MAX];
+    char *p_slash;
+
+    if (p_cb->fd >= 0)
+        return;
+
+    snprintf(p_cb->path, sizeof(p_cb->path), "%s", p_path);
+    snprintf(dir, sizeof(dir), "%s", p_path);
+
+    if ((p_slash = strrchr(dir, '/')) != NULL)
+    {
+        p_cb->p_name = p_cb->path + (p_slash - dir) + 1;
+        *p_slash = '\0';
+        if (dir[0] == '\0')
+            strcpy(dir, "/");
     }
+    else
+    {
+        p_cb->p_name = p_cb->path;
+        strcpy(dir, ".");
+    }
+
+    if ((p_cb->fd = inotify_init()) < 0)
+    {
+        ALOGE("vnd_conf_watch_start: inotify_init failed (%s)", \
+              strerror(errno));
+        return;
+    }
+
+    fcntl(p_cb->fd, F_SETFL, fcntl(p_cb->fd, F_GETFL) | O_NONBLOCK);
+    fcntl(p_cb->fd, F_SETFD, FD_CLOEXEC);
+
+    if ((inotify_add_watch(p_cb->fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) \
+        || ((p_cb->p_timer = vnd_loop_timer_new(conf_watch_reload, NULL)) \
+            == NULL) || \
+        (vnd_loop_add_fd(p_cb->fd, EPOLLIN, conf_watch_event, NULL) < 0))
+    {
+        ALOGE("vnd_conf_watch_start: cannot watch %s", dir);
+        vnd_conf_watch_stop();
+        return;
+    }
+
+    ALOGI("watching %s for changes", p_cb->path);
 }
+#endif
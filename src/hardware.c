@@ -41,11 +41,13 @@
 #include <cutils/properties.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <stddef.h>
 #include "bt_hci_bdroid.h"
 #include "bt_vendor_brcm.h"
 #include "userial.h"
 #include "userial_vendor.h"
 #include "upio.h"
+#include "vnd_loop.h"
 
 #include <lct.h>
 
@@ -96,6 +98,11 @@
 #define HCD_REC_PAYLOAD_LEN_BYTE                2
 #define BD_ADDR_LEN                             6
 #define LOCAL_NAME_BUFFER_LEN                   32
+
+/* Largest firmware patch kept in memory */
+#ifndef FW_PATCH_CACHE_MAX_SIZE
+#define FW_PATCH_CACHE_MAX_SIZE                 (512 * 1024)
+#endif
 #define LOCAL_BDADDR_PATH_BUFFER_LEN            256
 
 #define HCI_READ_LOCAL_VERSION_INFORMATION      0x1001
@@ -105,6 +112,48 @@
 #define UINT16_TO_STREAM(p, u16) {*(p)++ = (uint8_t)(u16); *(p)++ = (uint8_t)((u16) >> 8);}
 #define UINT32_TO_STREAM(p, u32) {*(p)++ = (uint8_t)(u32); *(p)++ = (uint8_t)((u32) >> 8); *(p)++ = (uint8_t)((u32) >> 16); *(p)++ = (uint8_t)((u32) >> 24);}
 
+/* Vendor commands waiting behind the one in flight */
+#ifndef HW_OP_QUEUE_SIZE
+#define HW_OP_QUEUE_SIZE                8
+#endif
+
+/* Host idle timeout of the idle class, also the timeout given to the stack */
+#ifndef LPM_POLICY_IDLE_TIMEOUT_MS
+#define LPM_POLICY_IDLE_TIMEOUT_MS      500
+#endif
+
+/* Average gap between BT_WAKE requests above which the link is idle */
+#ifndef LPM_POLICY_IDLE_GAP_MS
+#define LPM_POLICY_IDLE_GAP_MS          2000
+#endif
+
+/* Longest average gap still handled as a periodic link */
+#ifndef LPM_POLICY_PERIODIC_MAX_MS
+#define LPM_POLICY_PERIODIC_MAX_MS      1000
+#endif
+
+/* BT_WAKE requests are counted over windows of this length, each window
+   with traffic giving one gap sample */
+#ifndef LPM_POLICY_WINDOW_MS
+#define LPM_POLICY_WINDOW_MS            100
+#endif
+
+/* Consecutive samples a new class must hold before it is applied */
+#ifndef LPM_POLICY_DWELL
+#define LPM_POLICY_DWELL                8
+#endif
+
+/* Minimum time between two HCI_VSC_WRITE_SLEEP_MODE re-issues */
+#ifndef LPM_POLICY_MIN_REISSUE_MS
+#define LPM_POLICY_MIN_REISSUE_MS       10000
+#endif
+
+/* Gap samples are capped so that one long pause does not dominate */
+#define LPM_POLICY_GAP_CAP_MS           10000
+
+/* EWMA weight of a new gap sample, as a power of two */
+#define LPM_POLICY_EWMA_SHIFT           3
+
 /******************************************************************************
 **  Local type definitions
 ******************************************************************************/
@@ -130,25 +179,104 @@ enum {
 typedef struct
 {
     uint8_t state;                          /* Hardware configuration state */
-    int     fw_fd;                          /* FW patch file fd */
+    uint8_t fw_patch;                       /* FW patch image to download */
+    uint16_t fw_rec;                        /* Next FW patch record */
     uint8_t f_set_baud_2;                   /* Baud rate switch state */
+    uint8_t warm;                           /* Controller already patched */
+    uint8_t recover;                        /* Identity and patch cached */
+    uint8_t hw_error;                       /* Failed after identification */
+    uint8_t complete;                       /* Last fwcfg succeeded */
+    const char *p_mode;                     /* warm, recovery or cold */
+    uint32_t start_ms;                      /* Time fwcfg started */
+    int ready_ms;                           /* Power on to ready, -1 unknown */
     char    local_chip_name[LOCAL_NAME_BUFFER_LEN];
 } bt_hw_cfg_cb_t;
 
-/* Hardware SCO Configuration State */
-enum hw_sco_state {
-    HW_SCO_PCM,
-    HW_SCO_PCM_FORMAT,
-    HW_SCO_I2S
+/*
+ * The firmware patch is read and split into HCD records once, and kept for
+ * the life of the process along with the controller name it was found for,
+ * as long as the configured patch location and the file do not change.
+ * The configuration following a controller failure, e.g. a Hardware Error
+ * while it was being configured, also skips the local name read.
+ */
+typedef struct
+{
+    char     chip_name[LOCAL_NAME_BUFFER_LEN];  /* Controller identity */
+    char     conf_path[256];                    /* fw_patchfile_path and */
+    char     conf_name[128];                    /* _name it was found with */
+    char     path[FW_PATCHFILE_PATH_MAXLEN];
+    off_t    size;
+    time_t   mtime;
+    uint8_t  *p_image;                          /* Whole .hcd file */
+    uint32_t *p_rec;                            /* Offset of each record */
+    uint16_t rec_count;
+} hw_patch_cache_t;
+
+/* Hardware SCO Configuration VSCs */
+enum {
+    HW_SCO_VSC_MSBC,
+    HW_SCO_VSC_PCM,
+    HW_SCO_VSC_PCM_FORMAT,
+    HW_SCO_VSC_I2S,
+    HW_SCO_VSC_MAX
 };
 
-/* Hardware Codec Configuration State */
-enum hw_wbs_state {
-    HW_WBS_CODEC,
-    HW_WBS_PCM,
-    HW_WBS_I2S
+/* Largest parameter block of the SCO configuration VSCs */
+#define HW_SCO_PARAM_MAX    8
+
+/* Parameters of the SCO configuration VSCs, 0 length if none/unknown */
+typedef struct
+{
+    uint8_t param[HW_SCO_VSC_MAX][HW_SCO_PARAM_MAX];
+    uint8_t len[HW_SCO_VSC_MAX];
+} hw_sco_params_t;
+
+/* Hardware SCO Configuration control block */
+typedef struct
+{
+    pthread_mutex_t mutex;              /* Guards in_flight and status */
+    hw_sco_params_t codec[2];           /* Narrowband, wideband (mSBC) */
+    uint8_t stale;                      /* codec[] to rebuild from config */
+    uint8_t msbc;                       /* Codec in use, index of codec[] */
+#if (SCO_USE_I2S_INTERFACE == TRUE)
+    uint8_t i2s_resample;               /* I2S fixed at 16K for both codecs */
+#endif
+    hw_sco_params_t acked;              /* Acknowledged by the controller */
+    hw_sco_params_t pending;            /* Sent, not acknowledged yet */
+    uint8_t in_flight;                  /* VSCs sent plus the sender */
+    uint8_t sent;
+    uint8_t op;                         /* HW_OP_SCO_CFG or HW_OP_WBS_CFG */
+    bt_vendor_op_result_t status;
+    uint32_t start_ms;
+} hw_sco_cb_t;
+
+/* Vendor operations serialized through the op queue */
+enum {
+    HW_OP_LPM_ENABLE,                       /* stack LPM enable */
+    HW_OP_LPM_DISABLE,                      /* stack LPM disable */
+    HW_OP_LPM_POLICY,                       /* adaptive policy update */
+    HW_OP_SCO_CFG,                          /* stack SCO configuration */
+    HW_OP_WBS_CFG                           /* mSBC codec enable/disable */
 };
 
+/* queued vendor operation */
+typedef struct
+{
+    uint8_t type;                           /* HW_OP_xxx */
+    uint8_t param;                          /* operation parameter */
+    uint8_t count;                          /* coalesced stack requests */
+} hw_op_t;
+
+/* vendor op queue control block */
+typedef struct
+{
+    pthread_mutex_t mutex;                  /* protects the fields below */
+    hw_op_t queue[HW_OP_QUEUE_SIZE];
+    uint8_t head;                           /* op in flight when busy */
+    uint8_t count;                          /* ops in queue, incl. in flight */
+    uint8_t busy;                           /* head op has been started */
+} hw_op_cb_t;
+
 /* low power mode parameters */
 typedef struct
 {
@@ -166,6 +294,37 @@ typedef struct
     uint8_t pulsed_host_wake;               /* pulsed host wake if mode = 1 */
 } bt_lpm_param_t;
 
+/* LPM traffic classes */
+enum {
+    LPM_CLASS_DEFAULT,          /* not enough samples yet */
+    LPM_CLASS_IDLE,             /* sparse traffic */
+    LPM_CLASS_BURSTY,           /* irregular short gaps (BLE, HCI commands) */
+    LPM_CLASS_PERIODIC,         /* regular short gaps (A2DP, HID) */
+    LPM_CLASS_MAX
+};
+
+/* LPM policy control block, protected by lpm_policy_mutex */
+typedef struct
+{
+    uint8_t  enabled;           /* LPM turned on by the stack */
+    uint8_t  cur_class;         /* class currently applied */
+    uint8_t  cand_class;        /* class suggested by the latest samples */
+    uint8_t  cand_count;        /* consecutive samples agreeing on cand_class */
+    uint8_t  host_idle_thresh;  /* thresholds programmed in the controller */
+    uint8_t  hc_idle_thresh;
+    uint8_t  tgt_host_idle_thresh;  /* thresholds wanted by the policy */
+    uint8_t  tgt_hc_idle_thresh;
+    uint32_t timeout_ms;        /* host idle timeout currently applied */
+    uint32_t window_ms;         /* start of the current counting window */
+    uint32_t last_active_ms;    /* end of the last window with traffic */
+    uint32_t gap_avg;           /* EWMA of gaps, scaled by 2^EWMA_SHIFT */
+    uint32_t gap_dev;           /* EWMA of gap deviation, same scale */
+    uint32_t samples;
+    uint32_t last_reissue_ms;
+    uint32_t class_changes;
+    uint32_t reissues;
+} bt_lpm_policy_cb_t;
+
 /* Firmware re-launch settlement time */
 typedef struct {
     const char *chipset_name;
@@ -178,6 +337,19 @@ typedef struct {
 ******************************************************************************/
 
 void hw_config_cback(void *p_evt_buf);
+void hw_config_start(void);
+static void hw_config_ready(int ready_ms);
+static uint8_t hw_lpm_send(uint8_t turn_on);
+static uint8_t hw_lpm_policy_send(void);
+#if (SCO_CFG_INCLUDED == TRUE) || (SCO_USE_I2S_INTERFACE == TRUE)
+void hw_sco_cfg_cback(void *p_mem);
+#endif
+#if (SCO_CFG_INCLUDED == TRUE)
+static uint8_t hw_sco_send(bt_vendor_op_result_t *p_status);
+#endif
+#if (SCO_USE_I2S_INTERFACE == TRUE)
+static uint8_t hw_wbs_send(uint8_t state, bt_vendor_op_result_t *p_status);
+#endif
 extern uint8_t vnd_local_bd_addr[BD_ADDR_LEN];
 
 
@@ -192,9 +364,15 @@ static int fw_patch_settlement_delay = -1;
 #endif
 
 static bt_hw_cfg_cb_t hw_cfg_cb;
-static enum hw_sco_state hw_sco_cb_state = 0;
-static enum hw_wbs_state hw_wbs_cb_state = 0;
-static pthread_mutex_t lpm_mutex = PTHREAD_MUTEX_INITIALIZER;
+static hw_patch_cache_t hw_patch_cache;
+static hw_sco_cb_t hw_sco_cb = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .stale = TRUE,
+#if (SCO_USE_I2S_INTERFACE == TRUE)
+    .i2s_resample = SCO_I2SPCM_IF_RESAMPLE
+#endif
+};
+static hw_op_cb_t hw_op_cb = { .mutex = PTHREAD_MUTEX_INITIALIZER };
 
 static bt_lpm_param_t lpm_param =
 {
@@ -206,11 +384,49 @@ static bt_lpm_param_t lpm_param =
     LPM_ALLOW_HOST_SLEEP_DURING_SCO,
     LPM_COMBINE_SLEEP_MODE_AND_LPM,
     LPM_ENABLE_UART_TXD_TRI_STATE,
-    0,  /* not applicable */
-    0,  /* not applicable */
-    0,  /* not applicable */
+    LPM_SLEEP_GUARD_TIME,
+    LPM_WAKEUP_GUARD_TIME,
+    LPM_TXD_CONFIG,
     LPM_PULSED_HOST_WAKE
 };
+static uint8_t lpm_idle_timeout_multiple = LPM_IDLE_TIMEOUT_MULTIPLE;
+
+/*
+ * LPM parameters from bt_vendor.conf are staged here and take effect at the
+ * next hw_lpm_enable, so that a running LPM session is never changed under
+ * the controller's feet.
+ */
+static pthread_mutex_t lpm_conf_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bt_lpm_param_t lpm_conf_param;
+static uint8_t lpm_conf_idle_timeout_multiple;
+static uint8_t lpm_conf_pending = FALSE;
+
+/* conf param of LPM_IDLE_TIMEOUT_MULTIPLE, past the bt_lpm_param_t offsets */
+#define LPM_CONF_IDLE_TIMEOUT_MULTIPLE  sizeof(bt_lpm_param_t)
+
+static bt_lpm_policy_cb_t lpm_policy_cb;
+static pthread_mutex_t lpm_policy_mutex = PTHREAD_MUTEX_INITIALIZER;
+static vnd_loop_timer_t *lpm_policy_timer;
+
+/* Shared with the transmit path, atomics only */
+static uint8_t lpm_policy_counting;     /* BT_WAKE requests are counted */
+static uint8_t lpm_policy_idle;         /* Window timer stopped, no traffic */
+static uint32_t lpm_policy_requests;    /* Counted in the current window */
+
+/* LpmAdaptivePolicy, read when the stack asks for its idle timeout and at
+ * every LPM enable */
+static uint8_t lpm_policy_conf = LPM_ADAPTIVE_POLICY;
+
+/* Idle timeout handed to the stack, 0 until it asks */
+static uint32_t lpm_stack_timeout_ms;
+
+static const char *lpm_class_name[LPM_CLASS_MAX] =
+{
+    "default",
+    "idle",
+    "bursty",
+    "periodic"
+};
 
 static uint8_t bt_pcm_sco_param[SCO_PCM_PARAM_SIZE] =
 {
@@ -220,19 +436,6 @@ static uint8_t bt_pcm_sco_param[SCO_PCM_PARAM_SIZE] =
     SCO_PCM_IF_SYNC_MODE,
     SCO_PCM_IF_CLOCK_MODE
 };
-/*
- * Parameter names used in bt_vendor.conf to configure BT SCO PCM settings.
- * Below table should always matches the previous table in terms of size
- * and elements order.
- */
-static const char* sco_pcm_parameter_name[SCO_PCM_PARAM_SIZE] =
-{
-    "SCO_PCM_ROUTING",
-    "SCO_PCM_IF_CLOCK_RATE",
-    "SCO_PCM_IF_FRAME_TYPE",
-    "SCO_PCM_IF_SYNC_MODE",
-    "SCO_PCM_IF_CLOCK_MODE"
-};
 
 static uint8_t bt_pcm_data_fmt_param[PCM_DATA_FORMAT_PARAM_SIZE] =
 {
@@ -242,19 +445,6 @@ static uint8_t bt_pcm_data_fmt_param[PCM_DATA_FORMAT_PARAM_SIZE] =
     PCM_DATA_FMT_FILL_NUM,
     PCM_DATA_FMT_JUSTIFY_MODE
 };
-/*
- * Parameter names used in bt_vendor.conf to configure BT SCO PCM FORMAT settings.
- * Below table should always matches the previous table in terms of size
- * and elements order.
- */
-static const char* pcm_data_fmt_parameter_name[PCM_DATA_FORMAT_PARAM_SIZE] =
-{
-    "PCM_DATA_FMT_SHIFT_MODE",
-    "PCM_DATA_FMT_FILL_BITS",
-    "PCM_DATA_FMT_FILL_METHOD",
-    "PCM_DATA_FMT_FILL_NUM",
-    "PCM_DATA_FMT_JUSTIFY_MODE"
-};
 
 #if (SCO_USE_I2S_INTERFACE == TRUE)
 static uint8_t bt_i2s_sco_param[SCO_I2SPCM_PARAM_SIZE] =
@@ -264,17 +454,6 @@ static uint8_t bt_i2s_sco_param[SCO_I2SPCM_PARAM_SIZE] =
     SCO_I2SPCM_IF_SAMPLE_RATE,
     SCO_I2SPCM_IF_CLOCK_RATE
 };
-/*
- * Parameter names use in bt_vendor.conf to configure BT SCO I2S settings.
- * Below table should always match the previous table in term of size
- * and element order.
- */
-static const char* sco_i2s_parameter_name[SCO_I2SPCM_PARAM_SIZE] = {
-    "SCO_I2SPCM_IF_MODE",
-    "SCO_I2SPCM_IF_ROLE",
-    "SCO_I2SPCM_IF_SAMPLE_RATE",
-    "SCO_I2SPCM_IF_CLOCK_RATE"
-};
 
 #endif // (SCO_USE_I2S_INTERFACE == TRUE)
 
@@ -293,6 +472,40 @@ static uint8_t msbc_disable_param[MSBC_DISABLE_PARAM_SIZE] = {
        0
 };
 
+#if (SCO_CFG_INCLUDED == TRUE)
+/* VSCs sent on SCO configuration request */
+static const uint8_t hw_sco_seq[] = {
+    HW_SCO_VSC_PCM,
+    HW_SCO_VSC_PCM_FORMAT,
+#if (SCO_USE_I2S_INTERFACE == TRUE)
+    HW_SCO_VSC_I2S
+#endif
+};
+#endif
+
+#if (SCO_USE_I2S_INTERFACE == TRUE)
+/* VSCs sent on mSBC codec enable/disable */
+static const uint8_t hw_wbs_seq[] = {
+    HW_SCO_VSC_MSBC,
+    HW_SCO_VSC_PCM,
+    HW_SCO_VSC_I2S
+};
+#endif
+
+static const uint16_t hw_sco_vsc_opcode[HW_SCO_VSC_MAX] = {
+    HCI_VSC_WRITE_MSBC_ENABLE_PARAM,
+    HCI_VSC_WRITE_SCO_PCM_INT_PARAM,
+    HCI_VSC_WRITE_PCM_DATA_FORMAT_PARAM,
+    HCI_VSC_WRITE_I2SPCM_INTERFACE_PARAM
+};
+
+static const char *hw_sco_vsc_name[HW_SCO_VSC_MAX] = {
+    "mSBC codec",
+    "SCO PCM",
+    "PCM data format",
+    "SCO I2SPCM interface"
+};
+
 /*
  * The look-up table of recommended firmware settlement delay (milliseconds) on
  * known chipsets.
@@ -388,6 +601,23 @@ void ms_delay (uint32_t timeout)
     } while (err < 0 && errno ==EINTR);
 }
 
+/*******************************************************************************
+**
+** Function         hw_now_ms
+**
+** Description      Monotonic time in milliseconds
+**
+** Returns          Time in milliseconds
+**
+*******************************************************************************/
+static uint32_t hw_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
 /*******************************************************************************
 **
 ** Function        line_speed_to_userial_baud
@@ -583,6 +813,192 @@ static uint8_t hw_config_findpatch(char *p_chip_id_str)
 
     return (retval);
 }
+/*******************************************************************************
+**
+** Function         hw_patch_cache_load
+**
+** Description      Read a firmware patch file into memory and index its HCD
+**                  records
+**
+** Returns          TRUE if the image is usable, FALSE otherwise
+**
+*******************************************************************************/
+static uint8_t hw_patch_cache_load(const char *p_path, const struct stat *p_st)
+{
+    uint8_t *p_image;
+    uint32_t *p_rec;
+    uint32_t off;
+    uint16_t count = 0;
+    ssize_t len = 0, n;
+    int fd;
+
+    if ((p_st->st_size <= 0) || (p_st->st_size > FW_PATCH_CACHE_MAX_SIZE))
+    {
+        ALOGE("vendor lib patch [%s] size %ld not supported", p_path, \
+              (long) p_st->st_size);
+        return FALSE;
+    }
+
+    if ((fd = open(p_path, O_RDONLY)) == -1)
+    {
+        ALOGE("vendor lib preload failed to open [%s]", p_path);
+        return FALSE;
+    }
+
+    if ((p_image = (uint8_t *) malloc(p_st->st_size)) == NULL)
+    {
+        close(fd);
+        return FALSE;
+    }
+
+    while ((len < p_st->st_size) && \
+           ((n = read(fd, p_image + len, p_st->st_size - len)) > 0))
+        len += n;
+    close(fd);
+
+    /* count, then index complete records */
+    for (off = 0; off + HCI_CMD_PREAMBLE_SIZE <= (uint32_t) len; count++)
+        off += HCI_CMD_PREAMBLE_SIZE + p_image[off + HCD_REC_PAYLOAD_LEN_BYTE];
+    if ((off != (uint32_t) len) && (count > 0))
+    {
+        /* drop the truncated last record */
+        ALOGW("firmware patch file might be altered!");
+        count--;
+    }
+
+    if ((count == 0) || \
+        ((p_rec = (uint32_t *) malloc(count * sizeof(uint32_t))) == NULL))
+    {
+        free(p_image);
+        return FALSE;
+    }
+
+    for (off = 0, n = 0; n < count; n++)
+    {
+        p_rec[n] = off;
+        off += HCI_CMD_PREAMBLE_SIZE + p_image[off + HCD_REC_PAYLOAD_LEN_BYTE];
+    }
+
+    free(hw_patch_cache.p_image);
+    free(hw_patch_cache.p_rec);
+
+    hw_patch_cache.p_image = p_image;
+    hw_patch_cache.p_rec = p_rec;
+    hw_patch_cache.rec_count = count;
+    hw_patch_cache.size = p_st->st_size;
+    hw_patch_cache.mtime = p_st->st_mtime;
+    snprintf(hw_patch_cache.path, sizeof(hw_patch_cache.path), "%s", p_path);
+    strcpy(hw_patch_cache.conf_path, fw_patchfile_path);
+    strcpy(hw_patch_cache.conf_name, fw_patchfile_name);
+
+    ALOGI("vendor lib patch [%s] cached, %u records", p_path, count);
+
+    return TRUE;
+}
+
+/*******************************************************************************
+**
+** Function         hw_patch_cache_valid
+**
+** Description      Tell if the cached patch of a controller still is the one
+**                  the configuration points to, unchanged on disk
+**
+** Returns          TRUE/FALSE
+**
+*******************************************************************************/
+static uint8_t hw_patch_cache_valid(const char *p_chip_name)
+{
+    struct stat st;
+
+    return ((hw_patch_cache.p_image != NULL) && \
+            (hw_patch_cache.chip_name[0] != 0) && \
+            (strcmp(hw_patch_cache.chip_name, p_chip_name) == 0) && \
+            (strcmp(hw_patch_cache.conf_path, fw_patchfile_path) == 0) && \
+            (strcmp(hw_patch_cache.conf_name, fw_patchfile_name) == 0) && \
+            (stat(hw_patch_cache.path, &st) == 0) && \
+            (st.st_size == hw_patch_cache.size) && \
+            (st.st_mtime == hw_patch_cache.mtime)) ? TRUE : FALSE;
+}
+
+/*******************************************************************************
+**
+** Function         hw_patch_cache_lookup
+**
+** Description      Make the firmware patch of the given controller available
+**                  in memory, from the cache when the file did not change
+**
+** Returns          TRUE if a patch image is available, FALSE otherwise
+**
+*******************************************************************************/
+static uint8_t hw_patch_cache_lookup(const char *p_chip_name)
+{
+    char tmp_path[FW_PATCHFILE_PATH_MAXLEN + 8];
+    struct stat st;
+
+    if (hw_patch_cache_valid(p_chip_name) == TRUE)
+        return TRUE;
+
+    hw_patch_cache.chip_name[0] = 0;
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s", p_chip_name);
+
+    if (hw_config_findpatch(tmp_path) == FALSE)
+    {
+        ALOGE("vendor lib preload failed to locate firmware patch file");
+        lct_log(CT_EV_STAT, "cws.bt", "fw_error", 0, tmp_path);
+        return FALSE;
+    }
+
+    if ((stat(tmp_path, &st) != 0) || \
+        (hw_patch_cache_load(tmp_path, &st) == FALSE))
+    {
+        lct_log(CT_EV_STAT, "cws.bt", "fw_error", 0, tmp_path);
+        return FALSE;
+    }
+
+    snprintf(hw_patch_cache.chip_name, sizeof(hw_patch_cache.chip_name), \
+             "%s", p_chip_name);
+
+    return TRUE;
+}
+
+/*******************************************************************************
+**
+** Function         hw_config_done
+**
+** Description      Account for a successful controller configuration
+**
+** Returns          None
+**
+*******************************************************************************/
+static void hw_config_done(void)
+{
+    char tmp[12];
+    uint32_t elapsed_ms = hw_now_ms() - hw_cfg_cb.start_ms;
+
+    if (hw_cfg_cb.ready_ms >= 0)
+        ALOGI("vendor lib fwcfg completed in %u ms (%s), controller ready " \
+              "in %d ms", elapsed_ms, hw_cfg_cb.p_mode, hw_cfg_cb.ready_ms);
+    else
+        ALOGI("vendor lib fwcfg completed in %u ms (%s), controller ready " \
+              "time unknown", elapsed_ms, hw_cfg_cb.p_mode);
+
+    snprintf(tmp, sizeof(tmp), "%u", elapsed_ms);
+    lct_log(CT_EV_INFO, "cws.bt", "fw_cfg_time", 0, hw_cfg_cb.p_mode, tmp);
+
+    /* Not measured on a warm start, the controller was never powered off,
+     * nor without flow control or a known power on time */
+    if (hw_cfg_cb.ready_ms >= 0)
+    {
+        snprintf(tmp, sizeof(tmp), "%d", hw_cfg_cb.ready_ms);
+        lct_log(CT_EV_INFO, "cws.bt", "ready_time", 0, hw_cfg_cb.p_mode, tmp);
+    }
+
+    hw_cfg_cb.state = 0;
+    hw_cfg_cb.fw_patch = FALSE;
+    hw_cfg_cb.complete = TRUE;
+}
+
 
 /*******************************************************************************
 **
@@ -728,6 +1144,22 @@ void hw_config_cback(void *p_mem)
     p = (uint8_t *)(p_evt_buf + 1) + HCI_EVT_CMD_CMPL_OPCODE;
     STREAM_TO_UINT16(opcode,p);
 
+    /* A controller kept up for a warm restart but refusing HCI_RESET is not
+     * in the state it was left in. It answers at the target baud rate, so
+     * configure it from scratch from there. */
+    if ((status != 0) && (hw_cfg_cb.state == HW_CFG_START) && hw_cfg_cb.warm)
+    {
+        ALOGW("vendor lib fwcfg warm start failed (0x%02x), cold start", \
+              status);
+
+        if (bt_vendor_cbacks)
+            bt_vendor_cbacks->dealloc(p_evt_buf);
+
+        hw_cfg_cb.warm = FALSE;
+        hw_config_start();
+        return;
+    }
+
     /* Ask a new buffer big enough to hold any HCI commands sent in here */
     if ((status == 0) && bt_vendor_cbacks)
         p_buf = (HC_BT_HDR *) bt_vendor_cbacks->alloc(BT_HC_HDR_SIZE + \
@@ -745,6 +1177,26 @@ void hw_config_cback(void *p_mem)
         switch (hw_cfg_cb.state)
         {
             case HW_CFG_START:
+                if (hw_cfg_cb.warm)
+                {
+                    /* patch and baud rate survived, only the address is left */
+                    hw_cfg_cb.warm = FALSE;
+#if (USE_CONTROLLER_BDADDR == TRUE)
+                    is_proceeding = hw_config_read_bdaddr(p_buf);
+#else
+                    is_proceeding = hw_config_set_bdaddr(p_buf);
+#endif
+                    break;
+                }
+
+                if (hw_cfg_cb.recover)
+                {
+                    /* same controller as last time, patch in memory */
+                    BTHWDBG("Chipset %s (cached)", hw_cfg_cb.local_chip_name);
+                    hw_cfg_cb.fw_patch = TRUE;
+                    goto set_baudrate;
+                }
+
                 /* read local name */
                 UINT16_TO_STREAM(p, HCI_READ_LOCAL_NAME);
                 *p = 0; /* parameter length */
@@ -820,44 +1272,37 @@ void hw_config_cback(void *p_mem)
             case HW_CFG_CHECK_LOCAL_NAME:
 
 check_local_name:
-                {
-                    char tmp_path[255];
+                BTHWDBG("Chipset %s", hw_cfg_cb.local_chip_name);
 
-                    BTHWDBG("Chipset %s", hw_cfg_cb.local_chip_name);
+                hw_cfg_cb.fw_patch = \
+                    hw_patch_cache_lookup(hw_cfg_cb.local_chip_name);
 
-                    strcpy(tmp_path, hw_cfg_cb.local_chip_name);
-
-                    if ((status = hw_config_findpatch(tmp_path)) == TRUE)
-                    {
-                        if ((hw_cfg_cb.fw_fd = open(tmp_path, O_RDONLY)) == -1)
-                        {
-                            ALOGE("vendor lib preload failed to open [%s]", tmp_path);
-                            lct_log(CT_EV_STAT, "cws.bt", "fw_error", 0, tmp_path);
-                        }
-                    }
-                    else
+set_baudrate:
+                if (is_proceeding == FALSE)
+                {
+                    /* found at the target rate on open, no need to switch */
+                    if (userial_vendor_get_baud() == \
+                        line_speed_to_userial_baud(UART_TARGET_BAUD_RATE))
                     {
-                        ALOGE( \
-                        "vendor lib preload failed to locate firmware patch file" \
-                        );
-                        lct_log(CT_EV_STAT, "cws.bt", "fw_error", 0, tmp_path);
+                        ALOGI("bt vendor lib: UART already at %i", \
+                              UART_TARGET_BAUD_RATE);
+                        goto set_uart_baud_1;
                     }
-                }
 
-                if (is_proceeding == FALSE)
-                {
                     is_proceeding = hw_config_set_baudrate(p_buf);
                 }
                 break;
 
             case HW_CFG_SET_UART_BAUD_1:
+
+set_uart_baud_1:
                 /* update baud rate of host's UART port */
                 ALOGI("bt vendor lib: set UART baud %i", UART_TARGET_BAUD_RATE);
                 userial_vendor_set_baud( \
                     line_speed_to_userial_baud(UART_TARGET_BAUD_RATE) \
                 );
 
-                if (hw_cfg_cb.fw_fd != -1)
+                if (hw_cfg_cb.fw_patch)
                 {
                     /* vsc_download_minidriver */
                     UINT16_TO_STREAM(p, HCI_VSC_DOWNLOAD_MINIDRV);
@@ -882,19 +1327,20 @@ check_local_name:
                 hw_cfg_cb.state = HW_CFG_DL_FW_PATCH;
                 /* fall through intentionally */
             case HW_CFG_DL_FW_PATCH:
-                p_buf->len = read(hw_cfg_cb.fw_fd, p, HCI_CMD_PREAMBLE_SIZE);
-                if (p_buf->len > 0)
+                if (hw_cfg_cb.fw_rec < hw_patch_cache.rec_count)
                 {
-                    if ((p_buf->len < HCI_CMD_PREAMBLE_SIZE) || \
-                        (opcode == HCI_VSC_LAUNCH_RAM))
+                    if (opcode == HCI_VSC_LAUNCH_RAM)
                     {
                         ALOGW("firmware patch file might be altered!");
                     }
                     else
                     {
-                        p_buf->len += read(hw_cfg_cb.fw_fd, \
-                                           p+HCI_CMD_PREAMBLE_SIZE,\
-                                           *(p+HCD_REC_PAYLOAD_LEN_BYTE));
+                        uint8_t *p_rec = hw_patch_cache.p_image + \
+                                    hw_patch_cache.p_rec[hw_cfg_cb.fw_rec++];
+
+                        p_buf->len = HCI_CMD_PREAMBLE_SIZE + \
+                                     p_rec[HCD_REC_PAYLOAD_LEN_BYTE];
+                        memcpy(p, p_rec, p_buf->len);
                         STREAM_TO_UINT16(opcode,p);
                         is_proceeding = bt_vendor_cbacks->xmit_cb(opcode, \
                                                 p_buf, hw_config_cback);
@@ -902,8 +1348,7 @@ check_local_name:
                     }
                 }
 
-                close(hw_cfg_cb.fw_fd);
-                hw_cfg_cb.fw_fd = -1;
+                hw_cfg_cb.fw_patch = FALSE;
 
                 /* Normally the firmware patch configuration file
                  * sets the new starting baud rate at 115200.
@@ -943,17 +1388,10 @@ check_local_name:
 #endif
                 /* fall through intentionally */
             case HW_CFG_SET_BD_ADDR:
-                ALOGI("vendor lib fwcfg completed");
                 bt_vendor_cbacks->dealloc(p_buf);
                 bt_vendor_cbacks->fwcfg_cb(BT_VND_OP_RESULT_SUCCESS);
 
-                hw_cfg_cb.state = 0;
-
-                if (hw_cfg_cb.fw_fd != -1)
-                {
-                    close(hw_cfg_cb.fw_fd);
-                    hw_cfg_cb.fw_fd = -1;
-                }
+                hw_config_done();
 
                 is_proceeding = TRUE;
                 break;
@@ -977,17 +1415,10 @@ check_local_name:
                         *(p_tmp+2), *(p_tmp+1), *p_tmp);
                 }
 
-                ALOGI("vendor lib fwcfg completed");
                 bt_vendor_cbacks->dealloc(p_buf);
                 bt_vendor_cbacks->fwcfg_cb(BT_VND_OP_RESULT_SUCCESS);
 
-                hw_cfg_cb.state = 0;
-
-                if (hw_cfg_cb.fw_fd != -1)
-                {
-                    close(hw_cfg_cb.fw_fd);
-                    hw_cfg_cb.fw_fd = -1;
-                }
+                hw_config_done();
 
                 is_proceeding = TRUE;
                 break;
@@ -1011,138 +1442,1097 @@ check_local_name:
             bt_vendor_cbacks->fwcfg_cb(BT_VND_OP_RESULT_FAIL);
         }
 
-        if (hw_cfg_cb.fw_fd != -1)
-        {
-            close(hw_cfg_cb.fw_fd);
-            hw_cfg_cb.fw_fd = -1;
-        }
+        /* A controller failing once identified, e.g. on a Hardware Error,
+         * is taken back without identification on the next attempt. If
+         * that was the attempt, do not trust the cached identity again. */
+        if (hw_cfg_cb.recover)
+            hw_patch_cache.chip_name[0] = 0;
+        else
+            hw_cfg_cb.hw_error = (hw_patch_cache.chip_name[0] != 0) && \
+                                 (strcmp(hw_patch_cache.chip_name, \
+                                         hw_cfg_cb.local_chip_name) == 0);
 
         hw_cfg_cb.state = 0;
+        hw_cfg_cb.fw_patch = FALSE;
+        hw_cfg_cb.warm = FALSE;
     }
 }
 
 /******************************************************************************
-**   LPM Static Functions
+**   Vendor Op Queue Static Functions
 ******************************************************************************/
 
+/*
+ * Vendor commands issued on behalf of the stack (LPM, SCO, WBS) and by the
+ * adaptive LPM policy go through one queue. Only one operation is in flight
+ * at a time, the next one is started from the completion of the previous
+ * one. Callers never wait for the controller.
+ */
+
 /*******************************************************************************
 **
-** Function         hw_lpm_ctrl_cback
+** Function         hw_op_send
 **
-** Description      Callback function for lpm enable/disable rquest
+** Description      Send the first command of a vendor operation. An
+**                  operation ending without controller traffic sets
+**                  *p_status, left to BT_VND_OP_RESULT_FAIL otherwise.
 **
-** Returns          None
+** Returns          TRUE if a command is in flight, FALSE otherwise
 **
 *******************************************************************************/
-void hw_lpm_ctrl_cback(void *p_mem)
+static uint8_t hw_op_send(const hw_op_t *p_op, bt_vendor_op_result_t *p_status)
 {
-    HC_BT_HDR *p_evt_buf = (HC_BT_HDR *) p_mem;
-    bt_vendor_op_result_t status = BT_VND_OP_RESULT_FAIL;
+    *p_status = BT_VND_OP_RESULT_FAIL;
 
-    if (*((uint8_t *)(p_evt_buf + 1) + HCI_EVT_CMD_CMPL_STATUS_RET_BYTE) == 0)
+    switch (p_op->type)
     {
-        status = BT_VND_OP_RESULT_SUCCESS;
-    }
-    pthread_mutex_unlock(&lpm_mutex);
+        case HW_OP_LPM_ENABLE:
+            return hw_lpm_send(TRUE);
 
-    if (bt_vendor_cbacks)
-    {
-        bt_vendor_cbacks->lpm_cb(status);
-        bt_vendor_cbacks->dealloc(p_evt_buf);
-    }
-}
+        case HW_OP_LPM_DISABLE:
+            return hw_lpm_send(FALSE);
 
+        case HW_OP_LPM_POLICY:
+            return hw_lpm_policy_send();
 
 #if (SCO_CFG_INCLUDED == TRUE)
-/*****************************************************************************
-**   SCO Configuration Static Functions
-*****************************************************************************/
+        case HW_OP_SCO_CFG:
+            return hw_sco_send(p_status);
+#endif
+
+#if (SCO_USE_I2S_INTERFACE == TRUE)
+        case HW_OP_WBS_CFG:
+            return hw_wbs_send(p_op->param, p_status);
+#endif
+
+        default:
+            return FALSE;
+    }
+}
 
 /*******************************************************************************
 **
-** Function         hw_sco_cfg_cback
+** Function         hw_op_report
 **
-** Description      Callback function for SCO configuration rquest
+** Description      Report the result of a vendor operation to the stack,
+**                  once for each request coalesced into it
 **
 ** Returns          None
 **
 *******************************************************************************/
-void hw_sco_cfg_cback(void *p_mem)
+static void hw_op_report(const hw_op_t *p_op, bt_vendor_op_result_t status)
 {
-    HC_BT_HDR *p_evt_buf = (HC_BT_HDR *) p_mem;
-    uint8_t     *p;
-    uint16_t    opcode;
-    HC_BT_HDR  *p_buf=NULL;
-    uint8_t     ret;
+    uint8_t i;
+
+    if (bt_vendor_cbacks == NULL)
+        return;
+
+    for (i = 0; i < p_op->count; i++)
+    {
+        switch (p_op->type)
+        {
+            case HW_OP_LPM_ENABLE:
+            case HW_OP_LPM_DISABLE:
+                bt_vendor_cbacks->lpm_cb(status);
+                break;
+
+            case HW_OP_SCO_CFG:
+                if (status != BT_VND_OP_RESULT_SUCCESS)
+                    ALOGE("vendor lib scocfg aborted");
+                bt_vendor_cbacks->scocfg_cb(status);
+                break;
+
+            default:
+                break;
+        }
+    }
+}
+
+/*******************************************************************************
+**
+** Function         hw_op_done
+**
+** Description      Complete the vendor operation in flight and start the
+**                  next queued one. Operations not sending any command
+**                  complete right away with the status hw_op_send gives.
+**
+** Returns          None
+**
+*******************************************************************************/
+static void hw_op_done(bt_vendor_op_result_t status)
+{
+    hw_op_t op, next;
+    uint8_t more;
+
+    do
+    {
+        pthread_mutex_lock(&hw_op_cb.mutex);
+        if (hw_op_cb.busy == FALSE)
+        {
+            /* queue flushed by hw_config_cleanup meanwhile */
+            pthread_mutex_unlock(&hw_op_cb.mutex);
+            return;
+        }
+        op = hw_op_cb.queue[hw_op_cb.head];
+        hw_op_cb.head = (hw_op_cb.head + 1) % HW_OP_QUEUE_SIZE;
+        hw_op_cb.count--;
+        more = (hw_op_cb.count > 0) ? TRUE : FALSE;
+        if (more == TRUE)
+            next = hw_op_cb.queue[hw_op_cb.head];
+        else
+            hw_op_cb.busy = FALSE;
+        pthread_mutex_unlock(&hw_op_cb.mutex);
+
+        hw_op_report(&op, status);
+
+        if (more == FALSE)
+            return;
+    } while (hw_op_send(&next, &status) == FALSE);
+}
+
+/*******************************************************************************
+**
+** Function         hw_op_enqueue
+**
+** Description      Queue a vendor operation and start it if nothing is in
+**                  flight. Requests cancelling or repeating an operation
+**                  still waiting in the queue are coalesced with it:
+**                  - an LPM enable/disable pair cancels out and both requests
+**                    complete successfully without controller traffic
+**                  - a repeated LPM or SCO request shares the completion of
+**                    the queued one
+**                  - a newer WBS request replaces the queued one
+**                  - an LPM disable drops a queued policy update
+**
+** Returns          TRUE if queued or coalesced, FALSE if the queue is full
+**
+*******************************************************************************/
+static uint8_t hw_op_enqueue(uint8_t type, uint8_t param)
+{
+    hw_op_t *p_tail = NULL;
+    hw_op_t op = { type, param, 1 };
+    hw_op_t cancelled = { 0, 0, 0 };
+    uint8_t start = FALSE;
+    uint8_t waiting;
+    bt_vendor_op_result_t status;
+
+    pthread_mutex_lock(&hw_op_cb.mutex);
+
+    /* ops behind the one in flight can still be coalesced */
+    waiting = hw_op_cb.count - ((hw_op_cb.busy == TRUE) ? 1 : 0);
+    if (waiting > 0)
+        p_tail = &hw_op_cb.queue[(hw_op_cb.head + hw_op_cb.count - 1) % \
+                                 HW_OP_QUEUE_SIZE];
+
+    if ((p_tail != NULL) && (type == HW_OP_LPM_DISABLE) && \
+        (p_tail->type == HW_OP_LPM_POLICY))
+    {
+        hw_op_cb.count--;
+        waiting--;
+        p_tail = (waiting > 0) ? &hw_op_cb.queue[(hw_op_cb.head + \
+                        hw_op_cb.count - 1) % HW_OP_QUEUE_SIZE] : NULL;
+    }
+
+    if ((p_tail != NULL) && (p_tail->type == type))
+    {
+        p_tail->param = param;
+        if (type != HW_OP_WBS_CFG)
+            p_tail->count++;
+        pthread_mutex_unlock(&hw_op_cb.mutex);
+        return TRUE;
+    }
+
+    if ((p_tail != NULL) && \
+        (((type == HW_OP_LPM_ENABLE) && (p_tail->type == HW_OP_LPM_DISABLE)) || \
+         ((type == HW_OP_LPM_DISABLE) && (p_tail->type == HW_OP_LPM_ENABLE))))
+    {
+        cancelled = *p_tail;
+        hw_op_cb.count--;
+        pthread_mutex_unlock(&hw_op_cb.mutex);
+
+        BTHWDBG("op queue: LPM enable/disable pair cancelled");
+        hw_op_report(&cancelled, BT_VND_OP_RESULT_SUCCESS);
+        hw_op_report(&op, BT_VND_OP_RESULT_SUCCESS);
+        return TRUE;
+    }
+
+    if (hw_op_cb.count == HW_OP_QUEUE_SIZE)
+    {
+        pthread_mutex_unlock(&hw_op_cb.mutex);
+        ALOGE("op queue: full, op %d dropped", type);
+        return FALSE;
+    }
+
+    hw_op_cb.queue[(hw_op_cb.head + hw_op_cb.count) % HW_OP_QUEUE_SIZE] = op;
+    hw_op_cb.count++;
+    if (hw_op_cb.busy == FALSE)
+    {
+        hw_op_cb.busy = TRUE;
+        start = TRUE;
+    }
+    pthread_mutex_unlock(&hw_op_cb.mutex);
+
+    if ((start == TRUE) && (hw_op_send(&op, &status) == FALSE))
+        hw_op_done(status);
+
+    return TRUE;
+}
+
+/******************************************************************************
+**   LPM Static Functions
+******************************************************************************/
+
+/*******************************************************************************
+**
+** Function         hw_lpm_ctrl_cback
+**
+** Description      Callback function for lpm enable/disable rquest
+**
+** Returns          None
+**
+*******************************************************************************/
+void hw_lpm_ctrl_cback(void *p_mem)
+{
+    HC_BT_HDR *p_evt_buf = (HC_BT_HDR *) p_mem;
+    bt_vendor_op_result_t status = BT_VND_OP_RESULT_FAIL;
+
+    if (*((uint8_t *)(p_evt_buf + 1) + HCI_EVT_CMD_CMPL_STATUS_RET_BYTE) == 0)
+    {
+        status = BT_VND_OP_RESULT_SUCCESS;
+    }
+
+    if (bt_vendor_cbacks)
+        bt_vendor_cbacks->dealloc(p_evt_buf);
+
+    hw_op_done(status);
+}
+
+
+/*******************************************************************************
+**
+** Function         hw_lpm_conf_apply
+**
+** Description      Take the LPM parameters staged from bt_vendor.conf or
+**                  properties into use
+**
+** Returns          None
+**
+*******************************************************************************/
+static void hw_lpm_conf_apply(void)
+{
+    pthread_mutex_lock(&lpm_conf_mutex);
+    if (lpm_conf_pending == TRUE)
+    {
+        lpm_param = lpm_conf_param;
+        lpm_idle_timeout_multiple = lpm_conf_idle_timeout_multiple;
+        lpm_conf_pending = FALSE;
+
+        ALOGI("lpm: mode %d, idle thresholds %d/%d x%d, guard times %d/%d", \
+              lpm_param.sleep_mode, lpm_param.host_stack_idle_threshold, \
+              lpm_param.host_controller_idle_threshold, \
+              lpm_idle_timeout_multiple, lpm_param.sleep_guard_time, \
+              lpm_param.wakeup_guard_time);
+    }
+    pthread_mutex_unlock(&lpm_conf_mutex);
+}
+
+/*******************************************************************************
+**
+** Function         hw_lpm_unit_ms
+**
+** Description      Duration of one LPM idle threshold unit for this chip
+**
+** Returns          Unit in milliseconds
+**
+*******************************************************************************/
+static uint32_t hw_lpm_unit_ms(void)
+{
+    if (strstr(hw_cfg_cb.local_chip_name, "BCM4325") != NULL)
+        return 25; // 12.5 or 25 ?
+    else
+        return 300;
+}
+
+/*******************************************************************************
+**
+** Function         hw_lpm_base_idle_timeout
+**
+** Description      Idle timeout derived from the configured host stack idle
+**                  threshold
+**
+** Returns          Timeout in milliseconds
+**
+*******************************************************************************/
+static uint32_t hw_lpm_base_idle_timeout(void)
+{
+    /* set idle time to be LPM_IDLE_TIMEOUT_MULTIPLE times of
+     * host stack idle threshold (in 300ms/25ms)
+     */
+    return (uint32_t)lpm_param.host_stack_idle_threshold \
+                            * lpm_idle_timeout_multiple * hw_lpm_unit_ms();
+}
+
+/*******************************************************************************
+**
+** Function         hw_lpm_stack_idle_timeout
+**
+** Description      Idle timeout handed to the stack. It is the shortest one
+**                  any class uses, longer class timeouts are obtained by
+**                  holding BT_WAKE after the stack deasserts it.
+**
+** Returns          Timeout in milliseconds
+**
+*******************************************************************************/
+static uint32_t hw_lpm_stack_idle_timeout(void)
+{
+    uint32_t base_ms = hw_lpm_base_idle_timeout();
+
+    return (base_ms < LPM_POLICY_IDLE_TIMEOUT_MS) ? \
+                base_ms : LPM_POLICY_IDLE_TIMEOUT_MS;
+}
+
+/*******************************************************************************
+**
+** Function         hw_lpm_wake_hold
+**
+** Description      Time BT_WAKE must be held after the stack deasserts it,
+**                  for an idle timeout of timeout_ms. The stack keeps the
+**                  timeout it was given at init, whatever LpmAdaptivePolicy
+**                  was then.
+**
+** Returns          Hold time in milliseconds
+**
+*******************************************************************************/
+static uint32_t hw_lpm_wake_hold(uint32_t timeout_ms)
+{
+    uint32_t stack_ms = __atomic_load_n(&lpm_stack_timeout_ms, \
+                                        __ATOMIC_RELAXED);
+
+    if (stack_ms == 0)
+        stack_ms = hw_lpm_base_idle_timeout();
+
+    return (timeout_ms > stack_ms) ? timeout_ms - stack_ms : 0;
+}
+
+/*******************************************************************************
+**
+** Function         hw_lpm_policy_target
+**
+** Description      Compute host idle timeout and LPM idle thresholds of a
+**                  traffic class for the current average gap
+**
+** Returns          Host idle timeout in milliseconds
+**
+*******************************************************************************/
+static uint32_t hw_lpm_policy_target(uint8_t lpm_class, uint8_t *p_host_thresh,
+                                     uint8_t *p_hc_thresh)
+{
+    uint32_t gap_ms = lpm_policy_cb.gap_avg >> LPM_POLICY_EWMA_SHIFT;
+    uint32_t stack_ms = hw_lpm_stack_idle_timeout();
+    uint32_t base_ms = hw_lpm_base_idle_timeout();
+    uint32_t unit_ms = hw_lpm_unit_ms();
+    uint32_t timeout_ms, thresh;
+
+    *p_host_thresh = lpm_param.host_stack_idle_threshold;
+    *p_hc_thresh = lpm_param.host_controller_idle_threshold;
+
+    switch (lpm_class)
+    {
+        case LPM_CLASS_IDLE:
+            /* Nothing follows a lone packet soon, go to sleep right away */
+            timeout_ms = stack_ms;
+            *p_host_thresh = 1;
+            *p_hc_thresh = 1;
+            break;
+
+        case LPM_CLASS_BURSTY:
+            /* Cover a few gaps of a burst, never beyond the configured one */
+            timeout_ms = gap_ms * 4;
+            if (timeout_ms < stack_ms)
+                timeout_ms = stack_ms;
+            if (timeout_ms > base_ms)
+                timeout_ms = base_ms;
+            break;
+
+        case LPM_CLASS_PERIODIC:
+            /* Stay awake across periods so that every packet does not pay
+             * the wake latency, on both host and controller side
+             */
+            timeout_ms = gap_ms * 4;
+            if (timeout_ms < stack_ms)
+                timeout_ms = stack_ms;
+
+            thresh = (gap_ms * 2 + unit_ms - 1) / unit_ms;
+            if (thresh > 255)
+                thresh = 255;
+            if (thresh > *p_host_thresh)
+                *p_host_thresh = (uint8_t) thresh;
+            if (thresh > *p_hc_thresh)
+                *p_hc_thresh = (uint8_t) thresh;
+            break;
+
+        default:
+            timeout_ms = base_ms;
+            break;
+    }
+
+    return timeout_ms;
+}
+
+/*******************************************************************************
+**
+** Function         hw_lpm_policy_cback
+**
+** Description      Callback function for a policy issued sleep mode update.
+**                  The stack did not request it, so lpm_cb is not called.
+**
+** Returns          None
+**
+*******************************************************************************/
+static void hw_lpm_policy_cback(void *p_mem)
+{
+    HC_BT_HDR *p_evt_buf = (HC_BT_HDR *) p_mem;
+    uint8_t *p = (uint8_t *)(p_evt_buf + 1) + HCI_EVT_CMD_CMPL_STATUS_RET_BYTE;
+    bt_vendor_op_result_t status = BT_VND_OP_RESULT_FAIL;
+
+    if (*p == 0)
+    {
+        pthread_mutex_lock(&lpm_policy_mutex);
+        lpm_policy_cb.host_idle_thresh = lpm_policy_cb.tgt_host_idle_thresh;
+        lpm_policy_cb.hc_idle_thresh = lpm_policy_cb.tgt_hc_idle_thresh;
+        lpm_policy_cb.reissues++;
+        pthread_mutex_unlock(&lpm_policy_mutex);
+        status = BT_VND_OP_RESULT_SUCCESS;
+    }
+    else
+    {
+        ALOGW("lpm policy: sleep mode update failed (0x%02x)", *p);
+    }
+
+    if (bt_vendor_cbacks)
+        bt_vendor_cbacks->dealloc(p_evt_buf);
+
+    hw_op_done(status);
+}
+
+/*******************************************************************************
+**
+** Function         hw_lpm_policy_send
+**
+** Description      Re-issue HCI_VSC_WRITE_SLEEP_MODE with the thresholds
+**                  wanted by the policy
+**
+** Returns          TRUE if the command is in flight, FALSE otherwise
+**
+*******************************************************************************/
+static uint8_t hw_lpm_policy_send(void)
+{
+    HC_BT_HDR  *p_buf = NULL;
+    uint8_t    *p;
+    bt_lpm_param_t param;
+    uint8_t enabled;
+
+    param = lpm_param;
+    pthread_mutex_lock(&lpm_policy_mutex);
+    enabled = lpm_policy_cb.enabled;
+    param.host_stack_idle_threshold = lpm_policy_cb.tgt_host_idle_thresh;
+    param.host_controller_idle_threshold = lpm_policy_cb.tgt_hc_idle_thresh;
+    pthread_mutex_unlock(&lpm_policy_mutex);
+
+    if ((enabled == FALSE) || (bt_vendor_cbacks == NULL))
+        return FALSE;
+
+    p_buf = (HC_BT_HDR *) bt_vendor_cbacks->alloc(BT_HC_HDR_SIZE + \
+                                                   HCI_CMD_PREAMBLE_SIZE + \
+                                                   LPM_CMD_PARAM_SIZE);
+    if (p_buf == NULL)
+        return FALSE;
+
+    p_buf->event = MSG_STACK_TO_HC_HCI_CMD;
+    p_buf->offset = 0;
+    p_buf->layer_specific = 0;
+    p_buf->len = HCI_CMD_PREAMBLE_SIZE + LPM_CMD_PARAM_SIZE;
+
+    p = (uint8_t *) (p_buf + 1);
+    UINT16_TO_STREAM(p, HCI_VSC_WRITE_SLEEP_MODE);
+    *p++ = LPM_CMD_PARAM_SIZE; /* parameter length */
+    memcpy(p, &param, LPM_CMD_PARAM_SIZE);
+
+    BTHWDBG("lpm policy: idle thresholds %d/%d", \
+            param.host_stack_idle_threshold, \
+            param.host_controller_idle_threshold);
+
+    if (bt_vendor_cbacks->xmit_cb(HCI_VSC_WRITE_SLEEP_MODE, p_buf, \
+                                  hw_lpm_policy_cback) == FALSE)
+    {
+        bt_vendor_cbacks->dealloc(p_buf);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*******************************************************************************
+**
+** Function         hw_lpm_policy_apply
+**
+** Description      Apply the targets of a traffic class: adjust the BT_WAKE
+**                  hold time, and re-issue the sleep mode command when the
+**                  controller thresholds differ and the last re-issue is not
+**                  too recent. Called with lpm_policy_mutex held, the work
+**                  left to do unlocked is returned through *p_hold_ms
+**                  (UINT32_MAX if unchanged) and *p_reissue.
+**
+** Returns          None
+**
+*******************************************************************************/
+static void hw_lpm_policy_apply(uint8_t lpm_class, uint32_t now_ms,
+                                uint32_t *p_hold_ms, uint8_t *p_reissue)
+{
+    uint8_t host_thresh, hc_thresh;
+    uint32_t timeout_ms, delta_ms;
+
+    timeout_ms = hw_lpm_policy_target(lpm_class, &host_thresh, &hc_thresh);
+
+    if (lpm_class != lpm_policy_cb.cur_class)
+    {
+        BTHWDBG("lpm policy: %s -> %s, idle timeout %d ms", \
+                lpm_class_name[lpm_policy_cb.cur_class], \
+                lpm_class_name[lpm_class], timeout_ms);
+        lpm_policy_cb.cur_class = lpm_class;
+        lpm_policy_cb.class_changes++;
+    }
+
+    /* Ignore timeout drifts below 25% */
+    delta_ms = (timeout_ms > lpm_policy_cb.timeout_ms) ? \
+                    timeout_ms - lpm_policy_cb.timeout_ms : \
+                    lpm_policy_cb.timeout_ms - timeout_ms;
+    if (delta_ms * 4 > lpm_policy_cb.timeout_ms)
+    {
+        lpm_policy_cb.timeout_ms = timeout_ms;
+        *p_hold_ms = hw_lpm_wake_hold(timeout_ms);
+    }
+
+    if ((host_thresh == lpm_policy_cb.host_idle_thresh) && \
+        (hc_thresh == lpm_policy_cb.hc_idle_thresh))
+        return;
+
+    if ((now_ms - lpm_policy_cb.last_reissue_ms) < LPM_POLICY_MIN_REISSUE_MS)
+        return;
+
+    /* Thresholds are read when the update reaches the head of the queue */
+    lpm_policy_cb.tgt_host_idle_thresh = host_thresh;
+    lpm_policy_cb.tgt_hc_idle_thresh = hc_thresh;
+    lpm_policy_cb.last_reissue_ms = now_ms;
+    *p_reissue = TRUE;
+}
+
+/*******************************************************************************
+**
+** Function         hw_lpm_policy_sample
+**
+** Description      Account one gap sample and classify the traffic. Runs in
+**                  the vendor event loop thread.
+**
+** Returns          None
+**
+*******************************************************************************/
+static void hw_lpm_policy_sample(uint32_t gap_ms, uint32_t now_ms)
+{
+    uint32_t avg_ms, dev_ms;
+    uint32_t hold_ms = UINT32_MAX;
+    uint8_t reissue = FALSE;
+    int32_t err;
+    uint8_t lpm_class;
+
+    if (gap_ms > LPM_POLICY_GAP_CAP_MS)
+        gap_ms = LPM_POLICY_GAP_CAP_MS;
+
+    pthread_mutex_lock(&lpm_policy_mutex);
+
+    if (lpm_policy_cb.enabled == FALSE)
+    {
+        pthread_mutex_unlock(&lpm_policy_mutex);
+        return;
+    }
+
+    if (lpm_policy_cb.samples++ == 0)
+    {
+        lpm_policy_cb.gap_avg = gap_ms << LPM_POLICY_EWMA_SHIFT;
+        lpm_policy_cb.gap_dev = 0;
+    }
+    else
+    {
+        err = (int32_t) gap_ms - \
+              (int32_t) (lpm_policy_cb.gap_avg >> LPM_POLICY_EWMA_SHIFT);
+        lpm_policy_cb.gap_avg += err;
+        lpm_policy_cb.gap_dev += ((err < 0) ? -err : err) - \
+                            (lpm_policy_cb.gap_dev >> LPM_POLICY_EWMA_SHIFT);
+    }
+
+    avg_ms = lpm_policy_cb.gap_avg >> LPM_POLICY_EWMA_SHIFT;
+    dev_ms = lpm_policy_cb.gap_dev >> LPM_POLICY_EWMA_SHIFT;
+
+    if (avg_ms >= LPM_POLICY_IDLE_GAP_MS)
+        lpm_class = LPM_CLASS_IDLE;
+    else if ((avg_ms <= LPM_POLICY_PERIODIC_MAX_MS) && (dev_ms * 4 <= avg_ms))
+        lpm_class = LPM_CLASS_PERIODIC;
+    else
+        lpm_class = LPM_CLASS_BURSTY;
+
+    if (lpm_class != lpm_policy_cb.cand_class)
+    {
+        lpm_policy_cb.cand_class = lpm_class;
+        lpm_policy_cb.cand_count = 0;
+    }
+    else if (lpm_policy_cb.cand_count < LPM_POLICY_DWELL)
+    {
+        lpm_policy_cb.cand_count++;
+    }
+    else
+    {
+        /* Stable class: re-evaluate once per dwell period */
+        lpm_policy_cb.cand_count = 0;
+        hw_lpm_policy_apply(lpm_class, now_ms, &hold_ms, &reissue);
+    }
+
+    pthread_mutex_unlock(&lpm_policy_mutex);
+
+    if (hold_ms != UINT32_MAX)
+        upio_set_wake_hold(hold_ms);
+    if (reissue == TRUE)
+        hw_op_enqueue(HW_OP_LPM_POLICY, 0);
+}
+
+/*******************************************************************************
+**
+** Function         hw_lpm_policy_wake
+**
+** Description      First BT_WAKE request after an idle period, posted by
+**                  hw_lpm_set_wake_state: the idle period is one gap sample,
+**                  and the requests are counted per window again. Runs in
+**                  the vendor event loop thread.
+**
+** Returns          None
+**
+*******************************************************************************/
+static void hw_lpm_policy_wake(void *p_data)
+{
+    uint32_t now_ms = hw_now_ms();
+    uint32_t gap_ms;
+
+    /* The requests which woke us up belong to the idle gap */
+    __atomic_store_n(&lpm_policy_requests, 0, __ATOMIC_SEQ_CST);
+
+    pthread_mutex_lock(&lpm_policy_mutex);
+    if (lpm_policy_cb.enabled == FALSE)
+    {
+        /* LPM turned off since this was posted */
+        pthread_mutex_unlock(&lpm_policy_mutex);
+        return;
+    }
+    gap_ms = now_ms - lpm_policy_cb.last_active_ms;
+    lpm_policy_cb.window_ms = now_ms;
+    lpm_policy_cb.last_active_ms = now_ms;
+    pthread_mutex_unlock(&lpm_policy_mutex);
+
+    vnd_loop_timer_start(lpm_policy_timer, LPM_POLICY_WINDOW_MS, \
+                         LPM_POLICY_WINDOW_MS);
+    hw_lpm_policy_sample(gap_ms, now_ms);
+}
+
+/*******************************************************************************
+**
+** Function         hw_lpm_policy_tick
+**
+** Description      End of a counting window. A window with traffic is one
+**                  sample of its average gap. An empty one stops the window
+**                  timer until the next request, so that an idle link does
+**                  not wake the host up. Runs in the vendor event loop
+**                  thread.
+**
+** Returns          None
+**
+*******************************************************************************/
+static void hw_lpm_policy_tick(void *p_data)
+{
+    uint32_t now_ms = hw_now_ms();
+    uint32_t requests, elapsed_ms;
+
+    requests = __atomic_exchange_n(&lpm_policy_requests, 0, __ATOMIC_SEQ_CST);
+
+    if (requests == 0)
+    {
+        vnd_loop_timer_stop(lpm_policy_timer);
+        __atomic_store_n(&lpm_policy_idle, TRUE, __ATOMIC_SEQ_CST);
+
+        /* A request counted before it could see the idle flag posts
+         * nothing: take it over */
+        if ((__atomic_load_n(&lpm_policy_requests, __ATOMIC_SEQ_CST) != 0) && \
+            (__atomic_exchange_n(&lpm_policy_idle, FALSE, __ATOMIC_SEQ_CST)))
+            hw_lpm_policy_wake(NULL);
+        return;
+    }
+
+    pthread_mutex_lock(&lpm_policy_mutex);
+    elapsed_ms = now_ms - lpm_policy_cb.window_ms;
+    lpm_policy_cb.window_ms = now_ms;
+    lpm_policy_cb.last_active_ms = now_ms;
+    pthread_mutex_unlock(&lpm_policy_mutex);
+
+    hw_lpm_policy_sample(elapsed_ms / requests, now_ms);
+}
+
+/*******************************************************************************
+**
+** Function         hw_lpm_policy_reset
+**
+** Description      Restart the policy from the configured parameters when
+**                  LPM is turned on or off. It only runs while
+**                  LpmAdaptivePolicy is set.
+**
+** Returns          None
+**
+*******************************************************************************/
+static void hw_lpm_policy_reset(uint8_t turn_on)
+{
+    uint32_t now_ms = hw_now_ms();
+    uint32_t hold_ms;
+    uint8_t policy_on = (turn_on && \
+                __atomic_load_n(&lpm_policy_conf, __ATOMIC_RELAXED)) ? \
+                TRUE : FALSE;
+
+    /* Counting stops first, a window or wake in progress then finds the
+     * policy disabled */
+    __atomic_store_n(&lpm_policy_counting, FALSE, __ATOMIC_SEQ_CST);
+    vnd_loop_timer_stop(lpm_policy_timer);
+
+    pthread_mutex_lock(&lpm_policy_mutex);
+
+    if (lpm_policy_cb.enabled == TRUE)
+    {
+        ALOGI("lpm policy: %d class changes, %d sleep mode updates", \
+              lpm_policy_cb.class_changes, lpm_policy_cb.reissues);
+    }
+
+    memset(&lpm_policy_cb, 0, sizeof(bt_lpm_policy_cb_t));
+    lpm_policy_cb.cur_class = LPM_CLASS_DEFAULT;
+    lpm_policy_cb.cand_class = LPM_CLASS_DEFAULT;
+    lpm_policy_cb.host_idle_thresh = lpm_param.host_stack_idle_threshold;
+    lpm_policy_cb.hc_idle_thresh = lpm_param.host_controller_idle_threshold;
+    lpm_policy_cb.timeout_ms = hw_lpm_base_idle_timeout();
+    lpm_policy_cb.last_reissue_ms = now_ms - LPM_POLICY_MIN_REISSUE_MS;
+    lpm_policy_cb.last_active_ms = now_ms;
+
+    /* With the policy the stack gets the shortest timeout, hold BT_WAKE
+     * for the rest. Without it, only make up for a shorter timeout given
+     * to the stack while the policy was on. */
+    hold_ms = (turn_on) ? hw_lpm_wake_hold(lpm_policy_cb.timeout_ms) : 0;
+
+    lpm_policy_cb.enabled = policy_on;
+
+    pthread_mutex_unlock(&lpm_policy_mutex);
+
+    upio_set_wake_hold(hold_ms);
+
+    if (policy_on == FALSE)
+        return;
+
+    if ((lpm_policy_timer == NULL) && \
+        ((lpm_policy_timer = vnd_loop_timer_new(hw_lpm_policy_tick, NULL)) \
+                                                                    == NULL))
+    {
+        ALOGW("lpm policy: no window timer, policy not applied");
+        return;
+    }
+
+    /* The first request starts the counting windows */
+    __atomic_store_n(&lpm_policy_requests, 0, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&lpm_policy_idle, TRUE, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&lpm_policy_counting, TRUE, __ATOMIC_SEQ_CST);
+}
+
+#if (SCO_CFG_INCLUDED == TRUE) || (SCO_USE_I2S_INTERFACE == TRUE)
+/*****************************************************************************
+**   SCO Configuration Static Functions
+*****************************************************************************/
+
+/*
+ * The parameters of the SCO configuration VSCs are precomputed for both
+ * codecs whenever the configuration changes, so that switching codec (on the
+ * HFP call setup path) does no more than pick a set. The VSCs of a request are
+ * sent back-to-back and the request completes with the last Command Complete.
+ *
+ * The SCO and WBS requests of the stack mostly repeat the settings the
+ * controller already runs with. The parameters of each VSC are kept once
+ * acknowledged and only VSCs carrying different ones are sent. The cache is
+ * dropped whenever the controller gets reset, i.e. on each configuration
+ * (including the one following a Hardware Error) and on the epilog.
+ */
+
+/*******************************************************************************
+**
+** Function         hw_sco_params_set
+**
+** Description      Set the parameters of a VSC in a SCO parameter set
+**
+** Returns          None
+**
+*******************************************************************************/
+static void hw_sco_params_set(hw_sco_params_t *p_params, uint8_t vsc, \
+                              const uint8_t *p_param, uint8_t len)
+{
+    memcpy(p_params->param[vsc], p_param, len);
+    p_params->len[vsc] = len;
+}
+
+/*******************************************************************************
+**
+** Function         hw_sco_params_build
+**
+** Description      Precompute the narrowband and wideband SCO parameter sets
+**                  from the configured ones, if they changed. The conf file
+**                  can be reloaded at any time, see hw_pcm_set_param.
+**
+** Returns          None
+**
+*******************************************************************************/
+static void hw_sco_params_build(void)
+{
+    hw_sco_params_t *p_nbs = &hw_sco_cb.codec[FALSE];
+    hw_sco_params_t *p_wbs = &hw_sco_cb.codec[TRUE];
+
+    pthread_mutex_lock(&hw_sco_cb.mutex);
+    if (hw_sco_cb.stale == FALSE)
+    {
+        pthread_mutex_unlock(&hw_sco_cb.mutex);
+        return;
+    }
+    hw_sco_cb.stale = FALSE;
+
+    memset(p_nbs, 0, sizeof(*p_nbs));
+    hw_sco_params_set(p_nbs, HW_SCO_VSC_MSBC, msbc_disable_param, \
+                      MSBC_DISABLE_PARAM_SIZE);
+    hw_sco_params_set(p_nbs, HW_SCO_VSC_PCM, bt_pcm_sco_param, \
+                      SCO_PCM_PARAM_SIZE);
+    hw_sco_params_set(p_nbs, HW_SCO_VSC_PCM_FORMAT, bt_pcm_data_fmt_param, \
+                      PCM_DATA_FORMAT_PARAM_SIZE);
+#if (SCO_USE_I2S_INTERFACE == TRUE)
+    hw_sco_params_set(p_nbs, HW_SCO_VSC_I2S, bt_i2s_sco_param, \
+                      SCO_I2SPCM_PARAM_SIZE);
+#endif
+
+    /* Wideband differs in the clocks, see vnd_conf_keys.h for the
+     * indexes */
+    *p_wbs = *p_nbs;
+    hw_sco_params_set(p_wbs, HW_SCO_VSC_MSBC, msbc_enable_param, \
+                      MSBC_ENABLE_PARAM_SIZE);
+    p_wbs->param[HW_SCO_VSC_PCM][1] = SCO_PCM_IF_CLOCK_RATE_WBS;
+#if (SCO_USE_I2S_INTERFACE == TRUE)
+    p_wbs->param[HW_SCO_VSC_I2S][2] = SCO_I2SPCM_IF_SAMPLE_RATE_WBS;
+    p_wbs->param[HW_SCO_VSC_I2S][3] = SCO_I2SPCM_IF_CLOCK_RATE_WBS;
+
+    /* Narrowband audio resampled by the host: same I2S settings for both */
+    if (hw_sco_cb.i2s_resample == TRUE)
+    {
+        p_wbs->param[HW_SCO_VSC_I2S][2] = SCO_I2SPCM_IF_SAMPLE_RATE_16K;
+        hw_sco_params_set(p_nbs, HW_SCO_VSC_I2S, p_wbs->param[HW_SCO_VSC_I2S], \
+                          SCO_I2SPCM_PARAM_SIZE);
+    }
+#endif
+    pthread_mutex_unlock(&hw_sco_cb.mutex);
+}
+
+
+/*******************************************************************************
+**
+** Function         hw_sco_seq_done
+**
+** Description      Drop a reference on the VSC sequence in progress. The
+**                  last one finishes the sequence.
+**
+** Returns          TRUE if the sequence finished, FALSE otherwise
+**
+*******************************************************************************/
+static uint8_t hw_sco_seq_done(bt_vendor_op_result_t *p_status)
+{
+    uint8_t last = FALSE;
+    uint32_t elapsed_ms;
+    const char *p_name;
+    char tmp[16];
+
+    pthread_mutex_lock(&hw_sco_cb.mutex);
+    if ((hw_sco_cb.in_flight > 0) && (--hw_sco_cb.in_flight == 0))
+        last = TRUE;
+    *p_status = hw_sco_cb.status;
+    pthread_mutex_unlock(&hw_sco_cb.mutex);
+
+    if (last == FALSE)
+        return FALSE;
+
+    elapsed_ms = hw_now_ms() - hw_sco_cb.start_ms;
+    p_name = (hw_sco_cb.op == HW_OP_SCO_CFG) ? "SCO configuration" : \
+             (hw_sco_cb.msbc == TRUE) ? "switch to mSBC" : "switch to CVSD";
+    ALOGI("%s %s in %u ms, %d VSC(s) sent", p_name, \
+          (*p_status == BT_VND_OP_RESULT_SUCCESS) ? "done" : "failed", \
+          elapsed_ms, hw_sco_cb.sent);
+
+    if (hw_sco_cb.op == HW_OP_WBS_CFG)
+    {
+        snprintf(tmp, sizeof(tmp), "%u", elapsed_ms);
+        lct_log(CT_EV_INFO, "cws.bt", "codec_switch_time", 0, \
+                (hw_sco_cb.msbc == TRUE) ? "msbc" : "cvsd", tmp);
+    }
+
+    return TRUE;
+}
+
+/*******************************************************************************
+**
+** Function         hw_sco_seq_start
+**
+** Description      Send back-to-back the VSCs of a sequence whose parameters
+**                  differ from the acknowledged ones, for the codec set in
+**                  hw_sco_cb.msbc. If none is left in flight on return the
+**                  sequence finished and *p_status is set.
+**
+** Returns          TRUE if commands are in flight, FALSE otherwise
+**
+*******************************************************************************/
+static uint8_t hw_sco_seq_start(uint8_t op, const uint8_t *p_seq, \
+                                uint8_t seq_len, \
+                                bt_vendor_op_result_t *p_status)
+{
+    const hw_sco_params_t *p_want;
+    HC_BT_HDR *p_buf;
+    uint8_t *p, vsc, len, i, j;
+    char str[HW_SCO_PARAM_MAX * 5 + 1];
+    int n;
+
+    if (hw_sco_cb.stale == TRUE)
+        hw_sco_params_build();
+    p_want = &hw_sco_cb.codec[hw_sco_cb.msbc];
+
+    hw_sco_cb.op = op;
+    hw_sco_cb.start_ms = hw_now_ms();
+    hw_sco_cb.sent = 0;
+    hw_sco_cb.status = BT_VND_OP_RESULT_SUCCESS;
+    /* Held by the sender until all VSCs are out */
+    hw_sco_cb.in_flight = 1;
+
+    for (i = 0; i < seq_len; i++)
+    {
+        vsc = p_seq[i];
+        if ((len = p_want->len[vsc]) == 0)
+            continue;
+
+        if ((hw_sco_cb.acked.len[vsc] == len) && \
+            (memcmp(hw_sco_cb.acked.param[vsc], p_want->param[vsc], len) == 0))
+        {
+            BTHWDBG("%s unchanged, skipped", hw_sco_vsc_name[vsc]);
+            continue;
+        }
+
+        p_buf = NULL;
+        if (bt_vendor_cbacks)
+            p_buf = (HC_BT_HDR *) bt_vendor_cbacks->alloc(BT_HC_HDR_SIZE + \
+                                                HCI_CMD_PREAMBLE_SIZE + len);
+        if (p_buf == NULL)
+        {
+            pthread_mutex_lock(&hw_sco_cb.mutex);
+            hw_sco_cb.status = BT_VND_OP_RESULT_FAIL;
+            pthread_mutex_unlock(&hw_sco_cb.mutex);
+            break;
+        }
 
-    p = (uint8_t *)(p_evt_buf + 1) + HCI_EVT_CMD_CMPL_OPCODE;
-    STREAM_TO_UINT16(opcode,p);
-    if (bt_vendor_cbacks)
-        p_buf = (HC_BT_HDR *) bt_vendor_cbacks->alloc(BT_HC_HDR_SIZE + \
-                                                       HCI_CMD_MAX_LEN);
-    if (p_buf != NULL) {
         p_buf->event = MSG_STACK_TO_HC_HCI_CMD;
         p_buf->offset = 0;
         p_buf->layer_specific = 0;
-        p_buf->len = HCI_CMD_PREAMBLE_SIZE;
+        p_buf->len = HCI_CMD_PREAMBLE_SIZE + len;
+
+        p = (uint8_t *) (p_buf + 1);
+        UINT16_TO_STREAM(p, hw_sco_vsc_opcode[vsc]);
+        *p++ = len;
+        memcpy(p, p_want->param[vsc], len);
+
+        hw_sco_params_set(&hw_sco_cb.pending, vsc, p_want->param[vsc], len);
+
+        for (j = 0, n = 0; j < len; j++)
+            n += snprintf(str + n, sizeof(str) - n, (j) ? ", %d" : "%d", \
+                          p_want->param[vsc][j]);
+        ALOGI("%s configure {%s}", hw_sco_vsc_name[vsc], str);
+
+        pthread_mutex_lock(&hw_sco_cb.mutex);
+        hw_sco_cb.in_flight++;
+        pthread_mutex_unlock(&hw_sco_cb.mutex);
+
+        if (bt_vendor_cbacks->xmit_cb(hw_sco_vsc_opcode[vsc], p_buf, \
+                                      hw_sco_cfg_cback) == FALSE)
+        {
+            bt_vendor_cbacks->dealloc(p_buf);
+            pthread_mutex_lock(&hw_sco_cb.mutex);
+            hw_sco_cb.in_flight--;
+            hw_sco_cb.status = BT_VND_OP_RESULT_FAIL;
+            pthread_mutex_unlock(&hw_sco_cb.mutex);
+            break;
+        }
+        hw_sco_cb.sent++;
+    }
+
+    return (hw_sco_seq_done(p_status) == TRUE) ? FALSE : TRUE;
+}
+
+/*******************************************************************************
+**
+** Function         hw_sco_cfg_cback
+**
+** Description      Callback function for SCO configuration and mSBC codec
+**                  enable/disable VSCs
+**
+** Returns          None
+**
+*******************************************************************************/
+void hw_sco_cfg_cback(void *p_mem)
+{
+    HC_BT_HDR *p_evt_buf = (HC_BT_HDR *) p_mem;
+    uint8_t     *p, hci_status, vsc;
+    uint16_t    opcode;
+    bt_vendor_op_result_t status;
 
-        switch (hw_sco_cb_state) {
-
-            case HW_SCO_PCM: {
-                BTHWDBG("HW_SCO_PCM");
-                if (opcode == HCI_VSC_WRITE_SCO_PCM_INT_PARAM) {
-                    p_buf->len += PCM_DATA_FORMAT_PARAM_SIZE;
-                    p = (uint8_t *) (p_buf + 1);
-                    UINT16_TO_STREAM(p, HCI_VSC_WRITE_PCM_DATA_FORMAT_PARAM);
-                    *p++ = PCM_DATA_FORMAT_PARAM_SIZE;
-                    memcpy(p, &bt_pcm_data_fmt_param, PCM_DATA_FORMAT_PARAM_SIZE);
-                    hw_sco_cb_state = HW_SCO_PCM_FORMAT;
-                    if ((ret = bt_vendor_cbacks->xmit_cb(HCI_VSC_WRITE_PCM_DATA_FORMAT_PARAM,\
-                                           p_buf, hw_sco_cfg_cback)) == FALSE)
-                   {
-                       bt_vendor_cbacks->dealloc(p_buf);
-                   }
-                }
-            }
-            break;
+    hci_status = *((uint8_t *)(p_evt_buf + 1) + HCI_EVT_CMD_CMPL_STATUS_RET_BYTE);
+    p = (uint8_t *)(p_evt_buf + 1) + HCI_EVT_CMD_CMPL_OPCODE;
+    STREAM_TO_UINT16(opcode,p);
 
-            case HW_SCO_PCM_FORMAT: {
-                BTHWDBG("HW_SCO_PCO_FORMAT");
-                if (opcode == HCI_VSC_WRITE_PCM_DATA_FORMAT_PARAM) {
-#if (SCO_USE_I2S_INTERFACE == TRUE)
-                    p_buf->len += SCO_I2SPCM_PARAM_SIZE;
-                    p = (uint8_t *) (p_buf + 1);
-                    UINT16_TO_STREAM(p, HCI_VSC_WRITE_I2SPCM_INTERFACE_PARAM);
-                    *p++ = SCO_I2SPCM_PARAM_SIZE;
-                    memcpy(p, &bt_i2s_sco_param, SCO_I2SPCM_PARAM_SIZE);
-                    ALOGI("SCO over I2SPCM interface {%d, %d, %d, %d}",
-                        bt_i2s_sco_param[0], bt_i2s_sco_param[1], bt_i2s_sco_param[2], bt_i2s_sco_param[3]);
-                    hw_sco_cb_state = HW_SCO_I2S;
-                    if ((ret = bt_vendor_cbacks->xmit_cb(HCI_VSC_WRITE_I2SPCM_INTERFACE_PARAM,\
-                                           p_buf, hw_sco_cfg_cback)) == FALSE)
-                   {
-                       bt_vendor_cbacks->dealloc(p_buf);
-                   }
-                }
-            }
+    for (vsc = 0; vsc < HW_SCO_VSC_MAX; vsc++)
+        if (hw_sco_vsc_opcode[vsc] == opcode)
             break;
 
-            case HW_SCO_I2S: {
-                BTHWDBG("HW_SCO_I2S");
-                bt_vendor_cbacks->dealloc(p_buf);
-                if (opcode == HCI_VSC_WRITE_I2SPCM_INTERFACE_PARAM) {
-#endif // (SCO_USE_I2S_INTERFACE == TRUE)
-                    bt_vendor_cbacks->scocfg_cb(BT_VND_OP_RESULT_SUCCESS);
-                }
-            }
-            break;
-        }
+    if (vsc < HW_SCO_VSC_MAX)
+    {
+        BTHWDBG("%s status %d", hw_sco_vsc_name[vsc], hci_status);
+
+        /* Unknown again unless acknowledged */
+        hw_sco_cb.acked.len[vsc] = 0;
+        if (hci_status == 0)
+            hw_sco_params_set(&hw_sco_cb.acked, vsc, \
+                              hw_sco_cb.pending.param[vsc], \
+                              hw_sco_cb.pending.len[vsc]);
+    }
+    else
+    {
+        pthread_mutex_lock(&hw_sco_cb.mutex);
+        hw_sco_cb.status = BT_VND_OP_RESULT_FAIL;
+        pthread_mutex_unlock(&hw_sco_cb.mutex);
     }
+
     /* Free the RX event buffer */
     if (bt_vendor_cbacks)
         bt_vendor_cbacks->dealloc(p_evt_buf);
+
+    if (hw_sco_seq_done(&status) == TRUE)
+        hw_op_done(status);
 }
-#endif // SCO_CFG_INCLUDED
+#endif // (SCO_CFG_INCLUDED == TRUE) || (SCO_USE_I2S_INTERFACE == TRUE)
 
 /*****************************************************************************
 **   Hardware Configuration Interface Functions
@@ -1160,14 +2550,53 @@ void hw_sco_cfg_cback(void *p_mem)
 *******************************************************************************/
 void hw_config_start(void)
 {
-    HC_BT_HDR  *p_buf = NULL;
-    uint8_t     *p;
-
     hw_cfg_cb.state = 0;
-    hw_cfg_cb.fw_fd = -1;
+    hw_cfg_cb.fw_patch = FALSE;
+    hw_cfg_cb.fw_rec = 0;
     hw_cfg_cb.f_set_baud_2 = FALSE;
+    hw_cfg_cb.complete = FALSE;
+    hw_cfg_cb.start_ms = hw_now_ms();
+
+    /* HCI_RESET reverts the SCO settings */
+    memset(hw_sco_cb.acked.len, 0, sizeof(hw_sco_cb.acked.len));
+    hw_sco_cb.msbc = FALSE;
+#if (SCO_CFG_INCLUDED == TRUE) || (SCO_USE_I2S_INTERFACE == TRUE)
+    if (hw_sco_cb.stale == TRUE)
+        hw_sco_params_build();
+#endif
+
+    /* Right after the controller failed, it is the same one: skip its
+     * identification, provided its patch is still the configured one.
+     * Any other start, e.g. a BT off/on, identifies it. */
+    hw_cfg_cb.recover = (hw_cfg_cb.warm == FALSE) && hw_cfg_cb.hw_error && \
+                        hw_patch_cache_valid(hw_cfg_cb.local_chip_name);
+    hw_cfg_cb.hw_error = FALSE;
+    hw_cfg_cb.p_mode = (hw_cfg_cb.warm) ? "warm" : \
+                       (hw_cfg_cb.recover) ? "recovery" : "cold";
+
+    /* Send HCI_RESET as soon as the controller is out of reset. On timeout
+     * go ahead anyway and leave it to the HCI_RESET retries. */
+    if (hw_cfg_cb.warm == FALSE)
+        userial_vendor_wait_ready(hw_config_ready);
+    else
+        hw_config_ready(-1);
+}
+
+/*******************************************************************************
+**
+** Function        hw_config_ready
+**
+** Description     Controller out of reset, start from sending HCI_RESET
+**
+** Returns         None
+**
+*******************************************************************************/
+static void hw_config_ready(int ready_ms)
+{
+    HC_BT_HDR  *p_buf = NULL;
+    uint8_t     *p;
 
-    /* Start from sending HCI_RESET */
+    hw_cfg_cb.ready_ms = ready_ms;
 
     if (bt_vendor_cbacks)
     {
@@ -1192,6 +2621,8 @@ void hw_config_start(void)
     }
     else
     {
+        hw_cfg_cb.warm = FALSE;
+
         if (bt_vendor_cbacks)
         {
             ALOGE("vendor lib fw conf aborted [no buffer]");
@@ -1200,6 +2631,41 @@ void hw_config_start(void)
     }
 }
 
+/*******************************************************************************
+**
+** Function        hw_config_warm_start
+**
+** Description     Kick off controller initialization after a warm restart.
+**                 The controller kept its patch and baud rate, so HCI_RESET
+**                 is followed by the BD_ADDR only.
+**
+** Returns         None
+**
+*******************************************************************************/
+void hw_config_warm_start(void)
+{
+    ALOGI("vendor lib fwcfg warm start at %i", UART_TARGET_BAUD_RATE);
+
+    hw_cfg_cb.warm = TRUE;
+    hw_config_start();
+}
+
+/*******************************************************************************
+**
+** Function        hw_config_is_complete
+**
+** Description     Tell if the last controller initialization succeeded, that
+**                 is whether the controller is patched and at the target
+**                 baud rate
+**
+** Returns         TRUE/FALSE
+**
+*******************************************************************************/
+uint8_t hw_config_is_complete(void)
+{
+    return hw_cfg_cb.complete;
+}
+
 /*******************************************************************************
 **
 ** Function        hw_config_cleanup
@@ -1211,23 +2677,85 @@ void hw_config_start(void)
 *******************************************************************************/
 void hw_config_cleanup(void)
 {
-    if ((hw_cfg_cb.fw_fd != -1) && (hw_cfg_cb.fw_fd > 2 /*stderr*/))
+    /* the firmware patch cache is kept for the next configuration */
+    hw_cfg_cb.fw_patch = FALSE;
+    hw_cfg_cb.warm = FALSE;
+    memset(hw_sco_cb.acked.len, 0, sizeof(hw_sco_cb.acked.len));
+
+    __atomic_store_n(&lpm_policy_counting, FALSE, __ATOMIC_SEQ_CST);
+    vnd_loop_timer_free(lpm_policy_timer);
+    lpm_policy_timer = NULL;
+
+    /* Drop queued vendor ops, their completions will never come */
+    pthread_mutex_lock(&hw_op_cb.mutex);
+    hw_op_cb.head = 0;
+    hw_op_cb.count = 0;
+    hw_op_cb.busy = FALSE;
+    pthread_mutex_unlock(&hw_op_cb.mutex);
+}
+
+/*******************************************************************************
+**
+** Function        hw_lpm_log_stats
+**
+** Description     Report the BT_WAKE and HOST_WAKE statistics of the LPM
+**                 session being closed
+**
+** Returns         None
+**
+*******************************************************************************/
+static void hw_lpm_log_stats(void)
+{
+    upio_proc_stats_t proc_stats;
+    upio_wake_stats_t wake_stats;
+    upio_host_wake_stats_t host_wake_stats;
+    char tmp[12];
+    char tmp2[12];
+
+    upio_get_wake_stats(&wake_stats);
+    ALOGI("lpm: BT_WAKE %u asserts, %u deasserts, %u/%u deasserts " \
+          "cancelled, window %u ms", wake_stats.asserts, wake_stats.deasserts, \
+          wake_stats.deasserts_cancelled, wake_stats.deassert_requests, \
+          wake_stats.delay_ms);
+
+    snprintf(tmp, sizeof(tmp), "%u", wake_stats.asserts);
+    snprintf(tmp2, sizeof(tmp2), "%u", wake_stats.deasserts_cancelled);
+    lct_log(CT_EV_INFO, "cws.bt", "lpm_bt_wake", 0, tmp, tmp2);
+
+    upio_get_proc_stats(&proc_stats);
+    if (proc_stats.writes > 0)
+    {
+        ALOGI("lpm: %u proc writes, %u per second", proc_stats.writes, \
+              proc_stats.writes_per_sec);
+
+        snprintf(tmp, sizeof(tmp), "%u", proc_stats.writes_per_sec);
+        lct_log(CT_EV_INFO, "cws.bt", "lpm_proc_rate", 0, tmp);
+    }
+
+    upio_get_host_wake_stats(&host_wake_stats);
+    if (host_wake_stats.wakes > 0)
     {
-        close(hw_cfg_cb.fw_fd);
-        hw_cfg_cb.fw_fd = -1;
+        ALOGI("lpm: HOST_WAKE %u wakes, %u with data, latency %u/%u/%u us " \
+              "(min/avg/max)", host_wake_stats.wakes, \
+              host_wake_stats.first_bytes, host_wake_stats.latency_min_us, \
+              host_wake_stats.latency_avg_us, host_wake_stats.latency_max_us);
+
+        snprintf(tmp, sizeof(tmp), "%u", host_wake_stats.wakes);
+        snprintf(tmp2, sizeof(tmp2), "%u", host_wake_stats.latency_avg_us);
+        lct_log(CT_EV_INFO, "cws.bt", "lpm_host_wake", 0, tmp, tmp2);
     }
 }
 
 /*******************************************************************************
 **
-** Function        hw_lpm_enable
+** Function        hw_lpm_send
 **
-** Description     Enalbe/Disable LPM
+** Description     Send the LPM enable/disable command
 **
-** Returns         TRUE/FALSE
+** Returns         TRUE if the command is in flight, FALSE otherwise
 **
 *******************************************************************************/
-uint8_t hw_lpm_enable(uint8_t turn_on)
+static uint8_t hw_lpm_send(uint8_t turn_on)
 {
     HC_BT_HDR  *p_buf = NULL;
     uint8_t     *p;
@@ -1251,28 +2779,46 @@ uint8_t hw_lpm_enable(uint8_t turn_on)
 
         if (turn_on)
         {
+            hw_lpm_conf_apply();
             memcpy(p, &lpm_param, LPM_CMD_PARAM_SIZE);
             upio_set(UPIO_LPM_MODE, UPIO_ASSERT, 0);
+            upio_host_wake_start(lpm_param.host_wake_polarity);
         }
         else
         {
             memset(p, 0, LPM_CMD_PARAM_SIZE);
+            hw_lpm_log_stats();
             upio_set(UPIO_LPM_MODE, UPIO_DEASSERT, 0);
+            upio_host_wake_stop();
         }
-        if (!pthread_mutex_lock(&lpm_mutex)) {
-            if ((ret = bt_vendor_cbacks->xmit_cb(HCI_VSC_WRITE_SLEEP_MODE, p_buf, \
-                                        hw_lpm_ctrl_cback)) == FALSE)
-            {
-                bt_vendor_cbacks->dealloc(p_buf);
-                pthread_mutex_unlock(&lpm_mutex);
-            }
-        }
-        if (!turn_on)
+        hw_lpm_policy_reset(turn_on);
+
+        if ((ret = bt_vendor_cbacks->xmit_cb(HCI_VSC_WRITE_SLEEP_MODE, p_buf, \
+                                    hw_lpm_ctrl_cback)) == FALSE)
         {
-            pthread_mutex_unlock(&lpm_mutex); //sleep doesn't have a callback to unlock
+            bt_vendor_cbacks->dealloc(p_buf);
         }
     }
 
+    return ret;
+}
+
+/*******************************************************************************
+**
+** Function        hw_lpm_enable
+**
+** Description     Enalbe/Disable LPM. The request is queued behind vendor
+**                 commands in flight and completes through lpm_cb.
+**
+** Returns         TRUE/FALSE
+**
+*******************************************************************************/
+uint8_t hw_lpm_enable(uint8_t turn_on)
+{
+    uint8_t ret;
+
+    ret = hw_op_enqueue((turn_on) ? HW_OP_LPM_ENABLE : HW_OP_LPM_DISABLE, 0);
+
     if ((ret == FALSE) && bt_vendor_cbacks)
         bt_vendor_cbacks->lpm_cb(BT_VND_OP_RESULT_FAIL);
 
@@ -1283,7 +2829,9 @@ uint8_t hw_lpm_enable(uint8_t turn_on)
 **
 ** Function        hw_lpm_get_idle_timeout
 **
-** Description     Calculate idle time based on host stack idle threshold
+** Description     Calculate idle time based on host stack idle threshold.
+**                 With the adaptive policy this is the shortest per-class
+**                 timeout, the remainder is held by upio.
 **
 ** Returns         idle timeout value
 **
@@ -1292,17 +2840,12 @@ uint32_t hw_lpm_get_idle_timeout(void)
 {
     uint32_t timeout_ms;
 
-    /* set idle time to be LPM_IDLE_TIMEOUT_MULTIPLE times of
-     * host stack idle threshold (in 300ms/25ms)
-     */
-    timeout_ms = (uint32_t)lpm_param.host_stack_idle_threshold \
-                            * LPM_IDLE_TIMEOUT_MULTIPLE;
-
-    if (strstr(hw_cfg_cb.local_chip_name, "BCM4325") != NULL)
-        timeout_ms *= 25; // 12.5 or 25 ?
+    if (__atomic_load_n(&lpm_policy_conf, __ATOMIC_RELAXED))
+        timeout_ms = hw_lpm_stack_idle_timeout();
     else
-        timeout_ms *= 300;
+        timeout_ms = hw_lpm_base_idle_timeout();
 
+    __atomic_store_n(&lpm_stack_timeout_ms, timeout_ms, __ATOMIC_RELAXED);
     return timeout_ms;
 }
 
@@ -1319,58 +2862,51 @@ void hw_lpm_set_wake_state(uint8_t wake_assert)
 {
     uint8_t state = (wake_assert) ? UPIO_ASSERT : UPIO_DEASSERT;
 
+    /* Count only, the policy samples the count in the vendor event loop.
+     * The loop is only woken up by the first request after an idle period. */
+    if (wake_assert && \
+        __atomic_load_n(&lpm_policy_counting, __ATOMIC_RELAXED))
+    {
+        __atomic_fetch_add(&lpm_policy_requests, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&lpm_policy_idle, __ATOMIC_SEQ_CST) && \
+            __atomic_exchange_n(&lpm_policy_idle, FALSE, __ATOMIC_SEQ_CST))
+            vnd_loop_post(hw_lpm_policy_wake, NULL);
+    }
+
     upio_set(UPIO_BT_WAKE, state, lpm_param.bt_wake_polarity);
 }
 
 #if (SCO_CFG_INCLUDED == TRUE)
+/*******************************************************************************
+**
+** Function         hw_sco_send
+**
+** Description      Send the first SCO configuration command not matching
+**                  the controller settings
+**
+** Returns          TRUE if the command is in flight, FALSE otherwise
+**
+*******************************************************************************/
+static uint8_t hw_sco_send(bt_vendor_op_result_t *p_status)
+{
+    return hw_sco_seq_start(HW_OP_SCO_CFG, hw_sco_seq, sizeof(hw_sco_seq), \
+                            p_status);
+}
+
 /*******************************************************************************
 **
 ** Function         hw_sco_config
 **
-** Description      Configure SCO related hardware settings
+** Description      Configure SCO related hardware settings. The request is
+**                  queued behind vendor commands in flight and completes
+**                  through scocfg_cb.
 **
 ** Returns          None
 **
 *******************************************************************************/
 void hw_sco_config(void)
 {
-    HC_BT_HDR  *p_buf = NULL;
-    uint8_t     *p, ret;
-
-    uint16_t cmd_u16 = HCI_CMD_PREAMBLE_SIZE + SCO_PCM_PARAM_SIZE;
-
-    if (bt_vendor_cbacks)
-        p_buf = (HC_BT_HDR *) bt_vendor_cbacks->alloc(BT_HC_HDR_SIZE+cmd_u16);
-
-    if (p_buf)
-    {
-        p_buf->event = MSG_STACK_TO_HC_HCI_CMD;
-        p_buf->offset = 0;
-        p_buf->layer_specific = 0;
-        p_buf->len = cmd_u16;
-
-        p = (uint8_t *) (p_buf + 1);
-        UINT16_TO_STREAM(p, HCI_VSC_WRITE_SCO_PCM_INT_PARAM);
-        *p++ = SCO_PCM_PARAM_SIZE;
-        memcpy(p, &bt_pcm_sco_param, SCO_PCM_PARAM_SIZE);
-        cmd_u16 = HCI_VSC_WRITE_SCO_PCM_INT_PARAM;
-        ALOGI("SCO PCM configure {%d, %d, %d, %d, %d}",
-           bt_pcm_sco_param[0], bt_pcm_sco_param[1], bt_pcm_sco_param[2], bt_pcm_sco_param[3], \
-           bt_pcm_sco_param[4]);
-
-        hw_sco_cb_state = HW_SCO_PCM;
-
-        if ((ret=bt_vendor_cbacks->xmit_cb(cmd_u16, p_buf, hw_sco_cfg_cback)) \
-             == FALSE)
-        {
-            bt_vendor_cbacks->dealloc(p_buf);
-            pthread_mutex_unlock(&lpm_mutex);
-        }
-        else
-            return;
-    }
-
-    if (bt_vendor_cbacks)
+    if ((hw_op_enqueue(HW_OP_SCO_CFG, 0) == FALSE) && bt_vendor_cbacks)
     {
         ALOGE("vendor lib scocfg aborted");
         bt_vendor_cbacks->scocfg_cb(BT_VND_OP_RESULT_FAIL);
@@ -1381,143 +2917,46 @@ void hw_sco_config(void)
 #if (SCO_USE_I2S_INTERFACE == TRUE)
 /*******************************************************************************
 **
-** Function         hw_enable_mSBC_codec_cback
+** Function         hw_wbs_send
 **
-** Description      Callback function for enabling/disabling mSBC codec
+** Description      Send the first mSBC codec enable/disable command not
+**                  matching the controller settings
 **
-** Returns          None
+** Returns          TRUE if the command is in flight, FALSE otherwise
 **
 *******************************************************************************/
-void hw_enable_mSBC_codec_cback(void *p_mem)
+static uint8_t hw_wbs_send(uint8_t state, bt_vendor_op_result_t *p_status)
 {
-    HC_BT_HDR *p_evt_buf = (HC_BT_HDR *) p_mem;
-    uint8_t     *p;
-    uint16_t    opcode;
-    HC_BT_HDR  *p_buf=NULL;
-    uint8_t     ret;
-
-    p = (uint8_t *)(p_evt_buf + 1) + HCI_EVT_CMD_CMPL_OPCODE;
-    STREAM_TO_UINT16(opcode,p);
-    if (bt_vendor_cbacks)
-        p_buf = (HC_BT_HDR *) bt_vendor_cbacks->alloc(BT_HC_HDR_SIZE + \
-                                                       HCI_CMD_MAX_LEN);
-    if (p_buf != NULL) {
-        p_buf->event = MSG_STACK_TO_HC_HCI_CMD;
-        p_buf->offset = 0;
-        p_buf->layer_specific = 0;
-        p_buf->len = HCI_CMD_PREAMBLE_SIZE;
+    uint8_t ret;
 
-        switch (hw_wbs_cb_state) {
-
-            case HW_WBS_CODEC: {
-                BTHWDBG("HW_WBS_CODEC");
-                if (opcode == HCI_VSC_WRITE_MSBC_ENABLE_PARAM) {
-                    p_buf->len += SCO_PCM_PARAM_SIZE;
-                    p = (uint8_t *) (p_buf + 1);
-                    UINT16_TO_STREAM(p, HCI_VSC_WRITE_SCO_PCM_INT_PARAM);
-                    *p++ = SCO_PCM_PARAM_SIZE;
-                    memcpy(p, &bt_pcm_sco_param, SCO_PCM_PARAM_SIZE);
-                    ALOGI("SCO over PCM interface {%d, %d, %d, %d, %d}",
-                        bt_pcm_sco_param[0], bt_pcm_sco_param[1], bt_pcm_sco_param[2], \
-                        bt_pcm_sco_param[3], bt_pcm_sco_param[4]);
-                    hw_wbs_cb_state = HW_WBS_PCM;
-                    if ((ret = bt_vendor_cbacks->xmit_cb(HCI_VSC_WRITE_SCO_PCM_INT_PARAM,\
-                                           p_buf, hw_enable_mSBC_codec_cback)) == FALSE)
-                   {
-                       bt_vendor_cbacks->dealloc(p_buf);
-                   }
-               }
-            }
-            break;
-
-            case HW_WBS_PCM: {
-                BTHWDBG("HW_WBS_PCM");
-                if (opcode == HCI_VSC_WRITE_SCO_PCM_INT_PARAM) {
-                    p_buf->len += SCO_I2SPCM_PARAM_SIZE;
-                    p = (uint8_t *) (p_buf + 1);
-                    UINT16_TO_STREAM(p, HCI_VSC_WRITE_I2SPCM_INTERFACE_PARAM);
-                    *p++ = SCO_I2SPCM_PARAM_SIZE;
-                    memcpy(p, &bt_i2s_sco_param, SCO_I2SPCM_PARAM_SIZE);
-                    ALOGI("SCO over I2SPCM interface {%d, %d, %d, %d}",
-                        bt_i2s_sco_param[0], bt_i2s_sco_param[1], bt_i2s_sco_param[2], bt_i2s_sco_param[3]);
-                    hw_wbs_cb_state = HW_WBS_I2S;
-                    if ((ret = bt_vendor_cbacks->xmit_cb(HCI_VSC_WRITE_I2SPCM_INTERFACE_PARAM,\
-                                           p_buf, hw_enable_mSBC_codec_cback)) == FALSE)
-                   {
-                       bt_vendor_cbacks->dealloc(p_buf);
-                   }
-               }
-            }
-            break;
+    hw_sco_cb.msbc = (state == TRUE) ? TRUE : FALSE;
+    ret = hw_sco_seq_start(HW_OP_WBS_CFG, hw_wbs_seq, sizeof(hw_wbs_seq), \
+                           p_status);
 
-            case HW_WBS_I2S: {
-                BTHWDBG("HW_WBS_I2S");
-                pthread_mutex_unlock(&lpm_mutex);
-                bt_vendor_cbacks->dealloc(p_buf);
-            }
-            break;
-        }
+    if ((ret == FALSE) && (*p_status != BT_VND_OP_RESULT_SUCCESS))
+    {
+        if (state)
+            ALOGE("enable mSBC aborted");
+        else
+            ALOGE("disable mSBC aborted");
     }
-    /* Free the RX event buffer */
-    if (bt_vendor_cbacks)
-        bt_vendor_cbacks->dealloc(p_evt_buf);
+
+    return ret;
 }
 
 /*******************************************************************************
 **
 ** Function         hw_enable_mSBC_codec
 **
-** Description      Enable mSBC codec
+** Description      Enable mSBC codec. The request is queued behind vendor
+**                  commands in flight.
 **
 ** Returns          None
 **
 *******************************************************************************/
-void hw_enable_mSBC_codec(uint8_t state) {
-    HC_BT_HDR *p_buf = NULL;
-    uint8_t *p, ret;
-
-    if (bt_vendor_cbacks)
-            p_buf = (HC_BT_HDR *) bt_vendor_cbacks->alloc(BT_HC_HDR_SIZE + \
-                                                HCI_CMD_PREAMBLE_SIZE + \
-                                                MSBC_ENABLE_PARAM_SIZE);
-        if (p_buf)
-        {
-            p_buf->event = MSG_STACK_TO_HC_HCI_CMD;
-            p_buf->offset = 0;
-            p_buf->layer_specific = 0;
-
-            p = (uint8_t *) (p_buf + 1);
-            UINT16_TO_STREAM(p, HCI_VSC_WRITE_MSBC_ENABLE_PARAM);
-            if (state == TRUE) {
-                p_buf->len = HCI_CMD_PREAMBLE_SIZE + MSBC_ENABLE_PARAM_SIZE;
-                *p++ = MSBC_ENABLE_PARAM_SIZE;
-                memcpy(p, &msbc_enable_param, MSBC_ENABLE_PARAM_SIZE);
-            } else {
-                p_buf->len = HCI_CMD_PREAMBLE_SIZE + MSBC_DISABLE_PARAM_SIZE;
-                *p++ = MSBC_DISABLE_PARAM_SIZE;
-                memcpy(p, &msbc_disable_param, MSBC_DISABLE_PARAM_SIZE);
-            }
-
-            if (!pthread_mutex_lock(&lpm_mutex)) {
-                hw_wbs_cb_state = HW_WBS_CODEC;
-                if ((ret = bt_vendor_cbacks->xmit_cb(HCI_VSC_WRITE_MSBC_ENABLE_PARAM,\
-                                p_buf, hw_enable_mSBC_codec_cback)) == FALSE)
-                {
-                    bt_vendor_cbacks->dealloc(p_buf);
-                    pthread_mutex_unlock(&lpm_mutex);
-                }
-                else
-                    return;
-            }
-        }
-
-    if (bt_vendor_cbacks)
-    {
-        if (state)
-            ALOGE("enable mSBC aborted");
-        else
-            ALOGE("disable mSBC aborted");
-    }
+void hw_enable_mSBC_codec(uint8_t state)
+{
+    hw_op_enqueue(HW_OP_WBS_CFG, state);
 }
 #endif // (SCO_USE_I2S_INTERFACE == TRUE)
 
@@ -1531,10 +2970,11 @@ void hw_enable_mSBC_codec(uint8_t state) {
 **                 Otherwise : Fail
 **
 *******************************************************************************/
-int hw_set_patch_file_path(char *p_conf_name, char *p_conf_value, int param)
+int hw_set_patch_file_path(const char *p_conf_name,
+                           const conf_value_t *p_conf_value, int param)
 {
 
-    strcpy(fw_patchfile_path, p_conf_value);
+    strcpy(fw_patchfile_path, p_conf_value->p_str);
 
     return 0;
 }
@@ -1549,10 +2989,11 @@ int hw_set_patch_file_path(char *p_conf_name, char *p_conf_value, int param)
 **                 Otherwise : Fail
 **
 *******************************************************************************/
-int hw_set_patch_file_name(char *p_conf_name, char *p_conf_value, int param)
+int hw_set_patch_file_name(const char *p_conf_name,
+                           const conf_value_t *p_conf_value, int param)
 {
 
-    strcpy(fw_patchfile_name, p_conf_value);
+    strcpy(fw_patchfile_name, p_conf_value->p_str);
 
     return 0;
 }
@@ -1568,30 +3009,104 @@ int hw_set_patch_file_name(char *p_conf_name, char *p_conf_value, int param)
 **                 Otherwise : Fail
 **
 *******************************************************************************/
-int hw_set_patch_settlement_delay(char *p_conf_name, char *p_conf_value, int param)
+int hw_set_patch_settlement_delay(const char *p_conf_name,
+                                  const conf_value_t *p_conf_value, int param)
 {
-    fw_patch_settlement_delay = atoi(p_conf_value);
+    fw_patch_settlement_delay = (int) p_conf_value->num;
 
     return 0;
 }
 #endif  //VENDOR_LIB_RUNTIME_TUNING_ENABLED
 
-static inline int set_param(char *p_name, uint8_t p_value, int param, int size, \
-                            const char *param_name[], uint8_t *bt_param)
+/*******************************************************************************
+**
+** Function        hw_lpm_set_param
+**
+** Description     Set a LPM parameter. The value is validated against the
+**                 range of the parameter and used from the next LPM enable.
+**
+** Returns         0 : Success
+**                 Otherwise : Fail
+**
+*******************************************************************************/
+int hw_lpm_set_param(const char *p_conf_name,
+                     const conf_value_t *p_conf_value, int param)
 {
-    int i;
-    BTHWDBG( "%s: parameter: %s value: %u", __func__, p_name, p_value);
+    /* sleep mode is one of 0 (disable), 1 (UART) or 9 (H5), param is within
+     * range by vnd_conf_keys.h */
+    if (((size_t) param == offsetof(bt_lpm_param_t, sleep_mode)) && \
+        (p_conf_value->num != 0) && (p_conf_value->num != 1) && \
+        (p_conf_value->num != 9))
+    {
+        ALOGE("%s: invalid value %s for %s", __func__, p_conf_value->p_str, \
+              p_conf_name);
+        return -EINVAL;
+    }
 
-    for (i = 0; i < size; i++) {
-         if (strcmp(param_name[i], p_name) == 0) {
-           bt_param[i] = p_value;
-           return 0;
-        }
+    pthread_mutex_lock(&lpm_conf_mutex);
+    if (lpm_conf_pending == FALSE)
+    {
+        lpm_conf_param = lpm_param;
+        lpm_conf_idle_timeout_multiple = lpm_idle_timeout_multiple;
+        lpm_conf_pending = TRUE;
+    }
+
+    if ((size_t) param < LPM_CONF_IDLE_TIMEOUT_MULTIPLE)
+        *((uint8_t *) &lpm_conf_param + param) = (uint8_t) p_conf_value->num;
+    else
+        lpm_conf_idle_timeout_multiple = (uint8_t) p_conf_value->num;
+    pthread_mutex_unlock(&lpm_conf_mutex);
+
+    return 0;
+}
+
+/*******************************************************************************
+**
+** Function        hw_lpm_set_adaptive_policy
+**
+** Description     Turn the adaptive LPM policy on or off. It is used from
+**                 the next LPM enable.
+**
+** Returns         0 : Success
+**                 Otherwise : Fail
+**
+*******************************************************************************/
+int hw_lpm_set_adaptive_policy(const char *p_conf_name,
+                               const conf_value_t *p_conf_value, int param)
+{
+    __atomic_store_n(&lpm_policy_conf, p_conf_value->num ? TRUE : FALSE, \
+                     __ATOMIC_RELAXED);
+
+    return 0;
+}
+
+/*******************************************************************************
+**
+** Function        set_param
+**
+** Description     Store a PCM/I2S parameter, param being its index in
+**                 bt_param
+**
+** Returns         0 : Success
+**                 Otherwise : Fail
+**
+*******************************************************************************/
+static inline int set_param(const char *p_name, const conf_value_t *p_value, \
+                            int param, int size, uint8_t *bt_param)
+{
+    BTHWDBG( "%s: parameter: %s value: %u", __func__, p_name, p_value->num);
+
+    if ((param < 0) || (param >= size))
+    {
+        ALOGE( "%s: invalid parameter %s", __func__, p_name);
+        return -EINVAL;
     }
 
-    // no parameter matching
-    ALOGE( "%s: invalid parameter %s", __func__, p_name);
-    return -EINVAL;
+    pthread_mutex_lock(&hw_sco_cb.mutex);
+    bt_param[param] = (uint8_t) p_value->num;
+    hw_sco_cb.stale = TRUE;
+    pthread_mutex_unlock(&hw_sco_cb.mutex);
+    return 0;
 }
 
 /*******************************************************************************
@@ -1604,10 +3119,11 @@ static inline int set_param(char *p_name, uint8_t p_value, int param, int size,
 **                 Otherwise : Fail
 **
 *******************************************************************************/
-int hw_pcm_set_param(char *p_name, char *p_value, int param)
+int hw_pcm_set_param(const char *p_conf_name,
+                     const conf_value_t *p_conf_value, int param)
 {
-    return set_param(p_name, p_value, param, SCO_PCM_PARAM_SIZE, \
-                     sco_pcm_parameter_name, bt_pcm_sco_param);
+    return set_param(p_conf_name, p_conf_value, param, SCO_PCM_PARAM_SIZE, \
+                     bt_pcm_sco_param);
 }
 
 /*******************************************************************************
@@ -1620,10 +3136,11 @@ int hw_pcm_set_param(char *p_name, char *p_value, int param)
 **                 Otherwise : Fail
 **
 *******************************************************************************/
-int hw_pcm_fmt_set_param(char *p_name, uint8_t p_value, int param)
+int hw_pcm_fmt_set_param(const char *p_conf_name,
+                         const conf_value_t *p_conf_value, int param)
 {
-    return set_param(p_name, p_value, param, PCM_DATA_FORMAT_PARAM_SIZE, \
-                     pcm_data_fmt_parameter_name, bt_pcm_data_fmt_param);
+    return set_param(p_conf_name, p_conf_value, param, \
+                     PCM_DATA_FORMAT_PARAM_SIZE, bt_pcm_data_fmt_param);
 }
 
 #if (SCO_USE_I2S_INTERFACE == TRUE)
@@ -1637,32 +3154,52 @@ int hw_pcm_fmt_set_param(char *p_name, uint8_t p_value, int param)
 **                 Otherwise : Fail
 **
 *******************************************************************************/
-int hw_i2s_set_param(char *p_name, uint8_t p_value, int param)
+int hw_i2s_set_param(const char *p_conf_name,
+                     const conf_value_t *p_conf_value, int param)
 {
-    return set_param(p_name, p_value, param, SCO_I2SPCM_PARAM_SIZE, \
-                     sco_i2s_parameter_name, bt_i2s_sco_param);
+    return set_param(p_conf_name, p_conf_value, param, SCO_I2SPCM_PARAM_SIZE, \
+                     bt_i2s_sco_param);
 }
 
 /*******************************************************************************
 **
-** Function         hw_wbs_config
+** Function        hw_i2s_set_resample
 **
-** Description      Configure WBS related hardware settings
+** Description     Keep the I2S port at 16K for both codecs, see
+**                 SCO_I2SPCM_IF_RESAMPLE
+**
+** Returns         0 : Success
+**                 Otherwise : Fail
+**
+*******************************************************************************/
+int hw_i2s_set_resample(const char *p_conf_name,
+                        const conf_value_t *p_conf_value, int param)
+{
+    uint8_t value = (uint8_t) p_conf_value->num;
+
+    pthread_mutex_lock(&hw_sco_cb.mutex);
+    hw_sco_cb.i2s_resample = value;
+    hw_sco_cb.stale = TRUE;
+    pthread_mutex_unlock(&hw_sco_cb.mutex);
+    ALOGI("SCO I2S %s", (value == 1) ? "fixed at 16K, 8K resampled by host" : \
+          "rate follows the codec");
+
+    return 0;
+}
+
+/*******************************************************************************
+**
+** Function         hw_wbs_enable
+**
+** Description      Switch the SCO codec between mSBC (WBS) and CVSD. The
+**                  precomputed settings of the codec are applied, see
+**                  hw_sco_params_build.
 **
 ** Returns          None
 **
 *******************************************************************************/
 void hw_wbs_enable(uint8_t wbs_state)
 {
-    if (wbs_state == TRUE) {
-        hw_pcm_set_param("SCO_PCM_IF_CLOCK_RATE", SCO_PCM_IF_CLOCK_RATE_WBS, 0);
-        hw_i2s_set_param("SCO_I2SPCM_IF_SAMPLE_RATE", SCO_I2SPCM_IF_SAMPLE_RATE_WBS, 0);
-        hw_i2s_set_param("SCO_I2SPCM_IF_CLOCK_RATE", SCO_I2SPCM_IF_CLOCK_RATE_WBS, 0);
-    } else {
-        hw_pcm_set_param("SCO_PCM_IF_CLOCK_RATE", SCO_PCM_IF_CLOCK_RATE, 0);
-        hw_i2s_set_param("SCO_I2SPCM_IF_SAMPLE_RATE", SCO_I2SPCM_IF_SAMPLE_RATE, 0);
-        hw_i2s_set_param("SCO_I2SPCM_IF_CLOCK_RATE", SCO_I2SPCM_IF_CLOCK_RATE, 0);
-    }
     hw_enable_mSBC_codec(wbs_state);
 }
 #endif // (SCO_USE_I2S_INTERFACE == TRUE)
@@ -1721,6 +3258,8 @@ void hw_epilog_process(void)
 
     BTHWDBG("hw_epilog_process");
 
+    memset(hw_sco_cb.acked.len, 0, sizeof(hw_sco_cb.acked.len));
+
     /* Sending a HCI_RESET */
     if (bt_vendor_cbacks)
     {
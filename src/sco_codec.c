@@ -0,0 +1,1685 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2009-2012 Broadcom Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+/******************************************************************************
+ *
+ *  Filename:      sco_codec.c
+ *
+ *  Description:   Contains the host side SCO voice codecs
+ *                      CVSD, 64 kbps 1 bit per sample at 8 x 8 kHz
+ *                      mSBC, 16 kHz mono SBC in HFP H2 framing
+ *                 the concealment of lost frames by pitch waveform
+ *                 substitution and an 8 <-> 16 kHz polyphase sample rate
+ *                 converter. The filterbanks, the CVSD rate conversion, the
+ *                 concealment correlation / overlap-add and the converter
+ *                 FIR run on SSE2 / SSSE3 kernels when built for x86, with a
+ *                 scalar reference selectable at runtime.
+ *
+ ******************************************************************************/
+
+#define LOG_TAG "bt_sco_codec"
+
+#include <utils/Log.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bt_vendor_brcm.h"
+#include "sco_codec.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+/******************************************************************************
+**  Constants & Macros
+******************************************************************************/
+
+#ifndef SCO_CODEC_DBG
+#define SCO_CODEC_DBG FALSE
+#endif
+
+#if (SCO_CODEC_DBG == TRUE)
+#define SCOCDBG(param, ...) {ALOGD(param, ## __VA_ARGS__);}
+#else
+#define SCOCDBG(param, ...) {}
+#endif
+
+/* CVSD, Bluetooth Core Vol 2 Part B 9.2. State in Q10 PCM units */
+#define CVSD_Q                  10
+#define CVSD_OVERSAMPLING       8
+#define CVSD_BITS               (SCO_CODEC_CVSD_SAMPLES * CVSD_OVERSAMPLING)
+#define CVSD_DELTA_MIN          (10 << CVSD_Q)
+#define CVSD_DELTA_MAX          (1280 << CVSD_Q)
+#define CVSD_Y_MAX              (32767 << CVSD_Q)
+#define CVSD_Y_MIN              (-32768 * (1 << CVSD_Q))
+#define CVSD_HIST_MASK          0x0F    /* J = 4 */
+#define CVSD_HIST_INIT          0x05
+
+/* mSBC, HFP 1.6 5.7.4: SBC with fixed parameters in H2 framing */
+#define MSBC_SUBBANDS           8
+#define MSBC_BLOCKS             15
+#define MSBC_BITPOOL            26
+#define MSBC_TAPS               (MSBC_SUBBANDS * 10)
+#define MSBC_SYNCWORD           0xAD
+#define MSBC_FRAME_LEN          57
+#define MSBC_H2_SYNC            0x01
+#define MSBC_CRC_INIT           0x0F
+#define MSBC_CRC_POLY           0x1D
+
+/* Fixed point scale of the filterbank matrices, the largest keeping the
+ * accumulation of a full scale input within 32 bits */
+#define MSBC_ANALYSIS_SHIFT     15
+#define MSBC_SYNTHESIS_SHIFT    11
+
+/* Packet loss concealment, in samples at 8 kHz, doubled at 16 kHz */
+#define PLC_PITCH_MIN           40      /* 5 ms, 200 Hz */
+#define PLC_PITCH_MAX           120     /* 15 ms, 66 Hz */
+#define PLC_WINDOW              32      /* Pitch correlation window, 4 ms */
+#define PLC_OLA                 16      /* Overlap-add on recovery, 2 ms */
+#define PLC_HOLD                80      /* Full level, 10 ms */
+#define PLC_FADE                400     /* Then down to silence, 50 ms */
+#define PLC_HIST                (PLC_PITCH_MAX + PLC_WINDOW)
+#define PLC_MULT_MAX            2
+
+/* 8 <-> 16 kHz converter: Kaiser windowed lowpass at 16 kHz, passband up to
+ * 3.1 kHz, stopband from 4 kHz. Upsampling runs it as 2 phases. */
+#define RS_TAPS                 64
+#define RS_PHASE_TAPS           (RS_TAPS / 2)
+#define RS_CUTOFF_HZ            3600
+#define RS_KAISER_BETA          6.0
+#define RS_BLOCK                240     /* Input samples per FIR pass */
+
+/* Distinct frames of the benchmark signal */
+#define SCO_CODEC_BENCH_FRAMES  16
+
+#define SCO_CODEC_SAT16(v)      (((v) > 32767) ? 32767 : \
+                                 ((v) < -32768) ? -32768 : (v))
+
+/******************************************************************************
+**  Local type definitions
+******************************************************************************/
+
+/* Kernels, one set per instruction set */
+typedef struct
+{
+    uint8_t isa;
+    const char *p_name;
+    /* out[r] = sum(x[i] * w[r * MSBC_TAPS + i]), r < 8, i < MSBC_TAPS */
+    void (*dot80x8)(const int16_t *x, const int16_t *w, int32_t *out);
+    /* 8 x linear interpolation of n samples following prev */
+    void (*upsample8)(int16_t prev, const int16_t *p_in, uint16_t n,
+                      int16_t *p_out);
+    /* Average of each 8 samples out of n * 8 */
+    void (*decimate8)(const int16_t *p_in, uint16_t n, int16_t *p_out);
+    /* sum(a[i] * b[i]), n multiple of 8 */
+    int64_t (*dot)(const int16_t *a, const int16_t *b, uint16_t n);
+    /* to[i] = from[i] * win[2i] + to[i] * win[2i + 1], Q15, n multiple of 8 */
+    void (*xfade)(const int16_t *p_from, int16_t *p_to, const int16_t *p_win,
+                  uint16_t n);
+    /* out[i] = sum(x[i * step + k] * h[k]) Q15 over taps, multiple of 8 */
+    void (*fir)(const int16_t *p_x, const int16_t *p_h, uint16_t taps,
+                uint8_t step, uint16_t n, int16_t *p_out);
+} sco_codec_ops_t;
+
+typedef struct
+{
+    int32_t est;                        /* Accumulator, x^(k) */
+    int32_t delta;                      /* Step size */
+    uint8_t hist;                       /* Last J bits */
+} sco_cvsd_t;
+
+typedef struct
+{
+    uint8_t mult;                       /* 1 at 8 kHz, 2 at 16 kHz */
+    uint8_t concealing;
+    int16_t hist[PLC_MULT_MAX * PLC_HIST];  /* Last output, oldest first */
+    int16_t period[PLC_MULT_MAX * PLC_PITCH_MAX];   /* Period repeated */
+    uint16_t pitch;
+    uint16_t pos;                       /* Next sample of period[] */
+    uint32_t lost_samples;              /* Concealed since the last frame */
+} sco_plc_t;
+
+struct sco_resampler
+{
+    uint8_t dir;
+    uint16_t hist;                      /* Input samples kept between calls */
+    int16_t buf[RS_TAPS - 1 + RS_BLOCK];
+    int16_t phase[2][RS_BLOCK];
+};
+
+struct sco_codec
+{
+    uint8_t codec;
+
+    /* Receive path */
+    sco_plc_t plc;
+    sco_codec_stats_t stats;
+    uint64_t plc_ns;
+
+    /* CVSD */
+    sco_cvsd_t cvsd_enc;
+    sco_cvsd_t cvsd_dec;
+    int16_t cvsd_prev;                  /* Last encoded PCM sample */
+    int16_t cvsd_tail[CVSD_OVERSAMPLING / 2];   /* Last decoded bits */
+
+    /* mSBC */
+    int16_t msbc_x[MSBC_TAPS];          /* Analysis input, newest first */
+    int16_t msbc_v[MSBC_TAPS];          /* Synthesis input, newest first */
+    uint8_t msbc_seq;                   /* H2 sequence number */
+};
+
+/******************************************************************************
+**  Static variables
+******************************************************************************/
+
+/* SBC prototype filter of 8 subbands (A2DP 1.2 12.8) */
+static const double msbc_proto[MSBC_TAPS] =
+{
+     0.00000000E+00,  1.56575398E-04,  3.43256425E-04,  5.54620202E-04,
+     8.23919506E-04,  1.13992507E-03,  1.47640169E-03,  1.78371725E-03,
+     2.01182542E-03,  2.10371989E-03,  1.99454554E-03,  1.61656283E-03,
+     9.02154502E-04, -1.78805361E-04, -1.64973098E-03, -3.49717454E-03,
+     5.65949473E-03,  8.02941163E-03,  1.04584443E-02,  1.27472335E-02,
+     1.46525263E-02,  1.59045603E-02,  1.62208471E-02,  1.53184106E-02,
+     1.29371806E-02,  8.85757540E-03,  2.92408442E-03, -4.91578024E-03,
+    -1.46404076E-02, -2.61098752E-02, -3.90751381E-02, -5.31873032E-02,
+     6.79989431E-02,  8.29847578E-02,  9.75753918E-02,  1.11196689E-01,
+     1.23264548E-01,  1.33264415E-01,  1.40753505E-01,  1.45389847E-01,
+     1.46955068E-01,  1.45389847E-01,  1.40753505E-01,  1.33264415E-01,
+     1.23264548E-01,  1.11196689E-01,  9.75753918E-02,  8.29847578E-02,
+    -6.79989431E-02, -5.31873032E-02, -3.90751381E-02, -2.61098752E-02,
+    -1.46404076E-02, -4.91578024E-03,  2.92408442E-03,  8.85757540E-03,
+     1.29371806E-02,  1.53184106E-02,  1.62208471E-02,  1.59045603E-02,
+     1.46525263E-02,  1.27472335E-02,  1.04584443E-02,  8.02941163E-03,
+    -5.65949473E-03, -3.49717454E-03, -1.64973098E-03, -1.78805361E-04,
+     9.02154502E-04,  1.61656283E-03,  1.99454554E-03,  2.10371989E-03,
+     2.01182542E-03,  1.78371725E-03,  1.47640169E-03,  1.13992507E-03,
+     8.23919506E-04,  5.54620202E-04,  3.43256425E-04,  1.56575398E-04
+};
+
+/* Loudness bit allocation offsets of 8 subbands at 16 kHz */
+static const int8_t msbc_loudness_offset[MSBC_SUBBANDS] =
+{
+    -2, 0, 0, 0, 0, 0, 0, 1
+};
+
+/* H2 header second byte of sequence numbers 0..3 */
+static const uint8_t msbc_h2_seq[4] = { 0x08, 0x38, 0xC8, 0xF8 };
+
+/* Filterbanks folded with their cosine modulation, built once.
+ * Analysis:  S[m] = sum(X[i] * A[m][i]), X the last 80 input samples.
+ * Synthesis: x[j] = sum(V[i] * B[j][i]), V the last 10 blocks of (halved)
+ * subband samples. */
+static int16_t msbc_analysis[MSBC_SUBBANDS * MSBC_TAPS] __attribute__((aligned(16)));
+static int16_t msbc_synthesis[MSBC_SUBBANDS * MSBC_TAPS] __attribute__((aligned(16)));
+
+/* Recovery overlap-add ramps as (1 - w, w) Q15 pairs, per rate */
+static int16_t plc_xfade_win[PLC_MULT_MAX][2 * PLC_MULT_MAX * PLC_OLA] __attribute__((aligned(16)));
+
+/* Converter filter as correlation coefficients, and its 2 upsampling phases
+ * producing the even and odd output samples */
+static int16_t rs_down[RS_TAPS] __attribute__((aligned(16)));
+static int16_t rs_up[2][RS_PHASE_TAPS] __attribute__((aligned(16)));
+
+static pthread_once_t sco_codec_once = PTHREAD_ONCE_INIT;
+static const sco_codec_ops_t *p_sco_codec_ops;
+
+/******************************************************************************
+**  Scalar Kernels
+******************************************************************************/
+
+static void sco_dot80x8_scalar(const int16_t *x, const int16_t *w, int32_t *out)
+{
+    int r, i;
+    int32_t acc;
+
+    for (r = 0; r < MSBC_SUBBANDS; r++, w += MSBC_TAPS)
+    {
+        for (i = 0, acc = 0; i < MSBC_TAPS; i++)
+            acc += x[i] * w[i];
+        out[r] = acc;
+    }
+}
+
+static void sco_upsample8_scalar(int16_t prev, const int16_t *p_in, uint16_t n,
+                                 int16_t *p_out)
+{
+    int i, k;
+
+    for (i = 0; i < n; i++)
+    {
+        for (k = 0; k < CVSD_OVERSAMPLING; k++)
+            *p_out++ = (int16_t) ((prev * (7 - k) + p_in[i] * (k + 1)) >> 3);
+        prev = p_in[i];
+    }
+}
+
+static void sco_decimate8_scalar(const int16_t *p_in, uint16_t n, int16_t *p_out)
+{
+    int i, k;
+    int32_t sum;
+
+    for (i = 0; i < n; i++, p_in += CVSD_OVERSAMPLING)
+    {
+        for (k = 0, sum = 0; k < CVSD_OVERSAMPLING; k++)
+            sum += p_in[k];
+        p_out[i] = (int16_t) (sum >> 3);
+    }
+}
+
+static int64_t sco_dot_scalar(const int16_t *a, const int16_t *b, uint16_t n)
+{
+    int64_t acc = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+        acc += a[i] * b[i];
+    return acc;
+}
+
+static void sco_xfade_scalar(const int16_t *p_from, int16_t *p_to,
+                             const int16_t *p_win, uint16_t n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        p_to[i] = (int16_t) ((p_from[i] * p_win[2 * i] + \
+                              p_to[i] * p_win[2 * i + 1]) >> 15);
+}
+
+static void sco_fir_scalar(const int16_t *p_x, const int16_t *p_h,
+                           uint16_t taps, uint8_t step, uint16_t n,
+                           int16_t *p_out)
+{
+    int32_t acc;
+    int i, k;
+
+    for (i = 0; i < n; i++, p_x += step)
+    {
+        acc = 1 << 14;
+        for (k = 0; k < taps; k++)
+            acc += p_x[k] * p_h[k];
+        acc >>= 15;
+        p_out[i] = (int16_t) SCO_CODEC_SAT16(acc);
+    }
+}
+
+static const sco_codec_ops_t sco_codec_ops_scalar =
+{
+    SCO_CODEC_ISA_SCALAR, "scalar",
+    sco_dot80x8_scalar, sco_upsample8_scalar, sco_decimate8_scalar,
+    sco_dot_scalar, sco_xfade_scalar, sco_fir_scalar
+};
+
+#if defined(__SSE2__)
+/******************************************************************************
+**  SSE2 Kernels
+******************************************************************************/
+
+/* Sum of the dot products of 8 int16 lanes, 4 int32 partial sums */
+static inline __m128i sco_dot80_sse2(const int16_t *x, const int16_t *w)
+{
+    __m128i acc = _mm_setzero_si128();
+    int i;
+
+    for (i = 0; i < MSBC_TAPS; i += 8)
+        acc = _mm_add_epi32(acc, _mm_madd_epi16( \
+                  _mm_loadu_si128((const __m128i *) (x + i)), \
+                  _mm_load_si128((const __m128i *) (w + i))));
+    return acc;
+}
+
+static void sco_dot80x8_sse2(const int16_t *x, const int16_t *w, int32_t *out)
+{
+    __m128i a0, a1, a2, a3;
+    int r;
+
+    /* 4 rows at a time, reduced horizontally by transposition */
+    for (r = 0; r < MSBC_SUBBANDS; r += 4, w += 4 * MSBC_TAPS)
+    {
+        a0 = sco_dot80_sse2(x, w);
+        a1 = sco_dot80_sse2(x, w + MSBC_TAPS);
+        a2 = sco_dot80_sse2(x, w + 2 * MSBC_TAPS);
+        a3 = sco_dot80_sse2(x, w + 3 * MSBC_TAPS);
+        a0 = _mm_add_epi32(_mm_unpacklo_epi32(a0, a1), _mm_unpackhi_epi32(a0, a1));
+        a2 = _mm_add_epi32(_mm_unpacklo_epi32(a2, a3), _mm_unpackhi_epi32(a2, a3));
+        a0 = _mm_add_epi32(_mm_unpacklo_epi64(a0, a2), _mm_unpackhi_epi64(a0, a2));
+        _mm_storeu_si128((__m128i *) (out + r), a0);
+    }
+}
+
+static void sco_upsample8_sse2(int16_t prev, const int16_t *p_in, uint16_t n,
+                               int16_t *p_out)
+{
+    /* (prev, cur) pairs weighted (7 - k, k + 1) */
+    const __m128i w_lo = _mm_setr_epi16(7, 1, 6, 2, 5, 3, 4, 4);
+    const __m128i w_hi = _mm_setr_epi16(3, 5, 2, 6, 1, 7, 0, 8);
+    __m128i pair, lo, hi;
+    int i;
+
+    for (i = 0; i < n; i++, p_out += CVSD_OVERSAMPLING)
+    {
+        pair = _mm_set1_epi32((uint16_t) prev | ((uint32_t) (uint16_t) p_in[i] << 16));
+        lo = _mm_srai_epi32(_mm_madd_epi16(pair, w_lo), 3);
+        hi = _mm_srai_epi32(_mm_madd_epi16(pair, w_hi), 3);
+        _mm_storeu_si128((__m128i *) p_out, _mm_packs_epi32(lo, hi));
+        prev = p_in[i];
+    }
+}
+
+static void sco_decimate8_sse2(const int16_t *p_in, uint16_t n, int16_t *p_out)
+{
+    const __m128i ones = _mm_set1_epi16(1);
+    __m128i a, b;
+    int i = 0;
+
+    /* Two output samples per iteration */
+    for (; i + 1 < n; i += 2, p_in += 2 * CVSD_OVERSAMPLING)
+    {
+        a = _mm_madd_epi16(_mm_loadu_si128((const __m128i *) p_in), ones);
+        b = _mm_madd_epi16(_mm_loadu_si128((const __m128i *) (p_in + 8)), ones);
+        /* a0+a1 b0+b1 a2+a3 b2+b3 */
+        a = _mm_add_epi32(_mm_unpacklo_epi32(a, b), _mm_unpackhi_epi32(a, b));
+        a = _mm_add_epi32(a, _mm_shuffle_epi32(a, 0x4E));
+        a = _mm_srai_epi32(a, 3);
+        p_out[i] = (int16_t) _mm_cvtsi128_si32(a);
+        p_out[i + 1] = (int16_t) _mm_cvtsi128_si32(_mm_shuffle_epi32(a, 0x55));
+    }
+    if (i < n)
+        sco_decimate8_scalar(p_in, 1, p_out + i);
+}
+
+static int64_t sco_dot_sse2(const int16_t *a, const int16_t *b, uint16_t n)
+{
+    __m128i acc = _mm_setzero_si128(), p, sign;
+    int64_t sum[2];
+    int i;
+
+    /* Pair sums widened to 64 bits before accumulating */
+    for (i = 0; i < n; i += 8)
+    {
+        p = _mm_madd_epi16(_mm_loadu_si128((const __m128i *) (a + i)), \
+                           _mm_loadu_si128((const __m128i *) (b + i)));
+        sign = _mm_srai_epi32(p, 31);
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(p, sign));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(p, sign));
+    }
+    _mm_storeu_si128((__m128i *) sum, acc);
+    return sum[0] + sum[1];
+}
+
+static void sco_xfade_sse2(const int16_t *p_from, int16_t *p_to,
+                           const int16_t *p_win, uint16_t n)
+{
+    __m128i from, to, lo, hi;
+    int i;
+
+    for (i = 0; i < n; i += 8)
+    {
+        from = _mm_loadu_si128((const __m128i *) (p_from + i));
+        to = _mm_loadu_si128((const __m128i *) (p_to + i));
+        lo = _mm_madd_epi16(_mm_unpacklo_epi16(from, to), \
+                            _mm_load_si128((const __m128i *) (p_win + 2 * i)));
+        hi = _mm_madd_epi16(_mm_unpackhi_epi16(from, to), \
+                            _mm_load_si128((const __m128i *) (p_win + 2 * i + 8)));
+        _mm_storeu_si128((__m128i *) (p_to + i), \
+                         _mm_packs_epi32(_mm_srai_epi32(lo, 15), \
+                                         _mm_srai_epi32(hi, 15)));
+    }
+}
+
+/* Dot product of taps int16 lanes, 4 int32 partial sums */
+static inline __m128i sco_fir_tap_sse2(const int16_t *p_x, const int16_t *p_h,
+                                       uint16_t taps)
+{
+    __m128i acc = _mm_setzero_si128();
+    int k;
+
+    for (k = 0; k < taps; k += 8)
+        acc = _mm_add_epi32(acc, _mm_madd_epi16( \
+                  _mm_loadu_si128((const __m128i *) (p_x + k)), \
+                  _mm_load_si128((const __m128i *) (p_h + k))));
+    return acc;
+}
+
+static void sco_fir_sse2(const int16_t *p_x, const int16_t *p_h,
+                         uint16_t taps, uint8_t step, uint16_t n,
+                         int16_t *p_out)
+{
+    const __m128i round = _mm_set1_epi32(1 << 14);
+    __m128i a0, a1, a2, a3;
+    int i = 0;
+
+    /* 4 outputs at a time, reduced horizontally by transposition */
+    for (; i + 4 <= n; i += 4, p_x += 4 * step)
+    {
+        a0 = sco_fir_tap_sse2(p_x, p_h, taps);
+        a1 = sco_fir_tap_sse2(p_x + step, p_h, taps);
+        a2 = sco_fir_tap_sse2(p_x + 2 * step, p_h, taps);
+        a3 = sco_fir_tap_sse2(p_x + 3 * step, p_h, taps);
+        a0 = _mm_add_epi32(_mm_unpacklo_epi32(a0, a1), _mm_unpackhi_epi32(a0, a1));
+        a2 = _mm_add_epi32(_mm_unpacklo_epi32(a2, a3), _mm_unpackhi_epi32(a2, a3));
+        a0 = _mm_add_epi32(_mm_unpacklo_epi64(a0, a2), _mm_unpackhi_epi64(a0, a2));
+        a0 = _mm_srai_epi32(_mm_add_epi32(a0, round), 15);
+        _mm_storel_epi64((__m128i *) (p_out + i), _mm_packs_epi32(a0, a0));
+    }
+    if (i < n)
+        sco_fir_scalar(p_x, p_h, taps, step, n - i, p_out + i);
+}
+
+static const sco_codec_ops_t sco_codec_ops_sse2 =
+{
+    SCO_CODEC_ISA_SSE2, "sse2",
+    sco_dot80x8_sse2, sco_upsample8_sse2, sco_decimate8_sse2,
+    sco_dot_sse2, sco_xfade_sse2, sco_fir_sse2
+};
+#endif // __SSE2__
+
+#if defined(__SSSE3__)
+/******************************************************************************
+**  SSSE3 Kernels
+******************************************************************************/
+
+static void sco_dot80x8_ssse3(const int16_t *x, const int16_t *w, int32_t *out)
+{
+    __m128i a0, a1, a2, a3;
+    int r;
+
+    /* 4 rows at a time, reduced horizontally by 2 levels of phaddd */
+    for (r = 0; r < MSBC_SUBBANDS; r += 4, w += 4 * MSBC_TAPS)
+    {
+        a0 = sco_dot80_sse2(x, w);
+        a1 = sco_dot80_sse2(x, w + MSBC_TAPS);
+        a2 = sco_dot80_sse2(x, w + 2 * MSBC_TAPS);
+        a3 = sco_dot80_sse2(x, w + 3 * MSBC_TAPS);
+        a0 = _mm_hadd_epi32(_mm_hadd_epi32(a0, a1), _mm_hadd_epi32(a2, a3));
+        _mm_storeu_si128((__m128i *) (out + r), a0);
+    }
+}
+
+static const sco_codec_ops_t sco_codec_ops_ssse3 =
+{
+    SCO_CODEC_ISA_SSSE3, "ssse3",
+    sco_dot80x8_ssse3, sco_upsample8_sse2, sco_decimate8_sse2,
+    sco_dot_sse2, sco_xfade_sse2, sco_fir_sse2
+};
+#endif // __SSSE3__
+
+/******************************************************************************
+**  Static functions
+******************************************************************************/
+
+/*******************************************************************************
+**
+** Function        sco_codec_cpu_isa
+**
+** Description     Get the best kernel instruction set of the CPU that is
+**                 built in
+**
+** Returns         SCO_CODEC_ISA_*
+**
+*******************************************************************************/
+static uint8_t sco_codec_cpu_isa(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    unsigned int eax, ebx, ecx = 0, edx = 0;
+
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0)
+        return SCO_CODEC_ISA_SCALAR;
+#if defined(__SSSE3__)
+    if (ecx & bit_SSSE3)
+        return SCO_CODEC_ISA_SSSE3;
+#endif
+#if defined(__SSE2__)
+    if (edx & bit_SSE2)
+        return SCO_CODEC_ISA_SSE2;
+#endif
+#endif
+    return SCO_CODEC_ISA_SCALAR;
+}
+
+/*******************************************************************************
+**
+** Function        sco_codec_ops_get
+**
+** Description     Get the kernels of an instruction set, lowered to the
+**                 best one available
+**
+** Returns         Kernels
+**
+*******************************************************************************/
+static const sco_codec_ops_t *sco_codec_ops_get(uint8_t isa)
+{
+    uint8_t cpu_isa = sco_codec_cpu_isa();
+
+    if (isa > cpu_isa)
+        isa = cpu_isa;
+
+#if defined(__SSSE3__)
+    if (isa >= SCO_CODEC_ISA_SSSE3)
+        return &sco_codec_ops_ssse3;
+#endif
+#if defined(__SSE2__)
+    if (isa >= SCO_CODEC_ISA_SSE2)
+        return &sco_codec_ops_sse2;
+#endif
+    return &sco_codec_ops_scalar;
+}
+
+/*******************************************************************************
+**
+** Function        sco_bessel_i0
+**
+** Description     Modified Bessel function of the first kind, order 0
+**
+** Returns         I0(x)
+**
+*******************************************************************************/
+static double sco_bessel_i0(double x)
+{
+    double sum = 1, term = 1;
+    int k;
+
+    for (k = 1; k < 32; k++)
+    {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+/*******************************************************************************
+**
+** Function        sco_resampler_init
+**
+** Description     Design the converter lowpass and split it in phases
+**
+** Returns         None
+**
+*******************************************************************************/
+static void sco_resampler_init(void)
+{
+    double h[RS_TAPS], fc = (double) RS_CUTOFF_HZ / 16000, sum = 0, t, r;
+    int k;
+
+    for (k = 0; k < RS_TAPS; k++)
+    {
+        t = k - (RS_TAPS - 1) / 2.0;
+        r = 2.0 * k / (RS_TAPS - 1) - 1;
+        h[k] = 2 * fc * sin(2 * M_PI * fc * t) / (2 * M_PI * fc * t) * \
+               sco_bessel_i0(RS_KAISER_BETA * sqrt(1 - r * r)) / \
+               sco_bessel_i0(RS_KAISER_BETA);
+        sum += h[k];
+    }
+
+    /* Unity gain downsampling. Upsampling doubles it for the zeros in
+     * between input samples: y[2m + p] = sum(h[2k + p] * x[m - k]). */
+    for (k = 0; k < RS_TAPS; k++)
+        rs_down[k] = (int16_t) lrint(h[RS_TAPS - 1 - k] / sum * 32768);
+    for (k = 0; k < RS_PHASE_TAPS; k++)
+    {
+        rs_up[0][k] = (int16_t) lrint(h[2 * (RS_PHASE_TAPS - 1 - k)] / sum * 65536);
+        rs_up[1][k] = (int16_t) lrint(h[2 * (RS_PHASE_TAPS - 1 - k) + 1] / sum * 65536);
+    }
+}
+
+/*******************************************************************************
+**
+** Function        sco_codec_init
+**
+** Description     Build the mSBC filterbank matrices and select the fastest
+**                 kernels. Runs once.
+**
+** Returns         None
+**
+*******************************************************************************/
+static void sco_codec_init(void)
+{
+    int m, i, j, b, k;
+
+    for (m = 0; m < MSBC_SUBBANDS; m++)
+        for (i = 0; i < MSBC_TAPS; i++)
+            msbc_analysis[m * MSBC_TAPS + i] = (int16_t) lrint( \
+                msbc_proto[i] * cos((m + 0.5) * ((i & 15) - 4) * M_PI / 8) * \
+                (1 << MSBC_ANALYSIS_SHIFT));
+
+    /* Synthesis window -8 x proto on the 16 point matrixing of each past
+     * block, even blocks feed V[0..7] and odd ones V[8..15]. Subband samples
+     * come in halved to fit 16 bits. */
+    for (j = 0; j < MSBC_SUBBANDS; j++)
+        for (b = 0; b < 10; b++)
+        {
+            k = (b & 1) ? j + 8 : j;
+            for (m = 0; m < MSBC_SUBBANDS; m++)
+                msbc_synthesis[j * MSBC_TAPS + b * MSBC_SUBBANDS + m] = \
+                    (int16_t) lrint(-16 * msbc_proto[j + 8 * b] * \
+                                    cos((m + 0.5) * (k + 4) * M_PI / 8) * \
+                                    (1 << MSBC_SYNTHESIS_SHIFT));
+        }
+
+    for (m = 0; m < PLC_MULT_MAX; m++)
+    {
+        k = (m + 1) * PLC_OLA;
+        for (i = 0; i < k; i++)
+        {
+            plc_xfade_win[m][2 * i + 1] = (int16_t) ((i + 1) * 32767 / (k + 1));
+            plc_xfade_win[m][2 * i] = 32767 - plc_xfade_win[m][2 * i + 1];
+        }
+    }
+
+    sco_resampler_init();
+
+    p_sco_codec_ops = sco_codec_ops_get(SCO_CODEC_ISA_BEST);
+    ALOGI("sco codec kernels: %s", p_sco_codec_ops->p_name);
+}
+
+/*******************************************************************************
+**
+** Function        sco_cvsd_reset
+**
+** Description     Reset a CVSD encoder or decoder state
+**
+** Returns         None
+**
+*******************************************************************************/
+static void sco_cvsd_reset(sco_cvsd_t *p_cvsd)
+{
+    p_cvsd->est = 0;
+    p_cvsd->delta = CVSD_DELTA_MIN;
+    p_cvsd->hist = CVSD_HIST_INIT;
+}
+
+/*******************************************************************************
+**
+** Function        sco_cvsd_step
+**
+** Description     Run the CVSD state machine on one bit
+**
+** Returns         New accumulator value, in PCM units
+**
+*******************************************************************************/
+static inline int16_t sco_cvsd_step(sco_cvsd_t *p_cvsd, uint8_t bit)
+{
+    int32_t y;
+
+    p_cvsd->hist = ((p_cvsd->hist << 1) | bit) & CVSD_HIST_MASK;
+
+    /* Slope overload: J equal bits grow the step, otherwise it decays */
+    if ((p_cvsd->hist == 0) || (p_cvsd->hist == CVSD_HIST_MASK))
+    {
+        p_cvsd->delta += CVSD_DELTA_MIN;
+        if (p_cvsd->delta > CVSD_DELTA_MAX)
+            p_cvsd->delta = CVSD_DELTA_MAX;
+    }
+    else
+    {
+        p_cvsd->delta -= p_cvsd->delta >> 10;       /* beta = 1 - 1/1024 */
+        if (p_cvsd->delta < CVSD_DELTA_MIN)
+            p_cvsd->delta = CVSD_DELTA_MIN;
+    }
+
+    y = p_cvsd->est + ((bit) ? p_cvsd->delta : -p_cvsd->delta);
+    if (y > CVSD_Y_MAX)
+        y = CVSD_Y_MAX;
+    else if (y < CVSD_Y_MIN)
+        y = CVSD_Y_MIN;
+
+    p_cvsd->est = y - (y >> 5);                     /* h = 1 - 1/32 */
+
+    return (int16_t) (p_cvsd->est >> CVSD_Q);
+}
+
+/*******************************************************************************
+**
+** Function        sco_cvsd_encode
+**
+** Description     Encode SCO_CODEC_CVSD_SAMPLES samples. Bits are packed
+**                 LSB first, the order of the air interface.
+**
+** Returns         Number of bytes written
+**
+*******************************************************************************/
+static int sco_cvsd_encode(sco_codec_t *p_codec, const int16_t *p_pcm,
+                           uint8_t *p_frame)
+{
+    int16_t up[CVSD_BITS];
+    int i, k;
+    uint8_t byte, bit;
+
+    p_sco_codec_ops->upsample8(p_codec->cvsd_prev, p_pcm, \
+                               SCO_CODEC_CVSD_SAMPLES, up);
+    p_codec->cvsd_prev = p_pcm[SCO_CODEC_CVSD_SAMPLES - 1];
+
+    for (i = 0; i < SCO_CODEC_CVSD_SAMPLES; i++)
+    {
+        for (k = 0, byte = 0; k < 8; k++)
+        {
+            bit = (((int32_t) up[i * 8 + k] << CVSD_Q) >= \
+                   p_codec->cvsd_enc.est) ? 1 : 0;
+            sco_cvsd_step(&p_codec->cvsd_enc, bit);
+            byte |= bit << k;
+        }
+        p_frame[i] = byte;
+    }
+
+    return SCO_CODEC_FRAME_BYTES;
+}
+
+/*******************************************************************************
+**
+** Function        sco_cvsd_decode
+**
+** Description     Decode a CVSD frame into SCO_CODEC_CVSD_SAMPLES samples
+**
+** Returns         Number of samples written
+**
+*******************************************************************************/
+static int sco_cvsd_decode(sco_codec_t *p_codec, const uint8_t *p_frame,
+                           int16_t *p_pcm)
+{
+    /* Averaging windows straddle two input samples of the encoder
+     * interpolation so that the output is delayed by exactly one sample */
+    int16_t up[CVSD_OVERSAMPLING / 2 + CVSD_BITS];
+    int16_t *p_up = up + CVSD_OVERSAMPLING / 2;
+    int i, k;
+
+    memcpy(up, p_codec->cvsd_tail, sizeof(p_codec->cvsd_tail));
+    for (i = 0; i < SCO_CODEC_FRAME_BYTES; i++)
+        for (k = 0; k < 8; k++)
+            p_up[i * 8 + k] = sco_cvsd_step(&p_codec->cvsd_dec, \
+                                            (p_frame[i] >> k) & 1);
+    memcpy(p_codec->cvsd_tail, up + CVSD_BITS, sizeof(p_codec->cvsd_tail));
+
+    p_sco_codec_ops->decimate8(up, SCO_CODEC_CVSD_SAMPLES, p_pcm);
+
+    return SCO_CODEC_CVSD_SAMPLES;
+}
+
+/*******************************************************************************
+**
+** Function        sco_msbc_crc
+**
+** Description     SBC CRC-8 over a byte string
+**
+** Returns         CRC
+**
+*******************************************************************************/
+static uint8_t sco_msbc_crc(uint8_t crc, const uint8_t *p, int len)
+{
+    int i;
+
+    while (len-- > 0)
+    {
+        crc ^= *p++;
+        for (i = 0; i < 8; i++)
+            crc = (crc & 0x80) ? (uint8_t) ((crc << 1) ^ MSBC_CRC_POLY) : \
+                                 (uint8_t) (crc << 1);
+    }
+    return crc;
+}
+
+/*******************************************************************************
+**
+** Function        sco_msbc_frame_crc
+**
+** Description     CRC of an SBC frame: header bytes 1-2 and scale factors
+**
+** Returns         CRC
+**
+*******************************************************************************/
+static uint8_t sco_msbc_frame_crc(const uint8_t *p_sbc)
+{
+    uint8_t crc;
+
+    crc = sco_msbc_crc(MSBC_CRC_INIT, p_sbc + 1, 2);
+    return sco_msbc_crc(crc, p_sbc + 4, MSBC_SUBBANDS / 2);
+}
+
+/*******************************************************************************
+**
+** Function        sco_msbc_bit_alloc
+**
+** Description     SBC loudness bit allocation of a mono frame (A2DP 12.6.3)
+**
+** Returns         None
+**
+*******************************************************************************/
+static void sco_msbc_bit_alloc(const uint8_t *p_sf, uint8_t *p_bits)
+{
+    int8_t bitneed[MSBC_SUBBANDS];
+    int max_bitneed = 0, bitcount = 0, slicecount = 0, bitslice;
+    int loudness, sb;
+
+    for (sb = 0; sb < MSBC_SUBBANDS; sb++)
+    {
+        if (p_sf[sb] == 0)
+            bitneed[sb] = -5;
+        else
+        {
+            loudness = p_sf[sb] - msbc_loudness_offset[sb];
+            bitneed[sb] = (loudness > 0) ? loudness / 2 : loudness;
+        }
+        if (bitneed[sb] > max_bitneed)
+            max_bitneed = bitneed[sb];
+    }
+
+    bitslice = max_bitneed + 1;
+    do
+    {
+        bitslice--;
+        bitcount += slicecount;
+        slicecount = 0;
+        for (sb = 0; sb < MSBC_SUBBANDS; sb++)
+        {
+            if ((bitneed[sb] > bitslice + 1) && (bitneed[sb] < bitslice + 16))
+                slicecount++;
+            else if (bitneed[sb] == bitslice + 1)
+                slicecount += 2;
+        }
+    } while (bitcount + slicecount < MSBC_BITPOOL);
+
+    if (bitcount + slicecount == MSBC_BITPOOL)
+    {
+        bitcount += slicecount;
+        bitslice--;
+    }
+
+    for (sb = 0; sb < MSBC_SUBBANDS; sb++)
+    {
+        if (bitneed[sb] < bitslice + 2)
+            p_bits[sb] = 0;
+        else
+            p_bits[sb] = (bitneed[sb] - bitslice < 16) ? \
+                         bitneed[sb] - bitslice : 16;
+    }
+
+    for (sb = 0; (bitcount < MSBC_BITPOOL) && (sb < MSBC_SUBBANDS); sb++)
+    {
+        if ((p_bits[sb] >= 2) && (p_bits[sb] < 16))
+        {
+            p_bits[sb]++;
+            bitcount++;
+        }
+        else if ((bitneed[sb] == bitslice + 1) && (MSBC_BITPOOL > bitcount + 1))
+        {
+            p_bits[sb] = 2;
+            bitcount += 2;
+        }
+    }
+
+    for (sb = 0; (bitcount < MSBC_BITPOOL) && (sb < MSBC_SUBBANDS); sb++)
+    {
+        if (p_bits[sb] < 16)
+        {
+            p_bits[sb]++;
+            bitcount++;
+        }
+    }
+}
+
+/*******************************************************************************
+**
+** Function        sco_msbc_put_bits / sco_msbc_get_bits
+**
+** Description     MSB first bit string access, the buffer being cleared
+**                 before writing
+**
+** Returns         None / bits read
+**
+*******************************************************************************/
+static void sco_msbc_put_bits(uint8_t *p, uint32_t *p_pos, uint32_t value,
+                              uint8_t bits)
+{
+    while (bits-- > 0)
+    {
+        if ((value >> bits) & 1)
+            p[*p_pos >> 3] |= 0x80 >> (*p_pos & 7);
+        (*p_pos)++;
+    }
+}
+
+static uint32_t sco_msbc_get_bits(const uint8_t *p, uint32_t *p_pos, uint8_t bits)
+{
+    uint32_t value = 0;
+
+    while (bits-- > 0)
+    {
+        value = (value << 1) | ((p[*p_pos >> 3] >> (7 - (*p_pos & 7))) & 1);
+        (*p_pos)++;
+    }
+    return value;
+}
+
+/*******************************************************************************
+**
+** Function        sco_msbc_encode
+**
+** Description     Encode SCO_CODEC_MSBC_SAMPLES samples into an H2 framed
+**                 mSBC frame
+**
+** Returns         Number of bytes written
+**
+*******************************************************************************/
+static int sco_msbc_encode(sco_codec_t *p_codec, const int16_t *p_pcm,
+                           uint8_t *p_frame)
+{
+    int32_t sb[MSBC_BLOCKS][MSBC_SUBBANDS], acc[MSBC_SUBBANDS];
+    uint8_t sf[MSBC_SUBBANDS], bits[MSBC_SUBBANDS];
+    uint8_t *p_sbc = p_frame + 2;
+    uint32_t pos, max, levels;
+    int blk, i, m;
+
+    /* Analysis */
+    for (blk = 0; blk < MSBC_BLOCKS; blk++, p_pcm += MSBC_SUBBANDS)
+    {
+        memmove(p_codec->msbc_x + MSBC_SUBBANDS, p_codec->msbc_x, \
+                (MSBC_TAPS - MSBC_SUBBANDS) * sizeof(int16_t));
+        for (i = 0; i < MSBC_SUBBANDS; i++)
+            p_codec->msbc_x[i] = p_pcm[MSBC_SUBBANDS - 1 - i];
+
+        p_sco_codec_ops->dot80x8(p_codec->msbc_x, msbc_analysis, acc);
+        for (m = 0; m < MSBC_SUBBANDS; m++)
+            sb[blk][m] = (acc[m] + (1 << (MSBC_ANALYSIS_SHIFT - 1))) >> \
+                         MSBC_ANALYSIS_SHIFT;
+    }
+
+    /* Smallest scale factors with |sb| < 2^(sf + 1) */
+    for (m = 0; m < MSBC_SUBBANDS; m++)
+    {
+        for (blk = 0, max = 0; blk < MSBC_BLOCKS; blk++)
+            if ((uint32_t) abs(sb[blk][m]) > max)
+                max = abs(sb[blk][m]);
+        for (sf[m] = 0; (sf[m] < 15) && (max >= (2U << sf[m])); sf[m]++)
+            ;
+    }
+    sco_msbc_bit_alloc(sf, bits);
+
+    memset(p_frame, 0, SCO_CODEC_FRAME_BYTES);
+    p_frame[0] = MSBC_H2_SYNC;
+    p_frame[1] = msbc_h2_seq[p_codec->msbc_seq];
+    p_codec->msbc_seq = (p_codec->msbc_seq + 1) & 3;
+
+    p_sbc[0] = MSBC_SYNCWORD;
+    for (m = 0; m < MSBC_SUBBANDS; m += 2)
+        p_sbc[4 + m / 2] = (sf[m] << 4) | sf[m + 1];
+    p_sbc[3] = sco_msbc_frame_crc(p_sbc);
+
+    /* q = (sb / 2^(sf + 1) + 1) * levels / 2 */
+    pos = (4 + MSBC_SUBBANDS / 2) * 8;
+    for (blk = 0; blk < MSBC_BLOCKS; blk++)
+        for (m = 0; m < MSBC_SUBBANDS; m++)
+        {
+            if (bits[m] == 0)
+                continue;
+            levels = (1U << bits[m]) - 1;
+            sco_msbc_put_bits(p_sbc, &pos, (uint32_t) \
+                (((int64_t) (sb[blk][m] + (2 << sf[m])) * levels) >> \
+                 (sf[m] + 2)), bits[m]);
+        }
+
+    return SCO_CODEC_FRAME_BYTES;
+}
+
+/*******************************************************************************
+**
+** Function        sco_msbc_decode
+**
+** Description     Decode an H2 framed mSBC frame into
+**                 SCO_CODEC_MSBC_SAMPLES samples
+**
+** Returns         Number of samples written, -1 if the frame is corrupted
+**
+*******************************************************************************/
+static int sco_msbc_decode(sco_codec_t *p_codec, const uint8_t *p_frame,
+                           int16_t *p_pcm)
+{
+    int32_t acc[MSBC_SUBBANDS], s;
+    uint8_t sf[MSBC_SUBBANDS], bits[MSBC_SUBBANDS];
+    const uint8_t *p_sbc = p_frame + 2;
+    uint32_t pos, levels, q;
+    int blk, i, m;
+
+    if ((p_frame[0] != MSBC_H2_SYNC) || (p_sbc[0] != MSBC_SYNCWORD))
+    {
+        SCOCDBG("msbc: sync lost");
+        return -1;
+    }
+    for (i = 0; (i < 4) && (p_frame[1] != msbc_h2_seq[i]); i++)
+        ;
+    if ((i == 4) || (sco_msbc_frame_crc(p_sbc) != p_sbc[3]))
+    {
+        SCOCDBG("msbc: bad header or crc");
+        return -1;
+    }
+
+    for (m = 0; m < MSBC_SUBBANDS; m += 2)
+    {
+        sf[m] = p_sbc[4 + m / 2] >> 4;
+        sf[m + 1] = p_sbc[4 + m / 2] & 0x0F;
+    }
+    sco_msbc_bit_alloc(sf, bits);
+
+    pos = (4 + MSBC_SUBBANDS / 2) * 8;
+    for (blk = 0; blk < MSBC_BLOCKS; blk++, p_pcm += MSBC_SUBBANDS)
+    {
+        memmove(p_codec->msbc_v + MSBC_SUBBANDS, p_codec->msbc_v, \
+                (MSBC_TAPS - MSBC_SUBBANDS) * sizeof(int16_t));
+
+        /* sb = 2^(sf + 1) * ((2q + 1) / levels - 1) */
+        for (m = 0; m < MSBC_SUBBANDS; m++)
+        {
+            s = 0;
+            if (bits[m] != 0)
+            {
+                levels = (1U << bits[m]) - 1;
+                q = sco_msbc_get_bits(p_sbc, &pos, bits[m]);
+                s = (int32_t) ((((int64_t) (2 * q + 1)) << (sf[m] + 1)) / \
+                               levels) - (2 << sf[m]);
+            }
+            s >>= 1;
+            p_codec->msbc_v[m] = (int16_t) SCO_CODEC_SAT16(s);
+        }
+
+        p_sco_codec_ops->dot80x8(p_codec->msbc_v, msbc_synthesis, acc);
+        for (i = 0; i < MSBC_SUBBANDS; i++)
+        {
+            s = (acc[i] + (1 << (MSBC_SYNTHESIS_SHIFT - 1))) >> \
+                MSBC_SYNTHESIS_SHIFT;
+            p_pcm[i] = (int16_t) SCO_CODEC_SAT16(s);
+        }
+    }
+
+    return SCO_CODEC_MSBC_SAMPLES;
+}
+
+/*******************************************************************************
+**
+** Function        sco_codec_cpu_ns
+**
+** Description     CPU time of the calling thread
+**
+** Returns         Time in nanoseconds
+**
+*******************************************************************************/
+static uint64_t sco_codec_cpu_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*******************************************************************************
+**
+** Function        sco_plc_reset
+**
+** Description     Reset the concealment state for a sample rate of
+**                 mult x 8 kHz
+**
+** Returns         None
+**
+*******************************************************************************/
+static void sco_plc_reset(sco_plc_t *p_plc, uint8_t mult)
+{
+    memset(p_plc, 0, sizeof(*p_plc));
+    p_plc->mult = mult;
+}
+
+/*******************************************************************************
+**
+** Function        sco_plc_push
+**
+** Description     Append output samples to the concealment history
+**
+** Returns         None
+**
+*******************************************************************************/
+static void sco_plc_push(sco_plc_t *p_plc, const int16_t *p_pcm, uint16_t n)
+{
+    uint16_t len = p_plc->mult * PLC_HIST;
+
+    memmove(p_plc->hist, p_plc->hist + n, (len - n) * sizeof(int16_t));
+    memcpy(p_plc->hist + len - n, p_pcm, n * sizeof(int16_t));
+}
+
+/*******************************************************************************
+**
+** Function        sco_plc_pitch
+**
+** Description     Find the period whose past waveform best matches the end
+**                 of the history, by normalized cross-correlation
+**
+** Returns         Period in samples
+**
+*******************************************************************************/
+static uint16_t sco_plc_pitch(const sco_plc_t *p_plc)
+{
+    uint16_t win = p_plc->mult * PLC_WINDOW;
+    uint16_t pitch_min = p_plc->mult * PLC_PITCH_MIN;
+    uint16_t pitch_max = p_plc->mult * PLC_PITCH_MAX;
+    const int16_t *p_target = p_plc->hist + p_plc->mult * PLC_HIST - win;
+    const int16_t *p_cand = p_target - pitch_min;
+    uint16_t pitch, best = pitch_max;
+    double score, best_score = 0;
+    int64_t corr, energy;
+
+    energy = p_sco_codec_ops->dot(p_cand, p_cand, win);
+    for (pitch = pitch_min; pitch <= pitch_max; pitch++, p_cand--)
+    {
+        if (pitch > pitch_min)
+            energy += p_cand[0] * p_cand[0] - p_cand[win] * p_cand[win];
+
+        corr = p_sco_codec_ops->dot(p_target, p_cand, win);
+        if (corr <= 0)
+            continue;
+
+        score = (double) corr * corr / (double) (energy + 1);
+        if (score > best_score)
+        {
+            best_score = score;
+            best = pitch;
+        }
+    }
+
+    return best;
+}
+
+/*******************************************************************************
+**
+** Function        sco_plc_extend
+**
+** Description     Continue the repetition of the last pitch period, held at
+**                 full level for PLC_HOLD and then faded out over PLC_FADE
+**
+** Returns         None
+**
+*******************************************************************************/
+static void sco_plc_extend(sco_plc_t *p_plc, int16_t *p_out, uint16_t n)
+{
+    uint32_t hold = p_plc->mult * PLC_HOLD, fade = p_plc->mult * PLC_FADE;
+    uint32_t gain;
+    uint16_t i;
+
+    for (i = 0; i < n; i++, p_plc->lost_samples++)
+    {
+        if (p_plc->lost_samples < hold)
+            gain = 32767;
+        else if (p_plc->lost_samples < hold + fade)
+            gain = 32767 - (p_plc->lost_samples - hold) * 32767 / fade;
+        else
+            gain = 0;
+
+        p_out[i] = (int16_t) ((p_plc->period[p_plc->pos] * (int32_t) gain) >> 15);
+        if (++p_plc->pos == p_plc->pitch)
+            p_plc->pos = 0;
+    }
+}
+
+/*******************************************************************************
+**
+** Function        sco_plc_conceal
+**
+** Description     Produce a frame in place of a lost one
+**
+** Returns         None
+**
+*******************************************************************************/
+static void sco_plc_conceal(sco_plc_t *p_plc, int16_t *p_pcm, uint16_t n)
+{
+    if (p_plc->concealing == FALSE)
+    {
+        p_plc->pitch = sco_plc_pitch(p_plc);
+        memcpy(p_plc->period, \
+               p_plc->hist + p_plc->mult * PLC_HIST - p_plc->pitch, \
+               p_plc->pitch * sizeof(int16_t));
+        p_plc->pos = 0;
+        p_plc->lost_samples = 0;
+        p_plc->concealing = TRUE;
+        SCOCDBG("plc: pitch %d", p_plc->pitch);
+    }
+
+    sco_plc_extend(p_plc, p_pcm, n);
+    sco_plc_push(p_plc, p_pcm, n);
+}
+
+/*******************************************************************************
+**
+** Function        sco_plc_recover
+**
+** Description     Overlap-add the concealment continued over the start of
+**                 the first good frame, then let it through
+**
+** Returns         None
+**
+*******************************************************************************/
+static void sco_plc_recover(sco_plc_t *p_plc, int16_t *p_pcm, uint16_t n)
+{
+    int16_t ext[PLC_MULT_MAX * PLC_OLA];
+    uint16_t ola = p_plc->mult * PLC_OLA;
+
+    if (p_plc->concealing == TRUE)
+    {
+        sco_plc_extend(p_plc, ext, ola);
+        p_sco_codec_ops->xfade(ext, p_pcm, plc_xfade_win[p_plc->mult - 1], ola);
+        p_plc->concealing = FALSE;
+    }
+
+    sco_plc_push(p_plc, p_pcm, n);
+}
+
+/*****************************************************************************
+**   SCO Codec Interface Functions
+*****************************************************************************/
+
+/*******************************************************************************
+**
+** Function        sco_codec_open
+**
+** Description     Allocate a codec instance
+**
+** Returns         Codec instance, NULL if the codec is unknown or out of
+**                 memory
+**
+*******************************************************************************/
+sco_codec_t *sco_codec_open(uint8_t codec)
+{
+    sco_codec_t *p_codec;
+
+    if (sco_codec_frame_samples(codec) == 0)
+    {
+        ALOGE("sco codec %d unknown", codec);
+        return NULL;
+    }
+
+    pthread_once(&sco_codec_once, sco_codec_init);
+
+    if ((p_codec = calloc(1, sizeof(*p_codec))) == NULL)
+        return NULL;
+
+    p_codec->codec = codec;
+    sco_codec_reset(p_codec);
+
+    return p_codec;
+}
+
+/*******************************************************************************
+**
+** Function        sco_codec_close
+**
+** Description     Release a codec instance
+**
+** Returns         None
+**
+*******************************************************************************/
+void sco_codec_close(sco_codec_t *p_codec)
+{
+    sco_codec_stats_t stats;
+
+    if (p_codec == NULL)
+        return;
+
+    sco_codec_get_stats(p_codec, &stats);
+    if (stats.frames > 0)
+        ALOGI("sco codec rx: %u frames, %u concealed (%u lost, %u errors), " \
+              "plc %u ns/frame avg, %u max", stats.frames, stats.concealed, \
+              stats.lost, stats.errors, stats.plc_ns_avg, stats.plc_ns_max);
+
+    free(p_codec);
+}
+
+/*******************************************************************************
+**
+** Function        sco_codec_reset
+**
+** Description     Reset the encoder and decoder states
+**
+** Returns         None
+**
+*******************************************************************************/
+void sco_codec_reset(sco_codec_t *p_codec)
+{
+    sco_cvsd_reset(&p_codec->cvsd_enc);
+    sco_cvsd_reset(&p_codec->cvsd_dec);
+    p_codec->cvsd_prev = 0;
+    memset(p_codec->cvsd_tail, 0, sizeof(p_codec->cvsd_tail));
+    memset(p_codec->msbc_x, 0, sizeof(p_codec->msbc_x));
+    memset(p_codec->msbc_v, 0, sizeof(p_codec->msbc_v));
+    p_codec->msbc_seq = 0;
+
+    sco_plc_reset(&p_codec->plc, (p_codec->codec == SCO_CODEC_MSBC) ? 2 : 1);
+    memset(&p_codec->stats, 0, sizeof(p_codec->stats));
+    p_codec->plc_ns = 0;
+}
+
+/*******************************************************************************
+**
+** Function        sco_codec_frame_samples
+**
+** Description     Get the number of PCM samples coded in a frame
+**
+** Returns         Samples per frame, 0 if the codec is unknown
+**
+*******************************************************************************/
+uint16_t sco_codec_frame_samples(uint8_t codec)
+{
+    switch (codec)
+    {
+        case SCO_CODEC_CVSD:
+            return SCO_CODEC_CVSD_SAMPLES;
+
+        case SCO_CODEC_MSBC:
+            return SCO_CODEC_MSBC_SAMPLES;
+
+        default:
+            return 0;
+    }
+}
+
+/*******************************************************************************
+**
+** Function        sco_codec_encode
+**
+** Description     Encode one frame of PCM samples
+**
+** Returns         Number of bytes written, <0 on error
+**
+*******************************************************************************/
+int sco_codec_encode(sco_codec_t *p_codec, const int16_t *p_pcm,
+                     uint8_t *p_frame)
+{
+    if (p_codec->codec == SCO_CODEC_MSBC)
+        return sco_msbc_encode(p_codec, p_pcm, p_frame);
+
+    return sco_cvsd_encode(p_codec, p_pcm, p_frame);
+}
+
+/*******************************************************************************
+**
+** Function        sco_codec_decode
+**
+** Description     Decode one frame into PCM samples
+**
+** Returns         Number of samples written, <0 if the frame is corrupted
+**
+*******************************************************************************/
+int sco_codec_decode(sco_codec_t *p_codec, const uint8_t *p_frame,
+                     int16_t *p_pcm)
+{
+    if (p_codec->codec == SCO_CODEC_MSBC)
+        return sco_msbc_decode(p_codec, p_frame, p_pcm);
+
+    return sco_cvsd_decode(p_codec, p_frame, p_pcm);
+}
+
+/*******************************************************************************
+**
+** Function        sco_codec_receive
+**
+** Description     Decode one received frame, or conceal it when its packet
+**                 status flag reports an error or it does not decode
+**
+** Returns         Number of samples written
+**
+*******************************************************************************/
+int sco_codec_receive(sco_codec_t *p_codec, const uint8_t *p_frame,
+                      uint8_t pkt_status, int16_t *p_pcm)
+{
+    uint16_t samples = sco_codec_frame_samples(p_codec->codec);
+    uint64_t start_ns;
+    uint32_t ns;
+
+    p_codec->stats.frames++;
+
+    if ((pkt_status == SCO_CODEC_PKT_LOST) || \
+        (pkt_status == SCO_CODEC_PKT_PARTIAL) || (p_frame == NULL))
+    {
+        p_codec->stats.lost++;
+    }
+    else if ((pkt_status == SCO_CODEC_PKT_OK) && \
+             (sco_codec_decode(p_codec, p_frame, p_pcm) == samples))
+    {
+        sco_plc_recover(&p_codec->plc, p_pcm, samples);
+        return samples;
+    }
+    else
+    {
+        p_codec->stats.errors++;
+    }
+
+    start_ns = sco_codec_cpu_ns();
+    sco_plc_conceal(&p_codec->plc, p_pcm, samples);
+    ns = (uint32_t) (sco_codec_cpu_ns() - start_ns);
+
+    p_codec->stats.concealed++;
+    p_codec->plc_ns += ns;
+    if (ns > p_codec->stats.plc_ns_max)
+        p_codec->stats.plc_ns_max = ns;
+
+    return samples;
+}
+
+/*******************************************************************************
+**
+** Function        sco_codec_get_stats
+**
+** Description     Get the receive statistics of a codec instance
+**
+** Returns         None
+**
+*******************************************************************************/
+void sco_codec_get_stats(const sco_codec_t *p_codec, sco_codec_stats_t *p_stats)
+{
+    *p_stats = p_codec->stats;
+    p_stats->plc_ns_avg = (p_codec->stats.concealed > 0) ? \
+        (uint32_t) (p_codec->plc_ns / p_codec->stats.concealed) : 0;
+}
+
+/*******************************************************************************
+**
+** Function        sco_resampler_open
+**
+** Description     Allocate an 8 <-> 16 kHz sample rate converter
+**                 (SCO_RESAMPLE_*)
+**
+** Returns         Converter instance, NULL on error
+**
+*******************************************************************************/
+sco_resampler_t *sco_resampler_open(uint8_t dir)
+{
+    sco_resampler_t *p_rs;
+
+    if ((dir != SCO_RESAMPLE_8K_TO_16K) && (dir != SCO_RESAMPLE_16K_TO_8K))
+        return NULL;
+
+    pthread_once(&sco_codec_once, sco_codec_init);
+
+    if ((p_rs = calloc(1, sizeof(*p_rs))) == NULL)
+        return NULL;
+
+    p_rs->dir = dir;
+    p_rs->hist = ((dir == SCO_RESAMPLE_8K_TO_16K) ? RS_PHASE_TAPS : RS_TAPS) - 1;
+
+    return p_rs;
+}
+
+/*******************************************************************************
+**
+** Function        sco_resampler_close
+**
+** Description     Release a sample rate converter
+**
+** Returns         None
+**
+*******************************************************************************/
+void sco_resampler_close(sco_resampler_t *p_rs)
+{
+    free(p_rs);
+}
+
+/*******************************************************************************
+**
+** Function        sco_resampler_reset
+**
+** Description     Clear the filter history, e.g. when a new stream starts
+**
+** Returns         None
+**
+*******************************************************************************/
+void sco_resampler_reset(sco_resampler_t *p_rs)
+{
+    memset(p_rs->buf, 0, sizeof(p_rs->buf));
+}
+
+/*******************************************************************************
+**
+** Function        sco_resampler_process
+**
+** Description     Convert n input samples, n even when downsampling. p_out
+**                 holds 2 x n samples upsampling, n / 2 downsampling.
+**
+** Returns         Number of samples written
+**
+*******************************************************************************/
+uint16_t sco_resampler_process(sco_resampler_t *p_rs, const int16_t *p_in,
+                               uint16_t n, int16_t *p_out)
+{
+    uint16_t block, i, out = 0;
+
+    if ((p_rs->dir == SCO_RESAMPLE_16K_TO_8K) && (n & 1))
+    {
+        ALOGE("%s: odd input length %d", __func__, n);
+        return 0;
+    }
+
+    /* The history precedes each block in buf[], so that the FIR windows
+     * of all its outputs are contiguous */
+    for (; n > 0; n -= block, p_in += block)
+    {
+        block = (n > RS_BLOCK) ? RS_BLOCK : n;
+        memcpy(p_rs->buf + p_rs->hist, p_in, block * sizeof(int16_t));
+
+        if (p_rs->dir == SCO_RESAMPLE_8K_TO_16K)
+        {
+            p_sco_codec_ops->fir(p_rs->buf, rs_up[0], RS_PHASE_TAPS, 1, \
+                                 block, p_rs->phase[0]);
+            p_sco_codec_ops->fir(p_rs->buf, rs_up[1], RS_PHASE_TAPS, 1, \
+                                 block, p_rs->phase[1]);
+            for (i = 0; i < block; i++, out += 2)
+            {
+                p_out[out] = p_rs->phase[0][i];
+                p_out[out + 1] = p_rs->phase[1][i];
+            }
+        }
+        else
+        {
+            p_sco_codec_ops->fir(p_rs->buf + 1, rs_down, RS_TAPS, 2, \
+                                 block / 2, p_out + out);
+            out += block / 2;
+        }
+
+        memmove(p_rs->buf, p_rs->buf + block, p_rs->hist * sizeof(int16_t));
+    }
+
+    return out;
+}
+
+/*******************************************************************************
+**
+** Function        sco_codec_set_isa
+**
+** Description     Select the kernels of all codec instances
+**
+** Returns         SCO_CODEC_ISA_* in use
+**
+*******************************************************************************/
+uint8_t sco_codec_set_isa(uint8_t isa)
+{
+    pthread_once(&sco_codec_once, sco_codec_init);
+
+    p_sco_codec_ops = sco_codec_ops_get(isa);
+    ALOGI("sco codec kernels: %s", p_sco_codec_ops->p_name);
+
+    return p_sco_codec_ops->isa;
+}
+
+/*******************************************************************************
+**
+** Function        sco_codec_benchmark
+**
+** Description     Encode and decode frames of a synthetic voice signal on
+**                 the calling thread, with the kernels in use
+**
+** Returns         Encoded plus decoded frames per second, 0 on error
+**
+*******************************************************************************/
+uint32_t sco_codec_benchmark(uint8_t codec, uint32_t frames)
+{
+    static int16_t pcm[SCO_CODEC_BENCH_FRAMES][SCO_CODEC_MAX_SAMPLES];
+    int16_t out[SCO_CODEC_MAX_SAMPLES];
+    uint8_t frame[SCO_CODEC_FRAME_BYTES];
+    struct timespec start, end;
+    sco_codec_t *p_codec;
+    uint16_t samples;
+    uint32_t i, n, t, rate, fps, seed = 1;
+    uint64_t elapsed_us;
+
+    if ((frames == 0) || ((p_codec = sco_codec_open(codec)) == NULL))
+        return 0;
+
+    /* 300 Hz and 1.1 kHz tones over some noise, generated beforehand */
+    samples = sco_codec_frame_samples(codec);
+    rate = (codec == SCO_CODEC_MSBC) ? 16000 : 8000;
+    for (n = 0, t = 0; n < SCO_CODEC_BENCH_FRAMES; n++)
+        for (i = 0; i < samples; i++, t++)
+        {
+            seed = seed * 1103515245 + 12345;
+            pcm[n][i] = (int16_t) (8000 * sin(2 * M_PI * 300 * t / rate) + \
+                                   4000 * sin(2 * M_PI * 1100 * t / rate) + \
+                                   (int16_t) (seed >> 16) / 64);
+        }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (n = 0; n < frames; n++)
+    {
+        sco_codec_encode(p_codec, pcm[n % SCO_CODEC_BENCH_FRAMES], frame);
+        sco_codec_decode(p_codec, frame, out);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    sco_codec_close(p_codec);
+
+    elapsed_us = (uint64_t) (end.tv_sec - start.tv_sec) * 1000000 + \
+                 (end.tv_nsec - start.tv_nsec) / 1000;
+    if (elapsed_us == 0)
+        elapsed_us = 1;
+    fps = (uint32_t) ((uint64_t) frames * 1000000 / elapsed_us);
+
+    ALOGI("sco codec %s/%s: %u frames in %u us, %u frames/s", \
+          (codec == SCO_CODEC_MSBC) ? "msbc" : "cvsd", \
+          p_sco_codec_ops->p_name, frames, (uint32_t) elapsed_us, fps);
+
+    return fps;
+}
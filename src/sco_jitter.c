@@ -0,0 +1,587 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2009-2012 Broadcom Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+/******************************************************************************
+ *
+ *  Filename:      sco_jitter.c
+ *
+ *  Description:   Contains the adaptive jitter buffer of host routed SCO
+ *                 audio.
+ *
+ *                 SCO packets reach the host in bursts, after tty buffering
+ *                 and LPM wakeups. Each payload is reassembled into codec
+ *                 frames and the arrival of each frame is compared with the
+ *                 nominal 7.5 ms frame clock. The lateness distribution over
+ *                 the last 3 s sets the smallest playout delay that keeps
+ *                 underruns below SCO_JB_UNDERRUN_PPM. An underrun conceals
+ *                 one frame and thereby grows the delay by one frame, a
+ *                 delay above target for a whole second is shrunk by
+ *                 merging two frames into one.
+ *
+ ******************************************************************************/
+
+#define LOG_TAG "bt_sco_jitter"
+
+#include <utils/Log.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bt_vendor_brcm.h"
+#include "sco_codec.h"
+#include "sco_jitter.h"
+
+/******************************************************************************
+**  Constants & Macros
+******************************************************************************/
+
+#ifndef SCO_JB_DBG
+#define SCO_JB_DBG FALSE
+#endif
+
+#if (SCO_JB_DBG == TRUE)
+#define SCOJDBG(param, ...) {ALOGD(param, ## __VA_ARGS__);}
+#else
+#define SCOJDBG(param, ...) {}
+#endif
+
+/* Acceptable rate of underruns, in parts per million of frames */
+#ifndef SCO_JB_UNDERRUN_PPM
+#define SCO_JB_UNDERRUN_PPM     10000
+#endif
+
+/* Upper bound of the playout delay target */
+#ifndef SCO_JB_MAX_DELAY_MS
+#define SCO_JB_MAX_DELAY_MS     60
+#endif
+
+#define SCO_JB_FRAME_US         7500
+#define SCO_JB_WINDOW           400     /* Frames of the lateness model, 3 s */
+#define SCO_JB_SHRINK_FRAMES    133     /* Excess delay held for 1 s */
+
+/* HCI SCO data packet: handle with packet status flag, length, payload */
+#define SCO_JB_HDR_LEN          3
+#define SCO_JB_PKT_STATUS(hf)   (((hf) >> 12) & 0x03)
+
+/******************************************************************************
+**  Local type definitions
+******************************************************************************/
+
+typedef struct
+{
+    uint8_t data[SCO_CODEC_FRAME_BYTES];
+    uint8_t status;                     /* SCO_CODEC_PKT_* */
+    uint64_t arrival_us;
+} sco_jb_frame_t;
+
+struct sco_jb
+{
+    pthread_mutex_t mutex;
+    sco_codec_t *p_codec;
+    uint16_t samples;
+    uint32_t underrun_ppm;
+    uint8_t max_target;
+
+    /* Reassembly of SCO payloads into codec frames */
+    uint8_t asm_data[SCO_CODEC_FRAME_BYTES];
+    uint8_t asm_len;
+    uint8_t asm_status;
+
+    /* Frames waiting for playout */
+    sco_jb_frame_t frames[SCO_JB_MAX_FRAMES];
+    uint8_t head;
+    uint8_t depth;
+    uint8_t playing;
+    uint8_t target;                     /* Playout delay target in frames */
+    uint8_t min_depth;
+    uint16_t shrink_count;
+
+    /* Lateness model over the last SCO_JB_WINDOW frames */
+    uint64_t t0_us;
+    uint32_t seq;
+    int64_t offset_us[SCO_JB_WINDOW];   /* Arrival - seq x frame period */
+    uint8_t late_bin[SCO_JB_WINDOW];
+    uint16_t window_hist[SCO_JB_HIST_BINS];
+
+    sco_jb_stats_t stats;
+};
+
+/* Configuration from bt_vendor.conf, applied to jitter buffers opened next */
+typedef struct
+{
+    uint32_t underrun_ppm;
+    uint16_t max_delay_ms;
+} sco_jb_cfg_t;
+
+/******************************************************************************
+**  Static variables
+******************************************************************************/
+
+static sco_jb_cfg_t sco_jb_cfg =
+{
+    SCO_JB_UNDERRUN_PPM, SCO_JB_MAX_DELAY_MS
+};
+
+/*****************************************************************************
+**   Static functions
+*****************************************************************************/
+
+/*******************************************************************************
+**
+** Function        sco_jb_now_us
+**
+** Description     Monotonic time
+**
+** Returns         Time in microseconds
+**
+*******************************************************************************/
+static uint64_t sco_jb_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*******************************************************************************
+**
+** Function        sco_jb_bin
+**
+** Description     Histogram bin of a duration
+**
+** Returns         Bin index
+**
+*******************************************************************************/
+static uint8_t sco_jb_bin(int64_t us)
+{
+    if (us <= 0)
+        return 0;
+    if (us >= (int64_t) SCO_JB_HIST_BINS * SCO_JB_HIST_BIN_US)
+        return SCO_JB_HIST_BINS - 1;
+    return (uint8_t) (us / SCO_JB_HIST_BIN_US);
+}
+
+/*******************************************************************************
+**
+** Function        sco_jb_update_target
+**
+** Description     Set the playout delay target to the smallest lateness
+**                 exceeded by at most underrun_ppm of the recent frames
+**
+** Returns         None
+**
+*******************************************************************************/
+static void sco_jb_update_target(sco_jb_t *p_jb)
+{
+    uint32_t frames = (p_jb->seq < SCO_JB_WINDOW) ? p_jb->seq : SCO_JB_WINDOW;
+    uint64_t allowed = (uint64_t) frames * p_jb->underrun_ppm;
+    uint32_t above = frames;
+    uint32_t delay_us;
+    uint8_t bin, target;
+
+    for (bin = 0; bin < SCO_JB_HIST_BINS - 1; bin++)
+    {
+        above -= p_jb->window_hist[bin];
+        if ((uint64_t) above * 1000000 <= allowed)
+            break;
+    }
+
+    delay_us = (bin + 1) * SCO_JB_HIST_BIN_US;
+    target = (uint8_t) ((delay_us + SCO_JB_FRAME_US - 1) / SCO_JB_FRAME_US);
+    if (target > p_jb->max_target)
+        target = p_jb->max_target;
+    if (target < 1)
+        target = 1;
+
+    if (target != p_jb->target)
+        SCOJDBG("jb target %d -> %d frames", p_jb->target, target);
+    p_jb->target = target;
+}
+
+/*******************************************************************************
+**
+** Function        sco_jb_push
+**
+** Description     Queue the reassembled frame and account its lateness.
+**                 Called with the mutex held.
+**
+** Returns         None
+**
+*******************************************************************************/
+static void sco_jb_push(sco_jb_t *p_jb, uint64_t now_us)
+{
+    uint16_t slot = p_jb->seq % SCO_JB_WINDOW;
+    sco_jb_frame_t *p_frame;
+    int64_t offset_us, base_us;
+    uint16_t i, n;
+    uint8_t bin;
+
+    if (p_jb->seq == 0)
+        p_jb->t0_us = now_us;
+
+    /* Lateness against the earliest arrival of the window, which also
+     * follows the drift between the controller and the host clocks */
+    offset_us = (int64_t) (now_us - p_jb->t0_us) - \
+                (int64_t) p_jb->seq * SCO_JB_FRAME_US;
+    if (p_jb->seq >= SCO_JB_WINDOW)
+        p_jb->window_hist[p_jb->late_bin[slot]]--;
+    p_jb->offset_us[slot] = offset_us;
+
+    n = (p_jb->seq < SCO_JB_WINDOW) ? p_jb->seq + 1 : SCO_JB_WINDOW;
+    base_us = offset_us;
+    for (i = 0; i < n; i++)
+        if (p_jb->offset_us[i] < base_us)
+            base_us = p_jb->offset_us[i];
+
+    bin = sco_jb_bin(offset_us - base_us);
+    p_jb->late_bin[slot] = bin;
+    p_jb->window_hist[bin]++;
+    p_jb->stats.jitter_hist[bin]++;
+    p_jb->seq++;
+
+    sco_jb_update_target(p_jb);
+
+    if (p_jb->depth == SCO_JB_MAX_FRAMES)
+    {
+        p_jb->head = (p_jb->head + 1) % SCO_JB_MAX_FRAMES;
+        p_jb->depth--;
+        p_jb->stats.overflows++;
+    }
+
+    p_frame = &p_jb->frames[(p_jb->head + p_jb->depth) % SCO_JB_MAX_FRAMES];
+    memcpy(p_frame->data, p_jb->asm_data, SCO_CODEC_FRAME_BYTES);
+    p_frame->status = p_jb->asm_status;
+    p_frame->arrival_us = now_us;
+    p_jb->depth++;
+}
+
+/*******************************************************************************
+**
+** Function        sco_jb_pop
+**
+** Description     Dequeue the oldest frame. Called with the mutex held.
+**
+** Returns         None
+**
+*******************************************************************************/
+static void sco_jb_pop(sco_jb_t *p_jb, sco_jb_frame_t *p_frame)
+{
+    *p_frame = p_jb->frames[p_jb->head];
+    p_jb->head = (p_jb->head + 1) % SCO_JB_MAX_FRAMES;
+    p_jb->depth--;
+}
+
+/*****************************************************************************
+**   SCO Jitter Buffer Interface Functions
+*****************************************************************************/
+
+/*******************************************************************************
+**
+** Function        sco_jb_open
+**
+** Description     Allocate a jitter buffer decoding codec (SCO_CODEC_*)
+**
+** Returns         Jitter buffer instance, NULL on error
+**
+*******************************************************************************/
+sco_jb_t *sco_jb_open(uint8_t codec)
+{
+    sco_jb_t *p_jb;
+
+    if ((p_jb = calloc(1, sizeof(*p_jb))) == NULL)
+        return NULL;
+
+    if ((p_jb->p_codec = sco_codec_open(codec)) == NULL)
+    {
+        free(p_jb);
+        return NULL;
+    }
+
+    pthread_mutex_init(&p_jb->mutex, NULL);
+    p_jb->samples = sco_codec_frame_samples(codec);
+    p_jb->underrun_ppm = sco_jb_cfg.underrun_ppm;
+    p_jb->max_target = sco_jb_cfg.max_delay_ms * 1000 / SCO_JB_FRAME_US;
+    if (p_jb->max_target >= SCO_JB_MAX_FRAMES)
+        p_jb->max_target = SCO_JB_MAX_FRAMES - 1;
+    sco_jb_reset(p_jb);
+
+    return p_jb;
+}
+
+/*******************************************************************************
+**
+** Function        sco_jb_close
+**
+** Description     Release a jitter buffer, logging its statistics
+**
+** Returns         None
+**
+*******************************************************************************/
+void sco_jb_close(sco_jb_t *p_jb)
+{
+    char jitter[SCO_JB_HIST_BINS * 12], delay[SCO_JB_HIST_BINS * 12];
+    int jitter_len = 0, delay_len = 0;
+    sco_jb_stats_t stats;
+    uint8_t bin;
+
+    if (p_jb == NULL)
+        return;
+
+    sco_jb_get_stats(p_jb, &stats);
+    if (stats.frames > 0)
+    {
+        jitter[0] = delay[0] = '\0';
+        for (bin = 0; bin < SCO_JB_HIST_BINS; bin++)
+        {
+            if (stats.jitter_hist[bin] > 0)
+                jitter_len += snprintf(jitter + jitter_len, \
+                                       sizeof(jitter) - jitter_len, " %d:%u", \
+                                       bin * SCO_JB_HIST_BIN_US / 1000, \
+                                       stats.jitter_hist[bin]);
+            if (stats.delay_hist[bin] > 0)
+                delay_len += snprintf(delay + delay_len, \
+                                      sizeof(delay) - delay_len, " %d:%u", \
+                                      bin * SCO_JB_HIST_BIN_US / 1000, \
+                                      stats.delay_hist[bin]);
+        }
+
+        ALOGI("sco jb: %u packets, %u frames, %u underruns, %u drops, " \
+              "%u overflows, target %u ms", stats.packets, stats.frames, \
+              stats.underruns, stats.drops, stats.overflows, stats.target_ms);
+        ALOGI("sco jb: lateness ms:frames%s", jitter);
+        ALOGI("sco jb: delay ms:frames%s", delay);
+    }
+
+    sco_codec_close(p_jb->p_codec);
+    pthread_mutex_destroy(&p_jb->mutex);
+    free(p_jb);
+}
+
+/*******************************************************************************
+**
+** Function        sco_jb_reset
+**
+** Description     Flush the buffer and restart its timing model, e.g. when
+**                 the SCO link is set up again
+**
+** Returns         None
+**
+*******************************************************************************/
+void sco_jb_reset(sco_jb_t *p_jb)
+{
+    pthread_mutex_lock(&p_jb->mutex);
+
+    p_jb->asm_len = 0;
+    p_jb->asm_status = SCO_CODEC_PKT_OK;
+    p_jb->head = p_jb->depth = 0;
+    p_jb->playing = FALSE;
+    p_jb->target = 1;
+    p_jb->min_depth = 0xFF;
+    p_jb->shrink_count = 0;
+    p_jb->seq = 0;
+    memset(p_jb->window_hist, 0, sizeof(p_jb->window_hist));
+    memset(&p_jb->stats, 0, sizeof(p_jb->stats));
+    sco_codec_reset(p_jb->p_codec);
+
+    pthread_mutex_unlock(&p_jb->mutex);
+}
+
+/*******************************************************************************
+**
+** Function        sco_jb_put
+**
+** Description     Queue one HCI SCO data packet (handle, length and payload,
+**                 without the H4 packet type). To be called as soon as the
+**                 packet is read from the UART, it is timestamped on entry.
+**
+** Returns         None
+**
+*******************************************************************************/
+void sco_jb_put(sco_jb_t *p_jb, const uint8_t *p_pkt, uint16_t len)
+{
+    uint64_t now_us = sco_jb_now_us();
+    uint8_t status, data_len, n;
+
+    if ((len < SCO_JB_HDR_LEN) || (len < SCO_JB_HDR_LEN + p_pkt[2]))
+    {
+        ALOGW("%s: truncated SCO packet (%d bytes)", __func__, len);
+        return;
+    }
+
+    status = SCO_JB_PKT_STATUS(p_pkt[1]);
+    data_len = p_pkt[2];
+    p_pkt += SCO_JB_HDR_LEN;
+
+    pthread_mutex_lock(&p_jb->mutex);
+
+    p_jb->stats.packets++;
+
+    /* A frame is as bad as the first bad packet it came in */
+    while (data_len > 0)
+    {
+        n = SCO_CODEC_FRAME_BYTES - p_jb->asm_len;
+        if (n > data_len)
+            n = data_len;
+
+        memcpy(p_jb->asm_data + p_jb->asm_len, p_pkt, n);
+        p_jb->asm_len += n;
+        p_pkt += n;
+        data_len -= n;
+        if (p_jb->asm_status == SCO_CODEC_PKT_OK)
+            p_jb->asm_status = status;
+
+        if (p_jb->asm_len == SCO_CODEC_FRAME_BYTES)
+        {
+            sco_jb_push(p_jb, now_us);
+            p_jb->asm_len = 0;
+            p_jb->asm_status = SCO_CODEC_PKT_OK;
+        }
+    }
+
+    pthread_mutex_unlock(&p_jb->mutex);
+}
+
+/*******************************************************************************
+**
+** Function        sco_jb_get
+**
+** Description     Play out the next frame, on the audio clock. Missing data
+**                 is concealed.
+**
+** Returns         Number of samples written
+**
+*******************************************************************************/
+int sco_jb_get(sco_jb_t *p_jb, int16_t *p_pcm)
+{
+    sco_jb_frame_t frame, next;
+    int16_t merged[SCO_CODEC_MAX_SAMPLES];
+    uint8_t shrink = FALSE;
+    uint64_t now_us;
+    uint16_t i;
+
+    pthread_mutex_lock(&p_jb->mutex);
+
+    /* Silence until the first frames fill the target delay */
+    if ((p_jb->playing == FALSE) && (p_jb->depth < p_jb->target))
+    {
+        pthread_mutex_unlock(&p_jb->mutex);
+        memset(p_pcm, 0, p_jb->samples * sizeof(int16_t));
+        return p_jb->samples;
+    }
+    p_jb->playing = TRUE;
+    p_jb->stats.frames++;
+
+    if (p_jb->depth == 0)
+    {
+        /* Conceal in place of the late frame, which then plays one frame
+         * later: the delay grows by a frame */
+        p_jb->stats.underruns++;
+        p_jb->min_depth = 0;
+        pthread_mutex_unlock(&p_jb->mutex);
+        return sco_codec_receive(p_jb->p_codec, NULL, SCO_CODEC_PKT_LOST, p_pcm);
+    }
+
+    if (p_jb->depth < p_jb->min_depth)
+        p_jb->min_depth = p_jb->depth;
+    if (++p_jb->shrink_count >= SCO_JB_SHRINK_FRAMES)
+    {
+        shrink = (p_jb->min_depth > p_jb->target) ? TRUE : FALSE;
+        p_jb->shrink_count = 0;
+        p_jb->min_depth = 0xFF;
+    }
+
+    sco_jb_pop(p_jb, &frame);
+    if (shrink == TRUE)
+    {
+        sco_jb_pop(p_jb, &next);
+        p_jb->stats.drops++;
+    }
+
+    now_us = sco_jb_now_us();
+    p_jb->stats.delay_hist[sco_jb_bin(now_us - frame.arrival_us)]++;
+
+    pthread_mutex_unlock(&p_jb->mutex);
+
+    sco_codec_receive(p_jb->p_codec, frame.data, frame.status, p_pcm);
+    if (shrink == TRUE)
+    {
+        /* Fade from the frame continuing the playout into the one after,
+         * which continues the decoded stream */
+        sco_codec_receive(p_jb->p_codec, next.data, next.status, merged);
+        for (i = 0; i < p_jb->samples; i++)
+            p_pcm[i] = (int16_t) ((p_pcm[i] * (p_jb->samples - i) + \
+                                   merged[i] * i) / p_jb->samples);
+    }
+
+    return p_jb->samples;
+}
+
+/*******************************************************************************
+**
+** Function        sco_jb_get_stats
+**
+** Description     Get the statistics and histograms of a jitter buffer
+**
+** Returns         None
+**
+*******************************************************************************/
+void sco_jb_get_stats(sco_jb_t *p_jb, sco_jb_stats_t *p_stats)
+{
+    pthread_mutex_lock(&p_jb->mutex);
+    *p_stats = p_jb->stats;
+    p_stats->target_ms = p_jb->target * SCO_JB_FRAME_US / 1000;
+    pthread_mutex_unlock(&p_jb->mutex);
+}
+
+/*******************************************************************************
+**
+** Function        sco_jb_set_param
+**
+** Description     Configure the jitter buffers from bt_vendor.conf: param 0
+**                 sets the acceptable underrun rate (ppm), param 1 the
+**                 maximum playout delay (ms)
+**
+** Returns         0 : Success
+**                 Otherwise : Fail
+**
+*******************************************************************************/
+int sco_jb_set_param(const char *p_conf_name,
+                     const conf_value_t *p_conf_value, int param)
+{
+    uint32_t value = p_conf_value->num;
+
+    if (param == 0)
+    {
+        sco_jb_cfg.underrun_ppm = value;
+    }
+    else if ((param == 1) && (value >= SCO_JB_FRAME_US / 1000) && \
+             (value <= SCO_JB_MAX_FRAMES * SCO_JB_FRAME_US / 1000))
+    {
+        sco_jb_cfg.max_delay_ms = value;
+    }
+    else
+    {
+        ALOGE("%s: invalid %s value %s", __func__, p_conf_name, \
+              p_conf_value->p_str);
+        return -EINVAL;
+    }
+
+    return 0;
+}
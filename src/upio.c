@@ -31,10 +31,23 @@
 #include <utils/Log.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include <string.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
 #include <cutils/properties.h>
+#if (UPIO_GPIO_CHARDEV == TRUE)
+#include <linux/gpio.h>
+#endif
 #include "bt_vendor_brcm.h"
 #include "upio.h"
 #include "userial_vendor.h"
+#include "vnd_loop.h"
 
 /******************************************************************************
 **  Constants & Macros
@@ -54,6 +67,78 @@
 **  Local type definitions
 ******************************************************************************/
 
+/* Maximum length of a sysfs node or "/dev/gpiochipN:line" specification */
+#define UPIO_NODE_MAXLEN        128
+
+/* BT_WAKE backends, the ones built in are selectable from bt_vendor.conf */
+enum {
+    UPIO_BT_WAKE_NONE,          /* BT_WAKE is not driven */
+    UPIO_BT_WAKE_IOCTL,         /* UART driver ioctl (BT_WAKE_VIA_USERIAL_IOCTL) */
+    UPIO_BT_WAKE_PROC,          /* bluesleep proc nodes (BT_WAKE_VIA_PROC) */
+    UPIO_BT_WAKE_GPIOCHIP       /* gpiochip line handle (UPIO_GPIO_CHARDEV) */
+};
+
+/* Backend used unless bt_vendor.conf selects another one */
+#if (BT_WAKE_VIA_USERIAL_IOCTL == TRUE)
+#define UPIO_BT_WAKE_DEFAULT    UPIO_BT_WAKE_IOCTL
+#elif (BT_WAKE_VIA_PROC == TRUE)
+#define UPIO_BT_WAKE_DEFAULT    UPIO_BT_WAKE_PROC
+#else
+#define UPIO_BT_WAKE_DEFAULT    UPIO_BT_WAKE_NONE
+#endif
+
+/*
+ * rfkill
+ *
+ * The Bluetooth rfkill switch is looked up once and kept. Through /dev/rfkill
+ * it is found from the ADD events the kernel queues at open, and a power
+ * toggle is a CHANGE event whose completion is awaited. The sysfs class tree
+ * is used when /dev/rfkill is not available, or when a sysfs root other than
+ * the default one is configured (e.g. a fake tree for testing).
+ */
+#ifndef UPIO_RFKILL_DEV_NODE
+#define UPIO_RFKILL_DEV_NODE            "/dev/rfkill"
+#endif
+
+#ifndef UPIO_RFKILL_SYSFS_ROOT
+#define UPIO_RFKILL_SYSFS_ROOT          "/sys/class/rfkill"
+#endif
+
+/* Upper bound of the wait for the kernel to report a state change */
+#ifndef UPIO_RFKILL_CHANGE_TIMEOUT_MS
+#define UPIO_RFKILL_CHANGE_TIMEOUT_MS   500
+#endif
+
+/* From linux/rfkill.h */
+#define UPIO_RFKILL_TYPE_BLUETOOTH      2
+#define UPIO_RFKILL_OP_ADD              0
+#define UPIO_RFKILL_OP_DEL              1
+#define UPIO_RFKILL_OP_CHANGE           2
+
+/* Layout of struct rfkill_event (RFKILL_EVENT_SIZE_V1) */
+typedef struct __attribute__((packed))
+{
+    uint32_t idx;
+    uint8_t type;
+    uint8_t op;
+    uint8_t soft;
+    uint8_t hard;
+} upio_rfkill_event_t;
+
+/* rfkill control block */
+typedef struct
+{
+    char sysfs_root[UPIO_NODE_MAXLEN];
+    uint8_t emulator;               /* ro.kernel.qemu, read at init */
+    uint8_t disabled;               /* ro.rfkilldisabled, read at init */
+    int id;                         /* rfkill index, -1 until discovered */
+    int dev_fd;                     /* /dev/rfkill, kept open */
+    int state_fd;                   /* sysfs state node, kept open */
+    uint8_t soft;                   /* last reported soft block */
+    uint8_t hard;                   /* last reported hard block */
+    uint32_t epoch;                 /* bumped whenever power may be cut */
+} upio_rfkill_cb_t;
+
 #if (BT_WAKE_VIA_PROC == TRUE)
 
 /* proc fs node for enable/disable lpm mode */
@@ -61,179 +146,1659 @@
 #define VENDOR_LPM_PROC_NODE "/proc/bluetooth/sleep/lpm"
 #endif
 
-/* proc fs node for notifying write request */
-#ifndef VENDOR_BTWRITE_PROC_NODE
-#define VENDOR_BTWRITE_PROC_NODE "/proc/bluetooth/sleep/btwrite"
-#endif
+/* proc fs node for notifying write request */
+#ifndef VENDOR_BTWRITE_PROC_NODE
+#define VENDOR_BTWRITE_PROC_NODE "/proc/bluetooth/sleep/btwrite"
+#endif
+
+/*
+ * Maximum btwrite assertion holding time without consecutive btwrite kicking.
+ * This value is correlative(shorter) to the in-activity timeout period set in
+ * the bluesleep LPM code. The current value used in bluesleep is 10sec.
+ */
+#ifndef PROC_BTWRITE_TIMER_TIMEOUT_MS
+#define PROC_BTWRITE_TIMER_TIMEOUT_MS   8000
+#endif
+
+/*
+ * The btwrite holding timer ticks at half of the maximum holding time. While
+ * a kernel assertion is known to be held, new btwrite kicks are only flagged
+ * as pending and flushed with a single write at the next tick. The kernel
+ * therefore always sees a btwrite within PROC_BTWRITE_TIMER_TIMEOUT_MS of
+ * the previous one while traffic is flowing.
+ */
+#define PROC_BTWRITE_TICK_MS    (PROC_BTWRITE_TIMER_TIMEOUT_MS / 2)
+
+/* btwrite_flags bits, updated atomically by the BT_WAKE fast path */
+#define PROC_BTWRITE_ACTIVE     0x01    /* kernel holds BT_WAKE from a kick */
+#define PROC_BTWRITE_PENDING    0x02    /* kick requested since the last tick */
+
+/* lpm proc control block */
+typedef struct
+{
+    uint8_t btwrite_flags;
+    uint8_t timer_armed;
+    vnd_loop_timer_t *p_timer;  /* holding timer hosted by the event loop */
+    uint32_t timeout_ms;
+    int lpm_fd;                 /* kept open for the whole session */
+    int btwrite_fd;             /* kept open for the whole session */
+    uint32_t write_count;       /* write() calls into proc nodes, atomic */
+    uint32_t rate_count;        /* write_count at start of rate window */
+    struct timespec rate_ts;    /* start time of rate window */
+} vnd_lpm_proc_cb_t;
+
+static vnd_lpm_proc_cb_t lpm_proc_cb;
+#endif
+
+/*
+ * BT_WAKE deassert hysteresis
+ *
+ * A deassert request is held back for an idle window and dropped if an
+ * assert arrives in the meantime. The window starts at
+ * BT_WAKE_DEASSERT_DELAY_MS and adapts to the observed gaps between a
+ * deassert request and the next assert, bounded by
+ * BT_WAKE_DEASSERT_DELAY_MAX_MS. A zero delay disables the hysteresis.
+ */
+#ifndef BT_WAKE_DEASSERT_DELAY_MS
+#define BT_WAKE_DEASSERT_DELAY_MS       0
+#endif
+
+#ifndef BT_WAKE_DEASSERT_DELAY_MAX_MS
+#define BT_WAKE_DEASSERT_DELAY_MAX_MS   100
+#endif
+
+/* Flag or-ed into upio_state[UPIO_BT_WAKE] while a deassert is held back.
+ * It makes the lock-free "already asserted" check fail, so that an assert
+ * reaches the slow path and cancels the pending deassert.
+ */
+#define UPIO_DEASSERT_PENDING   0x80
+
+/* EWMA weight of a new gap sample, as a power of two */
+#define BT_WAKE_GAP_EWMA_SHIFT  3
+
+/* BT_WAKE hysteresis control block */
+typedef struct
+{
+    uint32_t delay_min_ms;          /* configured window, 0 = disabled */
+    uint32_t delay_max_ms;          /* upper bound of the adaptive window */
+    uint32_t delay_ms;              /* current window */
+    uint32_t hold_ms;               /* floor requested by the LPM policy */
+    uint32_t gap_ewma_ms;           /* average gap, scaled by 2^EWMA_SHIFT */
+    uint32_t deassert_req_ms;       /* time of last deassert request */
+    vnd_loop_timer_t *p_timer;      /* delayed deassert timer */
+    upio_wake_stats_t stats;
+} upio_wake_hyst_cb_t;
+
+/*
+ * HOST_WAKE monitor
+ *
+ * When a HOST_WAKE node is configured, its edges are watched from the vendor
+ * event loop while LPM is enabled. On assertion the CPU is kept out of deep
+ * idle through a PM QoS request and the UART runtime PM is forced on, until
+ * the first byte arrives, HOST_WAKE drops or HOST_WAKE_PREWAKE_TIMEOUT_MS
+ * expires. The time from the edge to the first readable byte is recorded.
+ */
+
+/* Upper bound of a pre-wake without UART data */
+#ifndef HOST_WAKE_PREWAKE_TIMEOUT_MS
+#define HOST_WAKE_PREWAKE_TIMEOUT_MS    200
+#endif
+
+/* CPU wakeup latency requested while pre-waking */
+#ifndef HOST_WAKE_CPU_LATENCY_US
+#define HOST_WAKE_CPU_LATENCY_US        0
+#endif
+
+#define HOST_WAKE_PM_QOS_NODE           "/dev/cpu_dma_latency"
+#define HOST_WAKE_PM_QOS_RELEASE        (2000 * 1000 * 1000)
+#define HOST_WAKE_UART_PM_NODE_FMT      "/sys/class/tty/%s/device/power/control"
+
+/* HOST_WAKE monitor control block */
+typedef struct
+{
+    pthread_mutex_t mutex;          /* monitor vs event loop thread */
+    char node[UPIO_NODE_MAXLEN];   /* sysfs value node or gpiochip:line */
+    int fd;                         /* watched value node or line event fd */
+    uint8_t chardev;                /* fd is a gpiochip line event fd */
+    uint8_t polarity;               /* 0=Active Low, 1= Active High */
+    uint8_t asserted;               /* last seen HOST_WAKE state */
+    uint8_t prewake;                /* pre-wake requests in effect */
+    int uart_fd;                    /* watched for the first byte */
+    int qos_fd;                     /* PM QoS request, kept open */
+    int uart_pm_fd;                 /* UART runtime PM control node */
+    vnd_loop_timer_t *p_timer;      /* pre-wake timeout */
+    struct timespec wake_ts;        /* time of the last assertion */
+    uint64_t latency_sum_us;
+    upio_host_wake_stats_t stats;
+} upio_host_wake_cb_t;
+
+/******************************************************************************
+**  Static variables
+******************************************************************************/
+
+/*
+ * upio_state[UPIO_BT_WAKE] is read without lock on the per packet fast path
+ * of upio_set(), and is only written with upio_mutex held after the
+ * transition has reached the hardware. upio_mutex also serializes all other
+ * upio state changes.
+ */
+static uint8_t upio_state[UPIO_MAX_COUNT];
+static pthread_mutex_t upio_mutex = PTHREAD_MUTEX_INITIALIZER;
+static upio_wake_hyst_cb_t wake_hyst_cb =
+{
+    .delay_min_ms = BT_WAKE_DEASSERT_DELAY_MS,
+    .delay_max_ms = BT_WAKE_DEASSERT_DELAY_MAX_MS,
+};
+static upio_host_wake_cb_t host_wake_cb =
+{
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .fd = -1,
+    .uart_fd = -1,
+    .qos_fd = -1,
+    .uart_pm_fd = -1,
+};
+static uint8_t bt_wake_backend = UPIO_BT_WAKE_DEFAULT;
+static uint8_t bt_wake_polarity = 1;
+#if (UPIO_GPIO_CHARDEV == TRUE)
+static char bt_wake_gpio[UPIO_NODE_MAXLEN];
+static int bt_wake_gpio_fd = -1;        /* line handle, kept open */
+#endif
+static upio_rfkill_cb_t rfkill_cb =
+{
+    .sysfs_root = UPIO_RFKILL_SYSFS_ROOT,
+    .id = -1,
+    .dev_fd = -1,
+    .state_fd = -1,
+};
+static int bt_emul_enable = 0;
+
+/******************************************************************************
+**  Static functions
+******************************************************************************/
+
+/* for friendly debugging outpout string */
+static char *lpm_mode[] = {
+    "UNKNOWN",
+    "disabled",
+    "enabled"
+};
+
+static char *lpm_state[] = {
+    "UNKNOWN",
+    "de-asserted",
+    "asserted"
+};
+
+/*****************************************************************************
+**   Helper Functions
+*****************************************************************************/
+
+/*******************************************************************************
+**
+** Function        upio_now_ms
+**
+** Description     Monotonic time in milliseconds
+**
+** Returns         Time in milliseconds
+**
+*******************************************************************************/
+static uint32_t upio_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+/*****************************************************************************
+**   Bluetooth On/Off Static Functions
+*****************************************************************************/
+
+static int is_emulator_context(void)
+{
+    char value[PROPERTY_VALUE_MAX];
+
+    property_get("ro.kernel.qemu", value, "0");
+    UPIODBG("is_emulator_context : %s", value);
+    if (strcmp(value, "1") == 0) {
+        return 1;
+    }
+    return 0;
+}
+
+static int is_rfkill_disabled(void)
+{
+    char value[PROPERTY_VALUE_MAX];
+
+    property_get("ro.rfkilldisabled", value, "0");
+    UPIODBG("is_rfkill_disabled ? [%s]", value);
+
+    if (strcmp(value, "1") == 0) {
+        return UPIO_BT_POWER_ON;
+    }
+
+    return UPIO_BT_POWER_OFF;
+}
+
+/*******************************************************************************
+**
+** Function        rfkill_dev_read
+**
+** Description     Read one pending event from /dev/rfkill and track the state
+**                 of the Bluetooth switch from it
+**
+** Returns         TRUE if an event was read, FALSE otherwise
+**
+*******************************************************************************/
+static uint8_t rfkill_dev_read(upio_rfkill_event_t *p_ev)
+{
+    ssize_t sz;
+
+    sz = read(rfkill_cb.dev_fd, p_ev, sizeof(upio_rfkill_event_t));
+    if (sz < (ssize_t) sizeof(upio_rfkill_event_t))
+        return FALSE;
+
+    if ((rfkill_cb.id == -1) && (p_ev->op == UPIO_RFKILL_OP_ADD) && \
+        (p_ev->type == UPIO_RFKILL_TYPE_BLUETOOTH))
+        rfkill_cb.id = (int) p_ev->idx;
+
+    if ((rfkill_cb.id == (int) p_ev->idx) && (p_ev->op != UPIO_RFKILL_OP_DEL))
+    {
+        rfkill_cb.soft = p_ev->soft;
+        rfkill_cb.hard = p_ev->hard;
+    }
+
+    /* a block, even one lifted since, is a power cut */
+    if ((rfkill_cb.id == (int) p_ev->idx) && \
+        ((p_ev->op == UPIO_RFKILL_OP_DEL) || p_ev->soft || p_ev->hard))
+        rfkill_cb.epoch++;
+
+    return TRUE;
+}
+
+/*******************************************************************************
+**
+** Function        rfkill_dev_open
+**
+** Description     Find the Bluetooth switch through /dev/rfkill. The kernel
+**                 queues an ADD event per switch at open, so discovery takes
+**                 a few non-blocking reads.
+**
+** Returns         0 : SUCCESS
+**                 <0 : ERROR
+**
+*******************************************************************************/
+static int rfkill_dev_open(void)
+{
+    upio_rfkill_event_t ev;
+
+    rfkill_cb.dev_fd = open(UPIO_RFKILL_DEV_NODE, \
+                            O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (rfkill_cb.dev_fd < 0)
+    {
+        UPIODBG("rfkill: open(%s) failed: %s", UPIO_RFKILL_DEV_NODE, \
+                strerror(errno));
+        return -1;
+    }
+
+    while (rfkill_dev_read(&ev) == TRUE)
+        ;
+
+    if (rfkill_cb.id == -1)
+    {
+        close(rfkill_cb.dev_fd);
+        rfkill_cb.dev_fd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+**
+** Function        rfkill_sysfs_open
+**
+** Description     Find the Bluetooth switch with the lowest index under the
+**                 rfkill sysfs root, and keep its state node open
+**
+** Returns         0 : SUCCESS
+**                 <0 : ERROR
+**
+*******************************************************************************/
+static int rfkill_sysfs_open(void)
+{
+    char path[UPIO_NODE_MAXLEN + 32];
+    char buf[16];
+    struct dirent *p_ent;
+    DIR *p_dir;
+    int fd, sz, id;
+
+    if ((p_dir = opendir(rfkill_cb.sysfs_root)) == NULL)
+    {
+        ALOGE("init_rfkill : opendir(%s) failed: %s (%d)", \
+             rfkill_cb.sysfs_root, strerror(errno), errno);
+        return -1;
+    }
+
+    while ((p_ent = readdir(p_dir)) != NULL)
+    {
+        if ((sscanf(p_ent->d_name, "rfkill%d", &id) != 1) || (id < 0))
+            continue;
+
+        if ((rfkill_cb.id != -1) && (id > rfkill_cb.id))
+            continue;
+
+        snprintf(path, sizeof(path), "%s/rfkill%d/type", rfkill_cb.sysfs_root, \
+                 id);
+        if ((fd = open(path, O_RDONLY)) < 0)
+            continue;
+
+        sz = read(fd, &buf, sizeof(buf));
+        close(fd);
+
+        if (sz >= 9 && memcmp(buf, "bluetooth", 9) == 0)
+            rfkill_cb.id = id;
+    }
+
+    closedir(p_dir);
+
+    if (rfkill_cb.id == -1)
+    {
+        ALOGE("init_rfkill : no bluetooth switch under %s", \
+              rfkill_cb.sysfs_root);
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "%s/rfkill%d/state", rfkill_cb.sysfs_root, \
+             rfkill_cb.id);
+    if ((rfkill_cb.state_fd = open(path, O_WRONLY | O_CLOEXEC)) < 0)
+    {
+        ALOGE("init_rfkill : open(%s) for write failed: %s (%d)", \
+              path, strerror(errno), errno);
+        rfkill_cb.id = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+**
+** Function        init_rfkill
+**
+** Description     Discover the Bluetooth rfkill switch, through /dev/rfkill
+**                 unless a sysfs root is configured
+**
+** Returns         0 : SUCCESS
+**                 <0 : ERROR
+**
+*******************************************************************************/
+static int init_rfkill(void)
+{
+    if ((strcmp(rfkill_cb.sysfs_root, UPIO_RFKILL_SYSFS_ROOT) == 0) && \
+        (rfkill_dev_open() == 0))
+    {
+        ALOGI("init_rfkill : rfkill%d via %s", rfkill_cb.id, \
+              UPIO_RFKILL_DEV_NODE);
+        return 0;
+    }
+
+    if (rfkill_sysfs_open() == 0)
+    {
+        ALOGI("init_rfkill : rfkill%d via %s", rfkill_cb.id, \
+              rfkill_cb.sysfs_root);
+        return 0;
+    }
+
+    return -1;
+}
+
+/*******************************************************************************
+**
+** Function        rfkill_dev_set
+**
+** Description     Toggle the soft block through /dev/rfkill and wait for the
+**                 kernel to report the new state
+**
+** Returns         0 : SUCCESS
+**                 <0 : ERROR
+**
+*******************************************************************************/
+static int rfkill_dev_set(int on)
+{
+    upio_rfkill_event_t ev;
+    struct pollfd pfd;
+    uint8_t soft = (on == UPIO_BT_POWER_ON) ? 0 : 1;
+    uint32_t start_ms, elapsed_ms;
+
+    /* bring the tracked state up to date */
+    while (rfkill_dev_read(&ev) == TRUE)
+        ;
+
+    if ((rfkill_cb.soft == soft) && !(on == UPIO_BT_POWER_ON && rfkill_cb.hard))
+        return 0;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.idx = (uint32_t) rfkill_cb.id;
+    ev.type = UPIO_RFKILL_TYPE_BLUETOOTH;
+    ev.op = UPIO_RFKILL_OP_CHANGE;
+    ev.soft = soft;
+
+    if (write(rfkill_cb.dev_fd, &ev, sizeof(ev)) < 0)
+    {
+        ALOGE("set_bluetooth_power : write(%s) failed: %s (%d)", \
+              UPIO_RFKILL_DEV_NODE, strerror(errno), errno);
+        return -1;
+    }
+
+    start_ms = upio_now_ms();
+    pfd.fd = rfkill_cb.dev_fd;
+    pfd.events = POLLIN;
+
+    while ((elapsed_ms = upio_now_ms() - start_ms) < \
+           UPIO_RFKILL_CHANGE_TIMEOUT_MS)
+    {
+        if (poll(&pfd, 1, UPIO_RFKILL_CHANGE_TIMEOUT_MS - elapsed_ms) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        while (rfkill_dev_read(&ev) == TRUE)
+            ;
+
+        if ((on == UPIO_BT_POWER_ON) && rfkill_cb.hard)
+        {
+            ALOGE("set_bluetooth_power : rfkill%d is hard blocked", \
+                  rfkill_cb.id);
+            return -1;
+        }
+
+        if (rfkill_cb.soft == soft)
+        {
+            UPIODBG("set_bluetooth_power : %d in %u ms", on, \
+                    upio_now_ms() - start_ms);
+            return 0;
+        }
+    }
+
+    ALOGE("set_bluetooth_power : rfkill%d state change not reported", \
+          rfkill_cb.id);
+    return -1;
+}
+
+/*****************************************************************************
+**   LPM Static Functions
+*****************************************************************************/
+
+#if (BT_WAKE_VIA_PROC == TRUE)
+/*******************************************************************************
+**
+** Function        proc_node_write
+**
+** Description     Write one character into a proc node. The node is opened on
+**                 first use and the fd is kept for later writes, so that the
+**                 hot BT_WAKE path costs a single write() syscall.
+**
+** Returns         0  : SUCCESS
+**                 <0 : ERROR
+**
+*******************************************************************************/
+static int proc_node_write(int *p_fd, const char *p_node, char value)
+{
+    if (*p_fd < 0)
+    {
+        *p_fd = open(p_node, O_WRONLY);
+
+        if (*p_fd < 0)
+        {
+            ALOGE("upio_set : open(%s) for write failed: %s (%d)",
+                    p_node, strerror(errno), errno);
+            return -1;
+        }
+    }
+
+    if (write(*p_fd, &value, 1) < 0)
+    {
+        ALOGE("upio_set : write(%s) failed: %s (%d)",
+                p_node, strerror(errno), errno);
+
+        /* Reopen on next attempt in case the node went away */
+        close(*p_fd);
+        *p_fd = -1;
+        return -1;
+    }
+
+    /* Written by the stack and the event loop threads */
+    __atomic_fetch_add(&lpm_proc_cb.write_count, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/*******************************************************************************
+**
+** Function        proc_btwrite_timer_arm
+**
+** Description     Start or stop the periodic btwrite holding timer
+**
+** Returns         None
+**
+*******************************************************************************/
+static void proc_btwrite_timer_arm(uint8_t arm)
+{
+    if ((lpm_proc_cb.p_timer == NULL) || (lpm_proc_cb.timer_armed == arm))
+        return;
+
+    if (arm)
+        vnd_loop_timer_start(lpm_proc_cb.p_timer, PROC_BTWRITE_TICK_MS, \
+                             PROC_BTWRITE_TICK_MS);
+    else
+        vnd_loop_timer_stop(lpm_proc_cb.p_timer);
+
+    lpm_proc_cb.timer_armed = arm;
+}
+
+/*******************************************************************************
+**
+** Function        proc_btwrite_defer
+**
+** Description     Lock-free part of a btwrite kick. If the kernel is still
+**                 holding a previous assertion, flag a pending kick for the
+**                 next timer tick.
+**
+** Returns         TRUE if the kick has been deferred, FALSE if a write to the
+**                 btwrite node is required
+**
+*******************************************************************************/
+static uint8_t proc_btwrite_defer(void)
+{
+    uint8_t flags = __atomic_load_n(&lpm_proc_cb.btwrite_flags, \
+                                    __ATOMIC_RELAXED);
+
+    while (flags & PROC_BTWRITE_ACTIVE)
+    {
+        if ((flags & PROC_BTWRITE_PENDING) || \
+            __atomic_compare_exchange_n(&lpm_proc_cb.btwrite_flags, &flags, \
+                                        flags | PROC_BTWRITE_PENDING, FALSE, \
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/*******************************************************************************
+**
+** Function        proc_btwrite_kick
+**
+** Description     Kick proc btwrite node, or defer the kick to the next timer
+**                 tick if the kernel is still holding a previous assertion.
+**                 Called with upio_mutex held.
+**
+** Returns         None
+**
+*******************************************************************************/
+static void proc_btwrite_kick(void)
+{
+    if (proc_btwrite_defer() == TRUE)
+        return;
+
+    if (proc_node_write(&lpm_proc_cb.btwrite_fd, VENDOR_BTWRITE_PROC_NODE, \
+                        '1') == 0)
+    {
+        UPIODBG("proc btwrite assertion");
+
+        __atomic_store_n(&lpm_proc_cb.btwrite_flags, PROC_BTWRITE_ACTIVE, \
+                         __ATOMIC_RELAXED);
+        proc_btwrite_timer_arm(TRUE);
+    }
+}
+
+/*******************************************************************************
+**
+** Function        proc_btwrite_timeout
+**
+** Description     Tick of proc/.../btwrite assertion holding timer, runs in
+**                 the vendor event loop thread
+**
+** Returns         None
+**
+*******************************************************************************/
+static void proc_btwrite_timeout(void *p_data)
+{
+    uint8_t flags;
+
+    UPIODBG("..%s..", __FUNCTION__);
+
+    pthread_mutex_lock(&upio_mutex);
+
+    flags = __atomic_load_n(&lpm_proc_cb.btwrite_flags, __ATOMIC_RELAXED);
+
+    /* The fast path may set PENDING concurrently, hence the CAS loop */
+    while (flags & PROC_BTWRITE_ACTIVE)
+    {
+        if (flags & PROC_BTWRITE_PENDING)
+        {
+            if (!__atomic_compare_exchange_n(&lpm_proc_cb.btwrite_flags, \
+                        &flags, PROC_BTWRITE_ACTIVE, FALSE, \
+                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                continue;
+
+            /* Flush the kicks batched up during the last tick period */
+            if (proc_node_write(&lpm_proc_cb.btwrite_fd, \
+                                VENDOR_BTWRITE_PROC_NODE, '1') == 0)
+                break;
+
+            __atomic_store_n(&lpm_proc_cb.btwrite_flags, 0, __ATOMIC_RELAXED);
+            proc_btwrite_timer_arm(FALSE);
+            break;
+        }
+
+        if (__atomic_compare_exchange_n(&lpm_proc_cb.btwrite_flags, &flags, \
+                    0, FALSE, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        {
+            proc_btwrite_timer_arm(FALSE);
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&upio_mutex);
+}
+#endif
+
+/*****************************************************************************
+**   GPIO Character Device Static Functions
+*****************************************************************************/
+
+#if (UPIO_GPIO_CHARDEV == TRUE)
+/*******************************************************************************
+**
+** Function        upio_gpiochip_parse
+**
+** Description     Split a "/dev/gpiochipN:line" specification
+**
+** Returns         TRUE if p_spec names a gpiochip line, FALSE otherwise
+**
+*******************************************************************************/
+static uint8_t upio_gpiochip_parse(const char *p_spec, char *p_chip,
+                                   size_t chip_len, uint32_t *p_line)
+{
+    const char *p_sep;
+    char *p_end;
+    unsigned long line;
+
+    if (strncmp(p_spec, "/dev/gpiochip", 13) != 0)
+        return FALSE;
+
+    if ((p_sep = strrchr(p_spec, ':')) == NULL)
+        return FALSE;
+
+    line = strtoul(p_sep + 1, &p_end, 10);
+    if ((p_end == p_sep + 1) || (*p_end != '\0') || \
+        ((size_t)(p_sep - p_spec) >= chip_len))
+        return FALSE;
+
+    memcpy(p_chip, p_spec, p_sep - p_spec);
+    p_chip[p_sep - p_spec] = '\0';
+    *p_line = (uint32_t) line;
+
+    return TRUE;
+}
+
+/*******************************************************************************
+**
+** Function        upio_gpiochip_set
+**
+** Description     Drive BT_WAKE through a gpiochip line handle. The handle is
+**                 requested on first use and kept, so that a transition costs
+**                 a single ioctl. Called with upio_mutex held.
+**
+** Returns         0 : SUCCESS
+**                 <0 : ERROR
+**
+*******************************************************************************/
+static int upio_gpiochip_set(uint8_t level)
+{
+    struct gpiohandle_request req;
+    struct gpiohandle_data data;
+    char chip[UPIO_NODE_MAXLEN];
+    uint32_t line;
+    int chip_fd;
+
+    if (bt_wake_gpio_fd < 0)
+    {
+        if (upio_gpiochip_parse(bt_wake_gpio, chip, sizeof(chip), &line) == FALSE)
+        {
+            ALOGE("bt wake: invalid gpio line \"%s\"", bt_wake_gpio);
+            return -1;
+        }
+
+        if ((chip_fd = open(chip, O_RDONLY | O_CLOEXEC)) < 0)
+        {
+            ALOGE("bt wake: unable to open %s (%s)", chip, strerror(errno));
+            return -1;
+        }
+
+        memset(&req, 0, sizeof(req));
+        req.lineoffsets[0] = line;
+        req.lines = 1;
+        req.flags = GPIOHANDLE_REQUEST_OUTPUT;
+        req.default_values[0] = level;
+        strncpy(req.consumer_label, "bt_wake", sizeof(req.consumer_label) - 1);
+
+        if (ioctl(chip_fd, GPIO_GET_LINEHANDLE_IOCTL, &req) < 0)
+        {
+            ALOGE("bt wake: line %u request failed (%s)", line, strerror(errno));
+            close(chip_fd);
+            return -1;
+        }
+        close(chip_fd);
+
+        bt_wake_gpio_fd = req.fd;
+        UPIODBG("bt wake: %s line %u", chip, line);
+
+        /* the request already drove the line to its initial level */
+        return 0;
+    }
+
+    memset(&data, 0, sizeof(data));
+    data.values[0] = level;
+
+    if (ioctl(bt_wake_gpio_fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &data) < 0)
+    {
+        ALOGE("bt wake: line set failed (%s)", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+#endif // (UPIO_GPIO_CHARDEV == TRUE)
+
+/*****************************************************************************
+**   BT_WAKE Static Functions
+*****************************************************************************/
+
+/*******************************************************************************
+**
+** Function        upio_drive_bt_wake
+**
+** Description     Drive BT_WAKE through the configured backend and publish
+**                 the new state. On a backend failure the state is left
+**                 unknown, so that the next request retries the hardware.
+**                 Called with upio_mutex held.
+**
+** Returns         0 : SUCCESS
+**                 <0 : ERROR
+**
+*******************************************************************************/
+static int upio_drive_bt_wake(uint8_t action)
+{
+    int status = 0;
+
+    switch (bt_wake_backend)
+    {
+#if (BT_WAKE_VIA_USERIAL_IOCTL == TRUE)
+        case UPIO_BT_WAKE_IOCTL:
+            userial_vendor_ioctl( ( (action==UPIO_ASSERT) ? \
+                      USERIAL_OP_ASSERT_BT_WAKE : USERIAL_OP_DEASSERT_BT_WAKE),\
+                      NULL);
+            break;
+#endif
+
+#if (BT_WAKE_VIA_PROC == TRUE)
+        case UPIO_BT_WAKE_PROC:
+            /*
+             *  Kick proc btwrite node only at UPIO_ASSERT
+             */
+            if (action == UPIO_ASSERT)
+                proc_btwrite_kick();
+            break;
+#endif
+
+#if (UPIO_GPIO_CHARDEV == TRUE)
+        case UPIO_BT_WAKE_GPIOCHIP:
+            status = upio_gpiochip_set((action == UPIO_ASSERT) ? \
+                                       bt_wake_polarity : !bt_wake_polarity);
+            break;
+#endif
+
+        default:
+            break;
+    }
+
+    if (status < 0)
+    {
+        __atomic_store_n(&upio_state[UPIO_BT_WAKE], UPIO_UNKNOWN, \
+                         __ATOMIC_RELEASE);
+        return status;
+    }
+
+    if (action == UPIO_ASSERT)
+        wake_hyst_cb.stats.asserts++;
+    else
+        wake_hyst_cb.stats.deasserts++;
+
+    /* Publish the new state only once the line has been driven, so
+     * that the fast path never skips a transition still in flight.
+     */
+    __atomic_store_n(&upio_state[UPIO_BT_WAKE], action, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/*******************************************************************************
+**
+** Function        upio_wake_hyst_clamp
+**
+** Description     Bound a deassert window to the configured range and to the
+**                 hold time requested by the LPM policy
+**
+** Returns         Bounded window in milliseconds
+**
+*******************************************************************************/
+static uint32_t upio_wake_hyst_clamp(uint32_t delay_ms)
+{
+    uint32_t lower = wake_hyst_cb.delay_min_ms;
+    uint32_t upper = wake_hyst_cb.delay_max_ms;
+
+    if (lower < wake_hyst_cb.hold_ms)
+        lower = wake_hyst_cb.hold_ms;
+    if (upper < lower)
+        upper = lower;
+
+    if (delay_ms < lower)
+        delay_ms = lower;
+    if (delay_ms > upper)
+        delay_ms = upper;
+
+    return delay_ms;
+}
+
+/*******************************************************************************
+**
+** Function        upio_wake_hyst_update
+**
+** Description     Account the gap between the last deassert request and an
+**                 assert, and adapt the deassert window to it. Called with
+**                 upio_mutex held.
+**
+** Returns         None
+**
+*******************************************************************************/
+static void upio_wake_hyst_update(void)
+{
+    uint32_t gap_ms = upio_now_ms() - wake_hyst_cb.deassert_req_ms;
+    uint32_t delay_ms;
+
+    /* Gaps beyond the maximum window are real idle periods */
+    if (gap_ms > upio_wake_hyst_clamp(wake_hyst_cb.delay_max_ms))
+        return;
+
+    if (wake_hyst_cb.gap_ewma_ms == 0)
+        wake_hyst_cb.gap_ewma_ms = gap_ms << BT_WAKE_GAP_EWMA_SHIFT;
+    else
+        wake_hyst_cb.gap_ewma_ms += gap_ms - \
+                    (wake_hyst_cb.gap_ewma_ms >> BT_WAKE_GAP_EWMA_SHIFT);
+
+    /* Keep the window 50% above the typical gap inside a burst */
+    delay_ms = (wake_hyst_cb.gap_ewma_ms >> BT_WAKE_GAP_EWMA_SHIFT) * 3 / 2;
+
+    wake_hyst_cb.delay_ms = upio_wake_hyst_clamp(delay_ms);
+}
+
+/*******************************************************************************
+**
+** Function        upio_wake_hyst_timeout
+**
+** Description     Delayed deassert timer, runs in the vendor event loop thread
+**
+** Returns         None
+**
+*******************************************************************************/
+static void upio_wake_hyst_timeout(void *p_data)
+{
+    pthread_mutex_lock(&upio_mutex);
+
+    /* Nothing to do if an assert cancelled the deassert meanwhile */
+    if (upio_state[UPIO_BT_WAKE] & UPIO_DEASSERT_PENDING)
+    {
+        UPIODBG("BT_WAKE delayed deassert after %u ms", wake_hyst_cb.delay_ms);
+        upio_drive_bt_wake(UPIO_DEASSERT);
+    }
+
+    pthread_mutex_unlock(&upio_mutex);
+}
+
+/*****************************************************************************
+**   HOST_WAKE Static Functions
+*****************************************************************************/
+
+/*******************************************************************************
+**
+** Function        host_wake_prewake
+**
+** Description     Take or release the pre-wake requests: PM QoS CPU latency,
+**                 forced UART runtime PM and the first byte watch.
+**                 Called with host_wake_cb.mutex held.
+**
+** Returns         None
+**
+*******************************************************************************/
+static void host_wake_prewake(uint8_t on)
+{
+    int32_t latency = (on) ? HOST_WAKE_CPU_LATENCY_US : \
+                             HOST_WAKE_PM_QOS_RELEASE;
+    const char *p_ctrl = (on) ? "on" : "auto";
+
+    if (host_wake_cb.prewake == on)
+        return;
+    host_wake_cb.prewake = on;
+
+    if (host_wake_cb.qos_fd >= 0)
+    {
+        if (write(host_wake_cb.qos_fd, &latency, sizeof(latency)) < 0)
+            UPIODBG("host wake: pm qos write failed (%s)", strerror(errno));
+    }
+
+    if (host_wake_cb.uart_pm_fd >= 0)
+    {
+        if (pwrite(host_wake_cb.uart_pm_fd, p_ctrl, strlen(p_ctrl), 0) < 0)
+            UPIODBG("host wake: uart pm write failed (%s)", strerror(errno));
+    }
+
+    /* One-shot, so that a hung up port cannot spin the event loop */
+    if (host_wake_cb.uart_fd >= 0)
+        vnd_loop_mod_fd(host_wake_cb.uart_fd, \
+                        (on) ? (EPOLLIN | EPOLLONESHOT) : EPOLLONESHOT);
+
+    if (on)
+        vnd_loop_timer_start(host_wake_cb.p_timer, \
+                             HOST_WAKE_PREWAKE_TIMEOUT_MS, 0);
+    else
+        vnd_loop_timer_stop(host_wake_cb.p_timer);
+}
+
+/*******************************************************************************
+**
+** Function        host_wake_edge
+**
+** Description     Handle a HOST_WAKE level change.
+**                 Called with host_wake_cb.mutex held.
+**
+** Returns         None
+**
+*******************************************************************************/
+static void host_wake_edge(uint8_t level)
+{
+    uint8_t asserted = (level == host_wake_cb.polarity) ? TRUE : FALSE;
+
+    if (asserted == host_wake_cb.asserted)
+        return;
+    host_wake_cb.asserted = asserted;
+
+    UPIODBG("host wake: %s", lpm_state[asserted ? UPIO_ASSERT : UPIO_DEASSERT]);
+
+    if (asserted)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &host_wake_cb.wake_ts);
+        host_wake_cb.stats.wakes++;
+    }
+
+    host_wake_prewake(asserted);
+}
+
+/*******************************************************************************
+**
+** Function        host_wake_read_level
+**
+** Description     Read the current HOST_WAKE level and drain pending line
+**                 events
+**
+** Returns         0 or 1, <0 on error
+**
+*******************************************************************************/
+static int host_wake_read_level(void)
+{
+    char value[2];
+    int level = -1;
+
+#if (UPIO_GPIO_CHARDEV == TRUE)
+    if (host_wake_cb.chardev)
+    {
+        struct gpioevent_data event;
+        struct gpiohandle_data data;
+
+        while (read(host_wake_cb.fd, &event, sizeof(event)) == sizeof(event))
+            level = (event.id == GPIOEVENT_EVENT_RISING_EDGE) ? 1 : 0;
+
+        if ((level < 0) && \
+            (ioctl(host_wake_cb.fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data) == 0))
+            level = data.values[0] ? 1 : 0;
+
+        return level;
+    }
+#endif
+
+    if (pread(host_wake_cb.fd, value, 1, 0) == 1)
+        level = (value[0] == '1') ? 1 : 0;
+
+    return level;
+}
+
+/*******************************************************************************
+**
+** Function        host_wake_event
+**
+** Description     HOST_WAKE node event, runs in the vendor event loop thread
+**
+** Returns         None
+**
+*******************************************************************************/
+static void host_wake_event(int fd, uint32_t events, void *p_data)
+{
+    int level;
+
+    pthread_mutex_lock(&host_wake_cb.mutex);
+    if ((fd == host_wake_cb.fd) && ((level = host_wake_read_level()) >= 0))
+        host_wake_edge((uint8_t) level);
+    pthread_mutex_unlock(&host_wake_cb.mutex);
+}
+
+/*******************************************************************************
+**
+** Function        host_wake_uart_event
+**
+** Description     First UART byte after a HOST_WAKE assertion, runs in the
+**                 vendor event loop thread. The data is left to the stack.
+**
+** Returns         None
+**
+*******************************************************************************/
+static void host_wake_uart_event(int fd, uint32_t events, void *p_data)
+{
+    struct timespec now;
+    uint32_t latency_us;
+    upio_host_wake_stats_t *p_stats = &host_wake_cb.stats;
+
+    pthread_mutex_lock(&host_wake_cb.mutex);
+    if ((fd == host_wake_cb.uart_fd) && (host_wake_cb.prewake == TRUE))
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        latency_us = (now.tv_sec - host_wake_cb.wake_ts.tv_sec) * 1000000 + \
+                     (now.tv_nsec - host_wake_cb.wake_ts.tv_nsec) / 1000;
+
+        p_stats->first_bytes++;
+        p_stats->latency_last_us = latency_us;
+        if ((p_stats->first_bytes == 1) || (latency_us < p_stats->latency_min_us))
+            p_stats->latency_min_us = latency_us;
+        if (latency_us > p_stats->latency_max_us)
+            p_stats->latency_max_us = latency_us;
+        host_wake_cb.latency_sum_us += latency_us;
+        p_stats->latency_avg_us = (uint32_t) \
+                    (host_wake_cb.latency_sum_us / p_stats->first_bytes);
+
+        UPIODBG("host wake: first byte after %u us", latency_us);
+
+        host_wake_prewake(FALSE);
+    }
+    pthread_mutex_unlock(&host_wake_cb.mutex);
+}
+
+/*******************************************************************************
+**
+** Function        host_wake_timeout
+**
+** Description     Pre-wake timeout, runs in the vendor event loop thread
+**
+** Returns         None
+**
+*******************************************************************************/
+static void host_wake_timeout(void *p_data)
+{
+    pthread_mutex_lock(&host_wake_cb.mutex);
+    host_wake_prewake(FALSE);
+    pthread_mutex_unlock(&host_wake_cb.mutex);
+}
+
+/*******************************************************************************
+**
+** Function        host_wake_open
+**
+** Description     Open the configured HOST_WAKE node for edge events
+**
+** Returns         fd, <0 on error
+**
+*******************************************************************************/
+static int host_wake_open(void)
+{
+    char path[UPIO_NODE_MAXLEN + 8];
+    char *p_dir;
+    int fd;
+#if (UPIO_GPIO_CHARDEV == TRUE)
+    struct gpioevent_request req;
+    uint32_t line;
+    int chip_fd;
+
+    if (upio_gpiochip_parse(host_wake_cb.node, path, sizeof(path), &line))
+    {
+        if ((chip_fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+        {
+            ALOGE("host wake: unable to open %s (%s)", path, strerror(errno));
+            return -1;
+        }
+
+        memset(&req, 0, sizeof(req));
+        req.lineoffset = line;
+        req.handleflags = GPIOHANDLE_REQUEST_INPUT;
+        req.eventflags = GPIOEVENT_REQUEST_BOTH_EDGES;
+        strncpy(req.consumer_label, "bt_host_wake", \
+                sizeof(req.consumer_label) - 1);
+
+        fd = -1;
+        if (ioctl(chip_fd, GPIO_GET_LINEEVENT_IOCTL, &req) == 0)
+        {
+            fd = req.fd;
+            fcntl(fd, F_SETFL, O_NONBLOCK);
+        }
+        else
+        {
+            ALOGE("host wake: line %u request failed (%s)", line, \
+                  strerror(errno));
+        }
+        close(chip_fd);
+
+        host_wake_cb.chardev = TRUE;
+        return fd;
+    }
+#endif
+
+    /* sysfs gpio: edges are reported as POLLPRI once "edge" is set */
+    snprintf(path, sizeof(path), "%s", host_wake_cb.node);
+    if ((p_dir = strrchr(path, '/')) != NULL)
+    {
+        strcpy(p_dir + 1, "edge");
+        if ((fd = open(path, O_WRONLY)) >= 0)
+        {
+            if (write(fd, "both", 4) < 0)
+                ALOGW("host wake: unable to set edge on %s", path);
+            close(fd);
+        }
+    }
+
+    if ((fd = open(host_wake_cb.node, O_RDONLY | O_NONBLOCK | O_CLOEXEC)) < 0)
+        ALOGE("host wake: unable to open %s (%s)", host_wake_cb.node, \
+              strerror(errno));
+
+    host_wake_cb.chardev = FALSE;
+    return fd;
+}
+
+/*****************************************************************************
+**   UPIO Interface Functions
+*****************************************************************************/
+
+/*******************************************************************************
+**
+** Function        upio_init
+**
+** Description     Initialization
+**
+** Returns         None
+**
+*******************************************************************************/
+void upio_init(void)
+{
+    pthread_mutex_lock(&upio_mutex);
+    memset(upio_state, UPIO_UNKNOWN, UPIO_MAX_COUNT);
+
+    memset(&wake_hyst_cb.stats, 0, sizeof(upio_wake_stats_t));
+    wake_hyst_cb.hold_ms = 0;
+    wake_hyst_cb.delay_ms = upio_wake_hyst_clamp(wake_hyst_cb.delay_min_ms);
+    wake_hyst_cb.gap_ewma_ms = 0;
+    /* bt_vendor.conf is parsed after upio_init, create the timer anyway */
+    if (wake_hyst_cb.p_timer == NULL)
+        wake_hyst_cb.p_timer = vnd_loop_timer_new(upio_wake_hyst_timeout, NULL);
+#if (BT_WAKE_VIA_PROC == TRUE)
+    memset(&lpm_proc_cb, 0, sizeof(vnd_lpm_proc_cb_t));
+    lpm_proc_cb.lpm_fd = -1;
+    lpm_proc_cb.btwrite_fd = -1;
+    clock_gettime(CLOCK_MONOTONIC, &lpm_proc_cb.rate_ts);
+#endif
+    pthread_mutex_unlock(&upio_mutex);
+
+    /* properties are read-only, no need to query them on every toggle */
+    rfkill_cb.emulator = is_emulator_context();
+    rfkill_cb.disabled = (is_rfkill_disabled() == UPIO_BT_POWER_ON);
+}
+
+/*******************************************************************************
+**
+** Function        upio_cleanup
+**
+** Description     Clean up
+**
+** Returns         None
+**
+*******************************************************************************/
+void upio_cleanup(void)
+{
+    pthread_mutex_lock(&upio_mutex);
+
+    ALOGI("upio_cleanup: BT_WAKE %u asserts, %u deasserts, %u/%u deasserts " \
+          "cancelled", wake_hyst_cb.stats.asserts, wake_hyst_cb.stats.deasserts, \
+          wake_hyst_cb.stats.deasserts_cancelled, \
+          wake_hyst_cb.stats.deassert_requests);
+
+    vnd_loop_timer_free(wake_hyst_cb.p_timer);
+    wake_hyst_cb.p_timer = NULL;
+    upio_state[UPIO_BT_WAKE] &= ~UPIO_DEASSERT_PENDING;
+
+    upio_host_wake_stop();
+
+#if (UPIO_GPIO_CHARDEV == TRUE)
+    if (bt_wake_gpio_fd >= 0)
+        close(bt_wake_gpio_fd);
+    bt_wake_gpio_fd = -1;
+#endif
+
+#if (BT_WAKE_VIA_PROC == TRUE)
+    vnd_loop_timer_free(lpm_proc_cb.p_timer);
+
+    lpm_proc_cb.p_timer = NULL;
+    lpm_proc_cb.timer_armed = FALSE;
+
+    ALOGI("upio_cleanup: %u proc writes", \
+          __atomic_load_n(&lpm_proc_cb.write_count, __ATOMIC_RELAXED));
+
+    if (lpm_proc_cb.lpm_fd >= 0)
+        close(lpm_proc_cb.lpm_fd);
+    if (lpm_proc_cb.btwrite_fd >= 0)
+        close(lpm_proc_cb.btwrite_fd);
+
+    lpm_proc_cb.lpm_fd = -1;
+    lpm_proc_cb.btwrite_fd = -1;
+    __atomic_store_n(&lpm_proc_cb.btwrite_flags, 0, __ATOMIC_RELAXED);
+#endif
+
+    pthread_mutex_unlock(&upio_mutex);
+
+    if (rfkill_cb.dev_fd >= 0)
+        close(rfkill_cb.dev_fd);
+    if (rfkill_cb.state_fd >= 0)
+        close(rfkill_cb.state_fd);
+
+    rfkill_cb.dev_fd = -1;
+    rfkill_cb.state_fd = -1;
+    rfkill_cb.id = -1;
+}
+
+/*******************************************************************************
+**
+** Function        upio_get_wake_stats
+**
+** Description     Report BT_WAKE transition counters of the hysteresis layer
+**
+** Returns         None
+**
+*******************************************************************************/
+void upio_get_wake_stats(upio_wake_stats_t *p_stats)
+{
+    pthread_mutex_lock(&upio_mutex);
+    *p_stats = wake_hyst_cb.stats;
+    p_stats->delay_ms = wake_hyst_cb.delay_ms;
+    pthread_mutex_unlock(&upio_mutex);
+}
+
+/*******************************************************************************
+**
+** Function        upio_host_wake_start
+**
+** Description     Start monitoring HOST_WAKE if a node has been configured.
+**                 Called when LPM is enabled.
+**
+** Returns         None
+**
+*******************************************************************************/
+void upio_host_wake_start(uint8_t polarity)
+{
+    char uart_pm_node[UPIO_NODE_MAXLEN];
+    const char *p_tty;
+    int level;
+
+    pthread_mutex_lock(&host_wake_cb.mutex);
+
+    if ((host_wake_cb.node[0] == '\0') || (host_wake_cb.fd >= 0))
+    {
+        pthread_mutex_unlock(&host_wake_cb.mutex);
+        return;
+    }
+
+    host_wake_cb.polarity = polarity;
+    host_wake_cb.asserted = FALSE;
+    host_wake_cb.prewake = FALSE;
+
+    if ((host_wake_cb.fd = host_wake_open()) < 0)
+    {
+        pthread_mutex_unlock(&host_wake_cb.mutex);
+        return;
+    }
+
+    if (vnd_loop_add_fd(host_wake_cb.fd, \
+                        host_wake_cb.chardev ? EPOLLIN : (EPOLLPRI | EPOLLERR), \
+                        host_wake_event, NULL) < 0)
+    {
+        close(host_wake_cb.fd);
+        host_wake_cb.fd = -1;
+        pthread_mutex_unlock(&host_wake_cb.mutex);
+        return;
+    }
+
+    if (host_wake_cb.p_timer == NULL)
+        host_wake_cb.p_timer = vnd_loop_timer_new(host_wake_timeout, NULL);
+
+    /* Best effort pre-wake helpers */
+    host_wake_cb.qos_fd = open(HOST_WAKE_PM_QOS_NODE, O_WRONLY | O_CLOEXEC);
+    if (host_wake_cb.qos_fd >= 0)
+    {
+        int32_t latency = HOST_WAKE_PM_QOS_RELEASE;
+        if (write(host_wake_cb.qos_fd, &latency, sizeof(latency)) < 0)
+            UPIODBG("host wake: pm qos write failed (%s)", strerror(errno));
+    }
+
+    if ((p_tty = strrchr(userial_vendor_get_port(), '/')) != NULL)
+    {
+        snprintf(uart_pm_node, sizeof(uart_pm_node), \
+                 HOST_WAKE_UART_PM_NODE_FMT, p_tty + 1);
+        host_wake_cb.uart_pm_fd = open(uart_pm_node, O_WRONLY | O_CLOEXEC);
+    }
+
+    host_wake_cb.uart_fd = userial_vendor_get_fd();
+    if ((host_wake_cb.uart_fd >= 0) && \
+        (vnd_loop_add_fd(host_wake_cb.uart_fd, EPOLLONESHOT, \
+                         host_wake_uart_event, NULL) < 0))
+        host_wake_cb.uart_fd = -1;
+
+    ALOGI("host wake: monitoring %s (pm qos %s, uart pm %s)", \
+          host_wake_cb.node, (host_wake_cb.qos_fd >= 0) ? "on" : "off", \
+          (host_wake_cb.uart_pm_fd >= 0) ? "on" : "off");
 
-/*
- * Maximum btwrite assertion holding time without consecutive btwrite kicking.
- * This value is correlative(shorter) to the in-activity timeout period set in
- * the bluesleep LPM code. The current value used in bluesleep is 10sec.
- */
-#ifndef PROC_BTWRITE_TIMER_TIMEOUT_MS
-#define PROC_BTWRITE_TIMER_TIMEOUT_MS   8000
-#endif
+    /* A wake may already be pending */
+    if ((level = host_wake_read_level()) >= 0)
+        host_wake_edge((uint8_t) level);
 
-/* lpm proc control block */
-typedef struct
+    pthread_mutex_unlock(&host_wake_cb.mutex);
+}
+
+/*******************************************************************************
+**
+** Function        upio_host_wake_stop
+**
+** Description     Stop monitoring HOST_WAKE and release pre-wake requests.
+**                 Called when LPM is disabled.
+**
+** Returns         None
+**
+*******************************************************************************/
+void upio_host_wake_stop(void)
 {
-    uint8_t btwrite_active;
-    uint8_t timer_created;
-    timer_t timer_id;
-    uint32_t timeout_ms;
-} vnd_lpm_proc_cb_t;
+    pthread_mutex_lock(&host_wake_cb.mutex);
 
-static vnd_lpm_proc_cb_t lpm_proc_cb;
-#endif
+    if (host_wake_cb.fd >= 0)
+    {
+        host_wake_prewake(FALSE);
 
-/******************************************************************************
-**  Static variables
-******************************************************************************/
+        vnd_loop_remove_fd(host_wake_cb.fd);
+        close(host_wake_cb.fd);
+        host_wake_cb.fd = -1;
 
-static uint8_t upio_state[UPIO_MAX_COUNT];
-static int rfkill_id = -1;
-static int bt_emul_enable = 0;
-static char *rfkill_state_path = NULL;
+        if (host_wake_cb.uart_fd >= 0)
+            vnd_loop_remove_fd(host_wake_cb.uart_fd);
+        host_wake_cb.uart_fd = -1;
 
-/******************************************************************************
-**  Static functions
-******************************************************************************/
+        if (host_wake_cb.qos_fd >= 0)
+            close(host_wake_cb.qos_fd);
+        host_wake_cb.qos_fd = -1;
 
-/* for friendly debugging outpout string */
-static char *lpm_mode[] = {
-    "UNKNOWN",
-    "disabled",
-    "enabled"
-};
+        if (host_wake_cb.uart_pm_fd >= 0)
+            close(host_wake_cb.uart_pm_fd);
+        host_wake_cb.uart_pm_fd = -1;
+    }
 
-static char *lpm_state[] = {
-    "UNKNOWN",
-    "de-asserted",
-    "asserted"
-};
+    vnd_loop_timer_free(host_wake_cb.p_timer);
+    host_wake_cb.p_timer = NULL;
 
-/*****************************************************************************
-**   Bluetooth On/Off Static Functions
-*****************************************************************************/
-static int is_emulator_context(void)
+    pthread_mutex_unlock(&host_wake_cb.mutex);
+}
+
+/*******************************************************************************
+**
+** Function        upio_get_host_wake_stats
+**
+** Description     Report HOST_WAKE wakes and wake-to-first-byte latency
+**
+** Returns         None
+**
+*******************************************************************************/
+void upio_get_host_wake_stats(upio_host_wake_stats_t *p_stats)
 {
-    char value[PROPERTY_VALUE_MAX];
+    pthread_mutex_lock(&host_wake_cb.mutex);
+    *p_stats = host_wake_cb.stats;
+    pthread_mutex_unlock(&host_wake_cb.mutex);
+}
 
-    property_get("ro.kernel.qemu", value, "0");
-    UPIODBG("is_emulator_context : %s", value);
-    if (strcmp(value, "1") == 0) {
-        return 1;
+/*******************************************************************************
+**
+** Function        upio_set_host_wake_node
+**
+** Description     Configure the HOST_WAKE node to monitor: a sysfs gpio
+**                 value node, or "/dev/gpiochipN:line"
+**
+** Returns         0 : Success
+**                 Otherwise : Fail
+**
+*******************************************************************************/
+int upio_set_host_wake_node(const char *p_conf_name,
+                            const conf_value_t *p_conf_value, int param)
+{
+    if (strlen(p_conf_value->p_str) >= UPIO_NODE_MAXLEN)
+    {
+        ALOGE("%s: %s too long", __func__, p_conf_name);
+        return -EINVAL;
+    }
+
+#if (UPIO_GPIO_CHARDEV == FALSE)
+    if (strncmp(p_conf_value->p_str, "/dev/gpiochip", 13) == 0)
+    {
+        ALOGE("%s: gpiochip support not built in", __func__);
+        return -EINVAL;
     }
+#endif
+
+    pthread_mutex_lock(&host_wake_cb.mutex);
+    strcpy(host_wake_cb.node, p_conf_value->p_str);
+    pthread_mutex_unlock(&host_wake_cb.mutex);
+
     return 0;
 }
 
-static int is_rfkill_disabled(void)
+/*******************************************************************************
+**
+** Function        upio_set_rfkill_root
+**
+** Description     Configure the rfkill sysfs class root. A root other than
+**                 the default one also bypasses /dev/rfkill, so that a fake
+**                 tree can stand in for the kernel.
+**
+** Returns         0 : Success
+**                 Otherwise : Fail
+**
+*******************************************************************************/
+int upio_set_rfkill_root(const char *p_conf_name,
+                         const conf_value_t *p_conf_value, int param)
 {
-    char value[PROPERTY_VALUE_MAX];
-
-    property_get("ro.rfkilldisabled", value, "0");
-    UPIODBG("is_rfkill_disabled ? [%s]", value);
-
-    if (strcmp(value, "1") == 0) {
-        return UPIO_BT_POWER_ON;
+    if (strlen(p_conf_value->p_str) >= UPIO_NODE_MAXLEN)
+    {
+        ALOGE("%s: %s too long", __func__, p_conf_name);
+        return -EINVAL;
     }
 
-    return UPIO_BT_POWER_OFF;
+    strcpy(rfkill_cb.sysfs_root, p_conf_value->p_str);
+    return 0;
 }
 
-static int init_rfkill()
+/*******************************************************************************
+**
+** Function        upio_set_bt_wake_backend
+**
+** Description     Select the BT_WAKE backend from bt_vendor.conf:
+**                 param 0 takes a backend name (none, ioctl, proc, gpiochip),
+**                 param 1 a "/dev/gpiochipN:line" and selects gpiochip.
+**                 Only backends built into the library are accepted.
+**
+** Returns         0 : Success
+**                 Otherwise : Fail
+**
+*******************************************************************************/
+int upio_set_bt_wake_backend(const char *p_conf_name,
+                             const conf_value_t *p_conf_value, int param)
 {
-    char path[64];
-    char buf[16];
-    int fd, sz, id;
-
-    if (is_rfkill_disabled())
-        return -1;
+    int backend = -1;
 
-    for (id = 0; ; id++)
+    if (param == 1)
     {
-        snprintf(path, sizeof(path), "/sys/class/rfkill/rfkill%d/type", id);
-        fd = open(path, O_RDONLY);
-        if (fd < 0)
-        {
-            ALOGE("init_rfkill : open(%s) failed: %s (%d)\n", \
-                 path, strerror(errno), errno);
-            return -1;
-        }
-
-        sz = read(fd, &buf, sizeof(buf));
-        close(fd);
+#if (UPIO_GPIO_CHARDEV == TRUE)
+        char chip[UPIO_NODE_MAXLEN];
+        uint32_t line;
 
-        if (sz >= 9 && memcmp(buf, "bluetooth", 9) == 0)
+        if ((strlen(p_conf_value->p_str) < UPIO_NODE_MAXLEN) && \
+            upio_gpiochip_parse(p_conf_value->p_str, chip, sizeof(chip), &line))
         {
-            rfkill_id = id;
-            break;
+            pthread_mutex_lock(&upio_mutex);
+            strcpy(bt_wake_gpio, p_conf_value->p_str);
+            bt_wake_backend = UPIO_BT_WAKE_GPIOCHIP;
+            pthread_mutex_unlock(&upio_mutex);
+            return 0;
         }
+#endif
+    }
+    else if (strcmp(p_conf_value->p_str, "none") == 0)
+        backend = UPIO_BT_WAKE_NONE;
+#if (BT_WAKE_VIA_USERIAL_IOCTL == TRUE)
+    else if (strcmp(p_conf_value->p_str, "ioctl") == 0)
+        backend = UPIO_BT_WAKE_IOCTL;
+#endif
+#if (BT_WAKE_VIA_PROC == TRUE)
+    else if (strcmp(p_conf_value->p_str, "proc") == 0)
+        backend = UPIO_BT_WAKE_PROC;
+#endif
+#if (UPIO_GPIO_CHARDEV == TRUE)
+    else if (strcmp(p_conf_value->p_str, "gpiochip") == 0)
+        backend = UPIO_BT_WAKE_GPIOCHIP;
+#endif
+
+    if (backend < 0)
+    {
+        ALOGE("%s: %s %s not supported by this build", __func__, \
+              p_conf_name, p_conf_value->p_str);
+        return -EINVAL;
     }
 
-    asprintf(&rfkill_state_path, "/sys/class/rfkill/rfkill%d/state", rfkill_id);
+    pthread_mutex_lock(&upio_mutex);
+    bt_wake_backend = (uint8_t) backend;
+    pthread_mutex_unlock(&upio_mutex);
+
     return 0;
 }
 
-/*****************************************************************************
-**   LPM Static Functions
-*****************************************************************************/
-
-#if (BT_WAKE_VIA_PROC == TRUE)
 /*******************************************************************************
 **
-** Function        proc_btwrite_timeout
+** Function        upio_set_wake_hysteresis
 **
-** Description     Timeout thread of proc/.../btwrite assertion holding timer
+** Description     Configure the BT_WAKE deassert window from bt_vendor.conf:
+**                 param 0 sets the initial/minimum window, param 1 the upper
+**                 bound of the adaptive window (milliseconds)
 **
-** Returns         None
+** Returns         0 : Success
+**                 Otherwise : Fail
 **
 *******************************************************************************/
-static void proc_btwrite_timeout(union sigval arg)
+int upio_set_wake_hysteresis(const char *p_conf_name,
+                             const conf_value_t *p_conf_value, int param)
 {
-    UPIODBG("..%s..", __FUNCTION__);
-    lpm_proc_cb.btwrite_active = FALSE;
-}
-#endif
+    int value = (int) p_conf_value->num;
 
-/*****************************************************************************
-**   UPIO Interface Functions
-*****************************************************************************/
+    pthread_mutex_lock(&upio_mutex);
+    if (param == 0)
+    {
+        wake_hyst_cb.delay_min_ms = value;
+        wake_hyst_cb.delay_ms = upio_wake_hyst_clamp(value);
+    }
+    else
+    {
+        wake_hyst_cb.delay_max_ms = value;
+        wake_hyst_cb.delay_ms = upio_wake_hyst_clamp(wake_hyst_cb.delay_ms);
+    }
+    pthread_mutex_unlock(&upio_mutex);
+
+    return 0;
+}
 
 /*******************************************************************************
 **
-** Function        upio_init
+** Function        upio_set_wake_hold
 **
-** Description     Initialization
+** Description     Keep BT_WAKE asserted for at least hold_ms after the stack
+**                 requests a deassert. Used by the LPM policy to extend the
+**                 stack idle timeout per traffic class. 0 removes the floor.
 **
 ** Returns         None
 **
 *******************************************************************************/
-void upio_init(void)
+void upio_set_wake_hold(uint32_t hold_ms)
 {
-    memset(upio_state, UPIO_UNKNOWN, UPIO_MAX_COUNT);
-#if (BT_WAKE_VIA_PROC == TRUE)
-    memset(&lpm_proc_cb, 0, sizeof(vnd_lpm_proc_cb_t));
-#endif
+    pthread_mutex_lock(&upio_mutex);
+    if (wake_hyst_cb.hold_ms != hold_ms)
+    {
+        wake_hyst_cb.hold_ms = hold_ms;
+        wake_hyst_cb.delay_ms = upio_wake_hyst_clamp(wake_hyst_cb.delay_ms);
+    }
+    pthread_mutex_unlock(&upio_mutex);
 }
 
 /*******************************************************************************
 **
-** Function        upio_cleanup
+** Function        upio_get_proc_stats
 **
-** Description     Clean up
+** Description     Report the number of writes issued into the bluesleep proc
+**                 nodes, in total and per second since LPM was enabled or
+**                 the previous call
 **
 ** Returns         None
 **
 *******************************************************************************/
-void upio_cleanup(void)
+void upio_get_proc_stats(upio_proc_stats_t *p_stats)
 {
 #if (BT_WAKE_VIA_PROC == TRUE)
-    if (lpm_proc_cb.timer_created == TRUE)
-        timer_delete(lpm_proc_cb.timer_id);
-
-    lpm_proc_cb.timer_created = FALSE;
+    struct timespec now;
+    uint32_t count;
+    uint32_t elapsed_ms;
+
+    pthread_mutex_lock(&upio_mutex);
+    count = __atomic_load_n(&lpm_proc_cb.write_count, __ATOMIC_RELAXED);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed_ms = (now.tv_sec - lpm_proc_cb.rate_ts.tv_sec) * 1000 + \
+                 (now.tv_nsec - lpm_proc_cb.rate_ts.tv_nsec) / 1000000;
+
+    p_stats->writes = count;
+    p_stats->writes_per_sec = (elapsed_ms > 0) ? \
+        (uint32_t)((uint64_t)(count - lpm_proc_cb.rate_count) * 1000 / elapsed_ms) : 0;
+
+    lpm_proc_cb.rate_count = count;
+    lpm_proc_cb.rate_ts = now;
+    pthread_mutex_unlock(&upio_mutex);
+#else
+    p_stats->writes = 0;
+    p_stats->writes_per_sec = 0;
 #endif
 }
 
@@ -251,7 +1816,6 @@ void upio_cleanup(void)
 int upio_set_bluetooth_power(int on)
 {
     int sz;
-    int fd = -1;
     int ret = -1;
     char buffer = '0';
 
@@ -266,7 +1830,7 @@ int upio_set_bluetooth_power(int on)
             break;
     }
 
-    if (is_emulator_context())
+    if (rfkill_cb.emulator)
     {
         /* if new value is same as current, return -1 */
         if (bt_emul_enable == on)
@@ -279,54 +1843,94 @@ int upio_set_bluetooth_power(int on)
     }
 
     /* check if we have rfkill interface */
-    if (is_rfkill_disabled())
+    if (rfkill_cb.disabled)
         return 0;
 
-    if (rfkill_id == -1)
+    if (rfkill_cb.id == -1)
     {
         if (init_rfkill())
             return ret;
     }
 
-    fd = open(rfkill_state_path, O_WRONLY);
+    if (rfkill_cb.dev_fd >= 0)
+    {
+        ret = rfkill_dev_set(on);
+    }
+    else
+    {
+        sz = pwrite(rfkill_cb.state_fd, &buffer, 1, 0);
+
+        if (sz < 0) {
+            ALOGE("set_bluetooth_power : write(rfkill%d) failed: %s (%d)",
+                rfkill_cb.id, strerror(errno),errno);
+        }
+        else
+            ret = 0;
+    }
 
-    if (fd < 0)
+    /* a real power cut brings the controller back to its default baud rate */
+    if ((ret == 0) && (on == UPIO_BT_POWER_OFF))
     {
-        ALOGE("set_bluetooth_power : open(%s) for write failed: %s (%d)",
-            rfkill_state_path, strerror(errno), errno);
-        return ret;
+        userial_vendor_forget_baud();
+        rfkill_cb.epoch++;
     }
 
-    sz = write(fd, &buffer, 1);
+    return ret;
+}
+
+/*******************************************************************************
+**
+** Function        upio_get_power_epoch
+**
+** Description     Tell whether the controller may have lost power: the
+**                 returned count changes on every power off, and on every
+**                 block of the Bluetooth switch by anybody else. Without
+**                 /dev/rfkill events, a switch found blocked counts as one.
+**
+** Returns         Power epoch, to be compared with an earlier one
+**
+*******************************************************************************/
+uint32_t upio_get_power_epoch(void)
+{
+    upio_rfkill_event_t ev;
+    char path[UPIO_NODE_MAXLEN + 32];
+    char state = '1';
+    int fd;
+
+    if (rfkill_cb.emulator || rfkill_cb.disabled || (rfkill_cb.id == -1))
+        return rfkill_cb.epoch;
 
-    if (sz < 0) {
-        ALOGE("set_bluetooth_power : write(%s) failed: %s (%d)",
-            rfkill_state_path, strerror(errno),errno);
+    if (rfkill_cb.dev_fd >= 0)
+    {
+        while (rfkill_dev_read(&ev) == TRUE)
+            ;
+        return rfkill_cb.epoch;
     }
-    else
-        ret = 0;
 
-    if (fd >= 0)
+    snprintf(path, sizeof(path), "%s/rfkill%d/state", rfkill_cb.sysfs_root, \
+             rfkill_cb.id);
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) >= 0)
+    {
+        if ((read(fd, &state, 1) == 1) && (state != '1'))
+            rfkill_cb.epoch++;
         close(fd);
+    }
 
-    return ret;
+    return rfkill_cb.epoch;
 }
 
-
 /*******************************************************************************
 **
-** Function        upio_set
+** Function        upio_set_locked
 **
-** Description     Set i/o based on polarity
+** Description     Set i/o based on polarity, called with upio_mutex held
 **
 ** Returns         None
 **
 *******************************************************************************/
-void upio_set(uint8_t pio, uint8_t action, uint8_t polarity)
+static void upio_set_locked(uint8_t pio, uint8_t action, uint8_t polarity)
 {
-    int rc;
 #if (BT_WAKE_VIA_PROC == TRUE)
-    int fd = -1;
     char buffer;
 #endif
 
@@ -342,66 +1946,56 @@ void upio_set(uint8_t pio, uint8_t action, uint8_t polarity)
             upio_state[UPIO_LPM_MODE] = action;
 
 #if (BT_WAKE_VIA_PROC == TRUE)
-            fd = open(VENDOR_LPM_PROC_NODE, O_WRONLY);
-
-            if (fd < 0)
-            {
-                ALOGE("upio_set : open(%s) for write failed: %s (%d)",
-                        VENDOR_LPM_PROC_NODE, strerror(errno), errno);
-                return;
-            }
+            if (bt_wake_backend != UPIO_BT_WAKE_PROC)
+                break;
 
             if (action == UPIO_ASSERT)
             {
                 buffer = '1';
+
+                /* The write rate is reported for the LPM session */
+                lpm_proc_cb.rate_count = __atomic_load_n( \
+                        &lpm_proc_cb.write_count, __ATOMIC_RELAXED);
+                clock_gettime(CLOCK_MONOTONIC, &lpm_proc_cb.rate_ts);
             }
             else
             {
                 buffer = '0';
 
-                // delete btwrite assertion holding timer
-                if (lpm_proc_cb.timer_created == TRUE)
-                {
-                    timer_delete(lpm_proc_cb.timer_id);
-                    lpm_proc_cb.timer_created = FALSE;
-                }
+                // stop btwrite assertion holding timer
+                proc_btwrite_timer_arm(FALSE);
+                __atomic_store_n(&lpm_proc_cb.btwrite_flags, 0, \
+                                 __ATOMIC_RELAXED);
             }
 
-            if (write(fd, &buffer, 1) < 0)
-            {
-                ALOGE("upio_set : write(%s) failed: %s (%d)",
-                        VENDOR_LPM_PROC_NODE, strerror(errno),errno);
-            }
-            else
+            if ((proc_node_write(&lpm_proc_cb.lpm_fd, VENDOR_LPM_PROC_NODE, \
+                                 buffer) == 0) && (action == UPIO_ASSERT))
             {
-                if (action == UPIO_ASSERT)
-                {
-                    // create btwrite assertion holding timer
-                    if (lpm_proc_cb.timer_created == FALSE)
-                    {
-                        int status;
-                        struct sigevent se;
-
-                        se.sigev_notify = SIGEV_THREAD;
-                        se.sigev_value.sival_ptr = &lpm_proc_cb.timer_id;
-                        se.sigev_notify_function = proc_btwrite_timeout;
-                        se.sigev_notify_attributes = NULL;
-
-                        status = timer_create(CLOCK_MONOTONIC, &se,
-                                                &lpm_proc_cb.timer_id);
-
-                        if (status == 0)
-                            lpm_proc_cb.timer_created = TRUE;
-                    }
-                }
+                // create btwrite assertion holding timer
+                if (lpm_proc_cb.p_timer == NULL)
+                    lpm_proc_cb.p_timer = vnd_loop_timer_new( \
+                                            proc_btwrite_timeout, NULL);
             }
-
-            if (fd >= 0)
-                close(fd);
 #endif
             break;
 
         case UPIO_BT_WAKE:
+            bt_wake_polarity = polarity;
+
+            if (upio_state[UPIO_BT_WAKE] & UPIO_DEASSERT_PENDING)
+            {
+                if (action == UPIO_DEASSERT)
+                    return;
+
+                /* Assert inside the idle window: keep the line asserted */
+                vnd_loop_timer_stop(wake_hyst_cb.p_timer);
+                wake_hyst_cb.stats.deasserts_cancelled++;
+                upio_wake_hyst_update();
+
+                __atomic_store_n(&upio_state[UPIO_BT_WAKE], UPIO_ASSERT, \
+                                 __ATOMIC_RELEASE);
+            }
+
             if (upio_state[UPIO_BT_WAKE] == action)
             {
 #if (UPIO_DBG == TRUE)
@@ -413,7 +2007,8 @@ void upio_set(uint8_t pio, uint8_t action, uint8_t polarity)
 #endif
 
 #if (BT_WAKE_VIA_PROC == TRUE)
-                if (lpm_proc_cb.btwrite_active == TRUE)
+                if ((action == UPIO_ASSERT) && \
+                    (bt_wake_backend == UPIO_BT_WAKE_PROC))
                     /*
                      * The proc btwrite node could have not been updated for
                      * certain time already due to heavy downstream path flow.
@@ -421,67 +2016,39 @@ void upio_set(uint8_t pio, uint8_t action, uint8_t polarity)
                      * node to keep the bt_wake assertion in the LPM kernel
                      * driver. The current kernel bluesleep LPM code starts
                      * a 10sec internal in-activity timeout timer before it
-                     * attempts to deassert BT_WAKE line.
+                     * attempts to deassert BT_WAKE line. While the previous
+                     * kick is still held this only flags a pending kick for
+                     * the next holding timer tick.
                      */
+                    proc_btwrite_kick();
 #endif
                 return;
             }
 
-            upio_state[UPIO_BT_WAKE] = action;
-
-#if (BT_WAKE_VIA_USERIAL_IOCTL == TRUE)
-
-            userial_vendor_ioctl( ( (action==UPIO_ASSERT) ? \
-                      USERIAL_OP_ASSERT_BT_WAKE : USERIAL_OP_DEASSERT_BT_WAKE),\
-                      NULL);
-
-#elif (BT_WAKE_VIA_PROC == TRUE)
-
-            /*
-             *  Kick proc btwrite node only at UPIO_ASSERT
-             */
             if (action == UPIO_DEASSERT)
-                return;
-
-            fd = open(VENDOR_BTWRITE_PROC_NODE, O_WRONLY);
-
-            if (fd < 0)
-            {
-                ALOGE("upio_set : open(%s) for write failed: %s (%d)",
-                        VENDOR_BTWRITE_PROC_NODE, strerror(errno), errno);
-                return;
-            }
-
-            buffer = '1';
-
-            if (write(fd, &buffer, 1) < 0)
             {
-                ALOGE("upio_set : write(%s) failed: %s (%d)",
-                        VENDOR_BTWRITE_PROC_NODE, strerror(errno),errno);
-            }
-            else
-            {
-                lpm_proc_cb.btwrite_active = TRUE;
+                wake_hyst_cb.stats.deassert_requests++;
+                wake_hyst_cb.deassert_req_ms = upio_now_ms();
 
-                if (lpm_proc_cb.timer_created == TRUE)
+                if ((wake_hyst_cb.delay_ms > 0) && \
+                    (upio_state[UPIO_BT_WAKE] == UPIO_ASSERT) && \
+                    (wake_hyst_cb.p_timer != NULL))
                 {
-                    struct itimerspec ts;
-
-                    ts.it_value.tv_sec = PROC_BTWRITE_TIMER_TIMEOUT_MS/1000;
-                    ts.it_value.tv_nsec = 1000*(PROC_BTWRITE_TIMER_TIMEOUT_MS%1000);
-                    ts.it_interval.tv_sec = 0;
-                    ts.it_interval.tv_nsec = 0;
-
-                    timer_settime(lpm_proc_cb.timer_id, 0, &ts, 0);
+                    __atomic_store_n(&upio_state[UPIO_BT_WAKE], \
+                                     UPIO_ASSERT | UPIO_DEASSERT_PENDING, \
+                                     __ATOMIC_RELAXED);
+                    vnd_loop_timer_start(wake_hyst_cb.p_timer, \
+                                         wake_hyst_cb.delay_ms, 0);
+                    return;
                 }
             }
+            else if ((wake_hyst_cb.delay_ms > 0) && \
+                     (upio_state[UPIO_BT_WAKE] == UPIO_DEASSERT))
+            {
+                upio_wake_hyst_update();
+            }
 
-            UPIODBG("proc btwrite assertion");
-
-            if (fd >= 0)
-                close(fd);
-#endif
-
+            upio_drive_bt_wake(action);
             break;
 
         case UPIO_HOST_WAKE:
@@ -490,4 +2057,34 @@ void upio_set(uint8_t pio, uint8_t action, uint8_t polarity)
     }
 }
 
+/*******************************************************************************
+**
+** Function        upio_set
+**
+** Description     Set i/o based on polarity
+**
+**                 UPIO_BT_WAKE is requested for every outgoing packet. When
+**                 the line already is in the requested state, this returns
+**                 after a single relaxed load without taking any lock.
+**
+** Returns         None
+**
+*******************************************************************************/
+void upio_set(uint8_t pio, uint8_t action, uint8_t polarity)
+{
+    if ((pio == UPIO_BT_WAKE) && \
+        (__atomic_load_n(&upio_state[UPIO_BT_WAKE], __ATOMIC_RELAXED) == action))
+    {
+#if (BT_WAKE_VIA_PROC == TRUE)
+        if ((bt_wake_backend != UPIO_BT_WAKE_PROC) || \
+            (action != UPIO_ASSERT) || (proc_btwrite_defer() == TRUE))
+            return;
+#else
+        return;
+#endif
+    }
 
+    pthread_mutex_lock(&upio_mutex);
+    upio_set_locked(pio, action, polarity);
+    pthread_mutex_unlock(&upio_mutex);
+}
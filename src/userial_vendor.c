@@ -31,9 +31,19 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <cutils/properties.h>
 #include "bt_vendor_brcm.h"
 #include "userial.h"
 #include "userial_vendor.h"
+#include "vnd_loop.h"
 
 /******************************************************************************
 **  Constants & Macros
@@ -51,6 +61,10 @@
 
 #define VND_PORT_NAME_MAXLEN    256
 
+/* HCI_RESET and its Command Complete, as seen on the H4 transport */
+#define USERIAL_H4_RESET_LEN    4
+#define USERIAL_H4_CMPL_LEN     7
+
 /******************************************************************************
 **  Local type definitions
 ******************************************************************************/
@@ -61,13 +75,47 @@ typedef struct
     int fd;                     /* fd to Bluetooth device */
     struct termios termios;     /* serial terminal of BT port */
     char port_name[VND_PORT_NAME_MAXLEN];
+    uint8_t baud;               /* USERIAL baud rate of the port */
+    uint32_t power_on_ms;       /* time of the last power on, 0 if unknown */
 } vnd_userial_cb_t;
 
+/* Controller readiness wait */
+typedef struct
+{
+    pthread_mutex_t mutex;
+    userial_ready_cback_t p_cback;  /* pending wait, NULL if none */
+    uint32_t start_ms;
+    uint32_t timeout_ms;            /* 0 to not wait */
+    int watch_fd;                   /* port watched for a first byte, or -1 */
+    vnd_loop_timer_t *p_timer;      /* wait timeout */
+    uint8_t waiter;                 /* TIOCMIWAIT thread still blocked */
+} userial_ready_cb_t;
+
 /******************************************************************************
 **  Static variables
 ******************************************************************************/
 
-static vnd_userial_cb_t vnd_userial;
+/* fd survives userial_vendor_init when the port is kept across a warm
+ * restart */
+static vnd_userial_cb_t vnd_userial = { .fd = -1 };
+static userial_ready_cb_t ready_cb =
+{
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .timeout_ms = USERIAL_READY_TIMEOUT_MS,
+    .watch_fd = -1,
+};
+
+/******************************************************************************
+**  Externs
+******************************************************************************/
+
+uint8_t line_speed_to_userial_baud(uint32_t line_speed);
+
+/******************************************************************************
+**  Static functions
+******************************************************************************/
+
+static void userial_ready_cts_event(void *p_data);
 
 /*****************************************************************************
 **   Helper Functions
@@ -121,6 +169,374 @@ uint8_t userial_to_tcio_baud(uint8_t cfg_baud, uint32_t *baud)
     return TRUE;
 }
 
+/*******************************************************************************
+**
+** Function        userial_now_ms
+**
+** Description     Monotonic time in milliseconds
+**
+** Returns         Time in milliseconds
+**
+*******************************************************************************/
+static uint32_t userial_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+/*******************************************************************************
+**
+** Function        userial_ready_cts
+**
+** Description     Check whether the controller asserts CTS
+**
+** Returns         TRUE/FALSE
+**
+*******************************************************************************/
+static uint8_t userial_ready_cts(int fd)
+{
+    int status;
+
+    return ((ioctl(fd, TIOCMGET, &status) == 0) && (status & TIOCM_CTS)) ? \
+           TRUE : FALSE;
+}
+
+/*******************************************************************************
+**
+** Function        userial_ready_time
+**
+** Description     Take the power on to ready time
+**
+** Returns         Time in ms, -1 if the power on time is unknown
+**
+*******************************************************************************/
+static int userial_ready_time(uint32_t now_ms)
+{
+    int ready_ms = (vnd_userial.power_on_ms) ? \
+                   (int) (now_ms - vnd_userial.power_on_ms) : -1;
+
+    vnd_userial.power_on_ms = 0;
+    return ready_ms;
+}
+
+/*******************************************************************************
+**
+** Function        userial_ready_stop
+**
+** Description     Drop the pending readiness wait, with ready_cb.mutex held
+**
+** Returns         Callback of the wait, NULL if none was pending
+**
+*******************************************************************************/
+static userial_ready_cback_t userial_ready_stop(void)
+{
+    userial_ready_cback_t p_cback = ready_cb.p_cback;
+
+    ready_cb.p_cback = NULL;
+    vnd_loop_timer_stop(ready_cb.p_timer);
+
+    if (ready_cb.watch_fd >= 0)
+        vnd_loop_remove_fd(ready_cb.watch_fd);
+    ready_cb.watch_fd = -1;
+
+    return p_cback;
+}
+
+/*******************************************************************************
+**
+** Function        userial_ready_finish
+**
+** Description     End the pending readiness wait and call its callback
+**
+** Returns         None
+**
+*******************************************************************************/
+static void userial_ready_finish(uint8_t ready)
+{
+    userial_ready_cback_t p_cback;
+    uint32_t now_ms = userial_now_ms();
+    int ready_ms = -1;
+
+    pthread_mutex_lock(&ready_cb.mutex);
+    if ((p_cback = userial_ready_stop()) != NULL)
+    {
+        if (ready == TRUE)
+        {
+            ready_ms = userial_ready_time(now_ms);
+            ALOGI("userial vendor: controller ready after %u ms wait", \
+                  now_ms - ready_cb.start_ms);
+        }
+        else
+        {
+            ALOGW("userial vendor: controller not ready after %u ms", \
+                  now_ms - ready_cb.start_ms);
+            vnd_userial.power_on_ms = 0;
+        }
+    }
+    pthread_mutex_unlock(&ready_cb.mutex);
+
+    if (p_cback != NULL)
+        p_cback(ready_ms);
+}
+
+/*******************************************************************************
+**
+** Function        userial_ready_thread
+**
+** Description     Block until the controller changes CTS. TIOCMIWAIT cannot
+**                 be given a timeout, so this runs on its own thread on a
+**                 dup of the port. A thread left blocked by a timed out wait
+**                 serves the next one, and ends on the next CTS change.
+**
+** Returns         NULL
+**
+*******************************************************************************/
+static void *userial_ready_thread(void *arg)
+{
+    int fd = (int) (intptr_t) arg;
+    int ret;
+
+    ret = ioctl(fd, TIOCMIWAIT, TIOCM_CTS);
+    close(fd);
+
+    pthread_mutex_lock(&ready_cb.mutex);
+    ready_cb.waiter = FALSE;
+    pthread_mutex_unlock(&ready_cb.mutex);
+
+    /* Without TIOCMIWAIT support, the first byte or the timeout ends it */
+    if (ret == 0)
+        vnd_loop_post(userial_ready_cts_event, NULL);
+
+    return NULL;
+}
+
+/*******************************************************************************
+**
+** Function        userial_ready_wait_cts
+**
+** Description     Start the CTS wait thread unless one is still blocked,
+**                 with ready_cb.mutex held
+**
+** Returns         None
+**
+*******************************************************************************/
+static void userial_ready_wait_cts(void)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+    int fd;
+
+    if ((ready_cb.waiter == TRUE) || \
+        ((fd = fcntl(vnd_userial.fd, F_DUPFD_CLOEXEC, 0)) < 0))
+        return;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    if (pthread_create(&thread, &attr, userial_ready_thread, \
+                       (void *) (intptr_t) fd) == 0)
+        ready_cb.waiter = TRUE;
+    else
+        close(fd);
+
+    pthread_attr_destroy(&attr);
+}
+
+/*******************************************************************************
+**
+** Function        userial_ready_cts_event
+**
+** Description     CTS changed, runs in the vendor event loop thread
+**
+** Returns         None
+**
+*******************************************************************************/
+static void userial_ready_cts_event(void *p_data)
+{
+    uint8_t ready = FALSE;
+
+    pthread_mutex_lock(&ready_cb.mutex);
+    if ((ready_cb.p_cback != NULL) && (vnd_userial.fd != -1))
+    {
+        if ((ready = userial_ready_cts(vnd_userial.fd)) == FALSE)
+            userial_ready_wait_cts();
+    }
+    pthread_mutex_unlock(&ready_cb.mutex);
+
+    if (ready == TRUE)
+        userial_ready_finish(TRUE);
+}
+
+/*******************************************************************************
+**
+** Function        userial_ready_rx_event
+**
+** Description     First byte from the controller, runs in the vendor event
+**                 loop thread. The byte is left to the stack.
+**
+** Returns         None
+**
+*******************************************************************************/
+static void userial_ready_rx_event(int fd, uint32_t events, void *p_data)
+{
+    if (events & EPOLLIN)
+        userial_ready_finish(TRUE);
+}
+
+/*******************************************************************************
+**
+** Function        userial_ready_timeout
+**
+** Description     Readiness wait timeout, runs in the vendor event loop thread
+**
+** Returns         None
+**
+*******************************************************************************/
+static void userial_ready_timeout(void *p_data)
+{
+    uint8_t expired;
+
+    /* Ignore an expiry of an earlier wait dispatched late */
+    pthread_mutex_lock(&ready_cb.mutex);
+    expired = (ready_cb.p_cback != NULL) && \
+              (userial_now_ms() - ready_cb.start_ms >= ready_cb.timeout_ms);
+    pthread_mutex_unlock(&ready_cb.mutex);
+
+    if (expired)
+        userial_ready_finish(FALSE);
+}
+
+/*******************************************************************************
+**
+** Function        userial_apply_baud
+**
+** Description     Switch the port to the given USERIAL baud rate
+**
+** Returns         None
+**
+*******************************************************************************/
+static void userial_apply_baud(uint8_t userial_baud)
+{
+    uint32_t tcio_baud;
+
+    userial_to_tcio_baud(userial_baud, &tcio_baud);
+
+    cfsetospeed(&vnd_userial.termios, tcio_baud);
+    cfsetispeed(&vnd_userial.termios, tcio_baud);
+    tcsetattr(vnd_userial.fd, TCSANOW, &vnd_userial.termios);
+
+    vnd_userial.baud = userial_baud;
+}
+
+/*******************************************************************************
+**
+** Function        userial_probe_reset
+**
+** Description     Send HCI_RESET at the current baud rate and look for its
+**                 Command Complete
+**
+** Returns         TRUE if the controller answered, FALSE otherwise
+**
+*******************************************************************************/
+static uint8_t userial_probe_reset(void)
+{
+    static const uint8_t reset[USERIAL_H4_RESET_LEN] = \
+        { 0x01, 0x03, 0x0C, 0x00 };
+    uint8_t buf[64];
+    struct pollfd pfd;
+    uint32_t start_ms, elapsed_ms;
+    int len = 0, n, i;
+
+    tcflush(vnd_userial.fd, TCIOFLUSH);
+
+    if (write(vnd_userial.fd, reset, sizeof(reset)) != sizeof(reset))
+        return FALSE;
+
+    start_ms = userial_now_ms();
+    pfd.fd = vnd_userial.fd;
+    pfd.events = POLLIN;
+
+    while ((elapsed_ms = userial_now_ms() - start_ms) < \
+           USERIAL_BAUD_PROBE_TIMEOUT_MS)
+    {
+        if (poll(&pfd, 1, USERIAL_BAUD_PROBE_TIMEOUT_MS - elapsed_ms) <= 0)
+            continue;
+
+        if ((n = read(vnd_userial.fd, buf + len, sizeof(buf) - len)) <= 0)
+            continue;
+        len += n;
+
+        /* 04 0E 04 <num packets> 03 0C 00 */
+        for (i = 0; i + USERIAL_H4_CMPL_LEN <= len; i++)
+        {
+            if ((buf[i] == 0x04) && (buf[i+1] == 0x0E) && (buf[i+2] == 0x04) \
+                && (buf[i+4] == 0x03) && (buf[i+5] == 0x0C) && (buf[i+6] == 0))
+                return TRUE;
+        }
+
+        /* keep a possibly partial event at the end */
+        if (len > USERIAL_H4_CMPL_LEN - 1)
+        {
+            memmove(buf, buf + len - (USERIAL_H4_CMPL_LEN - 1), \
+                    USERIAL_H4_CMPL_LEN - 1);
+            len = USERIAL_H4_CMPL_LEN - 1;
+        }
+    }
+
+    return FALSE;
+}
+
+/*******************************************************************************
+**
+** Function        userial_detect_baud
+**
+** Description     Find the baud rate of a controller left running by a
+**                 previous instance of the host, among the recorded one and
+**                 the target one. Nothing is probed when no rate is recorded,
+**                 i.e. when the controller is known to be at the open rate.
+**
+** Returns         None
+**
+*******************************************************************************/
+static void userial_detect_baud(uint8_t open_baud)
+{
+    char value[PROPERTY_VALUE_MAX];
+    uint8_t candidates[2];
+    int count = 0, i;
+    uint32_t start_ms = userial_now_ms();
+
+    if (property_get(USERIAL_BAUD_PROPERTY, value, "") <= 0)
+        return;
+
+    candidates[count++] = (uint8_t) atoi(value);
+    candidates[count] = line_speed_to_userial_baud(UART_TARGET_BAUD_RATE);
+    if (candidates[count] != candidates[0])
+        count++;
+
+    for (i = 0; i < count; i++)
+    {
+        if (candidates[i] == open_baud)
+            continue;
+
+        userial_apply_baud(candidates[i]);
+
+        if (userial_probe_reset() == TRUE)
+        {
+            ALOGI("userial vendor open: controller found at baud idx %i " \
+                  "in %u ms", candidates[i], userial_now_ms() - start_ms);
+            return;
+        }
+    }
+
+    ALOGW("userial vendor open: controller not found at baud idx %s, " \
+          "assuming idx %i", value, open_baud);
+
+    userial_apply_baud(open_baud);
+    userial_vendor_forget_baud();
+}
+
 #if (BT_WAKE_VIA_USERIAL_IOCTL==TRUE)
 /*******************************************************************************
 **
@@ -161,7 +577,7 @@ void userial_ioctl_init_bt_wake(int fd)
 *******************************************************************************/
 void userial_vendor_init(void)
 {
-    vnd_userial.fd = -1;
+    vnd_userial.power_on_ms = 0;
     snprintf(vnd_userial.port_name, VND_PORT_NAME_MAXLEN, "%s", \
             BLUETOOTH_UART_DEVICE_PORT);
 }
@@ -182,7 +598,15 @@ int userial_vendor_open(tUSERIAL_CFG *p_cfg)
     uint16_t parity;
     uint8_t stop_bits;
 
-    vnd_userial.fd = -1;
+    if (vnd_userial.fd != -1)
+    {
+        /* kept open across a warm restart, termios and baud rate included.
+         * Drop what the controller sent after the stack stopped reading. */
+        ALOGI("userial vendor open: reusing %s fd = %d", \
+              vnd_userial.port_name, vnd_userial.fd);
+        tcflush(vnd_userial.fd, TCIFLUSH);
+        return vnd_userial.fd;
+    }
 
     if (!userial_to_tcio_baud(p_cfg->baud, &baud))
     {
@@ -249,6 +673,10 @@ int userial_vendor_open(tUSERIAL_CFG *p_cfg)
     cfsetospeed(&vnd_userial.termios, baud);
     cfsetispeed(&vnd_userial.termios, baud);
     tcsetattr(vnd_userial.fd, TCSANOW, &vnd_userial.termios);
+    vnd_userial.baud = p_cfg->baud;
+
+    /* the controller may still run at the speed a crashed host left it */
+    userial_detect_baud(p_cfg->baud);
 
 #if (BT_WAKE_VIA_USERIAL_IOCTL==TRUE)
     userial_ioctl_init_bt_wake(vnd_userial.fd);
@@ -275,6 +703,13 @@ void userial_vendor_close(void)
     if (vnd_userial.fd == -1)
         return;
 
+    /* The stack is going away, a readiness wait has no one to tell */
+    pthread_mutex_lock(&ready_cb.mutex);
+    userial_ready_stop();
+    vnd_loop_timer_free(ready_cb.p_timer);
+    ready_cb.p_timer = NULL;
+    pthread_mutex_unlock(&ready_cb.mutex);
+
 #if (BT_WAKE_VIA_USERIAL_IOCTL==TRUE)
     /* de-assert bt_wake BEFORE closing port */
     ioctl(vnd_userial.fd, USERIAL_IOCTL_BT_WAKE_DEASSERT, NULL);
@@ -299,13 +734,41 @@ void userial_vendor_close(void)
 *******************************************************************************/
 void userial_vendor_set_baud(uint8_t userial_baud)
 {
-    uint32_t tcio_baud;
+    char value[PROPERTY_VALUE_MAX];
 
-    userial_to_tcio_baud(userial_baud, &tcio_baud);
+    userial_apply_baud(userial_baud);
 
-    cfsetospeed(&vnd_userial.termios, tcio_baud);
-    cfsetispeed(&vnd_userial.termios, tcio_baud);
-    tcsetattr(vnd_userial.fd, TCSANOW, &vnd_userial.termios);
+    snprintf(value, sizeof(value), "%d", userial_baud);
+    property_set(USERIAL_BAUD_PROPERTY, value);
+}
+
+/*******************************************************************************
+**
+** Function        userial_vendor_get_baud
+**
+** Description     Get the USERIAL baud rate the port is running at
+**
+** Returns         USERIAL baud rate
+**
+*******************************************************************************/
+uint8_t userial_vendor_get_baud(void)
+{
+    return vnd_userial.baud;
+}
+
+/*******************************************************************************
+**
+** Function        userial_vendor_forget_baud
+**
+** Description     Forget the baud rate recorded for the controller, after it
+**                 has been powered off
+**
+** Returns         None
+**
+*******************************************************************************/
+void userial_vendor_forget_baud(void)
+{
+    property_set(USERIAL_BAUD_PROPERTY, "");
 }
 
 /*******************************************************************************
@@ -342,6 +805,114 @@ void userial_vendor_ioctl(userial_vendor_ioctl_op_t op, void *p_data)
     }
 }
 
+/*******************************************************************************
+**
+** Function        userial_vendor_power_on
+**
+** Description     Note that the controller has just been powered on, so that
+**                 the next userial_vendor_wait_ready can measure from it
+**
+** Returns         None
+**
+*******************************************************************************/
+void userial_vendor_power_on(void)
+{
+    vnd_userial.power_on_ms = userial_now_ms();
+}
+
+/*******************************************************************************
+**
+** Function        userial_vendor_wait_ready
+**
+** Description     Wait for the controller to come out of reset, which shows
+**                 as CTS asserted by the controller or as a first received
+**                 byte. The byte is left in the port for the stack to read.
+**
+**                 Only waits with hardware flow control on: without it, CTS
+**                 tells nothing. Both are events, TIOCMIWAIT on a helper
+**                 thread and the port in the vendor event loop, bounded by
+**                 UartReadyTimeoutMs. p_cback is called right away when
+**                 there is nothing to wait for.
+**
+** Returns         None
+**
+*******************************************************************************/
+void userial_vendor_wait_ready(userial_ready_cback_t p_cback)
+{
+    struct termios tio;
+    uint32_t now_ms = userial_now_ms();
+    uint8_t wait = FALSE;
+    int ready_ms = -1;
+
+    pthread_mutex_lock(&ready_cb.mutex);
+    userial_ready_stop();
+
+    if ((vnd_userial.fd == -1) || (tcgetattr(vnd_userial.fd, &tio) < 0) || \
+        ((tio.c_cflag & CRTSCTS) == 0))
+    {
+        vnd_userial.power_on_ms = 0;
+    }
+    else if (userial_ready_cts(vnd_userial.fd) == TRUE)
+    {
+        ready_ms = userial_ready_time(now_ms);
+    }
+    else if (ready_cb.timeout_ms > 0)
+    {
+        if (ready_cb.p_timer == NULL)
+            ready_cb.p_timer = vnd_loop_timer_new(userial_ready_timeout, NULL);
+
+        if (ready_cb.p_timer != NULL)
+        {
+            ready_cb.p_cback = p_cback;
+            ready_cb.start_ms = now_ms;
+            vnd_loop_timer_start(ready_cb.p_timer, ready_cb.timeout_ms, 0);
+
+            if (vnd_loop_add_fd(vnd_userial.fd, EPOLLIN | EPOLLONESHOT, \
+                                userial_ready_rx_event, NULL) == 0)
+                ready_cb.watch_fd = vnd_userial.fd;
+
+            userial_ready_wait_cts();
+            wait = TRUE;
+        }
+    }
+    else
+    {
+        vnd_userial.power_on_ms = 0;
+    }
+    pthread_mutex_unlock(&ready_cb.mutex);
+
+    if (wait == FALSE)
+        p_cback(ready_ms);
+}
+
+/*******************************************************************************
+**
+** Function        userial_vendor_get_fd
+**
+** Description     Get the fd of the opened serial port
+**
+** Returns         device fd, -1 if the port is closed
+**
+*******************************************************************************/
+int userial_vendor_get_fd(void)
+{
+    return vnd_userial.fd;
+}
+
+/*******************************************************************************
+**
+** Function        userial_vendor_get_port
+**
+** Description     Get the configured serial port device name
+**
+** Returns         port name
+**
+*******************************************************************************/
+const char *userial_vendor_get_port(void)
+{
+    return vnd_userial.port_name;
+}
+
 /*******************************************************************************
 **
 ** Function        userial_set_port
@@ -352,9 +923,31 @@ void userial_vendor_ioctl(userial_vendor_ioctl_op_t op, void *p_data)
 **                 Otherwise : Fail
 **
 *******************************************************************************/
-int userial_set_port(char *p_conf_name, char *p_conf_value, int param)
+int userial_set_port(const char *p_conf_name,
+                     const conf_value_t *p_conf_value, int param)
+{
+    strcpy(vnd_userial.port_name, p_conf_value->p_str);
+
+    return 0;
+}
+
+/*******************************************************************************
+**
+** Function        userial_set_ready_timeout
+**
+** Description     Configure the upper bound of the wait for the controller
+**                 to come out of reset, 0 to not wait
+**
+** Returns         0 : Success
+**                 Otherwise : Fail
+**
+*******************************************************************************/
+int userial_set_ready_timeout(const char *p_conf_name,
+                              const conf_value_t *p_conf_value, int param)
 {
-    strcpy(vnd_userial.port_name, p_conf_value);
+    pthread_mutex_lock(&ready_cb.mutex);
+    ready_cb.timeout_ms = p_conf_value->num;
+    pthread_mutex_unlock(&ready_cb.mutex);
 
     return 0;
 }
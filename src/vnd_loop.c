@@ -0,0 +1,724 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2009-2012 Broadcom Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+/******************************************************************************
+ *
+ *  Filename:      vnd_loop.c
+ *
+ *  Description:   Contains the vendor library event loop. A single thread
+ *                 waits on an epoll set holding
+ *                      timerfd based timers
+ *                      fd watches
+ *                      an eventfd for deferred work
+ *                 so that time based and asynchronous work never spawns a
+ *                 thread per event.
+ *
+ ******************************************************************************/
+
+#define LOG_TAG "bt_vnd_loop"
+
+#include <utils/Log.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include "bt_vendor_brcm.h"
+#include "vnd_loop.h"
+
+/******************************************************************************
+**  Constants & Macros
+******************************************************************************/
+
+#ifndef VNDLOOP_DBG
+#define VNDLOOP_DBG FALSE
+#endif
+
+#if (VNDLOOP_DBG == TRUE)
+#define VNDLOOPDBG(param, ...) {ALOGD(param, ## __VA_ARGS__);}
+#else
+#define VNDLOOPDBG(param, ...) {}
+#endif
+
+#define VND_LOOP_THREAD_NAME    "bt_vnd_loop"
+#define VND_LOOP_MAX_EVENTS     8
+
+/* epoll user data encoding: source type in the upper half, slot in the lower */
+#define VND_LOOP_SRC_WAKE       1
+#define VND_LOOP_SRC_TIMER      2
+#define VND_LOOP_SRC_FD         3
+#define VND_LOOP_EV_DATA(src, idx)  (((uint64_t)(src) << 32) | (uint32_t)(idx))
+#define VND_LOOP_EV_SRC(data)       ((uint32_t)((data) >> 32))
+#define VND_LOOP_EV_IDX(data)       ((uint32_t)(data))
+
+/******************************************************************************
+**  Local type definitions
+******************************************************************************/
+
+struct vnd_loop_timer
+{
+    int fd;                     /* timerfd, -1 when the slot is free */
+    vnd_loop_cback_t p_cback;
+    void *p_data;
+};
+
+typedef struct
+{
+    int fd;                     /* watched fd, -1 when the slot is free */
+    vnd_loop_fd_cback_t p_cback;
+    void *p_data;
+} vnd_loop_watch_t;
+
+typedef struct
+{
+    vnd_loop_cback_t p_cback;
+    void *p_data;
+} vnd_loop_work_t;
+
+/* event loop control block */
+typedef struct
+{
+    pthread_t thread;
+    uint8_t running;
+    int epoll_fd;
+    int wake_fd;                /* eventfd kicking the loop thread */
+    pthread_mutex_t mutex;      /* protects slots and work queue */
+    vnd_loop_timer_t timers[VND_LOOP_MAX_TIMERS];
+    vnd_loop_watch_t watches[VND_LOOP_MAX_FDS];
+    vnd_loop_work_t work[VND_LOOP_MAX_WORK];
+    uint8_t work_head;
+    uint8_t work_count;
+} vnd_loop_cb_t;
+
+/******************************************************************************
+**  Static variables
+******************************************************************************/
+
+static vnd_loop_cb_t vnd_loop =
+{
+    .running = FALSE,
+    .epoll_fd = -1,
+    .wake_fd = -1,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/******************************************************************************
+**  Static functions
+******************************************************************************/
+
+/*******************************************************************************
+**
+** Function        vnd_loop_setup_thread
+**
+** Description     Name, prioritize and optionally pin the loop thread
+**
+** Returns         None
+**
+*******************************************************************************/
+static void vnd_loop_setup_thread(void)
+{
+    pid_t tid = (pid_t) syscall(SYS_gettid);
+
+    prctl(PR_SET_NAME, (unsigned long) VND_LOOP_THREAD_NAME, 0, 0, 0);
+
+    if ((VND_LOOP_THREAD_PRIORITY != 0) && \
+        (setpriority(PRIO_PROCESS, tid, VND_LOOP_THREAD_PRIORITY) < 0))
+    {
+        ALOGW("vnd_loop: failed to set priority %d: %s", \
+              VND_LOOP_THREAD_PRIORITY, strerror(errno));
+    }
+
+#if (VND_LOOP_CPU_AFFINITY != 0)
+    {
+        cpu_set_t cpu_set;
+        int cpu;
+
+        CPU_ZERO(&cpu_set);
+        for (cpu = 0; cpu < 32; cpu++)
+        {
+            if (VND_LOOP_CPU_AFFINITY & (1 << cpu))
+                CPU_SET(cpu, &cpu_set);
+        }
+
+        if (sched_setaffinity(tid, sizeof(cpu_set), &cpu_set) < 0)
+            ALOGW("vnd_loop: failed to set affinity: %s", strerror(errno));
+    }
+#endif
+}
+
+/*******************************************************************************
+**
+** Function        vnd_loop_run_work
+**
+** Description     Drain the deferred work queue
+**
+** Returns         None
+**
+*******************************************************************************/
+static void vnd_loop_run_work(void)
+{
+    vnd_loop_work_t work;
+    uint64_t count;
+
+    /* Clear the eventfd counter before draining the queue */
+    read(vnd_loop.wake_fd, &count, sizeof(count));
+
+    for (;;)
+    {
+        pthread_mutex_lock(&vnd_loop.mutex);
+        if (vnd_loop.work_count == 0)
+        {
+            pthread_mutex_unlock(&vnd_loop.mutex);
+            break;
+        }
+        work = vnd_loop.work[vnd_loop.work_head];
+        vnd_loop.work_head = (vnd_loop.work_head + 1) % VND_LOOP_MAX_WORK;
+        vnd_loop.work_count--;
+        pthread_mutex_unlock(&vnd_loop.mutex);
+
+        work.p_cback(work.p_data);
+    }
+}
+
+/*******************************************************************************
+**
+** Function        vnd_loop_run_timer
+**
+** Description     Dispatch an expired timer
+**
+** Returns         None
+**
+*******************************************************************************/
+static void vnd_loop_run_timer(uint32_t idx)
+{
+    vnd_loop_cback_t p_cback = NULL;
+    void *p_data = NULL;
+    uint64_t expirations;
+
+    pthread_mutex_lock(&vnd_loop.mutex);
+    /* A stopped or re-armed timer has its expiration count reset, in which
+     * case the read fails with EAGAIN and the stale expiry is dropped.
+     */
+    if ((vnd_loop.timers[idx].fd >= 0) && \
+        (read(vnd_loop.timers[idx].fd, &expirations, sizeof(expirations)) == \
+         sizeof(expirations)))
+    {
+        p_cback = vnd_loop.timers[idx].p_cback;
+        p_data = vnd_loop.timers[idx].p_data;
+    }
+    pthread_mutex_unlock(&vnd_loop.mutex);
+
+    if (p_cback)
+        p_cback(p_data);
+}
+
+/*******************************************************************************
+**
+** Function        vnd_loop_run_fd
+**
+** Description     Dispatch events of a watched fd
+**
+** Returns         None
+**
+*******************************************************************************/
+static void vnd_loop_run_fd(uint32_t idx, uint32_t events)
+{
+    vnd_loop_fd_cback_t p_cback = NULL;
+    void *p_data = NULL;
+    int fd;
+
+    pthread_mutex_lock(&vnd_loop.mutex);
+    fd = vnd_loop.watches[idx].fd;
+    if (fd >= 0)
+    {
+        p_cback = vnd_loop.watches[idx].p_cback;
+        p_data = vnd_loop.watches[idx].p_data;
+    }
+    pthread_mutex_unlock(&vnd_loop.mutex);
+
+    if (p_cback)
+        p_cback(fd, events, p_data);
+}
+
+/*******************************************************************************
+**
+** Function        vnd_loop_thread
+**
+** Description     Event loop thread
+**
+** Returns         None
+**
+*******************************************************************************/
+static void *vnd_loop_thread(void *arg)
+{
+    struct epoll_event events[VND_LOOP_MAX_EVENTS];
+    int n, i;
+
+    vnd_loop_setup_thread();
+
+    VNDLOOPDBG("vnd_loop thread started");
+
+    while (vnd_loop.running)
+    {
+        n = epoll_wait(vnd_loop.epoll_fd, events, VND_LOOP_MAX_EVENTS, -1);
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            ALOGE("vnd_loop: epoll_wait failed: %s", strerror(errno));
+            break;
+        }
+
+        for (i = 0; (i < n) && vnd_loop.running; i++)
+        {
+            uint64_t data = events[i].data.u64;
+
+            switch (VND_LOOP_EV_SRC(data))
+            {
+                case VND_LOOP_SRC_WAKE:
+                    vnd_loop_run_work();
+                    break;
+
+                case VND_LOOP_SRC_TIMER:
+                    vnd_loop_run_timer(VND_LOOP_EV_IDX(data));
+                    break;
+
+                case VND_LOOP_SRC_FD:
+                    vnd_loop_run_fd(VND_LOOP_EV_IDX(data), events[i].events);
+                    break;
+            }
+        }
+    }
+
+    VNDLOOPDBG("vnd_loop thread exiting");
+
+    return NULL;
+}
+
+/*****************************************************************************
+**   Event Loop Interface Functions
+*****************************************************************************/
+
+/*******************************************************************************
+**
+** Function        vnd_loop_init
+**
+** Description     Create the event loop and start its thread
+**
+** Returns         0  : SUCCESS
+**                 <0 : ERROR
+**
+*******************************************************************************/
+int vnd_loop_init(void)
+{
+    struct epoll_event ev;
+    int i;
+
+    if (vnd_loop.running)
+        return 0;
+
+    for (i = 0; i < VND_LOOP_MAX_TIMERS; i++)
+        vnd_loop.timers[i].fd = -1;
+    for (i = 0; i < VND_LOOP_MAX_FDS; i++)
+        vnd_loop.watches[i].fd = -1;
+    vnd_loop.work_head = 0;
+    vnd_loop.work_count = 0;
+
+    vnd_loop.epoll_fd = epoll_create(VND_LOOP_MAX_TIMERS + VND_LOOP_MAX_FDS + 1);
+    vnd_loop.wake_fd = eventfd(0, EFD_NONBLOCK);
+
+    if ((vnd_loop.epoll_fd < 0) || (vnd_loop.wake_fd < 0))
+    {
+        ALOGE("vnd_loop_init: epoll/eventfd failed: %s", strerror(errno));
+        goto error;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = VND_LOOP_EV_DATA(VND_LOOP_SRC_WAKE, 0);
+    if (epoll_ctl(vnd_loop.epoll_fd, EPOLL_CTL_ADD, vnd_loop.wake_fd, &ev) < 0)
+    {
+        ALOGE("vnd_loop_init: epoll_ctl failed: %s", strerror(errno));
+        goto error;
+    }
+
+    vnd_loop.running = TRUE;
+
+    if (pthread_create(&vnd_loop.thread, NULL, vnd_loop_thread, NULL) != 0)
+    {
+        ALOGE("vnd_loop_init: pthread_create failed");
+        vnd_loop.running = FALSE;
+        goto error;
+    }
+
+    return 0;
+
+error:
+    if (vnd_loop.epoll_fd >= 0)
+        close(vnd_loop.epoll_fd);
+    if (vnd_loop.wake_fd >= 0)
+        close(vnd_loop.wake_fd);
+    vnd_loop.epoll_fd = -1;
+    vnd_loop.wake_fd = -1;
+    return -1;
+}
+
+/*******************************************************************************
+**
+** Function        vnd_loop_cleanup
+**
+** Description     Stop the loop thread and release all timers and watches
+**
+** Returns         None
+**
+*******************************************************************************/
+void vnd_loop_cleanup(void)
+{
+    uint64_t one = 1;
+    int i;
+
+    if (vnd_loop.running == FALSE)
+        return;
+
+    vnd_loop.running = FALSE;
+    write(vnd_loop.wake_fd, &one, sizeof(one));
+
+    if (!pthread_equal(pthread_self(), vnd_loop.thread))
+        pthread_join(vnd_loop.thread, NULL);
+    else
+        pthread_detach(vnd_loop.thread);
+
+    pthread_mutex_lock(&vnd_loop.mutex);
+    for (i = 0; i < VND_LOOP_MAX_TIMERS; i++)
+    {
+        if (vnd_loop.timers[i].fd >= 0)
+            close(vnd_loop.timers[i].fd);
+        vnd_loop.timers[i].fd = -1;
+    }
+    for (i = 0; i < VND_LOOP_MAX_FDS; i++)
+        vnd_loop.watches[i].fd = -1;
+    vnd_loop.work_count = 0;
+    pthread_mutex_unlock(&vnd_loop.mutex);
+
+    close(vnd_loop.epoll_fd);
+    close(vnd_loop.wake_fd);
+    vnd_loop.epoll_fd = -1;
+    vnd_loop.wake_fd = -1;
+}
+
+/*******************************************************************************
+**
+** Function        vnd_loop_timer_new
+**
+** Description     Allocate a timer whose callback runs in the loop thread
+**
+** Returns         Timer handle, NULL if out of resources
+**
+*******************************************************************************/
+vnd_loop_timer_t *vnd_loop_timer_new(vnd_loop_cback_t p_cback, void *p_data)
+{
+    vnd_loop_timer_t *p_timer = NULL;
+    struct epoll_event ev;
+    int i, fd;
+
+    if ((vnd_loop.running == FALSE) || (p_cback == NULL))
+        return NULL;
+
+    fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (fd < 0)
+    {
+        ALOGE("vnd_loop_timer_new: timerfd_create failed: %s", strerror(errno));
+        return NULL;
+    }
+
+    pthread_mutex_lock(&vnd_loop.mutex);
+    for (i = 0; i < VND_LOOP_MAX_TIMERS; i++)
+    {
+        if (vnd_loop.timers[i].fd < 0)
+        {
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN;
+            ev.data.u64 = VND_LOOP_EV_DATA(VND_LOOP_SRC_TIMER, i);
+
+            if (epoll_ctl(vnd_loop.epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0)
+            {
+                p_timer = &vnd_loop.timers[i];
+                p_timer->fd = fd;
+                p_timer->p_cback = p_cback;
+                p_timer->p_data = p_data;
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&vnd_loop.mutex);
+
+    if (p_timer == NULL)
+    {
+        ALOGE("vnd_loop_timer_new: no timer available");
+        close(fd);
+    }
+
+    return p_timer;
+}
+
+/*******************************************************************************
+**
+** Function        vnd_loop_timer_start
+**
+** Description     (Re)arm a timer to expire in timeout_ms, and then every
+**                 period_ms if period_ms is not 0
+**
+** Returns         None
+**
+*******************************************************************************/
+void vnd_loop_timer_start(vnd_loop_timer_t *p_timer, uint32_t timeout_ms,
+                          uint32_t period_ms)
+{
+    struct itimerspec ts;
+
+    if ((p_timer == NULL) || (p_timer->fd < 0))
+        return;
+
+    /* A zero it_value would disarm the timer */
+    if (timeout_ms == 0)
+        timeout_ms = 1;
+
+    ts.it_value.tv_sec = timeout_ms / 1000;
+    ts.it_value.tv_nsec = 1000000 * (timeout_ms % 1000);
+    ts.it_interval.tv_sec = period_ms / 1000;
+    ts.it_interval.tv_nsec = 1000000 * (period_ms % 1000);
+
+    if (timerfd_settime(p_timer->fd, 0, &ts, NULL) < 0)
+        ALOGE("vnd_loop_timer_start: timerfd_settime failed: %s", \
+              strerror(errno));
+}
+
+/*******************************************************************************
+**
+** Function        vnd_loop_timer_stop
+**
+** Description     Disarm a timer. An expiry which has not been dispatched yet
+**                 is dropped.
+**
+** Returns         None
+**
+*******************************************************************************/
+void vnd_loop_timer_stop(vnd_loop_timer_t *p_timer)
+{
+    struct itimerspec ts;
+
+    if ((p_timer == NULL) || (p_timer->fd < 0))
+        return;
+
+    memset(&ts, 0, sizeof(ts));
+    timerfd_settime(p_timer->fd, 0, &ts, NULL);
+}
+
+/*******************************************************************************
+**
+** Function        vnd_loop_timer_free
+**
+** Description     Disarm and release a timer
+**
+** Returns         None
+**
+*******************************************************************************/
+void vnd_loop_timer_free(vnd_loop_timer_t *p_timer)
+{
+    if (p_timer == NULL)
+        return;
+
+    pthread_mutex_lock(&vnd_loop.mutex);
+    if (p_timer->fd >= 0)
+    {
+        epoll_ctl(vnd_loop.epoll_fd, EPOLL_CTL_DEL, p_timer->fd, NULL);
+        close(p_timer->fd);
+        p_timer->fd = -1;
+    }
+    pthread_mutex_unlock(&vnd_loop.mutex);
+}
+
+/*******************************************************************************
+**
+** Function        vnd_loop_post
+**
+** Description     Queue a work item to be run in the loop thread
+**
+** Returns         0  : SUCCESS
+**                 <0 : ERROR (loop not running or queue full)
+**
+*******************************************************************************/
+int vnd_loop_post(vnd_loop_cback_t p_cback, void *p_data)
+{
+    uint64_t one = 1;
+    int ret = -1;
+
+    if ((vnd_loop.running == FALSE) || (p_cback == NULL))
+        return -1;
+
+    pthread_mutex_lock(&vnd_loop.mutex);
+    if (vnd_loop.work_count < VND_LOOP_MAX_WORK)
+    {
+        uint8_t tail = (vnd_loop.work_head + vnd_loop.work_count) % \
+                       VND_LOOP_MAX_WORK;
+
+        vnd_loop.work[tail].p_cback = p_cback;
+        vnd_loop.work[tail].p_data = p_data;
+        vnd_loop.work_count++;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&vnd_loop.mutex);
+
+    if (ret == 0)
+        write(vnd_loop.wake_fd, &one, sizeof(one));
+    else
+        ALOGE("vnd_loop_post: work queue full");
+
+    return ret;
+}
+
+/*******************************************************************************
+**
+** Function        vnd_loop_add_fd
+**
+** Description     Watch fd for the given epoll events
+**
+** Returns         0  : SUCCESS
+**                 <0 : ERROR
+**
+*******************************************************************************/
+int vnd_loop_add_fd(int fd, uint32_t events, vnd_loop_fd_cback_t p_cback,
+                    void *p_data)
+{
+    struct epoll_event ev;
+    int i, ret = -1;
+
+    if ((vnd_loop.running == FALSE) || (fd < 0) || (p_cback == NULL))
+        return -1;
+
+    pthread_mutex_lock(&vnd_loop.mutex);
+    for (i = 0; i < VND_LOOP_MAX_FDS; i++)
+    {
+        if (vnd_loop.watches[i].fd < 0)
+        {
+            memset(&ev, 0, sizeof(ev));
+            ev.events = events;
+            ev.data.u64 = VND_LOOP_EV_DATA(VND_LOOP_SRC_FD, i);
+
+            if (epoll_ctl(vnd_loop.epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0)
+            {
+                vnd_loop.watches[i].fd = fd;
+                vnd_loop.watches[i].p_cback = p_cback;
+                vnd_loop.watches[i].p_data = p_data;
+                ret = 0;
+            }
+            else
+            {
+                ALOGE("vnd_loop_add_fd: epoll_ctl(%d) failed: %s", \
+                      fd, strerror(errno));
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&vnd_loop.mutex);
+
+    return ret;
+}
+
+/*******************************************************************************
+**
+** Function        vnd_loop_mod_fd
+**
+** Description     Change the epoll events watched on fd
+**
+** Returns         0  : SUCCESS
+**                 <0 : ERROR
+**
+*******************************************************************************/
+int vnd_loop_mod_fd(int fd, uint32_t events)
+{
+    struct epoll_event ev;
+    int i, ret = -1;
+
+    pthread_mutex_lock(&vnd_loop.mutex);
+    for (i = 0; i < VND_LOOP_MAX_FDS; i++)
+    {
+        if ((fd >= 0) && (vnd_loop.watches[i].fd == fd))
+        {
+            memset(&ev, 0, sizeof(ev));
+            ev.events = events;
+            ev.data.u64 = VND_LOOP_EV_DATA(VND_LOOP_SRC_FD, i);
+            ret = epoll_ctl(vnd_loop.epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&vnd_loop.mutex);
+
+    return ret;
+}
+
+/*******************************************************************************
+**
+** Function        vnd_loop_remove_fd
+**
+** Description     Stop watching fd
+**
+** Returns         None
+**
+*******************************************************************************/
+void vnd_loop_remove_fd(int fd)
+{
+    int i;
+
+    pthread_mutex_lock(&vnd_loop.mutex);
+    for (i = 0; i < VND_LOOP_MAX_FDS; i++)
+    {
+        if ((fd >= 0) && (vnd_loop.watches[i].fd == fd))
+        {
+            if (vnd_loop.epoll_fd >= 0)
+                epoll_ctl(vnd_loop.epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+            vnd_loop.watches[i].fd = -1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&vnd_loop.mutex);
+}
+
+/*******************************************************************************
+**
+** Function        vnd_loop_in_thread
+**
+** Description     Check whether the caller runs in the loop thread
+**
+** Returns         TRUE/FALSE
+**
+*******************************************************************************/
+uint8_t vnd_loop_in_thread(void)
+{
+    return (vnd_loop.running && pthread_equal(pthread_self(), vnd_loop.thread)) \
+           ? TRUE : FALSE;
+}
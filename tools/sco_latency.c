@@ -0,0 +1,829 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2009-2012 Broadcom Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+/******************************************************************************
+ *
+ *  Filename:      sco_latency.c
+ *
+ *  Description:   Host harness measuring the SCO path of the vendor library.
+ *
+ *                 The library is driven through its bt_vendor_interface_t
+ *                 with a scripted controller stand-in answering each HCI
+ *                 command after a configurable latency, which times the
+ *                 completion of BT_VND_OP_SCO_CFG and BT_VND_OP_WBS_CFG.
+ *
+ *                 For transport routing, the UART is a pty opened through
+ *                 BT_VND_OP_USERIAL_OPEN. Coded SCO frames are written to
+ *                 the master side on the 7.5 ms frame clock, optionally in
+ *                 bursts, read back from the vendor fd into the SCO jitter
+ *                 buffer and played out on a separate clock.
+ *
+ *                 All results are printed as histograms.
+ *
+ *                 System properties, e.g. ro.bt.vnd.* overrides, are read
+ *                 from the file named by BT_VND_HOST_PROPS, see
+ *                 vnd_props_host.c.
+ *
+ ******************************************************************************/
+
+#define LOG_TAG "bt_sco_latency"
+
+/* posix_openpt() and friends, M_PI */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <utils/Log.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "bt_hci_bdroid.h"
+#include "bt_vendor_brcm.h"
+#include "userial.h"
+#include "sco_codec.h"
+#include "sco_jitter.h"
+
+/******************************************************************************
+**  Constants & Macros
+******************************************************************************/
+
+#define LAT_HIST_BINS           40
+#define LAT_CFG_BIN_US          250     /* Configuration completion */
+#define LAT_SCO_BIN_US          500     /* SCO packet transport */
+#define LAT_BAR_WIDTH           50
+
+#define LAT_FRAME_US            7500
+#define LAT_CMD_QUEUE_SIZE      16
+#define LAT_CFG_TIMEOUT_MS      2000
+
+#define LAT_SCO_HANDLE          0x0006
+#define LAT_H4_SCO              0x03
+#define LAT_H4_SCO_HDR_LEN      4       /* Type, handle, length */
+
+/* Command Complete: code, length, num packets, opcode, status */
+#define LAT_EVT_CMD_CMPL        0x0E
+#define LAT_EVT_CMD_CMPL_LEN    6
+
+/******************************************************************************
+**  Local type definitions
+******************************************************************************/
+
+typedef struct
+{
+    uint32_t bin_us;
+    uint32_t count[LAT_HIST_BINS];
+    uint32_t n;
+    uint64_t sum_us;
+    uint32_t min_us;
+    uint32_t max_us;
+} lat_hist_t;
+
+typedef struct
+{
+    uint16_t opcode;
+    void *p_cmd;
+    tINT_CMD_CBACK p_cback;
+    uint64_t due_us;
+} lat_cmd_t;
+
+/* Scripted controller answering the commands in order */
+typedef struct
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    lat_cmd_t queue[LAT_CMD_QUEUE_SIZE];
+    uint8_t head;
+    uint8_t count;
+    uint8_t outstanding;                /* Sent, answer not handled yet */
+    uint8_t exit;
+    uint32_t latency_us;
+    uint32_t jitter_us;
+    uint32_t xmits;
+    uint64_t last_due_us;
+    uint64_t idle_us;                   /* Last answer handled */
+    uint8_t scocfg_done;
+    bt_vendor_op_result_t scocfg_result;
+    uint64_t scocfg_us;
+} lat_ctrl_t;
+
+/* Transport measurement */
+typedef struct
+{
+    int master_fd;
+    int vnd_fd;
+    uint8_t codec;
+    uint32_t frames;
+    uint32_t burst;
+    uint64_t start_us;
+    uint64_t *p_inject_us;
+    sco_jb_t *p_jb;
+    volatile uint8_t input_done;        /* No more packets to come */
+    volatile uint8_t done;
+} lat_sco_t;
+
+/******************************************************************************
+**  Externs
+******************************************************************************/
+
+extern const bt_vendor_interface_t BLUETOOTH_VENDOR_LIB_INTERFACE;
+conf_action_t userial_set_port;
+void vnd_load_conf(const char *p_path);
+
+/******************************************************************************
+**  Static variables
+******************************************************************************/
+
+static lat_ctrl_t lat_ctrl =
+{
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER
+};
+
+/*****************************************************************************
+**   Helper Functions
+*****************************************************************************/
+
+static uint64_t lat_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void lat_sleep_until(uint64_t due_us)
+{
+    struct timespec ts;
+
+    ts.tv_sec = due_us / 1000000;
+    ts.tv_nsec = (due_us % 1000000) * 1000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+static void lat_hist_init(lat_hist_t *p_hist, uint32_t bin_us)
+{
+    memset(p_hist, 0, sizeof(*p_hist));
+    p_hist->bin_us = bin_us;
+    p_hist->min_us = UINT32_MAX;
+}
+
+static void lat_hist_add(lat_hist_t *p_hist, uint64_t us)
+{
+    uint32_t bin = us / p_hist->bin_us;
+
+    p_hist->count[(bin < LAT_HIST_BINS) ? bin : LAT_HIST_BINS - 1]++;
+    p_hist->n++;
+    p_hist->sum_us += us;
+    if (us < p_hist->min_us)
+        p_hist->min_us = us;
+    if (us > p_hist->max_us)
+        p_hist->max_us = us;
+}
+
+/* Upper bound of the bin holding the given fraction of the samples */
+static uint32_t lat_hist_percentile(const uint32_t *p_count, uint32_t bins,
+                                    uint32_t bin_us, double fraction)
+{
+    uint32_t n = 0, sum = 0, bin;
+
+    for (bin = 0; bin < bins; bin++)
+        n += p_count[bin];
+    for (bin = 0; bin < bins - 1; bin++)
+        if ((sum += p_count[bin]) >= fraction * n)
+            break;
+    return (bin + 1) * bin_us;
+}
+
+static void lat_hist_print_bins(const uint32_t *p_count, uint32_t bins,
+                                uint32_t bin_us)
+{
+    char bar[LAT_BAR_WIDTH + 1];
+    uint32_t bin, peak = 0, width;
+
+    for (bin = 0; bin < bins; bin++)
+        if (p_count[bin] > peak)
+            peak = p_count[bin];
+
+    for (bin = 0; bin < bins; bin++)
+    {
+        if (p_count[bin] == 0)
+            continue;
+        width = (p_count[bin] * LAT_BAR_WIDTH + peak - 1) / peak;
+        memset(bar, '#', width);
+        bar[width] = '\0';
+        printf("  %s%7u us %8u |%s\n", (bin == bins - 1) ? ">=" : "  ", \
+               bin * bin_us, p_count[bin], bar);
+    }
+}
+
+static void lat_hist_print(const char *p_name, const lat_hist_t *p_hist)
+{
+    uint32_t p50, p99;
+
+    if (p_hist->n == 0)
+    {
+        printf("%s: no samples\n\n", p_name);
+        return;
+    }
+
+    p50 = lat_hist_percentile(p_hist->count, LAT_HIST_BINS, p_hist->bin_us, 0.5);
+    p99 = lat_hist_percentile(p_hist->count, LAT_HIST_BINS, p_hist->bin_us, 0.99);
+    printf("%s: %u samples, min %u avg %u max %u us, p50 < %u p99 < %u us\n", \
+           p_name, p_hist->n, p_hist->min_us, \
+           (uint32_t) (p_hist->sum_us / p_hist->n), p_hist->max_us, p50, p99);
+    lat_hist_print_bins(p_hist->count, LAT_HIST_BINS, p_hist->bin_us);
+    printf("\n");
+}
+
+/*****************************************************************************
+**   Controller Stand-in
+*****************************************************************************/
+
+/*******************************************************************************
+**
+** Function        lat_ctrl_thread
+**
+** Description     Answer the queued commands with a successful Command
+**                 Complete once they are due, in order
+**
+** Returns         None
+**
+*******************************************************************************/
+static void *lat_ctrl_thread(void *arg)
+{
+    lat_cmd_t cmd;
+    HC_BT_HDR *p_evt;
+    uint8_t *p;
+
+    pthread_mutex_lock(&lat_ctrl.mutex);
+    while (lat_ctrl.exit == FALSE)
+    {
+        if (lat_ctrl.count == 0)
+        {
+            pthread_cond_wait(&lat_ctrl.cond, &lat_ctrl.mutex);
+            continue;
+        }
+
+        cmd = lat_ctrl.queue[lat_ctrl.head];
+        lat_ctrl.head = (lat_ctrl.head + 1) % LAT_CMD_QUEUE_SIZE;
+        lat_ctrl.count--;
+        pthread_mutex_unlock(&lat_ctrl.mutex);
+
+        lat_sleep_until(cmd.due_us);
+
+        p_evt = (HC_BT_HDR *) malloc(BT_HC_HDR_SIZE + LAT_EVT_CMD_CMPL_LEN);
+        p_evt->event = 0;
+        p_evt->len = LAT_EVT_CMD_CMPL_LEN;
+        p_evt->offset = 0;
+        p_evt->layer_specific = 0;
+        p = (uint8_t *) (p_evt + 1);
+        *p++ = LAT_EVT_CMD_CMPL;
+        *p++ = LAT_EVT_CMD_CMPL_LEN - 2;
+        *p++ = 1;
+        *p++ = cmd.opcode & 0xFF;
+        *p++ = cmd.opcode >> 8;
+        *p = 0;
+
+        /* The stack frees the command once completed, the library the
+         * event */
+        free(cmd.p_cmd);
+        if (cmd.p_cback != NULL)
+            cmd.p_cback(p_evt);
+        else
+            free(p_evt);
+
+        pthread_mutex_lock(&lat_ctrl.mutex);
+        if (--lat_ctrl.outstanding == 0)
+            lat_ctrl.idle_us = lat_now_us();
+        pthread_cond_broadcast(&lat_ctrl.cond);
+    }
+    pthread_mutex_unlock(&lat_ctrl.mutex);
+
+    return NULL;
+}
+
+static uint8_t lat_xmit_cb(uint16_t opcode, void *p_buf, tINT_CMD_CBACK p_cback)
+{
+    uint64_t due_us;
+    lat_cmd_t *p_cmd;
+
+    pthread_mutex_lock(&lat_ctrl.mutex);
+    if (lat_ctrl.count == LAT_CMD_QUEUE_SIZE)
+    {
+        pthread_mutex_unlock(&lat_ctrl.mutex);
+        return FALSE;
+    }
+
+    due_us = lat_now_us() + lat_ctrl.latency_us;
+    if (lat_ctrl.jitter_us > 0)
+        due_us += rand() % lat_ctrl.jitter_us;
+    if (due_us < lat_ctrl.last_due_us)
+        due_us = lat_ctrl.last_due_us;
+    lat_ctrl.last_due_us = due_us;
+
+    p_cmd = &lat_ctrl.queue[(lat_ctrl.head + lat_ctrl.count) % LAT_CMD_QUEUE_SIZE];
+    p_cmd->opcode = opcode;
+    p_cmd->p_cmd = p_buf;
+    p_cmd->p_cback = p_cback;
+    p_cmd->due_us = due_us;
+    lat_ctrl.count++;
+    lat_ctrl.outstanding++;
+    lat_ctrl.xmits++;
+    pthread_cond_broadcast(&lat_ctrl.cond);
+    pthread_mutex_unlock(&lat_ctrl.mutex);
+
+    return TRUE;
+}
+
+static void lat_scocfg_cb(bt_vendor_op_result_t result)
+{
+    pthread_mutex_lock(&lat_ctrl.mutex);
+    lat_ctrl.scocfg_result = result;
+    lat_ctrl.scocfg_us = lat_now_us();
+    lat_ctrl.scocfg_done = TRUE;
+    pthread_cond_broadcast(&lat_ctrl.cond);
+    pthread_mutex_unlock(&lat_ctrl.mutex);
+}
+
+static void lat_result_cb(bt_vendor_op_result_t result)
+{
+}
+
+static void *lat_alloc(int size)
+{
+    return malloc(size);
+}
+
+static void lat_dealloc(void *p_buf)
+{
+    free(p_buf);
+}
+
+static const bt_vendor_callbacks_t lat_callbacks =
+{
+    sizeof(bt_vendor_callbacks_t),
+    lat_result_cb,
+    lat_scocfg_cb,
+    lat_result_cb,
+    lat_alloc,
+    lat_dealloc,
+    lat_xmit_cb,
+    lat_result_cb
+};
+
+/*******************************************************************************
+**
+** Function        lat_wait
+**
+** Description     Wait with the controller mutex held until *p_flag is set,
+**                 or until no command is outstanding when p_flag is NULL
+**
+** Returns         TRUE if done, FALSE on timeout
+**
+*******************************************************************************/
+static uint8_t lat_wait(volatile uint8_t *p_flag)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += LAT_CFG_TIMEOUT_MS / 1000;
+
+    while ((p_flag != NULL) ? (*p_flag == FALSE) : (lat_ctrl.outstanding > 0))
+        if (pthread_cond_timedwait(&lat_ctrl.cond, &lat_ctrl.mutex, &ts) == ETIMEDOUT)
+            return FALSE;
+
+    return TRUE;
+}
+
+/*****************************************************************************
+**   Configuration Timing
+*****************************************************************************/
+
+/*******************************************************************************
+**
+** Function        lat_run_sco_cfg
+**
+** Description     Time BT_VND_OP_SCO_CFG until scocfg_cb
+**
+** Returns         None
+**
+*******************************************************************************/
+static void lat_run_sco_cfg(uint32_t iterations)
+{
+    const bt_vendor_interface_t *p_vnd = &BLUETOOTH_VENDOR_LIB_INTERFACE;
+    lat_hist_t hist;
+    uint32_t i, xmits, fails = 0;
+    uint64_t start_us;
+
+    lat_hist_init(&hist, LAT_CFG_BIN_US);
+
+    for (i = 0; i < iterations; i++)
+    {
+        pthread_mutex_lock(&lat_ctrl.mutex);
+        lat_ctrl.scocfg_done = FALSE;
+        xmits = lat_ctrl.xmits;
+        pthread_mutex_unlock(&lat_ctrl.mutex);
+
+        start_us = lat_now_us();
+        if (p_vnd->op(BT_VND_OP_SCO_CFG, NULL) != 0)
+        {
+            printf("BT_VND_OP_SCO_CFG: not supported by this build\n\n");
+            return;
+        }
+
+        pthread_mutex_lock(&lat_ctrl.mutex);
+        if (lat_wait(&lat_ctrl.scocfg_done) == FALSE)
+        {
+            pthread_mutex_unlock(&lat_ctrl.mutex);
+            printf("BT_VND_OP_SCO_CFG: timeout\n\n");
+            return;
+        }
+        if (lat_ctrl.scocfg_result != BT_VND_OP_RESULT_SUCCESS)
+            fails++;
+        lat_hist_add(&hist, lat_ctrl.scocfg_us - start_us);
+        if (i == 0)
+            printf("BT_VND_OP_SCO_CFG: first run %u VSC(s) in %u us\n", \
+                   lat_ctrl.xmits - xmits, \
+                   (uint32_t) (lat_ctrl.scocfg_us - start_us));
+        pthread_mutex_unlock(&lat_ctrl.mutex);
+    }
+
+    if (fails > 0)
+        printf("BT_VND_OP_SCO_CFG: %u failure(s)\n", fails);
+    lat_hist_print("BT_VND_OP_SCO_CFG completion", &hist);
+}
+
+/*******************************************************************************
+**
+** Function        lat_run_wbs_cfg
+**
+** Description     Time BT_VND_OP_WBS_CFG, alternating mSBC and CVSD, until
+**                 its last VSC is answered. It has no completion callback.
+**
+** Returns         None
+**
+*******************************************************************************/
+static void lat_run_wbs_cfg(uint32_t iterations)
+{
+#if (SCO_USE_I2S_INTERFACE == TRUE)
+    const bt_vendor_interface_t *p_vnd = &BLUETOOTH_VENDOR_LIB_INTERFACE;
+    lat_hist_t hist[2];
+    uint32_t i, xmits, vscs[2] = { 0, 0 };
+    uint64_t start_us, end_us;
+    uint8_t state;
+
+    lat_hist_init(&hist[0], LAT_CFG_BIN_US);
+    lat_hist_init(&hist[1], LAT_CFG_BIN_US);
+
+    for (i = 0; i < 2 * iterations; i++)
+    {
+        state = (i & 1) ? FALSE : TRUE;
+
+        pthread_mutex_lock(&lat_ctrl.mutex);
+        xmits = lat_ctrl.xmits;
+        pthread_mutex_unlock(&lat_ctrl.mutex);
+
+        start_us = lat_now_us();
+        p_vnd->op(BT_VND_OP_WBS_CFG, &state);
+        end_us = lat_now_us();
+
+        pthread_mutex_lock(&lat_ctrl.mutex);
+        if (lat_wait(NULL) == FALSE)
+        {
+            pthread_mutex_unlock(&lat_ctrl.mutex);
+            printf("BT_VND_OP_WBS_CFG: timeout\n\n");
+            return;
+        }
+        if ((lat_ctrl.xmits != xmits) && (lat_ctrl.idle_us > end_us))
+            end_us = lat_ctrl.idle_us;
+        vscs[state] += lat_ctrl.xmits - xmits;
+        pthread_mutex_unlock(&lat_ctrl.mutex);
+
+        lat_hist_add(&hist[state], end_us - start_us);
+    }
+
+    printf("BT_VND_OP_WBS_CFG: %.1f VSC(s) per switch to mSBC, %.1f to CVSD\n", \
+           (double) vscs[TRUE] / iterations, (double) vscs[FALSE] / iterations);
+    lat_hist_print("BT_VND_OP_WBS_CFG mSBC completion", &hist[TRUE]);
+    lat_hist_print("BT_VND_OP_WBS_CFG CVSD completion", &hist[FALSE]);
+#else
+    printf("BT_VND_OP_WBS_CFG: not supported without I2S\n\n");
+#endif
+}
+
+/*****************************************************************************
+**   Transport Timing
+*****************************************************************************/
+
+/*******************************************************************************
+**
+** Function        lat_sco_inject_thread
+**
+** Description     Write coded SCO packets to the controller side of the pty
+**                 on the frame clock, burst frames at a time
+**
+** Returns         None
+**
+*******************************************************************************/
+static void *lat_sco_inject_thread(void *arg)
+{
+    lat_sco_t *p_sco = (lat_sco_t *) arg;
+    uint8_t pkt[LAT_H4_SCO_HDR_LEN + SCO_CODEC_FRAME_BYTES];
+    int16_t pcm[SCO_CODEC_MAX_SAMPLES];
+    sco_codec_t *p_codec = sco_codec_open(p_sco->codec);
+    uint16_t samples = sco_codec_frame_samples(p_sco->codec);
+    double rate = (p_sco->codec == SCO_CODEC_MSBC) ? 16000 : 8000;
+    uint32_t k, i, t = 0;
+
+    pkt[0] = LAT_H4_SCO;
+    pkt[1] = LAT_SCO_HANDLE & 0xFF;
+    pkt[2] = (LAT_SCO_HANDLE >> 8) & 0x0F;
+    pkt[3] = SCO_CODEC_FRAME_BYTES;
+
+    for (k = 0; k < p_sco->frames; k++)
+    {
+        for (i = 0; i < samples; i++, t++)
+            pcm[i] = (int16_t) (8000 * sin(2 * M_PI * 440 * t / rate));
+        sco_codec_encode(p_codec, pcm, pkt + LAT_H4_SCO_HDR_LEN);
+
+        /* A burst leaves with its last frame */
+        if (k % p_sco->burst == 0)
+            lat_sleep_until(p_sco->start_us + (uint64_t) LAT_FRAME_US * \
+                            ((k + p_sco->burst > p_sco->frames) ? \
+                             p_sco->frames - 1 : k + p_sco->burst - 1));
+
+        p_sco->p_inject_us[k] = lat_now_us();
+        if (write(p_sco->master_fd, pkt, sizeof(pkt)) != sizeof(pkt))
+        {
+            ALOGE("%s: write failed (%s)", __func__, strerror(errno));
+            break;
+        }
+    }
+
+    sco_codec_close(p_codec);
+    return NULL;
+}
+
+/*******************************************************************************
+**
+** Function        lat_sco_play_thread
+**
+** Description     Pull frames from the jitter buffer on the playout clock,
+**                 until the input ended and all its frames were played out.
+**                 Playing on would count the drained buffer as underruns.
+**
+** Returns         None
+**
+*******************************************************************************/
+static void *lat_sco_play_thread(void *arg)
+{
+    lat_sco_t *p_sco = (lat_sco_t *) arg;
+    int16_t pcm[SCO_CODEC_MAX_SAMPLES];
+    uint64_t due_us = p_sco->start_us + LAT_FRAME_US / 2;
+    sco_jb_stats_t stats;
+
+    while (p_sco->done == FALSE)
+    {
+        lat_sleep_until(due_us);
+
+        if (p_sco->input_done == TRUE)
+        {
+            /* One frame per packet here. A shrink plays one frame out of
+             * two, an underrun none. */
+            sco_jb_get_stats(p_sco->p_jb, &stats);
+            if (stats.frames - stats.underruns + stats.drops + \
+                stats.overflows >= stats.packets)
+                break;
+        }
+
+        sco_jb_get(p_sco->p_jb, pcm);
+        due_us += LAT_FRAME_US;
+    }
+
+    return NULL;
+}
+
+/*******************************************************************************
+**
+** Function        lat_run_transport
+**
+** Description     Measure the SCO packet latency from the pty to the vendor
+**                 fd and through the jitter buffer
+**
+** Returns         None
+**
+*******************************************************************************/
+static void lat_run_transport(lat_sco_t *p_sco)
+{
+    uint8_t buf[512], pkt[LAT_H4_SCO_HDR_LEN + 255];
+    lat_hist_t latency, gap;
+    sco_jb_stats_t stats;
+    pthread_t inject, play;
+    struct pollfd pfd;
+    uint64_t now_us, prev_us = 0;
+    uint32_t k = 0, len = 0, need = LAT_H4_SCO_HDR_LEN;
+    int n, i;
+
+    lat_hist_init(&latency, LAT_SCO_BIN_US);
+    lat_hist_init(&gap, LAT_SCO_BIN_US);
+
+    p_sco->p_inject_us = calloc(p_sco->frames, sizeof(uint64_t));
+    p_sco->p_jb = sco_jb_open(p_sco->codec);
+    p_sco->start_us = lat_now_us() + 10000;
+    p_sco->input_done = FALSE;
+    p_sco->done = FALSE;
+    if ((p_sco->p_inject_us == NULL) || (p_sco->p_jb == NULL))
+        return;
+
+    pthread_create(&inject, NULL, lat_sco_inject_thread, p_sco);
+    pthread_create(&play, NULL, lat_sco_play_thread, p_sco);
+
+    /* Where the stack H4 reader would be */
+    pfd.fd = p_sco->vnd_fd;
+    pfd.events = POLLIN;
+    while ((k < p_sco->frames) && (poll(&pfd, 1, LAT_CFG_TIMEOUT_MS) > 0))
+    {
+        if ((n = read(p_sco->vnd_fd, buf, sizeof(buf))) <= 0)
+            break;
+        now_us = lat_now_us();
+
+        for (i = 0; i < n; i++)
+        {
+            pkt[len++] = buf[i];
+            if (len == LAT_H4_SCO_HDR_LEN)
+                need = LAT_H4_SCO_HDR_LEN + pkt[3];
+            if (len < need)
+                continue;
+
+            lat_hist_add(&latency, now_us - p_sco->p_inject_us[k]);
+            if (k > 0)
+                lat_hist_add(&gap, now_us - prev_us);
+            prev_us = now_us;
+            sco_jb_put(p_sco->p_jb, pkt + 1, len - 1);
+
+            k++;
+            len = 0;
+            need = LAT_H4_SCO_HDR_LEN;
+        }
+    }
+
+    /* Let the buffer drain */
+    p_sco->input_done = TRUE;
+    lat_sleep_until(lat_now_us() + SCO_JB_MAX_FRAMES * LAT_FRAME_US);
+    p_sco->done = TRUE;
+    pthread_join(inject, NULL);
+    pthread_join(play, NULL);
+
+    printf("SCO transport: %u of %u packets, %s, bursts of %u\n", k, \
+           p_sco->frames, (p_sco->codec == SCO_CODEC_MSBC) ? "mSBC" : "CVSD", \
+           p_sco->burst);
+    lat_hist_print("SCO pty -> vendor fd latency", &latency);
+    lat_hist_print("SCO packet inter-arrival", &gap);
+
+    sco_jb_get_stats(p_sco->p_jb, &stats);
+    printf("SCO jitter buffer: %u frames played for %u packets, %u underruns, " \
+           "%u drops, %u overflows, target %u ms\n", stats.frames, \
+           stats.packets, stats.underruns, stats.drops, stats.overflows, \
+           stats.target_ms);
+    printf("SCO jitter buffer lateness: p99 < %u us\n", \
+           lat_hist_percentile(stats.jitter_hist, SCO_JB_HIST_BINS, \
+                               SCO_JB_HIST_BIN_US, 0.99));
+    lat_hist_print_bins(stats.jitter_hist, SCO_JB_HIST_BINS, SCO_JB_HIST_BIN_US);
+    printf("\nSCO jitter buffer arrival -> playout: p50 < %u p99 < %u us\n", \
+           lat_hist_percentile(stats.delay_hist, SCO_JB_HIST_BINS, \
+                               SCO_JB_HIST_BIN_US, 0.5), \
+           lat_hist_percentile(stats.delay_hist, SCO_JB_HIST_BINS, \
+                               SCO_JB_HIST_BIN_US, 0.99));
+    lat_hist_print_bins(stats.delay_hist, SCO_JB_HIST_BINS, SCO_JB_HIST_BIN_US);
+    if (latency.n > 0)
+        printf("\nSCO in -> out: avg %u us transport + playout delay above\n", \
+               (uint32_t) (latency.sum_us / latency.n));
+
+    sco_jb_close(p_sco->p_jb);
+    free(p_sco->p_inject_us);
+}
+
+/*****************************************************************************
+**   Main
+*****************************************************************************/
+
+static void lat_usage(const char *p_name)
+{
+    printf("Usage: %s [options]\n"
+           "  -n <count>   configuration runs (100)\n"
+           "  -l <us>      controller command latency (1000)\n"
+           "  -j <us>      controller command latency jitter (500)\n"
+           "  -t <frames>  SCO transport frames, 0 to skip (2000)\n"
+           "  -b <frames>  SCO frames per UART burst (1)\n"
+           "  -w           mSBC instead of CVSD on the transport\n"
+           "  -f <path>    bt_vendor.conf to load\n", p_name);
+}
+
+int main(int argc, char **argv)
+{
+    const bt_vendor_interface_t *p_vnd = &BLUETOOTH_VENDOR_LIB_INTERFACE;
+    unsigned char bdaddr[6] = { 0x00, 0x11, 0x22, 0x33, 0x44, 0x55 };
+    int fds[CH_MAX];
+    uint32_t iterations = 100;
+    const char *p_conf = NULL;
+    lat_sco_t sco;
+    conf_value_t port = { NULL, 0 };
+    pthread_t ctrl;
+    int opt;
+
+    memset(&sco, 0, sizeof(sco));
+    sco.codec = SCO_CODEC_CVSD;
+    sco.frames = 2000;
+    sco.burst = 1;
+    lat_ctrl.latency_us = 1000;
+    lat_ctrl.jitter_us = 500;
+
+    while ((opt = getopt(argc, argv, "n:l:j:t:b:wf:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': iterations = atoi(optarg); break;
+            case 'l': lat_ctrl.latency_us = atoi(optarg); break;
+            case 'j': lat_ctrl.jitter_us = atoi(optarg); break;
+            case 't': sco.frames = atoi(optarg); break;
+            case 'b': sco.burst = (atoi(optarg) > 0) ? atoi(optarg) : 1; break;
+            case 'w': sco.codec = SCO_CODEC_MSBC; break;
+            case 'f': p_conf = optarg; break;
+            default:
+                lat_usage(argv[0]);
+                return (opt == 'h') ? 0 : 1;
+        }
+    }
+
+    /* The pty stands for the UART, its master side for the controller */
+    if (((sco.master_fd = posix_openpt(O_RDWR | O_NOCTTY)) < 0) || \
+        (grantpt(sco.master_fd) < 0) || (unlockpt(sco.master_fd) < 0))
+    {
+        printf("pty: %s\n", strerror(errno));
+        return 1;
+    }
+
+    pthread_create(&ctrl, NULL, lat_ctrl_thread, NULL);
+
+    if (p_vnd->init(&lat_callbacks, bdaddr) != 0)
+    {
+        printf("vendor lib init failed\n");
+        return 1;
+    }
+    if (p_conf != NULL)
+        vnd_load_conf(p_conf);
+    port.p_str = ptsname(sco.master_fd);
+    userial_set_port("UartPort", &port, 0);
+
+    lat_run_sco_cfg(iterations);
+    lat_run_wbs_cfg(iterations);
+
+    if (sco.frames > 0)
+    {
+        if (p_vnd->op(BT_VND_OP_USERIAL_OPEN, &fds) < 1)
+        {
+            printf("BT_VND_OP_USERIAL_OPEN failed\n");
+        }
+        else
+        {
+            sco.vnd_fd = fds[CH_CMD];
+            lat_run_transport(&sco);
+            p_vnd->op(BT_VND_OP_USERIAL_CLOSE, NULL);
+        }
+    }
+
+    p_vnd->cleanup();
+
+    pthread_mutex_lock(&lat_ctrl.mutex);
+    lat_ctrl.exit = TRUE;
+    pthread_cond_broadcast(&lat_ctrl.cond);
+    pthread_mutex_unlock(&lat_ctrl.mutex);
+    pthread_join(ctrl, NULL);
+    close(sco.master_fd);
+
+    return 0;
+}
@@ -0,0 +1,826 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2009-2012 Broadcom Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+/******************************************************************************
+ *
+ *  Filename:      upio_gpiochip.c
+ *
+ *  Description:   Host check of the upio gpiochip backend (UPIO_GPIO_CHARDEV).
+ *
+ *                 The "/dev/gpiochipN:line" specifications are fed through
+ *                 the BtWakeGpio and HostWakeNode conf actions, then BT_WAKE
+ *                 is driven through upio_set() and HOST_WAKE monitored
+ *                 through upio_host_wake_start(), checking the line requests
+ *                 made to the chip and the ioctls issued per transition.
+ *
+ *                 open(), ioctl() and close() are wrapped at link time
+ *                 (-Wl,--wrap) to observe the chip. By default they also
+ *                 emulate it: a fake /dev/gpiochip-fake with pipe backed
+ *                 line events. With -c and -s, the calls go to a real chip,
+ *                 typically a gpio-sim one, whose line levels are read and
+ *                 pulled through its sysfs sim_gpio nodes.
+ *
+ *                 Exits with the number of failed checks.
+ *
+ ******************************************************************************/
+
+#define LOG_TAG "bt_upio_gpiochip"
+
+/* pipe2() */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <utils/Log.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/gpio.h>
+#include "bt_vendor_brcm.h"
+#include "upio.h"
+#include "vnd_loop.h"
+
+#if (UPIO_GPIO_CHARDEV == FALSE)
+#error "upio_gpiochip needs UPIO_GPIO_CHARDEV == TRUE"
+#endif
+
+/******************************************************************************
+**  Constants & Macros
+******************************************************************************/
+
+#define GC_FAKE_CHIP            "/dev/gpiochip-fake"
+#define GC_FAKE_LINES           8
+#define GC_BT_WAKE_LINE         3
+#define GC_HOST_WAKE_LINE       4
+
+#define GC_SPEC_LEN             160
+#define GC_LONG_CHIP_LEN        120     /* Fits the library buffers */
+#define GC_HYST_MS              20
+#define GC_SETTLE_MS            20      /* Event loop catching up on an edge */
+#define GC_WAIT_MS              500
+
+/******************************************************************************
+**  Local type definitions
+******************************************************************************/
+
+/* The chip under test, as seen through the wrapped calls */
+typedef struct
+{
+    pthread_mutex_t mutex;
+    const char *p_chip;                 /* Chip device path */
+    const char *p_sim;                  /* gpio-sim chip sysfs dir, NULL: fake */
+    int chip_fd;                        /* Open chip, -1 if none */
+    int handle_fd;                      /* BT_WAKE line handle */
+    int event_fd;                       /* HOST_WAKE line event fd */
+    int event_wr_fd;                    /* Fake: write side of the event pipe */
+    uint8_t value[GC_FAKE_LINES];       /* Fake: line levels */
+    struct gpiohandle_request handle_req;   /* Last handle request */
+    struct gpioevent_request event_req;     /* Last event request */
+    uint32_t opens;
+    uint32_t chip_closes;
+    uint32_t handle_reqs;
+    uint32_t handle_closes;
+    uint32_t event_reqs;
+    uint32_t event_closes;
+    uint32_t sets;
+    uint32_t gets;
+    uint32_t set_failures;              /* Next sets to fail with EIO */
+} gc_chip_t;
+
+/******************************************************************************
+**  Externs
+******************************************************************************/
+
+conf_action_t upio_set_bt_wake_backend;
+conf_action_t upio_set_host_wake_node;
+conf_action_t upio_set_wake_hysteresis;
+
+int __real_open(const char *p_path, int flags, ...);
+int __real_ioctl(int fd, unsigned long request, ...);
+int __real_close(int fd);
+
+/******************************************************************************
+**  Static variables
+******************************************************************************/
+
+static gc_chip_t gc =
+{
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .p_chip = GC_FAKE_CHIP,
+    .chip_fd = -1,
+    .handle_fd = -1,
+    .event_fd = -1,
+    .event_wr_fd = -1,
+};
+static uint32_t gc_failures;
+
+/*****************************************************************************
+**   Helper Functions
+*****************************************************************************/
+
+static void gc_sleep_ms(uint32_t ms)
+{
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000 };
+
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+        ;
+}
+
+/*******************************************************************************
+**
+** Function        gc_expect
+**
+** Description     Report a check, counting the failed ones
+**
+** Returns         ok
+**
+*******************************************************************************/
+static uint8_t gc_expect(uint8_t ok, const char *p_fmt, ...)
+{
+    va_list ap;
+
+    printf("%s ", ok ? "ok  " : "FAIL");
+    va_start(ap, p_fmt);
+    vprintf(p_fmt, ap);
+    va_end(ap);
+    printf("\n");
+
+    if (!ok)
+        gc_failures++;
+
+    return ok;
+}
+
+/*******************************************************************************
+**
+** Function        gc_snapshot
+**
+** Description     Copy the chip state
+**
+** Returns         None
+**
+*******************************************************************************/
+static void gc_snapshot(gc_chip_t *p_chip)
+{
+    pthread_mutex_lock(&gc.mutex);
+    *p_chip = gc;
+    pthread_mutex_unlock(&gc.mutex);
+}
+
+/*******************************************************************************
+**
+** Function        gc_sim_node
+**
+** Description     Access a gpio-sim line attribute
+**
+** Returns         0 : Success
+**                 <0 : Error
+**
+*******************************************************************************/
+static int gc_sim_node(uint32_t line, const char *p_attr, char *p_buf,
+                       size_t len, uint8_t write_it)
+{
+    char path[GC_SPEC_LEN + 32];
+    int fd;
+    int ret;
+
+    snprintf(path, sizeof(path), "%s/sim_gpio%u/%s", gc.p_sim, line, p_attr);
+    if ((fd = __real_open(path, (write_it) ? O_WRONLY : O_RDONLY)) < 0)
+    {
+        printf("%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    ret = (write_it) ? write(fd, p_buf, len) : read(fd, p_buf, len);
+    __real_close(fd);
+
+    return (ret > 0) ? 0 : -1;
+}
+
+/*******************************************************************************
+**
+** Function        gc_level
+**
+** Description     Read the level of a line driven by the library
+**
+** Returns         0 or 1, <0 on error
+**
+*******************************************************************************/
+static int gc_level(uint32_t line)
+{
+    char value[2] = { 0 };
+    int level;
+
+    if (gc.p_sim != NULL)
+        return (gc_sim_node(line, "value", value, 1, FALSE) == 0) ? \
+               (value[0] == '1') : -1;
+
+    pthread_mutex_lock(&gc.mutex);
+    level = gc.value[line];
+    pthread_mutex_unlock(&gc.mutex);
+
+    return level;
+}
+
+/*******************************************************************************
+**
+** Function        gc_drive
+**
+** Description     Drive a line monitored by the library, queueing its edge
+**                 event on the fake chip
+**
+** Returns         None
+**
+*******************************************************************************/
+static void gc_drive(uint32_t line, uint8_t level)
+{
+    struct gpioevent_data event;
+    struct timespec ts;
+    char pull[16];
+
+    if (gc.p_sim != NULL)
+    {
+        strcpy(pull, (level) ? "pull-up" : "pull-down");
+        gc_sim_node(line, "pull", pull, strlen(pull), TRUE);
+        return;
+    }
+
+    pthread_mutex_lock(&gc.mutex);
+    if (gc.value[line] != level)
+    {
+        gc.value[line] = level;
+
+        if ((gc.event_wr_fd >= 0) && (gc.event_req.lineoffset == line))
+        {
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            memset(&event, 0, sizeof(event));
+            event.timestamp = (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+            event.id = (level) ? GPIOEVENT_EVENT_RISING_EDGE : \
+                                 GPIOEVENT_EVENT_FALLING_EDGE;
+            if (write(gc.event_wr_fd, &event, sizeof(event)) != sizeof(event))
+                printf("fake chip: event lost (%s)\n", strerror(errno));
+        }
+    }
+    pthread_mutex_unlock(&gc.mutex);
+}
+
+/*******************************************************************************
+**
+** Function        gc_wait_wakes
+**
+** Description     Wait for the HOST_WAKE monitor to count wakes
+**
+** Returns         Wakes counted
+**
+*******************************************************************************/
+static uint32_t gc_wait_wakes(uint32_t wakes)
+{
+    upio_host_wake_stats_t stats;
+    uint32_t waited = 0;
+
+    for (;;)
+    {
+        upio_get_host_wake_stats(&stats);
+        if ((stats.wakes >= wakes) || (waited >= GC_WAIT_MS))
+            return stats.wakes;
+
+        gc_sleep_ms(1);
+        waited++;
+    }
+}
+
+/*****************************************************************************
+**   Fake Chip
+*****************************************************************************/
+
+/*******************************************************************************
+**
+** Function        gc_fake_ioctl
+**
+** Description     Line requests and values of the fake chip, with gc.mutex
+**                 held
+**
+** Returns         0 : Success
+**                 -1 : Error, errno set
+**
+*******************************************************************************/
+static int gc_fake_ioctl(int fd, unsigned long request, void *p_arg)
+{
+    struct gpiohandle_request *p_handle = p_arg;
+    struct gpioevent_request *p_event = p_arg;
+    struct gpiohandle_data *p_data = p_arg;
+    int fds[2];
+
+    if (fd == gc.chip_fd && request == GPIO_GET_LINEHANDLE_IOCTL)
+    {
+        if ((p_handle->lines != 1) || \
+            (p_handle->lineoffsets[0] >= GC_FAKE_LINES))
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        if ((p_handle->fd = __real_open("/dev/null", O_RDONLY | O_CLOEXEC)) < 0)
+            return -1;
+
+        if (p_handle->flags & GPIOHANDLE_REQUEST_OUTPUT)
+            gc.value[p_handle->lineoffsets[0]] = p_handle->default_values[0];
+        return 0;
+    }
+
+    if (fd == gc.chip_fd && request == GPIO_GET_LINEEVENT_IOCTL)
+    {
+        if (p_event->lineoffset >= GC_FAKE_LINES)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        if (pipe2(fds, O_CLOEXEC) < 0)
+            return -1;
+
+        p_event->fd = fds[0];
+        gc.event_wr_fd = fds[1];
+        return 0;
+    }
+
+    if (fd == gc.handle_fd && request == GPIOHANDLE_SET_LINE_VALUES_IOCTL)
+    {
+        gc.value[gc.handle_req.lineoffsets[0]] = p_data->values[0];
+        return 0;
+    }
+
+    if (fd == gc.event_fd && request == GPIOHANDLE_GET_LINE_VALUES_IOCTL)
+    {
+        p_data->values[0] = gc.value[gc.event_req.lineoffset];
+        return 0;
+    }
+
+    errno = ENOTTY;
+    return -1;
+}
+
+/*****************************************************************************
+**   Wrapped Functions
+*****************************************************************************/
+
+int __wrap_open(const char *p_path, int flags, ...)
+{
+    va_list ap;
+    int mode;
+    int fd;
+
+    va_start(ap, flags);
+    mode = (flags & O_CREAT) ? va_arg(ap, int) : 0;
+    va_end(ap);
+
+    if (strcmp(p_path, gc.p_chip) != 0)
+        return __real_open(p_path, flags, mode);
+
+    pthread_mutex_lock(&gc.mutex);
+    if (gc.p_sim == NULL)
+        fd = __real_open("/dev/null", O_RDONLY | (flags & O_CLOEXEC));
+    else
+        fd = __real_open(p_path, flags, mode);
+
+    if (fd >= 0)
+    {
+        gc.chip_fd = fd;
+        gc.opens++;
+    }
+    pthread_mutex_unlock(&gc.mutex);
+
+    return fd;
+}
+
+int __wrap_ioctl(int fd, unsigned long request, ...)
+{
+    struct gpiohandle_request *p_handle;
+    struct gpioevent_request *p_event;
+    va_list ap;
+    void *p_arg;
+    int ret;
+
+    va_start(ap, request);
+    p_arg = va_arg(ap, void *);
+    va_end(ap);
+
+    pthread_mutex_lock(&gc.mutex);
+
+    if ((fd < 0) || ((fd != gc.chip_fd) && (fd != gc.handle_fd) && \
+                     (fd != gc.event_fd)))
+    {
+        pthread_mutex_unlock(&gc.mutex);
+        return __real_ioctl(fd, request, p_arg);
+    }
+
+    if (fd == gc.chip_fd && request == GPIO_GET_LINEHANDLE_IOCTL)
+        gc.handle_reqs++;
+    else if (fd == gc.chip_fd && request == GPIO_GET_LINEEVENT_IOCTL)
+        gc.event_reqs++;
+    else if (fd == gc.handle_fd && request == GPIOHANDLE_SET_LINE_VALUES_IOCTL)
+        gc.sets++;
+    else if (fd == gc.event_fd && request == GPIOHANDLE_GET_LINE_VALUES_IOCTL)
+        gc.gets++;
+
+    if ((fd == gc.handle_fd) && (request == GPIOHANDLE_SET_LINE_VALUES_IOCTL) \
+        && (gc.set_failures > 0))
+    {
+        gc.set_failures--;
+        errno = EIO;
+        ret = -1;
+    }
+    else
+    {
+        ret = (gc.p_sim == NULL) ? gc_fake_ioctl(fd, request, p_arg) : \
+                                   __real_ioctl(fd, request, p_arg);
+    }
+
+    if ((ret == 0) && (fd == gc.chip_fd))
+    {
+        if (request == GPIO_GET_LINEHANDLE_IOCTL)
+        {
+            p_handle = p_arg;
+            gc.handle_req = *p_handle;
+            gc.handle_fd = p_handle->fd;
+        }
+        else if (request == GPIO_GET_LINEEVENT_IOCTL)
+        {
+            p_event = p_arg;
+            gc.event_req = *p_event;
+            gc.event_fd = p_event->fd;
+        }
+    }
+
+    pthread_mutex_unlock(&gc.mutex);
+    return ret;
+}
+
+int __wrap_close(int fd)
+{
+    pthread_mutex_lock(&gc.mutex);
+    if (fd >= 0)
+    {
+        if (fd == gc.chip_fd)
+        {
+            gc.chip_fd = -1;
+            gc.chip_closes++;
+        }
+        else if (fd == gc.handle_fd)
+        {
+            gc.handle_fd = -1;
+            gc.handle_closes++;
+        }
+        else if (fd == gc.event_fd)
+        {
+            gc.event_fd = -1;
+            gc.event_closes++;
+
+            if (gc.event_wr_fd >= 0)
+                __real_close(gc.event_wr_fd);
+            gc.event_wr_fd = -1;
+        }
+    }
+    pthread_mutex_unlock(&gc.mutex);
+
+    return __real_close(fd);
+}
+
+/*****************************************************************************
+**   Checks
+*****************************************************************************/
+
+/*******************************************************************************
+**
+** Function        gc_run_parse
+**
+** Description     Feed gpiochip specifications to BtWakeGpio
+**
+** Returns         None
+**
+*******************************************************************************/
+static void gc_run_parse(void)
+{
+    static const struct
+    {
+        const char *p_spec;
+        uint8_t valid;
+    } specs[] =
+    {
+        { "/dev/gpiochip0:5", TRUE },
+        { "/dev/gpiochip12:31", TRUE },
+        { "/dev/gpiochip0", FALSE },
+        { "/dev/gpiochip0:", FALSE },
+        { "/dev/gpiochip0:5x", FALSE },
+        { "/dev/gpiochip0:x5", FALSE },
+        { "gpiochip0:5", FALSE },
+        { "/sys/class/gpio/gpio5/value", FALSE },
+    };
+    char spec[GC_SPEC_LEN];
+    conf_value_t value = { spec, 0 };
+    uint32_t i;
+    int ret;
+
+    printf("-- BtWakeGpio specifications\n");
+
+    for (i = 0; i < sizeof(specs) / sizeof(specs[0]); i++)
+    {
+        strcpy(spec, specs[i].p_spec);
+        ret = upio_set_bt_wake_backend("BtWakeGpio", &value, 1);
+        gc_expect((ret == 0) == specs[i].valid, "\"%s\" %s", spec, \
+                  (ret == 0) ? "accepted" : "rejected");
+    }
+
+    /* Neither the chip path nor the whole specification may overflow */
+    memset(spec, 'x', sizeof(spec) - 1);
+    memcpy(spec, "/dev/gpiochip", 13);
+    strcpy(spec + sizeof(spec) - 3, ":1");
+    ret = upio_set_bt_wake_backend("BtWakeGpio", &value, 1);
+    gc_expect(ret != 0, "%u character chip path %s", \
+              (uint32_t) strlen(spec) - 2, (ret == 0) ? "accepted" : "rejected");
+
+    strcpy(spec + GC_LONG_CHIP_LEN, ":0000000001");
+    ret = upio_set_bt_wake_backend("BtWakeGpio", &value, 1);
+    gc_expect(ret != 0, "%u character specification %s", \
+              (uint32_t) strlen(spec), (ret == 0) ? "accepted" : "rejected");
+}
+
+/*******************************************************************************
+**
+** Function        gc_run_bt_wake
+**
+** Description     Drive BT_WAKE through the gpiochip backend
+**
+** Returns         None
+**
+*******************************************************************************/
+static void gc_run_bt_wake(uint32_t toggles)
+{
+    char spec[GC_SPEC_LEN];
+    conf_value_t value = { spec, 0 };
+    conf_value_t delay = { "0", 0 };
+    gc_chip_t before;
+    gc_chip_t after;
+    uint32_t i;
+
+    printf("-- BT_WAKE on %s:%u\n", gc.p_chip, GC_BT_WAKE_LINE);
+
+    /* Immediate deasserts first */
+    upio_set_wake_hysteresis("BT_WAKE_DEASSERT_DELAY_MAX_MS", &delay, 1);
+    upio_set_wake_hysteresis("BT_WAKE_DEASSERT_DELAY_MS", &delay, 0);
+
+    snprintf(spec, sizeof(spec), "%s:%u", gc.p_chip, GC_BT_WAKE_LINE);
+    if (!gc_expect(upio_set_bt_wake_backend("BtWakeGpio", &value, 1) == 0, \
+                   "BtWakeGpio %s accepted", spec))
+        return;
+
+    /* The first transition requests the handle, at the asserted level */
+    gc_snapshot(&before);
+    upio_set(UPIO_BT_WAKE, UPIO_ASSERT, 1);
+    gc_snapshot(&after);
+
+    gc_expect((after.opens == before.opens + 1) && \
+              (after.handle_reqs == before.handle_reqs + 1) && \
+              (after.handle_fd >= 0), "assert requests one line handle");
+    gc_expect(after.chip_fd < 0, "chip closed once the handle is held");
+    gc_expect((after.handle_req.lines == 1) && \
+              (after.handle_req.lineoffsets[0] == GC_BT_WAKE_LINE), \
+              "handle on line %u", after.handle_req.lineoffsets[0]);
+    gc_expect(after.handle_req.flags == GPIOHANDLE_REQUEST_OUTPUT, \
+              "handle flags 0x%x", after.handle_req.flags);
+    gc_expect(after.handle_req.default_values[0] == 1, \
+              "initial level %u", after.handle_req.default_values[0]);
+    gc_expect(strcmp(after.handle_req.consumer_label, "bt_wake") == 0, \
+              "consumer \"%s\"", after.handle_req.consumer_label);
+    gc_expect((after.sets == before.sets) && (gc_level(GC_BT_WAKE_LINE) == 1), \
+              "line high without a set");
+
+    /* Then one set per transition, none for a repeated state */
+    gc_snapshot(&before);
+    upio_set(UPIO_BT_WAKE, UPIO_DEASSERT, 1);
+    upio_set(UPIO_BT_WAKE, UPIO_DEASSERT, 1);
+    gc_snapshot(&after);
+    gc_expect((after.sets == before.sets + 1) && \
+              (gc_level(GC_BT_WAKE_LINE) == 0), "deassert: %u set, line low", \
+              after.sets - before.sets);
+
+    gc_snapshot(&before);
+    for (i = 0; i < toggles; i++)
+    {
+        upio_set(UPIO_BT_WAKE, UPIO_ASSERT, 1);
+        upio_set(UPIO_BT_WAKE, UPIO_ASSERT, 1);
+        upio_set(UPIO_BT_WAKE, UPIO_DEASSERT, 1);
+    }
+    gc_snapshot(&after);
+    gc_expect((after.sets == before.sets + 2 * toggles) && \
+              (after.opens == before.opens) && \
+              (after.handle_reqs == before.handle_reqs), \
+              "%u toggles: %u sets, %u handle requests", toggles, \
+              after.sets - before.sets, after.handle_reqs - before.handle_reqs);
+
+    /* A failed set is retried by the next request in the same direction */
+    pthread_mutex_lock(&gc.mutex);
+    gc.set_failures = 1;
+    pthread_mutex_unlock(&gc.mutex);
+    gc_snapshot(&before);
+    upio_set(UPIO_BT_WAKE, UPIO_ASSERT, 1);
+    gc_expect(gc_level(GC_BT_WAKE_LINE) == 0, "failed assert, line low");
+    upio_set(UPIO_BT_WAKE, UPIO_ASSERT, 1);
+    gc_snapshot(&after);
+    gc_expect((after.sets == before.sets + 2) && \
+              (gc_level(GC_BT_WAKE_LINE) == 1), \
+              "assert retried: %u sets, line high", after.sets - before.sets);
+    upio_set(UPIO_BT_WAKE, UPIO_DEASSERT, 1);
+
+    /* Active low */
+    upio_set(UPIO_BT_WAKE, UPIO_ASSERT, 0);
+    gc_expect(gc_level(GC_BT_WAKE_LINE) == 0, "active low assert, line low");
+    upio_set(UPIO_BT_WAKE, UPIO_DEASSERT, 0);
+    gc_expect(gc_level(GC_BT_WAKE_LINE) == 1, "active low deassert, line high");
+
+    /* A deassert inside the window is driven by the event loop, once */
+    delay.num = GC_HYST_MS;
+    upio_set_wake_hysteresis("BT_WAKE_DEASSERT_DELAY_MAX_MS", &delay, 1);
+    upio_set_wake_hysteresis("BT_WAKE_DEASSERT_DELAY_MS", &delay, 0);
+
+    upio_set(UPIO_BT_WAKE, UPIO_ASSERT, 1);
+    gc_snapshot(&before);
+    upio_set(UPIO_BT_WAKE, UPIO_DEASSERT, 1);
+    upio_set(UPIO_BT_WAKE, UPIO_ASSERT, 1);
+    upio_set(UPIO_BT_WAKE, UPIO_DEASSERT, 1);
+    gc_snapshot(&after);
+    gc_expect((after.sets == before.sets) && (gc_level(GC_BT_WAKE_LINE) == 1), \
+              "%u ms window: line held high", GC_HYST_MS);
+    gc_sleep_ms(GC_HYST_MS + GC_SETTLE_MS);
+    gc_snapshot(&after);
+    gc_expect((after.sets == before.sets + 1) && \
+              (gc_level(GC_BT_WAKE_LINE) == 0), \
+              "%u ms window: line low after %u set", GC_HYST_MS, \
+              after.sets - before.sets);
+
+    /* The handle is released on cleanup and requested again */
+    gc_snapshot(&before);
+    upio_cleanup();
+    gc_snapshot(&after);
+    gc_expect((after.handle_closes == before.handle_closes + 1) && \
+              (after.handle_fd < 0), "cleanup closes the handle");
+
+    upio_init();
+    gc_snapshot(&before);
+    upio_set(UPIO_BT_WAKE, UPIO_ASSERT, 1);
+    upio_set(UPIO_BT_WAKE, UPIO_DEASSERT, 1);
+    gc_snapshot(&after);
+    gc_expect(after.handle_reqs == before.handle_reqs + 1, \
+              "handle requested again after cleanup");
+}
+
+/*******************************************************************************
+**
+** Function        gc_run_host_wake
+**
+** Description     Monitor HOST_WAKE through a gpiochip line event fd
+**
+** Returns         None
+**
+*******************************************************************************/
+static void gc_run_host_wake(uint32_t edges)
+{
+    char spec[GC_SPEC_LEN];
+    conf_value_t value = { spec, 0 };
+    gc_chip_t before;
+    gc_chip_t after;
+    uint32_t wakes;
+    uint32_t i;
+
+    printf("-- HOST_WAKE on %s:%u\n", gc.p_chip, GC_HOST_WAKE_LINE);
+
+    snprintf(spec, sizeof(spec), "%s:%u", gc.p_chip, GC_HOST_WAKE_LINE);
+    if (!gc_expect(upio_set_host_wake_node("HostWakeNode", &value, 0) == 0, \
+                   "HostWakeNode %s accepted", spec))
+        return;
+
+    gc_drive(GC_HOST_WAKE_LINE, 0);
+
+    gc_snapshot(&before);
+    upio_host_wake_start(1);
+    gc_snapshot(&after);
+
+    gc_expect((after.event_reqs == before.event_reqs + 1) && \
+              (after.event_fd >= 0), "start requests one line event fd");
+    gc_expect(after.chip_fd < 0, "chip closed once the event fd is held");
+    gc_expect(after.event_req.lineoffset == GC_HOST_WAKE_LINE, \
+              "events on line %u", after.event_req.lineoffset);
+    gc_expect((after.event_req.handleflags == GPIOHANDLE_REQUEST_INPUT) && \
+              (after.event_req.eventflags == GPIOEVENT_REQUEST_BOTH_EDGES), \
+              "handle flags 0x%x, event flags 0x%x", \
+              after.event_req.handleflags, after.event_req.eventflags);
+    gc_expect(strcmp(after.event_req.consumer_label, "bt_host_wake") == 0, \
+              "consumer \"%s\"", after.event_req.consumer_label);
+
+    wakes = gc_wait_wakes(0);
+    gc_expect(wakes == 0, "line low: %u wakes", wakes);
+
+    for (i = 0; i < edges; i++)
+    {
+        gc_drive(GC_HOST_WAKE_LINE, 1);
+        if (gc_wait_wakes(i + 1) != i + 1)
+            break;
+        gc_drive(GC_HOST_WAKE_LINE, 0);
+        gc_sleep_ms(GC_SETTLE_MS);
+    }
+    wakes = gc_wait_wakes(edges);
+    gc_expect(wakes == edges, "%u rising edges: %u wakes", edges, wakes);
+
+    /* A wake pending at start is read back from the line */
+    gc_snapshot(&before);
+    upio_host_wake_stop();
+    gc_snapshot(&after);
+    gc_expect((after.event_closes == before.event_closes + 1) && \
+              (after.event_fd < 0), "stop closes the event fd");
+
+    gc_drive(GC_HOST_WAKE_LINE, 1);
+    upio_host_wake_start(1);
+    wakes = gc_wait_wakes(edges + 1);
+    gc_expect(wakes == edges + 1, "line high at start: %u wakes", wakes);
+
+    upio_host_wake_stop();
+    gc_drive(GC_HOST_WAKE_LINE, 0);
+}
+
+/*****************************************************************************
+**   Main
+*****************************************************************************/
+
+static void gc_usage(const char *p_name)
+{
+    printf("Usage: %s [options]\n"
+           "  -n <count>   BT_WAKE toggles and HOST_WAKE edges (100)\n"
+           "  -c <chip>    gpiochip device, instead of a fake one\n"
+           "  -s <dir>     gpio-sim sysfs dir of that chip, e.g.\n"
+           "               /sys/devices/platform/gpio-sim.0/gpiochip1,\n"
+           "               with lines %u and %u free\n", \
+           p_name, GC_BT_WAKE_LINE, GC_HOST_WAKE_LINE);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t count = 100;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:c:s:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': count = atoi(optarg); break;
+            case 'c': gc.p_chip = optarg; break;
+            case 's': gc.p_sim = optarg; break;
+            default:
+                gc_usage(argv[0]);
+                return (opt == 'h') ? 0 : 1;
+        }
+    }
+
+    if ((gc.p_sim != NULL) != (strcmp(gc.p_chip, GC_FAKE_CHIP) != 0))
+    {
+        gc_usage(argv[0]);
+        return 1;
+    }
+
+    if (vnd_loop_init() < 0)
+    {
+        printf("vnd_loop_init failed\n");
+        return 1;
+    }
+    upio_init();
+
+    gc_run_parse();
+    gc_run_bt_wake(count);
+    gc_run_host_wake(count);
+
+    upio_cleanup();
+    vnd_loop_cleanup();
+
+    printf("%u failed\n", gc_failures);
+    return (gc_failures > 255) ? 255 : (int) gc_failures;
+}
@@ -0,0 +1,222 @@
+/******************************************************************************
+ *
+ *  Copyright (C) 2009-2012 Broadcom Corporation
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at:
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ ******************************************************************************/
+
+/******************************************************************************
+ *
+ *  Filename:      vnd_props_host.c
+ *
+ *  Description:   Host stand-in of the Android system properties for the
+ *                 vendor library tools, in place of the libcutils ones.
+ *
+ *                 The properties are read once from the build.prop like
+ *                 file named by BT_VND_HOST_PROPS ("key=value" lines, '#'
+ *                 comments), e.g. to exercise ro.bt.vnd.* overrides:
+ *
+ *                   ro.bt.vnd.LPM_IDLE_THRESHOLD=20
+ *                   ro.bt.conf_file=/tmp/bt_vendor.conf
+ *
+ ******************************************************************************/
+
+#define LOG_TAG "bt_vnd_props"
+
+#include <utils/Log.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cutils/properties.h>
+
+/******************************************************************************
+**  Constants & Macros
+******************************************************************************/
+
+#define PROPS_HOST_ENV          "BT_VND_HOST_PROPS"
+#define PROPS_HOST_MAX          64
+
+/******************************************************************************
+**  Local type definitions
+******************************************************************************/
+
+typedef struct
+{
+    char key[PROPERTY_KEY_MAX];
+    char value[PROPERTY_VALUE_MAX];
+} props_host_entry_t;
+
+/******************************************************************************
+**  Static variables
+******************************************************************************/
+
+static pthread_mutex_t props_host_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t props_host_once = PTHREAD_ONCE_INIT;
+static props_host_entry_t props_host[PROPS_HOST_MAX];
+static int props_host_count;
+
+/*****************************************************************************
+**   Helper Functions
+*****************************************************************************/
+
+/*******************************************************************************
+**
+** Function        props_host_find
+**
+** Description     Find a property, with props_host_mutex held
+**
+** Returns         Property, NULL if not set
+**
+*******************************************************************************/
+static props_host_entry_t *props_host_find(const char *key)
+{
+    int i;
+
+    for (i = 0; i < props_host_count; i++)
+    {
+        if (strcmp(props_host[i].key, key) == 0)
+            return &props_host[i];
+    }
+
+    return NULL;
+}
+
+/*******************************************************************************
+**
+** Function        props_host_store
+**
+** Description     Set a property, with props_host_mutex held
+**
+** Returns         0 : Success
+**                 Otherwise : Fail
+**
+*******************************************************************************/
+static int props_host_store(const char *key, const char *value)
+{
+    props_host_entry_t *p_prop = props_host_find(key);
+
+    if ((strlen(key) >= PROPERTY_KEY_MAX) || \
+        (strlen(value) >= PROPERTY_VALUE_MAX))
+        return -1;
+
+    if (p_prop == NULL)
+    {
+        if (props_host_count == PROPS_HOST_MAX)
+            return -1;
+
+        p_prop = &props_host[props_host_count++];
+        strcpy(p_prop->key, key);
+    }
+
+    strcpy(p_prop->value, value);
+    return 0;
+}
+
+/*******************************************************************************
+**
+** Function        props_host_load
+**
+** Description     Read the properties file named by BT_VND_HOST_PROPS
+**
+** Returns         None
+**
+*******************************************************************************/
+static void props_host_load(void)
+{
+    const char *p_path = getenv(PROPS_HOST_ENV);
+    char line[PROPERTY_KEY_MAX + PROPERTY_VALUE_MAX + 2];
+    char *p_value;
+    FILE *p_file;
+
+    if ((p_path == NULL) || ((p_file = fopen(p_path, "r")) == NULL))
+        return;
+
+    while (fgets(line, sizeof(line), p_file) != NULL)
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+
+        if ((line[0] == '#') || ((p_value = strchr(line, '=')) == NULL))
+            continue;
+
+        *p_value++ = '\0';
+
+        if (props_host_store(line, p_value) != 0)
+            ALOGW("%s: %s ignored", p_path, line);
+    }
+
+    fclose(p_file);
+}
+
+/*****************************************************************************
+**   Property Functions
+*****************************************************************************/
+
+int property_get(const char *key, char *value, const char *default_value)
+{
+    props_host_entry_t *p_prop;
+    int len = 0;
+
+    pthread_once(&props_host_once, props_host_load);
+    pthread_mutex_lock(&props_host_mutex);
+
+    if ((p_prop = props_host_find(key)) != NULL)
+        default_value = p_prop->value;
+
+    if (default_value != NULL)
+    {
+        len = snprintf(value, PROPERTY_VALUE_MAX, "%s", default_value);
+        if (len >= PROPERTY_VALUE_MAX)
+            len = PROPERTY_VALUE_MAX - 1;
+    }
+    else
+    {
+        value[0] = '\0';
+    }
+
+    pthread_mutex_unlock(&props_host_mutex);
+    return len;
+}
+
+int property_set(const char *key, const char *value)
+{
+    int ret;
+
+    pthread_once(&props_host_once, props_host_load);
+    pthread_mutex_lock(&props_host_mutex);
+    ret = props_host_store(key, (value != NULL) ? value : "");
+    pthread_mutex_unlock(&props_host_mutex);
+
+    return ret;
+}
+
+int property_list(void (*propfn)(const char *key, const char *value,
+                                 void *cookie), void *cookie)
+{
+    props_host_entry_t props[PROPS_HOST_MAX];
+    int count;
+    int i;
+
+    /* Called back without the lock, propfn may read properties */
+    pthread_once(&props_host_once, props_host_load);
+    pthread_mutex_lock(&props_host_mutex);
+    count = props_host_count;
+    memcpy(props, props_host, count * sizeof(props[0]));
+    pthread_mutex_unlock(&props_host_mutex);
+
+    for (i = 0; i < count; i++)
+        propfn(props[i].key, props[i].value, cookie);
+
+    return 0;
+}